@@ -0,0 +1,105 @@
+#pragma once
+
+#include "co.h"
+
+namespace co {
+
+struct WriteBuffer;
+
+// BufferedConn wraps a connected socket with a read buffer and a write buffer.
+//
+// The read side recv as much as possible into the buffer, and protocol code
+// parses straight out of it with peek() or read_until(), then consume() what
+// has been parsed. Data in the buffer is always contiguous: consumed bytes are
+// dropped by moving the rest to the front, before the next recv, when needed.
+//
+// The write side coalesces small writes into one send, flush() must be called
+// to send the buffered data, unless the deferred flush is enabled. Large writes
+// go out directly with writev, together with the buffered data.
+//
+// BufferedConn MUST be used in coroutine, and it does not own the socket.
+class BufferedConn {
+  public:
+    explicit BufferedConn(sock_t fd, uint32 cap=4096);
+    ~BufferedConn();
+
+    sock_t fd() const { return _fd; }
+
+    // data in the read buffer, not consumed yet
+    const char* data() const { return _rbuf + _rb; }
+    size_t size() const { return _re - _rb; }
+
+    // drop @n bytes from the front of the read buffer
+    void consume(size_t n) {
+        _rb += n;
+        if (_rb >= _re) _rb = _re = _scan = 0;
+    }
+
+    // recv until at least @n bytes are in the read buffer, one recv may read
+    // more than @n bytes. return size() on success, 0 if the peer closed the
+    // connection, -1 on error or timeout in @ms.
+    int peek(size_t n, int ms=-1);
+
+    // recv until @delim is found in the read buffer.
+    // return length of data from data() to the end of @delim, nothing consumed.
+    // return 0 if the peer closed the connection, -1 on error or timeout in
+    // @ms, or @delim was not found in @max bytes (errno set to EMSGSIZE).
+    int read_until(const char* delim, size_t max, int ms=-1);
+
+    // read exact @n bytes to @buf, data in the read buffer is copied first,
+    // and the rest is received into @buf directly.
+    // return @n on success, 0 if the peer closed, -1 on error or timeout.
+    int read_exact(void* buf, int n, int ms=-1);
+
+    // append data to the write buffer, data is sent directly with the buffered
+    // data if the write buffer is not large enough.
+    // return @n on success, -1 on error or timeout.
+    int write(const void* buf, int n, int ms=-1);
+
+    // send all data in the write buffer.
+    // return 0 on success, -1 on error or timeout.
+    int flush(int ms=-1);
+
+    // drop data in the write buffer without sending it, it must be called
+    // before closing the socket if the data will not be flushed.
+    void discard();
+
+    // size of data in the write buffer
+    size_t pending() const;
+
+    // With deferred flush, the scheduler sends data in the write buffer at the
+    // end of each loop, before it waits for I/O events, so writes made in one
+    // loop are sent with one syscall. If the socket is not writable, the rest
+    // is sent by a coroutine waiting for it, with the timeout @ms (-1 for no
+    // timeout), and writes made meanwhile wait for it. flush() or discard() is
+    // still needed before closing the socket, discard() does not stop data
+    // being sent. Not supported on windows, where it does nothing.
+    void set_deferred_flush(bool on, int ms=-1);
+    bool deferred_flush() const { return _deferred; }
+
+  private:
+    // make room for @n more bytes at the end of the read buffer
+    void reserve(size_t n);
+
+    // recv once into the read buffer
+    int fill(int ms);
+
+    // wait for the rest of data sent by the scheduler with deferred flush
+    int wait_drain(int ms);
+
+  private:
+    sock_t _fd;
+    uint32 _cap;
+    char* _rbuf;
+    size_t _rcap;
+    size_t _rb;   // begin of data in the read buffer
+    size_t _re;   // end of data in the read buffer
+    size_t _scan; // position where read_until() goes on searching
+    WriteBuffer* _w; // on heap, the scheduler may flush it
+    int _flush_ms;   // timeout for data left by deferred flush
+    bool _deferred;
+
+    DISALLOW_COPY_AND_ASSIGN(BufferedConn);
+};
+
+} // co
@@ -4,6 +4,7 @@
 #include "closure.h"
 #include "byte_order.h"
 #include "fastring.h"
+#include <memory>
 
 #ifdef _WIN32
 #include <WinSock2.h>
@@ -19,16 +20,31 @@ typedef SOCKET sock_t;
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>  // basic socket api, struct linger
+#include <sys/uio.h>     // struct iovec
 #include <netinet/in.h>  // for struct sockaddr_in
 #include <netinet/tcp.h> // for TCP_NODELAY...
 #include <arpa/inet.h>   // for inet_ntop...
 #include <netdb.h>       // getaddrinfo, gethostby...
+#ifdef __linux__
+#include <netinet/udp.h> // for UDP_SEGMENT, UDP_GRO
+#endif
 
 typedef int sock_t;
 #endif
 
 namespace co {
 
+#ifdef _WIN32
+// scatter/gather buffer for co::readv & co::writev, it is in namespace co,
+// not to clash with other libraries that define struct iovec for windows.
+struct iovec {
+    void* iov_base;
+    size_t iov_len;
+};
+#else
+using ::iovec;
+#endif
+
 // Add a task, which will run as a coroutine.
 // Supported function types:
 //   void f();
@@ -71,9 +87,41 @@ int max_sched_num();
 // id of the current scheduler, -1 for non-scheduler
 int sched_id();
 
+// number of schedulers running, it is FLG_co_sched_num.
+int sched_num();
+
+// Add a task to the scheduler @id (0 <= id < sched_num()), instead of the one
+// chosen by go(). Coroutines sharing data may run in the same scheduler thread.
+void go_on(int id, Closure* cb);
+
 // id of the current coroutine, -1 for non-coroutine
 int coroutine_id();
 
+// Busy polling: before it sleeps in epoll_wait, an idle scheduler keeps 
+// checking for I/O events and new tasks without blocking for @us microseconds.
+// It saves the wakeup latency at the cost of cpu. This sets busy polling for 
+// the current scheduler, 0 to disable it. The default is FLG_co_busy_poll_us.
+void set_busy_poll(uint32 us);
+
+struct BusyPollStats {
+    uint64 spins;   // times of non-blocking polling
+    uint64 hits;    // times that busy polling found I/O events or tasks
+    uint64 sleeps;  // times that busy polling found nothing and the scheduler slept
+    uint64 spin_us; // total time in microseconds spent on busy polling
+};
+
+// stats of busy polling in scheduler @id, it may be a bit behind the scheduler.
+BusyPollStats busy_poll_stats(int id);
+
+#ifndef _WIN32
+// If FLG_co_hook_file_io is true, the hooked read, write, pread, pwrite, fsync
+// and fdatasync on regular files run in helper threads, and the coroutine is
+// suspended until done. Call this with @on = false to keep I/O on the file @fd 
+// in the scheduler thread, e.g. for small files that are likely to be cached.
+// The setting is cleared when @fd is closed.
+void set_file_io_offload(int fd, bool on);
+#endif
+
 // co::Event is for communications between coroutines.
 // It's similar to SyncEvent for threads.
 class Event {
@@ -280,6 +328,56 @@ int send(sock_t fd, const void* buf, int n, int ms=-1);
 // for udp, max(n) == 65507
 int sendto(sock_t fd, const void* buf, int n, const void* addr, int addrlen, int ms=-1);
 
+// scatter read, recv until all the @n buffers in @iov are filled or timeout
+// in @ms, or any error occured. Return 0 if the peer closed the connection.
+// The total size must not exceed INT_MAX, or -1 is returned with EINVAL.
+int readv(sock_t fd, const struct iovec* iov, int n, int ms=-1);
+
+// gather write, send until all the @n buffers in @iov are done or timeout
+// in @ms, or any error occured. Partial writes are handled internally.
+// The total size must not exceed INT_MAX, or -1 is returned with EINVAL.
+int writev(sock_t fd, const struct iovec* iov, int n, int ms=-1);
+
+// send all data in @buf like co::send(), with MSG_ZEROCOPY (linux 4.14+) if the
+// size is not less than FLG_co_zerocopy_size (0 for disabled). Pages of @buf are
+// pinned and sent by the kernel directly, the scheduler holds a reference to @buf
+// and releases it when the kernel reports the completion on the error queue, so 
+// the caller MUST NOT modify @buf after this call.
+// It falls back to co::send() if zero-copy is disabled or not supported.
+// The socket should be closed with co::close() or close() in the same scheduler.
+int send_zerocopy(sock_t fd, const std::shared_ptr<fastring>& buf, int ms=-1);
+
+#ifndef _WIN32
+// send @len bytes of the file @file_fd starting from @offset, with the zero-copy
+// sendfile(), until all are done or timeout in @ms, or any error occured.
+// return bytes sent, which may be less than @len if the end of the file is reached.
+int64 sendfile(sock_t fd, int file_fd, int64 offset, int64 len, int ms=-1);
+#endif
+
+#ifdef __linux__
+// recv up to @n datagrams with one syscall, wait until at least one datagram
+// is received or timeout in @ms, or any error occured.
+// return number of datagrams received, size of each is in msgs[i].msg_len.
+int recvmmsg(sock_t fd, struct mmsghdr* msgs, int n, int ms=-1);
+
+// send @n datagrams with as few syscalls as possible, until all are done or 
+// timeout in @ms, or any error occured.
+// return number of datagrams sent, -1 if nothing was sent.
+int sendmmsg(sock_t fd, struct mmsghdr* msgs, int n, int ms=-1);
+
+// move data from @from to @to with splice() through a kernel pipe, the data is
+// never copied to user space. When EOF is reached on @from, @to is shut down
+// for writing (half-close).
+// return bytes moved, or -1 on error or no data was moved for @idle_ms ms.
+int64 splice(sock_t from, sock_t to, int idle_ms=-1);
+
+// relay data between @a and @b in both directions with splice(), like two
+// co::splice() in one coroutine. It returns when both directions reached
+// EOF, or no data was moved for @idle_ms ms, or any error occured.
+// return total bytes moved, or -1 on error or timeout.
+int64 relay(sock_t a, sock_t b, int idle_ms=-1);
+#endif
+
 #ifdef _WIN32
 inline int getsockopt(sock_t fd, int lv, int opt, void* optval, int* optlen) {
     return ::getsockopt(fd, lv, opt, (char*)optval, optlen);
@@ -303,6 +401,15 @@ inline void set_reuseaddr(sock_t fd) {
     co::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &v, sizeof(v));
 }
 
+#ifdef SO_REUSEPORT
+// multiple sockets bind to the same port, the kernel balances connections 
+// between them.
+inline void set_reuseport(sock_t fd) {
+    int v = 1;
+    co::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &v, sizeof(v));
+}
+#endif
+
 // !! send/recv buffer size must be set before the socket is connected.
 inline void set_send_buffer_size(sock_t fd, int n) {
     co::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &n, sizeof(n));
@@ -329,6 +436,42 @@ inline void reset_tcp_socket(sock_t fd, int ms=0) {
     co::close(fd, ms);
 }
 
+#ifdef __linux__
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+// UDP GSO (linux 4.18+), a buffer passed to send/sendto/sendmmsg will be split
+// into datagrams of @size bytes by the kernel (or the NIC).
+inline bool set_udp_gso(sock_t fd, int size) {
+    return co::setsockopt(fd, SOL_UDP, UDP_SEGMENT, &size, sizeof(size)) == 0;
+}
+
+// UDP GRO (linux 5.0+), datagrams from the same flow may be coalesced into one
+// buffer. Use recvmsg/recvmmsg with a control buffer, and get size of each 
+// datagram with co::udp_gro_size().
+inline bool set_udp_gro(sock_t fd) {
+    int v = 1;
+    return co::setsockopt(fd, SOL_UDP, UDP_GRO, &v, sizeof(v)) == 0;
+}
+
+// return size of the coalesced datagrams, or 0 if the message was not coalesced
+inline int udp_gro_size(struct msghdr* msg) {
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR(msg, c)) {
+        if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+            int v;
+            memcpy(&v, CMSG_DATA(c), sizeof(v));
+            return v;
+        }
+    }
+    return 0;
+}
+#endif
+
 #ifndef _WIN32
 inline void set_nonblock(sock_t fd) {
     fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
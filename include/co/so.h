@@ -1,5 +1,6 @@
 #pragma once
 
 #include "so/tcp.h"
+#include "so/dns.h"
 #include "so/http.h"
 #include "so/rpc.h"
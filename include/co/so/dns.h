@@ -0,0 +1,38 @@
+#pragma once
+
+#include "../fastring.h"
+#include <vector>
+
+namespace so {
+namespace dns {
+
+// Resolve @host to ip addresses. MUST be called in coroutine.
+//   - @host may be an ipv4 or ipv6 address, which is returned as it is.
+//   - Names in /etc/hosts (FLG_dns_hosts) are resolved without any query.
+//   - Otherwise, A and AAAA queries are sent together over udp to the name
+//     servers in FLG_dns_servers, or /etc/resolv.conf if it is empty, with
+//     the search domains and ndots in resolv.conf. Truncated answers are
+//     queried again over tcp.
+//   - Names not found by the name servers are resolved by getaddrinfo() with
+//     FLG_dns_system_fallback, for other sources in nsswitch.conf. It is
+//     called in helper threads, not to block the scheduler.
+//
+// Answers are cached with their TTL, and the cache is shared by all threads.
+// Coroutines resolving the same name at the same time share one query, and
+// wait for it no longer than @ms.
+// ipv4 addresses come first in @ips.
+//
+// @ms: timeout in milliseconds for the whole resolution, -1 for using
+//      FLG_dns_timeout * FLG_dns_attempts.
+// return false if no address was found or timeout.
+bool resolve(const fastring& host, std::vector<fastring>* ips, int ms=-1);
+
+inline bool resolve(const char* host, std::vector<fastring>* ips, int ms=-1) {
+    return resolve(fastring(host), ips, ms);
+}
+
+// Remove all answers in the cache. It can be called from anywhere.
+void clear_cache();
+
+} // dns
+} // so
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "../def.h"
+#include "../fastring.h"
+#include <deque>
+#include <vector>
+
+namespace so {
+namespace http {
+namespace hpack {
+
+// Decoder of HPACK header blocks (RFC 7541), for one HTTP/2 connection, as
+// the dynamic table is shared by all header blocks of the connection.
+//
+//   hpack::Decoder d;
+//   std::vector<fastring> h;
+//   size_t n = 0;
+//   if (d.decode(block.data(), block.size(), h, &n)) {
+//       // h[0], h[1] are name and value of the first field, n strings used
+//   }
+class Decoder {
+  public:
+    Decoder() : _size(0), _max_size(4096), _limit(4096), _max_list_size(64 << 10) {}
+    ~Decoder() = default;
+
+    // Decode the header block @s of @n bytes, names and values are saved in
+    // @h as name, value, name, value..., strings of @h are reused, and (*m) is
+    // set to the number of strings used.
+    // return false on error, the connection must be closed then.
+    bool decode(const char* s, size_t n, std::vector<fastring>& h, size_t* m);
+
+    // The limit of the dynamic table, sent to the peer with the setting
+    // SETTINGS_HEADER_TABLE_SIZE, default: 4096. The table is shrunk at once
+    // if it is larger.
+    void set_limit(uint32 n) {
+        _limit = n;
+        if (_max_size > _limit) {
+            _max_size = _limit;
+            this->evict(_max_size);
+        }
+    }
+
+    // Max size of names and values decoded from a header block, a small block
+    // may refer to large entries of the table many times. default: 64k.
+    void set_max_list_size(size_t n) { _max_list_size = n; }
+
+  private:
+    bool get(uint32 index, const fastring** name, const fastring** value) const;
+    void add(const fastring& name, const fastring& value);
+    void evict(size_t max_size);
+
+  private:
+    struct Entry {
+        fastring name;
+        fastring value;
+    };
+
+    std::deque<Entry> _table; // the newest at the front
+    size_t _size;             // size of the table, name + value + 32 for each
+    size_t _max_size;         // set by the encoder with table size updates
+    size_t _limit;            // max size the encoder may set
+    size_t _max_list_size;
+};
+
+// Encoder of header blocks. The dynamic table is not used, so it needs no
+// state of the connection: fields are encoded with an index in the static
+// table if found there, or as literals not indexed, and strings are encoded
+// with huffman code if it makes them shorter.
+class Encoder {
+  public:
+    // append the field @name (lower case) and @value to @out
+    static void encode(const char* name, size_t nlen, const char* value, size_t vlen, fastring& out);
+
+    static void encode(const fastring& name, const fastring& value, fastring& out) {
+        encode(name.data(), name.size(), value.data(), value.size(), out);
+    }
+
+    // append ":status" to @out
+    static void encode_status(int status, fastring& out);
+};
+
+// append the integer @v with a prefix of @bits bits, the high bits of the
+// first byte are set to @flags.
+void encode_int(uint64 v, int bits, uint8 flags, fastring& out);
+
+// append the huffman code of @s to @out, return bytes appended
+size_t huffman_encode(const char* s, size_t n, fastring& out);
+
+// length of the huffman code of @s
+size_t huffman_len(const char* s, size_t n);
+
+// decode the huffman code @s of @n bytes, append the result to @out.
+// return false on error.
+bool huffman_decode(const char* s, size_t n, fastring& out);
+
+} // hpack
+} // http
+} // so
@@ -1,12 +1,24 @@
 #pragma once
 
 #include "tcp.h"
+#include "http_parser.h"
+#include <string.h>
 #include <vector>
 #include <functional>
+#include <memory>
+
+namespace co {
+class BufferedConn;
+} // co
 
 namespace so {
 namespace http {
 
+class BodyReader;
+class BodyWriter;
+class H2Conn;
+struct RouteNode;
+
 enum Version {
     kHTTP10, kHTTP11,
 };
@@ -17,7 +29,9 @@ enum Method {
 
 class Base {
   public:
-    Base() : _parsing(0), _version(kHTTP11) {}
+    Base() : _parsing(0), _version(kHTTP11), _nh(0) {
+        memset(_known, -1, sizeof(_known));
+    }
     ~Base() = default;
 
     int version() const { return _version; }
@@ -40,31 +54,49 @@ class Base {
     void set_body(const fastring& s) { _body = s; }
     int body_len() const { return (int) _body.size(); }
 
-    void add_header(fastring&& key, fastring&& val) {
-        _headers.push_back(std::move(key));
-        _headers.push_back(std::move(val));
-    }
+    void add_header(const char* key, size_t klen, const char* val, size_t vlen);
 
     void add_header(const fastring& key, const fastring& val) {
-        _headers.push_back(key);
-        _headers.push_back(val);
+        this->add_header(key.data(), key.size(), val.data(), val.size());
+    }
+
+    void add_header(const char* key, const char* val) {
+        this->add_header(key, strlen(key), val, strlen(val));
+    }
+
+    // remove all headers @key (case-insensitive)
+    void remove_header(const char* key, size_t n);
+
+    void remove_header(const char* key) {
+        this->remove_header(key, strlen(key));
+    }
+
+    // value of the header @key (case-insensitive), empty if not found.
+    const fastring& header(const char* key, size_t n) const;
+
+    const fastring& header(const char* key) const {
+        return this->header(key, strlen(key));
     }
 
     const fastring& header(const fastring& key) const {
-        static const fastring kEmptyString;
-        if (_headers.empty()) return kEmptyString;
+        return this->header(key.data(), key.size());
+    }
 
-        const fastring s = key.upper();
-        for (size_t i = 0; i < _headers.size(); i += 2) {
-            if (_headers[i].upper() == s) return _headers[i + 1];
-        }
-        return kEmptyString;
+    // value of a well-known header, e.g. header(kHeaderContentType)
+    const fastring& header(KnownHeader h) const {
+        return _known[h] >= 0 ? _headers[_known[h] + 1] : empty_string();
     }
 
+    int header_num() const { return (int)(_nh >> 1); }
+    const fastring& header_key(int i) const { return _headers[i * 2]; }
+    const fastring& header_value(int i) const { return _headers[i * 2 + 1]; }
+
+    // strings of headers are reused by the next message after clear()
     void clear() {
         _parsing = 0;
         _body.clear();
-        _headers.clear();
+        _nh = 0;
+        memset(_known, -1, sizeof(_known));
     }
 
     // ===========================================================
@@ -73,17 +105,27 @@ class Base {
     void set_parsing() { _parsing = 1; }
     int parsing() const { return _parsing; }
 
+    // value of the first header @key to be modified in place, NULL if not found
+    fastring* mutable_header(const char* key, size_t n);
+
+    static const fastring& empty_string() {
+        static const fastring kEmptyString;
+        return kEmptyString;
+    }
+
   protected:
     int _parsing;
     int _version;
     fastring _body;
-    std::vector<fastring> _headers;
+    std::vector<fastring> _headers; // key, value, key, value...
+    size_t _nh;                     // number of strings used in _headers
+    int16 _known[kNumKnownHeaders]; // index of well-known headers in _headers
 };
 
 class Req : public Base {
   public:
-    Req() : _method(kGet) {}
-    explicit Req(Method method) : _method(method) {}
+    Req() : _method(kGet), _reader(0), _np(0) {}
+    explicit Req(Method method) : _method(method), _reader(0), _np(0) {}
     ~Req() = default;
 
     int method() const { return _method; }
@@ -95,6 +137,7 @@ class Req : public Base {
         return s[_method];
     }
 
+    void set_method(Method m) { _method = m; }
     void set_method_get() { _method = kGet; }
     void set_method_head() { _method = kHead; }
     void set_method_post() { _method = kPost; }
@@ -112,23 +155,74 @@ class Req : public Base {
     const fastring& url() const { return _url; }
     void set_url(fastring&& s) { _url = std::move(s); }
     void set_url(const fastring& s) { _url = s; }
+    void set_url(const char* s, size_t n) { _url.clear(); _url.append(s, n); }
 
     void clear() {
         Base::clear();
         _url.clear();
+        _reader = 0;
+        _np = 0;
     }
 
+    // Value of the path parameter @key of the route matched, e.g. "id" of
+    // "/users/:id". The value points into url(), nothing is copied.
+    // return NULL if not found.
+    const char* param(const char* key, size_t* n) const;
+
+    // copy of the value of the path parameter @key, empty if not found
+    fastring param(const char* key) const {
+        size_t n;
+        const char* s = this->param(key, &n);
+        return s ? fastring(s, n) : fastring();
+    }
+
+    int param_num() const { return _np; }
+
+    // Read the body in pieces, in the handler of a server that streams request
+    // bodies (see Server::stream_req_body()), chunked bodies are decoded.
+    // return bytes read, 0 at the end of the body, -1 on error or timeout.
+    int read_body(void* buf, int n, int ms=-1) const;
+
+    // for internal use
+    void set_reader(BodyReader* r) { _reader = r; }
+    void set_param_num(int n) { _np = n; }
+
+    enum { kMaxParams = 8 };
+    void add_param(const fastring* key, uint32 off, uint32 len) {
+        _params[_np].key = key;
+        _params[_np].off = off;
+        _params[_np].len = len;
+        ++_np;
+    }
+
+    // start line and headers, ends with "\r\n\r\n"
+    fastring header_str() const;
+
+    // append the start line and headers to @s. With @chunked, the body is sent
+    // in pieces with chunked encoding, "Transfer-Encoding: chunked" is sent
+    // instead of Content-Length, and these headers set by the user are skipped.
+    void header_str(fastring& s, bool chunked) const;
+
     fastring str() const;
     fastring dbg() const;
 
   private:
     int _method;
     fastring _url;
+    BodyReader* _reader;
+
+    // path parameters, names are owned by the router
+    struct Param {
+        const fastring* key;
+        uint32 off;
+        uint32 len;
+    } _params[kMaxParams];
+    int _np;
 };
 
 class Res : public Base {
   public:
-    Res() : _status(200) {}
+    Res() : _status(200), _file_off(0), _file_len(0), _writer(0), _streaming(false) {}
     ~Res() = default;
 
     int status() const { return _status; }
@@ -146,24 +240,163 @@ class Res : public Base {
         _status = (100 <= status && status <= 599) ? status : 500;
     }
 
+    // Use @len bytes of the file @path, starting from @off, as the body.
+    // The file will be sent with the zero-copy sendfile() where possible,
+    // without being read into memory.
+    void set_file(const fastring& path, int64 off, int64 len) {
+        _file = path;
+        _file_off = off;
+        _file_len = len;
+    }
+
+    const fastring& file() const { return _file; }
+    int64 file_off() const { return _file_off; }
+    int64 file_len() const { return _file_len; }
+
     void clear() {
         Base::clear();
         _status = 200;
+        _file.clear();
+        _file_off = _file_len = 0;
+        _writer = 0;
+        _streaming = false;
     }
 
+    // Send the body in pieces, in the handler of a server. The status line and
+    // headers are sent on the first call, and the body is sent with chunked
+    // encoding, which ends after the handler returns. The body set by set_body()
+    // is not used then. HTTP/1.0 clients get the body without encoding, and the
+    // connection is closed at the end of it.
+    // return @n on success, -1 on error.
+    int write(const void* data, int n);
+
+    int write(const fastring& s) {
+        return this->write(s.data(), (int) s.size());
+    }
+
+    // whether the body is being sent by write()
+    bool streaming() const { return _streaming; }
+
+    // for internal use
+    void set_writer(BodyWriter* w) { _writer = w; }
+    void set_streaming() { _streaming = true; }
+
+    // status line and headers, ends with "\r\n\r\n"
+    fastring header_str() const;
+
+    // append the status line and headers to @s, the status line is not
+    // formatted, but copied from a table made once.
+    void header_str(fastring& s) const;
+
     fastring str() const;
     fastring dbg() const;
 
   private:
     int _status;
+    fastring _file;
+    int64 _file_off;
+    int64 _file_len;
+    BodyWriter* _writer;
+    bool _streaming;
 
     static const char** create_status_table();
+    static const fastring* create_status_lines();
 };
 
-class Server : public tcp::Server {
+// Router finds the handler of a request by method and path, with a compressed
+// radix trie for each method. The path of a route may have parameters and a
+// wildcard at the end:
+//   /users                 static path
+//   /users/:id/posts       ":id" matches one segment of the path
+//   /static/*file          "*file" matches the rest of the path
+// A parameter or wildcard starts at the beginning of a segment, ':' or '*'
+// elsewhere is a plain char, e.g. "/v1/files:batch". Static segments are
+// preferred to parameters, and parameters to wildcards, and if the preferred
+// one does not match the rest of the path, the next one is tried. HEAD requests
+// go to GET routes if no route for HEAD matches.
+// Routes are added before the server starts, they can't be changed later.
+class Router {
   public:
     typedef std::function<void(const Req&, Res&)> Fun;
 
+    Router();
+    ~Router();
+
+    // return false if the route is invalid, already added, or its parameter
+    // has a different name from another route at the same position, the
+    // error is logged.
+    bool add(Method method, const char* path, Fun&& fun);
+
+    bool empty() const { return _funs.empty(); }
+
+    // number of routes, they are numbered from 0 in the order added
+    size_t size() const { return _funs.size(); }
+
+    // method and path of the route @i
+    Method method(size_t i) const { return _methods[i]; }
+    const fastring& path(size_t i) const { return _paths[i]; }
+
+    // find the handler for @req, path parameters are saved in @req.
+    // return NULL if not found.
+    const Fun* find(Req* req) const;
+
+    // methods of the routes matching the path of @req, e.g. "GET, HEAD", for
+    // the Allow header of 405 responses. return empty if none.
+    fastring allow(Req* req) const;
+
+    // number of the route of @f found by find()
+    int index(const Fun* f) const { return (int)(f - _funs.data()); }
+
+  private:
+    RouteNode* _root[kOptions + 1];
+    std::vector<Fun> _funs;
+    std::vector<Method> _methods;
+    std::vector<fastring> _paths;
+
+    DISALLOW_COPY_AND_ASSIGN(Router);
+};
+
+// Metrics of requests handled by a server, for each route: requests by status
+// class, bytes of request and response bodies, and a histogram of latency from
+// calling the handler to sending the response. Requests not matched by any
+// route, or rejected before calling the handler, are recorded with the route
+// "other".
+//
+// Each scheduler records into counters of its own, without locks or atomic
+// operations, and str() adds them up when the metrics are read. Threads that
+// are not schedulers share one set of counters, updated atomically.
+class Metrics {
+  public:
+    Metrics();
+    ~Metrics();
+
+    // labels of the routes of @router, call it before requests are recorded
+    void init(const Router& router);
+
+    // record a request of @method, handled by the route @route, or -1 if not
+    // matched. @in, @out: bytes of bodies, @us: latency in microseconds.
+    // Routes added to the router after init() are recorded as "other".
+    void record(int route, int method, int status, int64 in, int64 out, int64 us);
+
+    // metrics in the prometheus text format
+    fastring str() const;
+
+  private:
+    struct Counters;
+    Counters* counters(int id);
+
+  private:
+    int _nslot;                    // routes, and "other" for each method
+    std::vector<fastring> _labels; // labels of each slot
+    std::vector<Counters*> _c;     // for each scheduler, and other threads
+
+    DISALLOW_COPY_AND_ASSIGN(Metrics);
+};
+
+class Server : public tcp::Server {
+  public:
+    typedef Router::Fun Fun;
+
     Server(const char* ip, int port);
     virtual ~Server();
 
@@ -175,11 +408,46 @@ class Server : public tcp::Server {
         _on_req = fun;
     }
 
+    // Route requests of @method and @path to @fun (see Router), requests not
+    // matched by any route are handled by the handler set by on_req(). If it
+    // is not set, they get 405 with the Allow header if the path is routed for
+    // other methods, or 404. CHECK failed if the route can't be added.
+    //   serv.on(http::kGet, "/users/:id", [](const http::Req& req, http::Res& res) {
+    //       fastring id = req.param("id");
+    //   });
+    void on(Method method, const char* path, Fun&& fun);
+
+    void on(Method method, const char* path, const Fun& fun) {
+        this->on(method, path, Fun(fun));
+    }
+
+    // Call the handler as soon as the header of a request is received, and the
+    // handler reads the body with Req::read_body(). The body is not held in
+    // memory then, and what the handler does not read is discarded.
+    // default: false.
+    void stream_req_body(bool on) { _stream_body = on; }
+
+    // Serve HTTP/2 over cleartext tcp (h2c) with prior knowledge: connections
+    // starting with the HTTP/2 connection preface speak HTTP/2, others go on
+    // with HTTP/1.x. Each stream is handled in a coroutine of the scheduler of
+    // the connection, by the same handlers as HTTP/1.x requests, which look
+    // like HTTP/1.1 requests to them. Responses of all streams are multiplexed
+    // on the connection, within the flow control windows of the client.
+    // Req::read_body() and Res::write() are not supported with HTTP/2, bodies
+    // are received and sent as a whole.
+    // default: false.
+    void h2c(bool on) { _h2c = on; }
+
+    // Record metrics of requests (see Metrics), and serve them in prometheus
+    // text format by the route GET @path, with the number of connections.
+    // Call it before start(). default: disabled.
+    void enable_metrics(const char* path="/metrics");
+
     void process(const Req& req, Res& res) {
         if (_on_req) {
             _on_req(req, res);
         } else {
-            res.set_status(501);
+            res.set_status(_router.empty() ? 501 : 404);
         }
     }
 
@@ -188,19 +456,62 @@ class Server : public tcp::Server {
   private:
     virtual void on_connection(Connection* conn);
 
+    // serve an HTTP/2 connection, the preface is consumed
+    void on_h2(co::BufferedConn& bc);
+
+    // call the handler of @req, and add headers of the library to @res.
+    // return number of the route matched, or -1 if not matched.
+    int handle(Req& req, Res& res);
+
+    friend class H2Conn;
+
   private:
     int32 _conn_num;
-    co::Pool _buffer; // memory buffer for co::recv()
+    bool _stream_body;
+    bool _h2c;
     Fun _on_req;
+    Router _router;
+    std::unique_ptr<Metrics> _metrics;
 };
 
+// Http client based on coroutine, see tcp::Client for the connection. With
+// use_pool(), keep-alive connections are shared by clients of the same host
+// in each scheduler.
 class Client : public tcp::Client {
   public:
     Client(const char* serv_ip, int serv_port);
     virtual ~Client();
 
+    // If built with zlib and @req has no Accept-Encoding, the client asks for
+    // gzip or deflate, and the body of @res is decompressed. Content-Encoding
+    // and Content-Length are removed from @res then, as they are not of the
+    // decompressed body.
     void call(const Req& req, Res& res);
 
+    // Send all @reqs on the connection without waiting for responses, then
+    // receive responses in order. It saves round trips for idempotent requests,
+    // the server must support pipelining (http::Server does). If a response
+    // fails, it and the following responses get the error status.
+    void pipeline(const std::vector<Req>& reqs, std::vector<Res>& res);
+
+    // Send and receive bodies in pieces, without holding them in memory:
+    //   if (cli.begin_req(req)) {         // send the header of req
+    //       cli.write_body(data, n);      // send the body with chunked encoding
+    //       cli.end_req();
+    //   }
+    //   if (cli.recv_header(res)) {       // recv the header of the response
+    //       while ((r = cli.read_body(buf, sizeof(buf))) > 0) ...
+    //   }
+    // Chunked response bodies are decoded by read_body(). begin_req() ignores
+    // the body of @req, and write_body() returns -1 on error. recv_header()
+    // sets the status of @res as call() does on error, and read_body() returns
+    // bytes read, 0 at the end of the body, -1 on error or timeout.
+    bool begin_req(const Req& req);
+    int write_body(const void* data, int n);
+    bool end_req();
+    bool recv_header(Res& res);
+    int read_body(void* buf, int n, int ms=-1);
+
     fastring get(fastring&& url) {
         return on_method(kGet, std::move(url));
     }
@@ -250,6 +561,11 @@ class Client : public tcp::Client {
     }
 
   private:
+    co::BufferedConn* conn();
+    void close_conn();
+    int send_req(const Req& req, bool chunked);
+    bool recv_res(Res& res);
+
     fastring on_method(Method method, fastring&& url) {
         Req req(method);
         Res res;
@@ -283,6 +599,97 @@ class Client : public tcp::Client {
         this->call(req, res);
         return std::move(res.mutable_body());
     }
+
+  private:
+    std::unique_ptr<co::BufferedConn> _bc;
+    std::unique_ptr<BodyReader> _reader;
+    bool _head;   // the request is HEAD, no body in the response
+    bool _close;  // close the connection after the response
+    bool _decode; // decompress the body of the response
+};
+
+// A request for fan_out(), to the server at @ip:@port.
+struct Call {
+    Call(const char* ip, int port) : ip(ip), port(port) {}
+
+    fastring ip;
+    int port;
+    Req req;
+    Res res;
+};
+
+// Send @calls concurrently, each in a coroutine of the current scheduler, with
+// keep-alive connections from the pool. It returns when all responses are
+// received, or @ms milliseconds passed. Calls not finished by then get status
+// 580 (Recv Timeout), and their connections are closed. If @ms < 0, it waits
+// for all calls without a timeout, each call is still limited by
+// FLG_http_conn_timeout and FLG_http_recv_timeout.
+// return number of calls finished. MUST be called in coroutine.
+int fan_out(std::vector<Call>& calls, int ms);
+
+// Content codings, gzip and deflate are supported if built with zlib (the
+// cmake option WITH_ZLIB, or xmake f --with_zlib=y).
+enum Encoding {
+    kIdentity, kGzip, kDeflate,
+};
+
+// compress @n bytes of @s with @enc (kGzip or kDeflate) into @out.
+// return false on error, or if zlib is not available.
+bool compress(int enc, const char* s, size_t n, fastring& out, int level=6);
+
+// decompress @n bytes of @s, encoded with @enc, into @out. It fails if the
+// result is larger than FLG_http_max_body_size.
+bool decompress(int enc, const char* s, size_t n, fastring& out);
+
+// Encoding of the value of Content-Encoding, kIdentity if not supported
+int content_encoding(const fastring& s);
+
+// for internal use, compress the body of @res if @req accepts it
+void compress_res(const Req& req, Res& res);
+
+// add Accept-Encoding to the Vary header of @res, unless it is already there
+// or Vary is "*"
+void add_vary(Res& res);
+
+// format @sec (seconds since the epoch) as "Sun, 06 Nov 1994 08:49:37 GMT",
+// @buf should have at least 32 bytes. return length of the date.
+int format_date(int64 sec, char* buf);
+
+struct FileCache;
+
+// Handler for static files under the directory @root, e.g.
+//   serv.on_req(http::StaticFiles("/var/www"));
+//   serv.on(http::kGet, "/static/*path", [files](const http::Req& req, http::Res& res) {
+//       size_t n;
+//       const char* p = req.param("path", &n);
+//       files.serve(req, res, p, n);
+//   });
+//
+// One cache is shared by all schedulers, and copies of the handler. Files not
+// larger than FLG_http_sendfile_size are cached in memory, FLG_http_file_cache_size
+// bytes in total, and larger files are sent with sendfile(). A cached file is
+// checked for changes at most once a second. Files are checked and read in
+// helper threads, not in the scheduler. Paths not found are cached apart in a
+// small LRU, so they can't evict files.
+//
+// Responses have ETag and Last-Modified, and requests with If-None-Match or
+// If-Modified-Since get 304 if the file is not modified. A single byte range
+// in the Range header is supported. If the client accepts gzip, "x.gz" is sent
+// instead of "x" when it exists.
+class StaticFiles {
+  public:
+    explicit StaticFiles(const char* root);
+    ~StaticFiles();
+
+    // serve the file of the path in url of @req
+    void operator()(const Req& req, Res& res) const;
+
+    // serve the file @path of @n bytes, relative to the root
+    void serve(const Req& req, Res& res, const char* path, size_t n) const;
+
+  private:
+    fastring _root;
+    std::shared_ptr<FileCache> _cache;
 };
 
 } // http
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "../def.h"
+#include <stddef.h>
+
+namespace so {
+namespace http {
+
+// Headers that are looked up by the library, or often by users. They are
+// indexed while parsing, and found without comparing strings.
+enum KnownHeader {
+    kHeaderHost,
+    kHeaderConnection,
+    kHeaderContentLength,
+    kHeaderContentType,
+    kHeaderTransferEncoding,
+    kHeaderAcceptEncoding,
+    kHeaderContentEncoding,
+    kHeaderExpect,
+    kHeaderUpgrade,
+    kHeaderRange,
+    kHeaderIfNoneMatch,
+    kHeaderIfModifiedSince,
+    kHeaderDate,
+    kNumKnownHeaders,
+};
+
+// return KnownHeader of the header name @s (case-insensitive), or -1.
+int known_header(const char* s, size_t n);
+
+// whether @a and @b are equal, ignoring case of ascii letters
+bool equal_nocase(const char* a, const char* b, size_t n);
+
+// Incremental parser for the start line and headers of http/1.x messages.
+//
+// The parser records offsets from the beginning of the message, nothing is
+// copied. It can be called again with more data after it returns kMore, and it
+// goes on from where it stopped. The buffer may be reallocated between calls,
+// as long as the message stays at the beginning of it.
+//
+//   Parser p;
+//   while ((r = p.parse_req(buf.data(), buf.size())) == Parser::kMore) {
+//       recv more data into buf...
+//   }
+//   if (r == Parser::kDone) // header of p.header_len() bytes is parsed
+class Parser {
+  public:
+    enum {
+        kDone = 0,
+        kMore = 1,
+    };
+
+    enum { kMaxHeaders = 64 };
+
+    struct Slice {
+        uint32 off;
+        uint32 len;
+    };
+
+    Parser() { this->reset(); }
+    ~Parser() = default;
+
+    // clear the state for the next message
+    void reset();
+
+    // parse a request in @s of @n bytes.
+    // return kDone if all headers are parsed, kMore if more data is needed, or
+    // http status code on error: 400 (Bad Request), 405 (Method Not Allowed),
+    // 431 (Request Header Fields Too Large), 505 (HTTP Version Not Supported).
+    int parse_req(const char* s, size_t n) {
+        return this->parse(s, n, true);
+    }
+
+    // parse a response in @s of @n bytes.
+    // return kDone, kMore, or -1 on error.
+    int parse_res(const char* s, size_t n) {
+        int r = this->parse(s, n, false);
+        return r <= kMore ? r : -1;
+    }
+
+    // length of the start line and headers, including the ending "\r\n\r\n"
+    size_t header_len() const { return _pos; }
+
+    // Method (kGet, kPost...) of a request
+    int method() const { return _method; }
+
+    // Version (kHTTP10, kHTTP11)
+    int version() const { return _version; }
+
+    // status code of a response
+    int status() const { return _status; }
+
+    // url of a request
+    const Slice& url() const { return _url; }
+
+    int header_num() const { return _nh; }
+    const Slice& key(int i) const { return _h[i * 2]; }
+    const Slice& value(int i) const { return _h[i * 2 + 1]; }
+
+    // index of the first header of KnownHeader @h, -1 if not found
+    int find(int h) const { return _known[h]; }
+
+    // value of Content-Length, -1 if not present
+    int64 content_length() const { return _content_length; }
+
+    // whether chunked is the last coding of Transfer-Encoding
+    bool chunked() const { return _chunked; }
+
+    // whether Transfer-Encoding is present
+    bool has_transfer_encoding() const { return _known[kHeaderTransferEncoding] >= 0; }
+
+  private:
+    int parse(const char* s, size_t n, bool req);
+    int parse_req_line(const char* s, size_t n);
+    int parse_res_line(const char* s, size_t n);
+    int parse_header(const char* s, size_t beg, size_t end);
+
+    // check Content-Length and Transfer-Encoding at the end of headers
+    int check_framing();
+
+  private:
+    uint32 _state;  // 0: start line, 1: headers, 2: done
+    uint32 _pos;    // where the current line begins
+    uint32 _scan;   // where searching for the end of line goes on
+    int _method;
+    int _version;
+    int _status;
+    int _nh;
+    int64 _content_length;
+    bool _chunked;
+    bool _req;
+    Slice _url;
+    int8 _known[kNumKnownHeaders];
+    Slice _h[kMaxHeaders * 2];
+};
+
+} // http
+} // so
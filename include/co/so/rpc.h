@@ -29,10 +29,22 @@ class Client {
 
     virtual void ping() = 0; // send a heartbeat
     virtual void call(const Json& req, Json& res) = 0;
+
+    // put @n new connections into the keep-alive pool, for pooled clients only.
+    // return number of connections created.
+    virtual int warm_up(int n) { return 0; }
 };
 
+// @ip: ipv4 or ipv6 address, or unix socket address as "unix:/path" or 
+//      "unix:@name" (abstract namespace on linux), @port is ignored for it.
 Server* new_server(const char* ip, int port, const char* passwd="");
-Client* new_client(const char* ip, int port, const char* passwd="");
+
+// @ip: domain name, ipv4 or ipv6 address, or unix socket address.
+// @pooled: if true, the client takes a connection from the per-scheduler keep-alive
+//          pool shared by rpc clients of the same server for each call, and
+//          returns it to the pool when the call is done. The connection is
+//          closed on errors.
+Client* new_client(const char* ip, int port, const char* passwd="", bool pooled=false);
 
 } // rpc
 } // so
@@ -6,7 +6,12 @@
 namespace so {
 namespace tcp {
 
+// A connection accepted by tcp::Server. It is counted by the server until it
+// is deleted, so delete it after the connection is closed.
 struct Connection {
+    Connection() : fd((sock_t)-1), port(0), p(0) {}
+    ~Connection();
+
     sock_t fd;   // conn fd
     fastring ip; // peer ip
     int port;    // peer port
@@ -15,11 +20,27 @@ struct Connection {
 
 // Tcp server based on coroutine.
 // Support both ipv4 and ipv6. One coroutine per connection.
+//
+// The server listens on a unix domain socket if @ip is "unix:/path", or 
+// "unix:@name" for the abstract namespace on linux, @port is ignored then.
+// The ip of connections is the same as @ip and the port is 0.
+//
+// By default, one coroutine accepts connections, and the connections are 
+// dispatched to all schedulers. If FLG_tcp_reuseport is true (linux only), 
+// there is a SO_REUSEPORT listener in each scheduler, and a connection is 
+// handled in the scheduler where it was accepted.
+//
+// Admission control: FLG_tcp_max_conn limits connections being handled, and
+// FLG_tcp_max_pending limits connections accepted but not yet handled by a 
+// coroutine. When a limit is reached, the server stops accepting until it
+// drops, or if FLG_tcp_reject_overload is true, new connections are accepted
+// and reset at once.
 class Server {
   public:
-    // @ip is either a ipv4 or ipv6 address.
+    // @ip is either a ipv4 or ipv6 address, or a unix socket address.
     Server(const char* ip, int port)
-        : _ip((ip && *ip) ? ip : "0.0.0.0"), _port(port) {
+        : _ip((ip && *ip) ? ip : "0.0.0.0"), _port(port),
+          _conn_num(0), _pending_num(0), _rejected_num(0), _nwait(0) {
     }
 
     virtual ~Server() = default;
@@ -31,33 +52,73 @@ class Server {
 
     // The derived class must implement this method.
     // The @conn was created by operator new. Remember to delete it 
-    // when the connection was closed.
+    // when the connection was closed, it may be done in another coroutine
+    // after this method returns.
     virtual void on_connection(Connection* conn) = 0;
 
+    // number of connections accepted and not closed, including pending ones
+    uint32 conn_num() const { return _conn_num; }
+
+    // number of connections waiting for a coroutine to handle them
+    uint32 pending_num() const { return _pending_num; }
+
+    // number of connections reset by the server as it was overloaded
+    uint64 rejected_num() const { return _rejected_num; }
+
   protected:
     fastring _ip;
     uint32 _port;
 
+  private:
+    uint32 _conn_num;
+    uint32 _pending_num;
+    uint64 _rejected_num;
+    uint32 _nwait;     // accept coroutines waiting for the load to drop
+    co::Event _ev;     // signaled when a connection is closed or handled
+
   private:
     // The server loop, listen on the port and wait for connections.
     // Call on_connection() in a new coroutine for every connection. 
     void loop();
 
+    // create a listening socket bound to _ip:_port
+    sock_t listen(bool reuseport);
+
+    // accept connections on @fd forever, connections are handled in the 
+    // current scheduler if @local is true.
+    void accept_loop(sock_t fd, bool local);
+
+    // whether FLG_tcp_max_conn or FLG_tcp_max_pending is reached
+    bool overloaded();
+
+    // wake up the accept coroutines if they wait for the load to drop
+    void wake_acceptor();
+
+    friend void on_new_connection(void* p);
+    friend struct Connection;
+
     DISALLOW_COPY_AND_ASSIGN(Server);
 };
 
 // Tcp client based on coroutine.
 // Support both ipv4 and ipv6. One client corresponds to one connection.
 // The Client MUST be used in coroutine, and it is not coroutine-safe.
+//
+// With use_pool(), connections are taken from a keep-alive pool in connect(),
+// and returned to the pool in release() or the destructor. The pool has idle
+// lists for each scheduler, keyed by host:port and a tag. Limits of the pool
+// are set by FLG_tcp_pool_max_idle, FLG_tcp_pool_idle_sec and
+// FLG_tcp_pool_max_life_sec.
 class Client {
   public:
-    // @ip is a domain name, or either a ipv4 or ipv6 address.
+    // @ip is a domain name, or either a ipv4 or ipv6 address, or a unix socket 
+    // address as "unix:/path" or "unix:@name", @port is ignored for the latter.
     Client(const char* ip, int port)
         : _ip((ip && *ip) ? ip : "127.0.0.1"), _port(port),
-          _fd((sock_t)-1), _sched_id(-1) {
+          _sched_id(-1), _fd((sock_t)-1), _born_ms(0), _reused(false) {
     }
 
-    virtual ~Client() { this->disconnect(); }
+    virtual ~Client() { this->release(); }
 
     int recv(void* buf, int n, int ms=-1) {
         return co::recv(_fd, buf, n, ms);
@@ -73,9 +134,15 @@ class Client {
 
     bool connected() const { return _fd != (sock_t)-1; }
 
+    // the connected socket, -1 if not connected
+    sock_t fd() const { return _fd; }
+
     // @ms: timeout in milliseconds
+    // If the pool is used, an idle connection in the pool is checked and reused
+    // if it is still alive, otherwise a new connection is created.
     bool connect(int ms);
 
+    // close the connection, it is never returned to the pool.
     // MUST be called in the thread where it is connected.
     void disconnect() {
         if (this->connected()) {
@@ -86,11 +153,41 @@ class Client {
         }
     }
 
+    // return the connection to the pool if the pool is used, otherwise close it.
+    // Do not call it if a request is still in progress on the connection.
+    // MUST be called in the thread where it is connected.
+    void release();
+
+    // use the per-scheduler keep-alive pool, connections are shared by clients
+    // with the same host, port and @tag. Call it before connect().
+    void use_pool(const char* tag="") {
+        _pool_key.clear();
+        _pool_key << _ip << ':' << _port << '#' << tag;
+    }
+
+    // create @n new connections in the current scheduler, and put them into 
+    // the pool. return number of connections created.
+    int warm_up(int n, int ms);
+
+    // whether the connection was taken from the pool
+    bool reused() const { return _reused; }
+
+  protected:
+    // called when a new connection is created, a derived class may do protocol
+    // handshake here (e.g. auth). return false to close the connection.
+    virtual bool on_connected() { return true; }
+
+    // create a new connection without the pool
+    bool new_connection(int ms);
+
   protected:
     fastring _ip;
     uint32 _port;
     int _sched_id;  // id of scheduler where this client runs in
     sock_t _fd;
+    int64 _born_ms; // time when the connection was created
+    bool _reused;
+    fastring _pool_key;
 
     DISALLOW_COPY_AND_ASSIGN(Client);
 };
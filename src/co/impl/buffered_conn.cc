@@ -0,0 +1,251 @@
+#include "co/buffered_conn.h"
+#include "co/log.h"
+#include "scheduler.h"
+#ifndef _WIN32
+#include "hook.h"
+#endif
+#include <string.h>
+#include <stdlib.h>
+
+namespace co {
+
+BufferedConn::BufferedConn(sock_t fd, uint32 cap)
+    : _fd(fd), _cap(cap > 64 ? cap : 64), _rbuf(0), _rcap(0), _rb(0), _re(0),
+      _scan(0), _w(0), _flush_ms(-1), _deferred(false) {
+}
+
+BufferedConn::~BufferedConn() {
+    if (_rbuf) free(_rbuf);
+    if (_w) {
+        if (_w->queued) gSched->del_flush(_w);
+        if (_w->draining) {
+            _w->orphan = true;
+            return;
+        }
+        free(_w->p);
+        delete _w;
+    }
+}
+
+size_t BufferedConn::pending() const {
+    return _w ? _w->n : 0;
+}
+
+void BufferedConn::reserve(size_t n) {
+    if (_rcap - _re >= n) return;
+
+    if (_rb > 0) {
+        if (_re > _rb) memmove(_rbuf, _rbuf + _rb, _re - _rb);
+        _scan = _scan > _rb ? _scan - _rb : 0;
+        _re -= _rb;
+        _rb = 0;
+    }
+
+    if (_rcap - _re < n) {
+        size_t cap = _rcap ? _rcap * 2 : _cap;
+        while (cap - _re < n) cap *= 2;
+        _rbuf = (char*) realloc(_rbuf, cap);
+        CHECK(_rbuf) << "realloc failed..";
+        _rcap = cap;
+    }
+}
+
+int BufferedConn::fill(int ms) {
+    this->reserve(_cap >> 1);
+    int r = co::recv(_fd, _rbuf + _re, (int)(_rcap - _re), ms);
+    if (r > 0) _re += r;
+    return r;
+}
+
+int BufferedConn::peek(size_t n, int ms) {
+    while (this->size() < n) {
+        this->reserve(n - this->size());
+        int r = this->fill(ms);
+        if (r <= 0) return r;
+    }
+    return (int) this->size();
+}
+
+static inline void set_error(int e) {
+  #ifdef _WIN32
+    WSASetLastError(e);
+  #else
+    errno = e;
+  #endif
+}
+
+int BufferedConn::read_until(const char* delim, size_t max, int ms) {
+    const size_t n = strlen(delim);
+
+    while (true) {
+        if (_re - _rb >= n) {
+            // search from where the last search stopped
+            const char* s = _rbuf + (_scan > _rb ? _scan : _rb);
+            const char* e = _rbuf + _re - n + 1;
+            for (; s < e; ++s) {
+                s = (const char*) memchr(s, *delim, e - s);
+                if (s == NULL) break;
+                if (memcmp(s, delim, n) == 0) return (int)(s + n - (_rbuf + _rb));
+            }
+            _scan = _re - n + 1;
+        }
+
+        if (_re - _rb >= max) {
+            set_error(EMSGSIZE);
+            return -1;
+        }
+
+        int r = this->fill(ms);
+        if (r <= 0) return r;
+    }
+}
+
+int BufferedConn::read_exact(void* buf, int n, int ms) {
+    size_t x = this->size();
+    if (x >= (size_t)n) {
+        memcpy(buf, this->data(), n);
+        this->consume(n);
+        return n;
+    }
+
+    if (x > 0) {
+        memcpy(buf, this->data(), x);
+        this->consume(x);
+    }
+
+    int r = co::recvn(_fd, (char*)buf + x, n - (int)x, ms);
+    return r <= 0 ? r : n;
+}
+
+int BufferedConn::wait_drain(int ms) {
+    while (_w->draining) {
+        if (ms < 0) {
+            _w->ev.wait();
+        } else if (!_w->ev.wait(ms)) {
+            set_error(ETIMEDOUT);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int BufferedConn::write(const void* buf, int n, int ms) {
+    if (!_w) {
+        _w = new WriteBuffer();
+        _w->fd = _fd;
+        _w->p = (char*) malloc(_cap);
+        CHECK(_w->p) << "malloc failed..";
+        _w->n = 0;
+        _w->ms = _flush_ms;
+        _w->err = 0;
+        _w->queued = false;
+        _w->draining = false;
+        _w->orphan = false;
+    }
+
+    if (unlikely(_w->draining) && this->wait_drain(ms) == -1) return -1;
+    if (unlikely(_w->err)) {
+        set_error(_w->err);
+        return -1;
+    }
+
+    if (_w->n + n <= _cap) {
+        memcpy(_w->p + _w->n, buf, n);
+        _w->n += n;
+        if (_deferred && !_w->queued) {
+            gSched->add_flush(_w);
+            _w->queued = true;
+        }
+        return n;
+    }
+
+    if (_w->n == 0) return co::send(_fd, buf, n, ms);
+
+    struct iovec iov[2] = {
+        { _w->p, _w->n },
+        { (void*)buf, (size_t)n },
+    };
+    _w->n = 0;
+    return co::writev(_fd, iov, 2, ms) == -1 ? -1 : n;
+}
+
+int BufferedConn::flush(int ms) {
+    if (!_w) return 0;
+    if (_w->queued) {
+        gSched->del_flush(_w);
+        _w->queued = false;
+    }
+    if (unlikely(_w->draining) && this->wait_drain(ms) == -1) return -1;
+    if (unlikely(_w->err)) {
+        set_error(_w->err);
+        return -1;
+    }
+
+    if (_w->n == 0) return 0;
+    int r = co::send(_fd, _w->p, (int)_w->n, ms);
+    _w->n = 0;
+    return r == -1 ? -1 : 0;
+}
+
+void BufferedConn::discard() {
+    if (!_w) return;
+    if (_w->queued) {
+        gSched->del_flush(_w);
+        _w->queued = false;
+    }
+    if (!_w->draining) _w->n = 0;
+}
+
+void BufferedConn::set_deferred_flush(bool on, int ms) {
+  #ifndef _WIN32
+    _deferred = on;
+    _flush_ms = ms;
+    if (_w) _w->ms = ms;
+  #else
+    (void) on;
+    (void) ms;
+  #endif
+}
+
+bool WriteBuffer::flush_now() {
+  #ifndef _WIN32
+  #ifndef MSG_NOSIGNAL
+  #define MSG_NOSIGNAL 0
+  #endif
+    // the socket is non-blocking, send as much as possible
+    size_t sent = 0;
+    while (sent < n) {
+        ssize_t r = fp_send(fd, p + sent, n - sent, MSG_NOSIGNAL);
+        if (r > 0) { sent += r; continue; }
+        if (r == -1 && errno == EINTR) continue;
+        if (r == -1 && (errno == EWOULDBLOCK || errno == EAGAIN)) break;
+        err = r == -1 ? errno : EPIPE;
+        sent = n;
+    }
+
+    queued = false;
+    if (sent < n) {
+        memmove(p, p + sent, n - sent);
+        n -= sent;
+        return false;
+    }
+    n = 0;
+  #else
+    queued = false;
+  #endif
+    return true;
+}
+
+void WriteBuffer::drain() {
+    if (co::send(fd, p, (int) n, ms) == -1) err = co::error();
+    n = 0;
+    draining = false;
+    if (orphan) {
+        free(p);
+        delete this;
+        return;
+    }
+    ev.signal();
+}
+
+} // co
@@ -26,10 +26,27 @@ int sched_id() {
     return gSched ? gSched->id() : -1;
 }
 
+int sched_num() {
+    return (int) sched_mgr()->size();
+}
+
+void go_on(int id, Closure* cb) {
+    sched_mgr()->at(id)->add_new_task(cb);
+}
+
 int coroutine_id() {
     return (gSched && gSched->running()) ? gSched->running()->id : -1;
 }
 
+void set_busy_poll(uint32 us) {
+    CHECK(gSched) << "must be called in scheduler thread..";
+    gSched->set_busy_poll(us);
+}
+
+BusyPollStats busy_poll_stats(int id) {
+    return sched_mgr()->at(id)->busy_poll_stats();
+}
+
 class EventImpl {
   public:
     EventImpl() = default;
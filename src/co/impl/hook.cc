@@ -7,25 +7,41 @@
 #include "co/atomic.h"
 
 #include <dlfcn.h>
+#include <sys/stat.h>
 #include <vector>
+#include <deque>
 #include <unordered_map>
+#include <unordered_set>
+
+DEF_bool(co_hook_file_io, false, "#1 run hooked read/write/pread/pwrite/fsync on regular files in helper threads");
+DEF_uint32(co_file_io_threads, 4, "#1 number of helper threads for file I/O, used when co_hook_file_io is true");
 
 namespace co {
 
 class HookInfo {
   public:
     HookInfo() : HookInfo(0) {}
-    explicit HookInfo(int64 v) : _v(v) {}
+    explicit HookInfo(int64 v) : _v(v), _file(false) {}
     ~HookInfo() = default;
 
     HookInfo(const HookInfo& h) {
         _v = h._v;
+        _file = h._file;
     }
 
     bool hookable() const {
         return _v != 0;
     }
 
+    // a regular file, not hookable, I/O on it may be done in helper threads
+    bool is_file() const {
+        return _file;
+    }
+
+    void set_file() {
+        _file = true;
+    }
+
     int send_timeout() const {
         return _p.send_timeout;
     }
@@ -51,6 +67,7 @@ class HookInfo {
 
         int64 _v;
     };
+    bool _file;
 };
 
 class Hook {
@@ -97,6 +114,13 @@ class Hook {
         auto it = hk.find(fd);
         if (it != hk.end()) return it->second;
 
+        // regular files are checked once, not for each read or write
+        if (FLG_co_hook_file_io && this->_Is_file(fd)) {
+            HookInfo hi;
+            hi.set_file();
+            return hk[fd] = hi;
+        }
+
         // check whether @fd is non-block, as we don't need to hook non-block socket
         int flag = fcntl(fd, F_GETFL);
         if (flag & O_NONBLOCK) return hk[fd] = HookInfo();
@@ -114,9 +138,28 @@ class Hook {
         return hk[fd] = hi;
     }
 
+    // whether @fd is a regular file, for pread, fsync... that are not called
+    // on sockets. Only files are saved, sockets are left to get_hook_info().
+    bool is_file(int fd) {
+        auto& hk = _hk[gSched->id()];
+        auto it = hk.find(fd);
+        if (it != hk.end()) return it->second.is_file();
+        if (!this->_Is_file(fd)) return false;
+
+        HookInfo hi;
+        hi.set_file();
+        hk[fd] = hi;
+        return true;
+    }
+
   private:
     std::vector<std::unordered_map<int, HookInfo>> _hk;
 
+    bool _Is_file(int fd) {
+        struct stat st;
+        return fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    }
+
     // return 0 if @fd is not valid, or it does not refer to a socket.
     // return -1 if timeout is not set for @fd, otherwise return a positive value.
     int _Get_timeout(int fd, char c) {
@@ -132,6 +175,127 @@ class Hook {
     }
 };
 
+// Blocking I/O on regular files can't be done with epoll. It is done in helper
+// threads, while the coroutine is suspended, and the scheduler goes on running
+// other coroutines. The helper thread wakes up the coroutine when the I/O is done.
+class FileIo {
+  public:
+    FileIo() : _nthreads(0), _nidle(0), _noff(0) {
+        pthread_cond_init(&_cond, 0);
+    }
+
+    ~FileIo() {
+        pthread_cond_destroy(&_cond);
+    }
+
+    // whether I/O on the regular file @fd should be done in the helper threads
+    bool offloadable(int fd) {
+        if (atomic_get(&_noff) > 0) {
+            ::MutexGuard g(_mtx);
+            if (_off.find(fd) != _off.end()) return false;
+        }
+        return true;
+    }
+
+    void set_offload(int fd, bool on) {
+        ::MutexGuard g(_mtx);
+        if (on) {
+            _off.erase(fd);
+        } else {
+            _off.insert(fd);
+        }
+        atomic_swap(&_noff, (uint32)_off.size());
+    }
+
+    void on_close(int fd) {
+        if (atomic_get(&_noff) > 0) this->set_offload(fd, true);
+    }
+
+    // run @f in a helper thread. MUST be called in coroutine.
+    // The coroutine is suspended until @f is done, errno is set if @f fails.
+    ssize_t run(std::function<ssize_t()>&& f);
+
+  private:
+    struct Task {
+        Task(std::function<ssize_t()>&& f, Coroutine* co)
+            : f(std::move(f)), co(co), r(-1), err(0) {
+        }
+        std::function<ssize_t()> f;
+        Coroutine* co;
+        ssize_t r;
+        int err;
+    };
+
+    void loop();
+
+  private:
+    ::Mutex _mtx;
+    pthread_cond_t _cond;         // signaled for each task, wakes one thread
+    std::deque<Task*> _tasks;
+    std::unordered_set<int> _off; // fds with offloading disabled
+    uint32 _nthreads;             // helper threads running
+    uint32 _nidle;                // helper threads waiting for tasks
+    uint32 _noff;
+};
+
+ssize_t FileIo::run(std::function<ssize_t()>&& f) {
+    // Task may be written by the helper thread after the coroutine is suspended,
+    // it can't be on the stack shared by coroutines.
+    Coroutine* co = gSched->running();
+    if (co->s != gSched) co->s = gSched;
+    std::unique_ptr<Task> t(new Task(std::move(f), co));
+
+    do {
+        ::MutexGuard g(_mtx);
+        _tasks.push_back(t.get());
+
+        // threads are started on demand, up to FLG_co_file_io_threads
+        const uint32 max = FLG_co_file_io_threads > 0 ? FLG_co_file_io_threads : 1;
+        if (_tasks.size() > _nidle && _nthreads < max) {
+            ++_nthreads;
+            Thread(&FileIo::loop, this).detach();
+        }
+        if (_nidle > 0) pthread_cond_signal(&_cond);
+    } while (0);
+
+    gSched->yield();
+
+    if (t->r == -1) errno = t->err;
+    return t->r;
+}
+
+// A helper thread exits if no task comes in 30 seconds, so threads are not
+// left behind when files are not used any more.
+void FileIo::loop() {
+    ::MutexGuard g(_mtx);
+    while (true) {
+        while (_tasks.empty()) {
+            struct timeval now;
+            gettimeofday(&now, 0);
+            struct timespec ts = { now.tv_sec + 30, now.tv_usec * 1000 };
+
+            ++_nidle;
+            const int r = pthread_cond_timedwait(&_cond, _mtx.mutex(), &ts);
+            --_nidle;
+            if (r == ETIMEDOUT && _tasks.empty()) {
+                --_nthreads;
+                return;
+            }
+        }
+
+        Task* t = _tasks.front();
+        _tasks.pop_front();
+        g.unlock();
+
+        do {
+            t->r = t->f();
+        } while (t->r == -1 && errno == EINTR);
+        if (t->r == -1) t->err = errno;
+        t->co->s->add_ready_task(t->co);
+        g.lock();
+    }
+}
+
 } // co
 
 inline co::Hook& gHook() {
@@ -139,11 +303,60 @@ inline co::Hook& gHook() {
     return hook;
 }
 
+inline co::FileIo& gFileIo() {
+    static co::FileIo* io = new co::FileIo();
+    return *io;
+}
+
+namespace co {
+void set_file_io_offload(int fd, bool on) {
+    gFileIo().set_offload(fd, on);
+}
+} // co
+
 using co::gSched;
 using co::EV_read;
 using co::EV_write;
 using co::IoEvent;
 
+// The buffer on the stack shared by coroutines can't be touched by the helper 
+// threads, a temporary buffer is used instead.
+static ssize_t file_read(int fd, void* buf, size_t n, off_t off, bool pos) {
+    char* p = (char*) buf;
+    if (gSched->on_stack(buf)) p = (char*) malloc(n);
+
+    ssize_t r = gFileIo().run([fd, p, n, off, pos]() {
+        return pos ? fp_pread(fd, p, n, off) : fp_read(fd, p, n);
+    });
+
+    if (p != buf) {
+        if (r > 0) memcpy(buf, p, r);
+        int err = errno;
+        free(p);
+        errno = err;
+    }
+    return r;
+}
+
+static ssize_t file_write(int fd, const void* buf, size_t n, off_t off, bool pos) {
+    const char* p = (const char*) buf;
+    if (gSched->on_stack((void*)buf)) {
+        p = (const char*) malloc(n);
+        memcpy((void*)p, buf, n);
+    }
+
+    ssize_t r = gFileIo().run([fd, p, n, off, pos]() {
+        return pos ? fp_pwrite(fd, p, n, off) : fp_write(fd, p, n);
+    });
+
+    if (p != buf) {
+        int err = errno;
+        free((void*)p);
+        errno = err;
+    }
+    return r;
+}
+
 inline struct hostent* gHostEnt() {
     static std::vector<struct hostent> ents(co::max_sched_num());
     return &ents[gSched->id()];
@@ -181,6 +394,10 @@ send_fp_t fp_send = 0;
 sendto_fp_t fp_sendto = 0;
 sendmsg_fp_t fp_sendmsg = 0;
 
+pread_fp_t fp_pread = 0;
+pwrite_fp_t fp_pwrite = 0;
+fsync_fp_t fp_fsync = 0;
+
 poll_fp_t fp_poll = 0;
 select_fp_t fp_select = 0;
 
@@ -198,6 +415,7 @@ gethostbyname2_fp_t fp_gethostbyname2 = 0;
 gethostbyname_r_fp_t fp_gethostbyname_r = 0;
 gethostbyname2_r_fp_t fp_gethostbyname2_r = 0;
 gethostbyaddr_r_fp_t fp_gethostbyaddr_r = 0;
+fdatasync_fp_t fp_fdatasync = 0;
 #else
 kevent_fp_t fp_kevent = 0;
 #endif
@@ -278,6 +496,12 @@ int close(int fd) {
     init_hook(close);
     if (!gSched) return fp_close(fd);
 
+    gFileIo().on_close(fd);
+  #ifdef __linux__
+    // the fd may be closed here without co::close(), e.g. a blocking socket,
+    // its zero-copy state must not be left to a new fd of the same number.
+    gSched->zerocopy().on_close(fd);
+  #endif
     auto hi = gHook().on_close(fd);
     if (!hi.hookable()) return fp_close(fd);
     return co::close(fd);
@@ -292,7 +516,12 @@ ssize_t read(int fd, void* buf, size_t count) {
     if (!gSched) return fp_read(fd, buf, count);
 
     auto hi = gHook().get_hook_info(fd);
-    if (!hi.hookable()) return fp_read(fd, buf, count);
+    if (!hi.hookable()) {
+        if (hi.is_file() && gFileIo().offloadable(fd)) {
+            return file_read(fd, buf, count, 0, false);
+        }
+        return fp_read(fd, buf, count);
+    }
 
     IoEvent ev(fd, EV_read);
     do_hook(fp_read(fd, buf, count), ev, hi.recv_timeout());
@@ -347,7 +576,12 @@ ssize_t write(int fd, const void* buf, size_t count) {
     if (!gSched) return fp_write(fd, buf, count);
 
     auto hi = gHook().get_hook_info(fd);
-    if (!hi.hookable()) return fp_write(fd, buf, count);
+    if (!hi.hookable()) {
+        if (hi.is_file() && gFileIo().offloadable(fd)) {
+            return file_write(fd, buf, count, 0, false);
+        }
+        return fp_write(fd, buf, count);
+    }
 
     IoEvent ev(fd, EV_write);
     do_hook(fp_write(fd, buf, count), ev, hi.send_timeout());
@@ -397,6 +631,30 @@ ssize_t sendmsg(int fd, const struct msghdr* msg, int flags) {
     do_hook(fp_sendmsg(fd, msg, flags), ev, hi.send_timeout());
 }
 
+ssize_t pread(int fd, void* buf, size_t count, off_t offset) {
+    init_hook(pread);
+    if (!gSched || !FLG_co_hook_file_io || !gHook().is_file(fd) || !gFileIo().offloadable(fd)) {
+        return fp_pread(fd, buf, count, offset);
+    }
+    return file_read(fd, buf, count, offset, true);
+}
+
+ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset) {
+    init_hook(pwrite);
+    if (!gSched || !FLG_co_hook_file_io || !gHook().is_file(fd) || !gFileIo().offloadable(fd)) {
+        return fp_pwrite(fd, buf, count, offset);
+    }
+    return file_write(fd, buf, count, offset, true);
+}
+
+int fsync(int fd) {
+    init_hook(fsync);
+    if (!gSched || !FLG_co_hook_file_io || !gHook().is_file(fd) || !gFileIo().offloadable(fd)) {
+        return fp_fsync(fd);
+    }
+    return (int) gFileIo().run([fd]() { return (ssize_t) fp_fsync(fd); });
+}
+
 int poll(struct pollfd* fds, nfds_t nfds, int ms) {
     init_hook(poll);
     if (!gSched || ms == 0) return fp_poll(fds, nfds, ms);
@@ -496,6 +754,14 @@ int epoll_wait(int epfd, struct epoll_event* events, int n, int ms) {
     return fp_epoll_wait(epfd, events, n, 0);
 }
 
+int fdatasync(int fd) {
+    init_hook(fdatasync);
+    if (!gSched || !FLG_co_hook_file_io || !gHook().is_file(fd) || !gFileIo().offloadable(fd)) {
+        return fp_fdatasync(fd);
+    }
+    return (int) gFileIo().run([fd]() { return (ssize_t) fp_fdatasync(fd); });
+}
+
 int accept4(int fd, struct sockaddr* addr, socklen_t* addrlen, int flags) {
     init_hook(accept4);
     if (!gSched) return fp_accept4(fd, addr, addrlen, flags);
@@ -682,6 +948,9 @@ bool init_hooks() {
     init_hook(send);
     init_hook(sendto);
     init_hook(sendmsg);
+    init_hook(pread);
+    init_hook(pwrite);
+    init_hook(fsync);
     init_hook(poll);
     init_hook(select);
     init_hook(sleep);
@@ -697,6 +966,7 @@ bool init_hooks() {
     init_hook(gethostbyname_r);
     init_hook(gethostbyname2_r);
     init_hook(gethostbyaddr_r);
+    init_hook(fdatasync);
   #else
     init_hook(kevent);
   #endif
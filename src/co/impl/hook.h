@@ -35,6 +35,13 @@ typedef ssize_t (*send_fp_t)(int, const void*, size_t, int);
 typedef ssize_t (*sendto_fp_t)(int, const void*, size_t, int, const struct sockaddr*, socklen_t);
 typedef ssize_t (*sendmsg_fp_t)(int, const struct msghdr*, int);
 
+typedef ssize_t (*pread_fp_t)(int, void*, size_t, off_t);
+typedef ssize_t (*pwrite_fp_t)(int, const void*, size_t, off_t);
+typedef int (*fsync_fp_t)(int);
+#ifdef __linux__
+typedef int (*fdatasync_fp_t)(int);
+#endif
+
 typedef int (*poll_fp_t)(struct pollfd*, nfds_t, int);
 typedef int (*select_fp_t)(int, fd_set*, fd_set*, fd_set*, struct timeval*);
 
@@ -75,6 +82,13 @@ extern send_fp_t fp_send;
 extern sendto_fp_t fp_sendto;
 extern sendmsg_fp_t fp_sendmsg;
 
+extern pread_fp_t fp_pread;
+extern pwrite_fp_t fp_pwrite;
+extern fsync_fp_t fp_fsync;
+#ifdef __linux__
+extern fdatasync_fp_t fp_fdatasync;
+#endif
+
 extern poll_fp_t fp_poll;
 extern select_fp_t fp_select;
 
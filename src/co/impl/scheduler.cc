@@ -1,8 +1,26 @@
 #include "scheduler.h"
 #include "co/os.h"
 
+#ifdef __linux__
+#include "hook.h"
+#include <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+#endif
+
 DEF_uint32(co_sched_num, os::cpunum(), "#1 number of coroutine schedulers, default: cpu num");
 DEF_uint32(co_stack_size, 1024 * 1024, "#1 size of the stack shared by coroutines, default: 1M");
+DEF_uint32(co_busy_poll_us, 0, "#1 schedulers poll without blocking for n us before sleeping in epoll_wait, 0 for disabled");
 
 namespace co {
 
@@ -11,7 +29,9 @@ __thread Scheduler* gSched = 0;
 
 Scheduler::Scheduler(uint32 id, uint32 stack_size)
     : _id(id), _stack_size(stack_size), _stack(0), _stack_top(0), _running(0), 
-      _wait_ms(-1), _co_pool(), _stop(false), _timeout(false) {
+      _wait_ms(-1), _busy_poll_us(FLG_co_busy_poll_us), _co_pool(),
+      _stop(false), _timeout(false) {
+    memset(&_bp, 0, sizeof(_bp));
     _main_co = _co_pool.pop();
 }
 
@@ -80,7 +100,7 @@ void Scheduler::loop() {
     std::unordered_map<Coroutine*, timer_id_t> ready_timer_tasks;
 
     while (!_stop) {
-        int n = _epoll.wait(_wait_ms);
+        int n = (_busy_poll_us == 0 || _wait_ms == 0) ? _epoll.wait(_wait_ms) : this->busy_wait();
         if (_stop) break;
 
         if (unlikely(n == -1)) {
@@ -157,6 +177,27 @@ void Scheduler::loop() {
             }
         } while (0);
 
+      #ifdef __linux__
+        do {
+            uint32 ms = _zc.reap();
+            if (_wait_ms > ms) _wait_ms = ms;
+        } while (0);
+      #endif
+
+        if (!_flush.empty()) {
+            // the rest of data on connections whose send buffer is full is
+            // sent by a new coroutine, which waits for the socket to be
+            // writable, instead of polling it in each loop.
+            for (size_t i = 0; i < _flush.size(); ++i) {
+                WriteBuffer* w = _flush[i];
+                if (!w->flush_now()) {
+                    w->draining = true;
+                    this->resume(this->new_coroutine(new_callback(&WriteBuffer::drain, w)));
+                }
+            }
+            _flush.clear();
+        }
+
         if (_running) _running = NULL;
     }
 
@@ -164,6 +205,35 @@ void Scheduler::loop() {
     _ev.signal();
 }
 
+int Scheduler::busy_wait() {
+    const int64 beg = now::us();
+    int64 end = beg + _busy_poll_us, t = beg;
+    if (_wait_ms != (uint32)-1 && end > beg + _wait_ms * 1000LL) end = beg + _wait_ms * 1000LL;
+
+    // new tasks from other threads also wake up epoll by the pipe
+    int n;
+    uint64 spins = 0;
+    do {
+        n = _epoll.wait(0);
+        ++spins;
+        t = now::us();
+        if (n != 0) break;
+    } while (t < end && !_stop);
+
+    atomic_set(&_bp.spins, _bp.spins + spins);
+    atomic_set(&_bp.spin_us, _bp.spin_us + (t - beg));
+    if (n != 0) {
+        atomic_set(&_bp.hits, _bp.hits + 1);
+    } else {
+        atomic_set(&_bp.sleeps, _bp.sleeps + 1);
+    }
+
+    if (n != 0 || _stop) return n;
+    if (_wait_ms == (uint32)-1) return _epoll.wait(-1);
+    int64 ms = _wait_ms - (t - beg) / 1000;
+    return _epoll.wait(ms > 0 ? (int) ms : 0);
+}
+
 uint32 TimerManager::check_timeout(std::vector<Coroutine*>& res) {
     if (_timer.empty()) return -1;
 
@@ -186,6 +256,103 @@ uint32 TimerManager::check_timeout(std::vector<Coroutine*>& res) {
     return (int) (_timer.begin()->first - now_ms);
 }
 
+#ifdef __linux__
+bool ZeroCopy::enable(sock_t fd) {
+    auto it = _socks.find(fd);
+    if (it != _socks.end()) return it->second.state == 0;
+
+    int on = 1;
+    auto& s = _socks[fd];
+    if (::setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) != 0) {
+        DLOG << "enable SO_ZEROCOPY failed for fd " << fd << ": " << co::strerror();
+        s.state = -1;
+    }
+    return s.state == 0;
+}
+
+void ZeroCopy::reap(sock_t fd, Sock& s) {
+    char control[128];
+    struct msghdr msg;
+
+    while (!s.bufs.empty()) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        int r = (int) fp_recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        if (r == -1) {
+            if (errno == EINTR) continue;
+            return; // EAGAIN, no more notifications
+        }
+
+        for (auto c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (!((c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR) ||
+                  (c->cmsg_level == SOL_IPV6 && c->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+
+            auto e = (struct sock_extended_err*) CMSG_DATA(c);
+            if (e->ee_errno != 0 || e->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+
+            // the kernel had to copy the data, zero-copy makes no sense any more
+            if (e->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) s.state = 1;
+
+            // sends in range [ee_info, ee_data] are done
+            const uint32 lo = e->ee_info, n = e->ee_data - e->ee_info;
+            for (auto it = s.bufs.begin(); it != s.bufs.end();) {
+                if (it->first - lo <= n) {
+                    it = s.bufs.erase(it);
+                    --_npending;
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+}
+
+uint32 ZeroCopy::reap_all() {
+    if (_npending > 0) {
+        for (auto it = _socks.begin(); it != _socks.end(); ++it) {
+            if (!it->second.bufs.empty()) this->reap(it->first, it->second);
+        }
+    }
+
+    if (!_orphans.empty()) {
+        int64 now_ms = now::ms();
+        size_t k = 0;
+        for (size_t i = 0; i < _orphans.size(); ++i) {
+            if (_orphans[i].first > now_ms) {
+                if (k != i) _orphans[k] = std::move(_orphans[i]);
+                ++k;
+            }
+        }
+        _orphans.resize(k);
+    }
+
+    // poll the error queue frequently while the kernel is sending our buffers
+    if (_npending > 0) return 1;
+    return _orphans.empty() ? -1 : 1000;
+}
+
+void ZeroCopy::erase(sock_t fd) {
+    auto it = _socks.find(fd);
+    if (it == _socks.end()) return;
+
+    auto& s = it->second;
+    this->reap(fd, s);
+
+    // Notifications are gone with the socket, while the kernel may be still 
+    // sending data from the buffers. Hold them for a while.
+    if (!s.bufs.empty()) {
+        int64 expire = now::ms() + 10000;
+        for (auto& x : s.bufs) _orphans.push_back(std::make_pair(expire, std::move(x.second)));
+        _npending -= s.bufs.size();
+    }
+    _socks.erase(it);
+}
+#endif
+
 #ifdef _WIN32
 extern void wsa_startup();
 extern void wsa_cleanup();
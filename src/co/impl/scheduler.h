@@ -19,6 +19,7 @@
 #include <memory>
 #include <functional>
 #include <vector>
+#include <deque>
 #include <map>
 #include <unordered_map>
 
@@ -68,6 +69,29 @@ struct Coroutine {
     };
 };
 
+// Write buffer of a BufferedConn. It is allocated on heap, as the BufferedConn
+// may be on the shared stack of a suspended coroutine while the scheduler
+// flushes it.
+struct WriteBuffer {
+    sock_t fd;
+    char* p;
+    size_t n;      // size of data in the buffer
+    int ms;        // timeout for sending data left by flush_now()
+    int err;       // error of the last flush
+    bool queued;   // waiting in the scheduler for deferred flush
+    bool draining; // data left by flush_now() is being sent by drain()
+    bool orphan;   // the BufferedConn is destroyed, drain() deletes the buffer
+    co::Event ev;  // signaled when drain() is done
+
+    // send data in the buffer without blocking.
+    // return false if some data is left in the buffer.
+    bool flush_now();
+
+    // send data left by flush_now(), in a coroutine started by the scheduler,
+    // which waits for the socket to be writable.
+    void drain();
+};
+
 // pool of Coroutine, using index as the coroutine id.
 class Copool {
   public:
@@ -181,6 +205,62 @@ class TimerManager {
     std::multimap<int64, Coroutine*>::iterator _it; // make insert faster with this hint
 };
 
+#ifdef __linux__
+// Buffers sent with MSG_ZEROCOPY must be kept alive until the kernel is done
+// with them. Each successful send() with MSG_ZEROCOPY on a socket is assigned a
+// sequence number (0, 1, 2...), and the kernel reports a range of completed 
+// sequence numbers on the error queue of the socket. 
+// ZeroCopy must be used in the scheduler thread. We need no lock here.
+class ZeroCopy {
+  public:
+    ZeroCopy() : _npending(0) {}
+    ~ZeroCopy() = default;
+
+    // enable SO_ZEROCOPY on the first call for @fd. 
+    // return false if zero-copy is not supported, or the kernel copied the data
+    // anyway (loopback, or the device doesn't support scatter-gather). 
+    bool enable(sock_t fd);
+
+    // hold a reference to @buf for the last send() with MSG_ZEROCOPY on @fd
+    void add(sock_t fd, const std::shared_ptr<fastring>& buf) {
+        auto& s = _socks[fd];
+        s.bufs.push_back(std::make_pair(s.seq++, buf));
+        ++_npending;
+    }
+
+    // reap completion notifications on all sockets with pending buffers.
+    // return time(ms) to wait before the next reap, -1 if nothing is pending.
+    uint32 reap() {
+        return (_npending == 0 && _orphans.empty()) ? -1 : this->reap_all();
+    }
+
+    // called in co::close() and the hooked close(), buffers still in flight
+    // are held for a while. Sockets must be closed in the scheduler that sent
+    // data on them, or the state is left to the next fd of the same number.
+    void on_close(sock_t fd) {
+        if (!_socks.empty()) this->erase(fd);
+    }
+
+  private:
+    typedef std::pair<uint32, std::shared_ptr<fastring>> buf_t;
+    struct Sock {
+        Sock() : seq(0), state(0) {}
+        uint32 seq;  // sequence number of the next send
+        int state;   // 0: enabled, 1: the kernel copied the data, -1: not supported
+        std::deque<buf_t> bufs;
+    };
+
+    uint32 reap_all();
+    void reap(sock_t fd, Sock& s);
+    void erase(sock_t fd);
+
+  private:
+    std::unordered_map<sock_t, Sock> _socks;
+    std::vector<std::pair<int64, std::shared_ptr<fastring>>> _orphans; // <expire_ms, buf>
+    size_t _npending;
+};
+#endif
+
 class Scheduler {
   public:
     Scheduler(uint32 id, uint32 stack_size);
@@ -210,6 +290,19 @@ class Scheduler {
 
     bool timeout() const { return _timeout; }
 
+    void set_busy_poll(uint32 us) { _busy_poll_us = us; }
+
+    // the stats are written only by this scheduler, and read with atomic loads
+    BusyPollStats busy_poll_stats() const {
+        BusyPollStats* p = const_cast<BusyPollStats*>(&_bp);
+        BusyPollStats x;
+        x.spins = atomic_get(&p->spins);
+        x.hits = atomic_get(&p->hits);
+        x.sleeps = atomic_get(&p->sleeps);
+        x.spin_us = atomic_get(&p->spin_us);
+        return x;
+    }
+
     bool on_stack(void* p) const {
         return (_stack <= (char*)p) && ((char*)p < _stack + _stack_size);
     }
@@ -219,6 +312,23 @@ class Scheduler {
         _cbs.push_back(std::move(cb));
     }
 
+    // BufferedConn with deferred flush, its write buffer is sent at the end
+    // of loop(), before waiting for I/O events, and the rest of data that can
+    // not be sent at once is sent by a new coroutine.
+    void add_flush(WriteBuffer* c) {
+        _flush.push_back(c);
+    }
+
+    void del_flush(WriteBuffer* c) {
+        for (size_t i = 0; i < _flush.size(); ++i) {
+            if (_flush[i] == c) {
+                _flush[i] = _flush.back();
+                _flush.pop_back();
+                return;
+            }
+        }
+    }
+
     // =========================================================================
     // add task ready to resume
     // =========================================================================
@@ -274,6 +384,10 @@ class Scheduler {
         _timer_mgr.del_timer(id);
     }
 
+  #ifdef __linux__
+    ZeroCopy& zerocopy() { return _zc; }
+  #endif
+
   #if defined(_WIN32)
     void on_timeout(sock_t fd, PerIoInfo* p) {
         _epoll.on_timeout(fd, p);
@@ -301,6 +415,9 @@ class Scheduler {
     }
 
   private:
+    // poll without blocking for at most _busy_poll_us, then wait in epoll
+    int busy_wait();
+
     void save_stack(Coroutine* co) {
         co->stack.clear();
         co->stack.append(co->ctx, _stack_top - (char*)co->ctx);
@@ -326,11 +443,17 @@ class Scheduler {
     Coroutine* _running; // the current running coroutine
     Epoll _epoll;
     uint32 _wait_ms;     // time epoll to wait
+    uint32 _busy_poll_us;
+    BusyPollStats _bp;
 
     Copool _co_pool;
     TaskManager _task_mgr;
     TimerManager _timer_mgr;
     std::vector<std::function<void()>> _cbs;
+    std::vector<WriteBuffer*> _flush;
+  #ifdef __linux__
+    ZeroCopy _zc;
+  #endif
 
     SyncEvent _ev;
     bool _stop;
@@ -349,6 +472,13 @@ class SchedManager {
         return _scheds[now::us() % _scheds.size()];
     }
 
+    size_t size() const { return _scheds.size(); }
+
+    Scheduler* at(int id) const {
+        CHECK(0 <= id && id < (int)_scheds.size()) << "invalid scheduler id: " << id;
+        return _scheds[id];
+    }
+
     // stop all schedulers
     void stop();
 
@@ -3,15 +3,45 @@
 #include "scheduler.h"
 #include "io_event.h"
 #include "hook.h"
+#include <limits.h>
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#else
+#include <sys/uio.h> // sendfile on mac
+#endif
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
 DEF_int32(co_max_recv_size, 1024 * 1024, "#1 max size for a single recv");
 DEF_int32(co_max_send_size, 1024 * 1024, "#1 max size for a single send");
+DEF_int32(co_so_busy_poll, 0, "#1 set SO_BUSY_POLL to n us for sockets created by co, linux only, 0 for disabled");
+DEF_int32(co_zerocopy_size, 0, "#1 send with MSG_ZEROCOPY in co::send_zerocopy() if size of the data >= this value, 0 for disabled");
 
 namespace co {
 
+#ifdef __linux__
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+// the kernel busy polls the device queue for n us when there is no data to
+// read, it may need CAP_NET_ADMIN.
+static inline void set_so_busy_poll(sock_t fd) {
+    int v = FLG_co_so_busy_poll;
+    if (v > 0) ::setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &v, sizeof(v));
+}
+#else
+static inline void set_so_busy_poll(sock_t) {}
+#endif
+
 #ifdef SOCK_NONBLOCK
 sock_t socket(int domain, int type, int protocol) {
-    return ::socket(domain, type | SOCK_NONBLOCK | SOCK_CLOEXEC, protocol);
+    sock_t fd = ::socket(domain, type | SOCK_NONBLOCK | SOCK_CLOEXEC, protocol);
+    if (fd != -1) set_so_busy_poll(fd);
+    return fd;
 }
 
 #else
@@ -20,6 +50,7 @@ sock_t socket(int domain, int type, int protocol) {
     if (fd != -1) {
         co::set_nonblock(fd);
         co::set_cloexec(fd);
+        set_so_busy_poll(fd);
     }
     return fd;
 }
@@ -28,6 +59,9 @@ sock_t socket(int domain, int type, int protocol) {
 int close(sock_t fd, int ms) {
     CHECK(gSched) << "must be called in coroutine..";
     gSched->del_event(fd);
+  #ifdef __linux__
+    gSched->zerocopy().on_close(fd);
+  #endif
     if (ms > 0) gSched->sleep(ms);
     int r;
     while ((r = fp_close(fd)) != 0 && errno == EINTR);
@@ -63,7 +97,10 @@ sock_t accept(sock_t fd, void* addr, int* addrlen) {
     do {
       #ifdef SOCK_NONBLOCK
         sock_t connfd = fp_accept4(fd, (sockaddr*)addr, (socklen_t*)addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
-        if (connfd != -1) return connfd;
+        if (connfd != -1) {
+            set_so_busy_poll(connfd);
+            return connfd;
+        }
       #else
         sock_t connfd = fp_accept(fd, (sockaddr*)addr, (socklen_t*)addrlen);
         if (connfd != -1) {
@@ -212,6 +249,46 @@ int send(sock_t fd, const void* buf, int n, int ms) {
     return r != remain ? r : n;
 }
 
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+int send_zerocopy(sock_t fd, const std::shared_ptr<fastring>& buf, int ms) {
+    CHECK(gSched) << "must be called in coroutine..";
+    const int n = (int) buf->size();
+  #ifdef __linux__
+    if (FLG_co_zerocopy_size <= 0 || n < FLG_co_zerocopy_size) return co::send(fd, buf->data(), n, ms);
+    auto& zc = gSched->zerocopy();
+    if (!zc.enable(fd)) return co::send(fd, buf->data(), n, ms);
+
+    const char* s = buf->data();
+    int remain = n;
+    int flags = MSG_ZEROCOPY;
+    IoEvent ev(fd, EV_write);
+
+    do {
+        int r = (int) fp_send(fd, s, remain, flags);
+        if (r > 0 && flags) zc.add(fd, buf);
+        if (r == remain) return n;
+
+        if (r == -1) {
+            if (errno == EWOULDBLOCK || errno == EAGAIN) {
+                if (!ev.wait(ms)) return -1;
+            } else if (errno == ENOBUFS && flags) {
+                flags = 0; // too many pages pinned (optmem_max), copy the rest
+            } else if (errno != EINTR) {
+                return -1;
+            }
+        } else {
+            remain -= r;
+            s += r;
+        }
+    } while (true);
+  #else
+    return co::send(fd, buf->data(), n, ms);
+  #endif
+}
+
 int sendto(sock_t fd, const void* buf, int n, const void* addr, int addrlen, int ms) {
     CHECK(gSched) << "must be called in coroutine..";
     IoEvent ev(fd, EV_write);
@@ -228,6 +305,332 @@ int sendto(sock_t fd, const void* buf, int n, const void* addr, int addrlen, int
     } while (true);
 }
 
+// Copy the iovec array, as it will be modified when partial read/write occurs.
+class IoVec {
+  public:
+    IoVec(const struct iovec* iov, int n)
+        : _p(n <= 16 ? 0 : (struct iovec*) malloc(sizeof(struct iovec) * n)),
+          _v(_p ? _p : _s), _n(n) {
+        memcpy(_v, iov, sizeof(struct iovec) * n);
+        this->skip(0);
+    }
+
+    ~IoVec() {
+        if (_p) free(_p);
+    }
+
+    struct iovec* data() const { return _v; }
+
+    // max number of iovecs for a single readv/writev
+    int size() const { return _n < IOV_MAX ? _n : IOV_MAX; }
+
+    bool empty() const { return _n == 0; }
+
+    // skip @n bytes that have been transfered
+    void skip(size_t n) {
+        while (_n > 0 && n >= _v->iov_len) {
+            n -= _v->iov_len;
+            ++_v; --_n;
+        }
+
+        if (n > 0) {
+            _v->iov_base = (char*)_v->iov_base + n;
+            _v->iov_len -= n;
+        }
+    }
+
+  private:
+    struct iovec _s[16];
+    struct iovec* _p; // malloced if there are more than 16 iovecs
+    struct iovec* _v; // the first iovec not done
+    int _n;           // number of iovecs not done
+
+    DISALLOW_COPY_AND_ASSIGN(IoVec);
+};
+
+int readv(sock_t fd, const struct iovec* iov, int n, int ms) {
+    CHECK(gSched) << "must be called in coroutine..";
+    size_t total = 0;
+    for (int i = 0; i < n; ++i) total += iov[i].iov_len;
+    if (total == 0) return 0;
+    if (total > (size_t) INT_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    IoVec v(iov, n);
+    IoEvent ev(fd, EV_read);
+
+    do {
+        ssize_t r = fp_readv(fd, v.data(), v.size());
+        if (r == 0) return 0;
+
+        if (r == -1) {
+            if (errno == EWOULDBLOCK || errno == EAGAIN) {
+                if (!ev.wait(ms)) return -1;
+            } else if (errno != EINTR) {
+                return -1;
+            }
+        } else {
+            v.skip((size_t) r);
+            if (v.empty()) return (int) total;
+        }
+    } while (true);
+}
+
+int writev(sock_t fd, const struct iovec* iov, int n, int ms) {
+    CHECK(gSched) << "must be called in coroutine..";
+    size_t total = 0;
+    for (int i = 0; i < n; ++i) total += iov[i].iov_len;
+    if (total == 0) return 0;
+    if (total > (size_t) INT_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    IoVec v(iov, n);
+    IoEvent ev(fd, EV_write);
+
+    do {
+        ssize_t r = fp_writev(fd, v.data(), v.size());
+
+        if (r == -1) {
+            if (errno == EWOULDBLOCK || errno == EAGAIN) {
+                if (!ev.wait(ms)) return -1;
+            } else if (errno != EINTR) {
+                return -1;
+            }
+        } else {
+            v.skip((size_t) r);
+            if (v.empty()) return (int) total;
+        }
+    } while (true);
+}
+
+int64 sendfile(sock_t fd, int file_fd, int64 offset, int64 len, int ms) {
+    CHECK(gSched) << "must be called in coroutine..";
+    int64 remain = len;
+    IoEvent ev(fd, EV_write);
+
+    while (remain > 0) {
+        // at most 0x7ffff000 bytes can be transfered on linux
+        size_t n = (size_t) (remain < (1 << 30) ? remain : (1 << 30));
+      #ifdef __linux__
+        off_t off = (off_t) offset;
+        ssize_t r = ::sendfile(fd, file_fd, &off, n);
+        if (r == 0) break; // end of file
+      #else
+        off_t x = (off_t) n;
+        ssize_t r = ::sendfile(file_fd, fd, (off_t) offset, &x, 0, 0);
+        if (r == 0 && x == 0) break; // end of file
+        if (x > 0) r = x;            // bytes may be sent even if -1 was returned
+      #endif
+
+        if (r > 0) {
+            offset += r;
+            remain -= r;
+        } else if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            if (!ev.wait(ms)) return -1;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    }
+
+    return len - remain;
+}
+
+#ifdef __linux__
+int recvmmsg(sock_t fd, struct mmsghdr* msgs, int n, int ms) {
+    CHECK(gSched) << "must be called in coroutine..";
+    IoEvent ev(fd, EV_read);
+
+    do {
+        int r = ::recvmmsg(fd, msgs, n, 0, 0);
+        if (r != -1) return r;
+
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            if (!ev.wait(ms)) return -1;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    } while (true);
+}
+
+int sendmmsg(sock_t fd, struct mmsghdr* msgs, int n, int ms) {
+    CHECK(gSched) << "must be called in coroutine..";
+    int sent = 0;
+    IoEvent ev(fd, EV_write);
+
+    do {
+        int r = ::sendmmsg(fd, msgs + sent, n - sent, 0);
+        if (r != -1) {
+            if ((sent += r) == n) return n;
+            continue;
+        }
+
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            if (!ev.wait(ms)) return sent > 0 ? sent : -1;
+        } else if (errno != EINTR) {
+            return sent > 0 ? sent : -1;
+        }
+    } while (true);
+}
+
+// A kernel pipe used by splice() to move data from @from to @to.
+class SplicePipe {
+  public:
+    SplicePipe(int from, int to)
+        : _from(from), _to(to), _n(0), _eof(false), _done(false), _ev(0) {
+        _fds[0] = _fds[1] = -1;
+    }
+
+    ~SplicePipe() {
+        if (_fds[0] != -1) fp_close(_fds[0]);
+        if (_fds[1] != -1) fp_close(_fds[1]);
+    }
+
+    bool open() {
+        return ::pipe2(_fds, O_NONBLOCK | O_CLOEXEC) == 0;
+    }
+
+    // move data until it would block, return bytes moved to @_to, or -1 on error.
+    // event to wait for is set in _ev when no more data can be moved.
+    int64 pump() {
+        int64 moved = 0;
+        _ev = 0;
+
+        while (!_done) {
+            bool progress = false;
+            if (!_eof && _n < kCap) {
+                ssize_t r = ::splice(_from, 0, _fds[1], 0, kCap - _n, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (r > 0) {
+                    _n += r;
+                    progress = true;
+                } else if (r == 0) {
+                    _eof = true;
+                    progress = true;
+                } else if (errno == EWOULDBLOCK || errno == EAGAIN) {
+                    _ev = EV_read;
+                } else if (errno != EINTR) {
+                    return -1;
+                }
+            }
+
+            if (_n > 0) {
+                ssize_t r = ::splice(_fds[0], 0, _to, 0, _n, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (r > 0) {
+                    _n -= r;
+                    moved += r;
+                    progress = true;
+                } else if (errno == EWOULDBLOCK || errno == EAGAIN) {
+                    _ev = EV_write;
+                } else if (r == 0 || errno != EINTR) {
+                    return -1;
+                }
+            }
+
+            if (_eof && _n == 0) {
+                fp_shutdown(_to, SHUT_WR); // half-close
+                _done = true;
+            }
+
+            if (!progress) break;
+        }
+
+        return moved;
+    }
+
+    int from() const { return _from; }
+    int to() const { return _to; }
+    bool done() const { return _done; }
+
+    // EV_read: wait for data on @_from,  EV_write: wait for @_to to be writable
+    int ev() const { return _done ? 0 : _ev; }
+
+  private:
+    static const size_t kCap = 64 * 1024; // default capacity of a pipe
+    int _from;
+    int _to;
+    int _fds[2];
+    size_t _n; // bytes in the pipe
+    bool _eof;
+    bool _done;
+    int _ev;
+};
+
+int64 splice(sock_t from, sock_t to, int idle_ms) {
+    CHECK(gSched) << "must be called in coroutine..";
+    SplicePipe p(from, to);
+    if (!p.open()) return -1;
+
+    int64 total = 0;
+    while (true) {
+        int64 r = p.pump();
+        if (r == -1) return -1;
+        total += r;
+        if (p.done()) return total;
+
+        if (p.ev() == EV_read) {
+            IoEvent ev(from, EV_read);
+            if (!ev.wait(idle_ms)) return -1;
+        } else {
+            IoEvent ev(to, EV_write);
+            if (!ev.wait(idle_ms)) return -1;
+        }
+    }
+}
+
+// Events of both directions are added to a private epoll, and the coroutine
+// waits for the epoll fd to be readable, as a coroutine can only wait for
+// one fd in the scheduler.
+int64 relay(sock_t a, sock_t b, int idle_ms) {
+    CHECK(gSched) << "must be called in coroutine..";
+    SplicePipe x(a, b), y(b, a);
+    if (!x.open() || !y.open()) return -1;
+
+    int efd = epoll_create1(EPOLL_CLOEXEC);
+    if (efd == -1) return -1;
+
+    int64 total = 0, r = 0;
+    uint32 ea = 0, eb = 0; // events of a & b added to the epoll
+    epoll_event evs[2];
+
+    while (true) {
+        if ((r = x.pump()) == -1) break;
+        total += r;
+        if ((r = y.pump()) == -1) break;
+        total += r;
+        if (x.done() && y.done()) break;
+
+        // a: read for x, write for y;  b: read for y, write for x
+        uint32 na = (x.ev() == EV_read ? EPOLLIN : 0) | (y.ev() == EV_write ? EPOLLOUT : 0);
+        uint32 nb = (y.ev() == EV_read ? EPOLLIN : 0) | (x.ev() == EV_write ? EPOLLOUT : 0);
+
+        if (na != ea) {
+            epoll_event e; e.events = na; e.data.fd = a;
+            r = epoll_ctl(efd, ea ? (na ? EPOLL_CTL_MOD : EPOLL_CTL_DEL) : EPOLL_CTL_ADD, a, &e);
+            if (r != 0) break;
+            ea = na;
+        }
+
+        if (nb != eb) {
+            epoll_event e; e.events = nb; e.data.fd = b;
+            r = epoll_ctl(efd, eb ? (nb ? EPOLL_CTL_MOD : EPOLL_CTL_DEL) : EPOLL_CTL_ADD, b, &e);
+            if (r != 0) break;
+            eb = nb;
+        }
+
+        if (fp_epoll_wait(efd, evs, 2, 0) == 0) {
+            IoEvent ev(efd, EV_read);
+            if (!ev.wait(idle_ms)) { r = -1; break; }
+        }
+    }
+
+    fp_close(efd);
+    return r == -1 ? -1 : total;
+}
+#endif
+
 // a thread-safe wrapper for strerror()
 const char* strerror(int err) {
     static __thread std::unordered_map<int, const char*>* kErrStr = 0;
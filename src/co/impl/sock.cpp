@@ -3,9 +3,11 @@
 #include "scheduler.h"
 #include "io_event.h"
 #include <ws2spi.h>
+#include <limits.h>
 
 DEF_int32(co_max_recv_size, 1024 * 1024, "#1 max size for a single recv");
 DEF_int32(co_max_send_size, 1024 * 1024, "#1 max size for a single send");
+DEF_int32(co_zerocopy_size, 0, "#1 not used on windows, co::send_zerocopy() is the same as co::send()");
 
 namespace co {
 
@@ -357,6 +359,11 @@ int send(sock_t fd, const void* buf, int n, int ms) {
     return r != x ? r : n;
 }
 
+// IOCP sends from the user buffer already, no MSG_ZEROCOPY on windows.
+int send_zerocopy(sock_t fd, const std::shared_ptr<fastring>& buf, int ms) {
+    return co::send(fd, buf->data(), (int) buf->size(), ms);
+}
+
 int sendto(sock_t fd, const void* buf, int n, const void* addr, int addrlen, int ms) {
     CHECK(gSched) << "must be called in coroutine..";
     std::unique_ptr<PerIoInfo> info;
@@ -387,6 +394,54 @@ int sendto(sock_t fd, const void* buf, int n, const void* addr, int addrlen, int
     } while (0);
 }
 
+// There is no readv/writev for overlapped sockets, the buffers are received
+// or sent one by one here, without being copied into a temporary one.
+static inline int iov_size(const struct iovec* iov, int n) {
+    size_t total = 0;
+    for (int i = 0; i < n; ++i) total += iov[i].iov_len;
+    if (total > (size_t) INT_MAX) {
+        WSASetLastError(WSAEINVAL);
+        return -1;
+    }
+    return (int) total;
+}
+
+// time left before @end for calls on each buffer, at least 1 ms, so the call
+// times out by itself when no time is left.
+static inline int left_ms(int64 end, int ms) {
+    if (ms < 0) return -1;
+    const int64 t = end - now::ms();
+    return t > 0 ? (int) t : 1;
+}
+
+int readv(sock_t fd, const struct iovec* iov, int n, int ms) {
+    CHECK(gSched) << "must be called in coroutine..";
+    const int total = iov_size(iov, n);
+    if (total <= 0) return total;
+
+    const int64 end = ms < 0 ? 0 : now::ms() + ms;
+    for (int i = 0; i < n; ++i) {
+        if (iov[i].iov_len == 0) continue;
+        int r = co::recvn(fd, iov[i].iov_base, (int) iov[i].iov_len, left_ms(end, ms));
+        if (r <= 0) return r;
+    }
+    return total;
+}
+
+int writev(sock_t fd, const struct iovec* iov, int n, int ms) {
+    CHECK(gSched) << "must be called in coroutine..";
+    const int total = iov_size(iov, n);
+    if (total <= 0) return total;
+
+    const int64 end = ms < 0 ? 0 : now::ms() + ms;
+    for (int i = 0; i < n; ++i) {
+        if (iov[i].iov_len == 0) continue;
+        int r = co::send(fd, iov[i].iov_base, (int) iov[i].iov_len, left_ms(end, ms));
+        if (r == -1) return -1;
+    }
+    return total;
+}
+
 const char* strerror(int err) {
     static __thread std::unordered_map<int, const char*>* kErrStr = 0;
     if (!kErrStr) kErrStr = new std::unordered_map<int, const char*>();
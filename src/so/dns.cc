@@ -0,0 +1,709 @@
+#include "co/so/dns.h"
+#include "co/co.h"
+#include "co/flag.h"
+#include "co/log.h"
+#include "co/fastream.h"
+#include "co/str.h"
+#include "co/fs.h"
+#include "co/thread.h"
+#include "co/time.h"
+#include "co/atomic.h"
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <random>
+#include <unordered_map>
+
+DEF_string(dns_servers, "", "#2 dns servers separated by comma, e.g. 8.8.8.8,[::1]:53, use nameservers in resolv.conf if empty");
+#ifdef _WIN32
+DEF_string(dns_hosts, "C:/Windows/System32/drivers/etc/hosts", "#2 path of the hosts file");
+DEF_string(dns_resolv_conf, "", "#2 path of resolv.conf");
+#else
+DEF_string(dns_hosts, "/etc/hosts", "#2 path of the hosts file");
+DEF_string(dns_resolv_conf, "/etc/resolv.conf", "#2 path of resolv.conf");
+#endif
+DEF_int32(dns_timeout, 1000, "#2 timeout in ms for queries sent to a dns server");
+DEF_int32(dns_attempts, 2, "#2 times to try all the dns servers");
+DEF_int32(dns_max_ttl, 300, "#2 max seconds to cache a dns answer, 0 for no cache");
+DEF_bool(dns_system_fallback, true, "#2 resolve with getaddrinfo() names not found by the dns servers, for other sources in nsswitch.conf");
+
+namespace so {
+namespace dns {
+namespace xx {
+
+enum {
+    kTypeA = 1,
+    kTypeAAAA = 28,
+    kClassIN = 1,
+    kRcodeNxDomain = 3,
+    kTruncated = -2,
+};
+
+struct Server {
+    fastring ip;
+    int port;
+};
+
+// name servers, search domains and the hosts file, loaded on the first
+// resolution
+class Config {
+  public:
+    Config() : _ndots(1), _loaded(false) {}
+    ~Config() = default;
+
+    void load() {
+        ::MutexGuard g(_mtx);
+        if (_loaded) return;
+        this->load_servers();
+        this->load_hosts();
+        _loaded = true;
+    }
+
+    const std::vector<Server>& servers() const { return _servers; }
+
+    // names to query for @name, with the search domains like the resolver of
+    // glibc: @name is tried first if it has at least ndots dots, or last.
+    std::vector<fastring> names(const fastring& name) const {
+        std::vector<fastring> v;
+        if (name.ends_with('.') || _search.empty()) {
+            v.push_back(name);
+            return v;
+        }
+
+        int dots = 0;
+        for (size_t i = 0; i < name.size(); ++i) dots += name[i] == '.';
+        if (dots >= _ndots) v.push_back(name);
+        for (size_t i = 0; i < _search.size(); ++i) {
+            v.push_back(name + "." + _search[i]);
+        }
+        if (dots < _ndots) v.push_back(name);
+        return v;
+    }
+
+    const std::vector<fastring>* host(const fastring& name) const {
+        auto it = _hosts.find(name);
+        return it != _hosts.end() ? &it->second : NULL;
+    }
+
+  private:
+    void add_server(fastring s) {
+        Server x;
+        x.port = 53;
+        if (s.starts_with('[')) { // [ipv6]:port
+            size_t p = s.find(']');
+            if (p == s.npos) return;
+            if (p + 2 < s.size() && s[p + 1] == ':') x.port = atoi(s.c_str() + p + 2);
+            x.ip = s.substr(1, p - 1);
+        } else {
+            size_t p = s.find(':');
+            if (p != s.npos && s.find(':', p + 1) == s.npos) { // ipv4:port
+                x.port = atoi(s.c_str() + p + 1);
+                s.resize(p);
+            }
+            x.ip = s;
+        }
+        if (!x.ip.empty() && x.port > 0) _servers.push_back(x);
+    }
+
+    void load_servers() {
+        if (!FLG_dns_servers.empty()) {
+            auto v = str::split(FLG_dns_servers, ',');
+            for (size_t i = 0; i < v.size(); ++i) this->add_server(str::strip(v[i]));
+        }
+
+        if (FLG_dns_resolv_conf.empty()) return;
+        fs::file f;
+        if (!f.open(FLG_dns_resolv_conf.c_str(), 'r')) return;
+        auto lines = str::split(f.read(f.size()), '\n');
+        for (size_t i = 0; i < lines.size(); ++i) {
+            auto v = str::split(str::replace(str::strip(lines[i]), "\t", " "), ' ');
+            if (v.size() < 2) continue;
+            if (v[0] == "nameserver") {
+                if (FLG_dns_servers.empty()) this->add_server(v[1]);
+            } else if (v[0] == "search" || v[0] == "domain") {
+                // the last one wins
+                _search.clear();
+                for (size_t k = 1; k < v.size(); ++k) {
+                    fastring d = v[k].lower();
+                    while (d.ends_with('.')) d.resize(d.size() - 1);
+                    if (!d.empty()) _search.push_back(d);
+                }
+            } else if (v[0] == "options") {
+                // timeout and attempts are set by FLG_dns_timeout, FLG_dns_attempts
+                for (size_t k = 1; k < v.size(); ++k) {
+                    if (v[k].starts_with("ndots:")) {
+                        const int n = atoi(v[k].c_str() + 6);
+                        _ndots = n < 0 ? 0 : (n > 15 ? 15 : n);
+                    }
+                }
+            }
+        }
+        if (!FLG_dns_servers.empty()) return;
+
+      #ifndef _WIN32
+        // the resolver of glibc uses the local server by default
+        if (_servers.empty()) this->add_server("127.0.0.1");
+      #endif
+    }
+
+    void load_hosts() {
+        fs::file f;
+        if (FLG_dns_hosts.empty() || !f.open(FLG_dns_hosts.c_str(), 'r')) return;
+        auto lines = str::split(f.read(f.size()), '\n');
+        for (size_t i = 0; i < lines.size(); ++i) {
+            fastring s = lines[i];
+            size_t p = s.find('#');
+            if (p != s.npos) s.resize(p);
+
+            auto v = str::split(str::replace(str::strip(s), "\t", " "), ' ');
+            if (v.size() < 2) continue;
+            for (size_t k = 1; k < v.size(); ++k) {
+                if (!v[k].empty()) _hosts[v[k].lower()].push_back(v[0]);
+            }
+        }
+    }
+
+  private:
+    ::Mutex _mtx;
+    std::vector<Server> _servers;
+    std::vector<fastring> _search; // search domains
+    int _ndots;
+    std::unordered_map<fastring, std::vector<fastring>> _hosts;
+    bool _loaded;
+};
+
+inline Config& config() {
+    static Config kConfig;
+    return kConfig;
+}
+
+// An answer in the cache. Other coroutines resolving the same name wait for
+// the coroutine doing the query, they are woken up in a new coroutine on their
+// schedulers, which runs after they are suspended, as co::Event wakes up only
+// coroutines already waiting.
+struct Answer {
+    Answer() : expire(0), done(false) {}
+    co::Event ev;
+    std::vector<fastring> ips;
+    std::vector<int> scheds; // schedulers of the coroutines waiting
+    int64 expire;            // time in ms when the answer expires
+    bool done;
+};
+
+class Cache {
+  public:
+    Cache() = default;
+    ~Cache() = default;
+
+    // return the answer for @name. @owner is set to true if the caller should
+    // do the query, or the caller waits for the query in progress, if the
+    // answer is not done.
+    std::shared_ptr<Answer> get(const fastring& name, bool* owner) {
+        ::MutexGuard g(_mtx);
+        auto& a = _map[name];
+        if (a && (!a->done || a->expire > now::ms())) {
+            *owner = false;
+            if (!a->done) {
+                const int id = co::sched_id();
+                auto& v = a->scheds;
+                if (std::find(v.begin(), v.end(), id) == v.end()) v.push_back(id);
+            }
+            return a;
+        }
+
+        a.reset(new Answer);
+        *owner = true;
+        return a;
+    }
+
+    // copy addresses of @a to @ips, return false if it is not done
+    bool result(const std::shared_ptr<Answer>& a, std::vector<fastring>* ips) {
+        ::MutexGuard g(_mtx);
+        if (!a->done) return false;
+        *ips = a->ips;
+        return true;
+    }
+
+    // the query is done, wake up the coroutines waiting for it
+    void done(const fastring& name, const std::shared_ptr<Answer>& a) {
+        std::vector<int> scheds;
+        do {
+            ::MutexGuard g(_mtx);
+            a->done = true;
+            a->scheds.swap(scheds);
+            if (a->ips.empty() || a->expire <= now::ms()) {
+                auto it = _map.find(name);
+                if (it != _map.end() && it->second == a) _map.erase(it);
+            }
+        } while (0);
+
+        for (size_t i = 0; i < scheds.size(); ++i) {
+            co::go_on(scheds[i], new_callback([a]() { a->ev.signal(); }));
+        }
+    }
+
+    void clear() {
+        ::MutexGuard g(_mtx);
+        _map.clear();
+    }
+
+  private:
+    ::Mutex _mtx;
+    std::unordered_map<fastring, std::shared_ptr<Answer>> _map;
+};
+
+inline Cache& cache() {
+    static Cache kCache;
+    return kCache;
+}
+
+inline void put16(fastream& fs, uint16 v) {
+    fs.append((char)(v >> 8)).append((char)(v & 0xff));
+}
+
+inline uint16 get16(const uint8* p) {
+    return (uint16)((p[0] << 8) | p[1]);
+}
+
+inline uint32 get32(const uint8* p) {
+    return ((uint32)get16(p) << 16) | get16(p + 2);
+}
+
+// build a query with recursion desired, return false if @name is invalid.
+bool build_query(fastream& fs, uint16 id, const fastring& name, uint16 type) {
+    put16(fs, id);
+    put16(fs, 0x0100); // RD
+    put16(fs, 1);      // QDCOUNT
+    put16(fs, 0);
+    put16(fs, 0);
+    put16(fs, 0);
+
+    const char* s = name.data();
+    const char* e = s + name.size();
+    if (e > s && *(e - 1) == '.') --e;
+    if (e == s || e - s > 253) return false;
+
+    while (s < e) {
+        const char* p = (const char*) memchr(s, '.', e - s);
+        if (p == NULL) p = e;
+        if (p == s || p - s > 63) return false;
+        fs.append((char)(p - s)).append(s, p - s);
+        s = p + 1;
+    }
+    fs.append('\0');
+
+    put16(fs, type);
+    put16(fs, kClassIN);
+    return true;
+}
+
+// skip a name, which may be compressed, return position after the name or -1.
+int skip_name(const uint8* p, int n, int pos) {
+    while (pos < n) {
+        uint8 len = p[pos];
+        if ((len & 0xc0) == 0xc0) return pos + 2 <= n ? pos + 2 : -1;
+        if (len == 0) return pos + 1;
+        pos += len + 1;
+    }
+    return -1;
+}
+
+// random query ids, that can't be guessed by others to forge answers
+inline uint32 random32() {
+    static __thread std::random_device* rd = 0;
+    if (!rd) rd = new std::random_device();
+    return (*rd)();
+}
+
+// parse a response to the query @q with the id @id and type @type.
+// return rcode of the response, kTruncated if the TC bit is set, or -1 if it
+// is not a valid response to the query.
+int parse_response(
+    const uint8* p, int n, const fastream& q, uint16 id, uint16 type,
+    std::vector<fastring>* ips, uint32* ttl
+) {
+    if (n < 12 || get16(p) != id || !(p[2] & 0x80)) return -1;
+    const int rcode = p[3] & 0x0f;
+    const int qd = get16(p + 4);
+    const int an = get16(p + 6);
+
+    // the question must be the same as the query, the case of the name may
+    // be changed by some servers.
+    const int qlen = (int) q.size() - 12;
+    if (qd != 1 || n < 12 + qlen) return -1;
+    for (int i = 0; i < qlen; ++i) {
+        const uint8 a = p[12 + i], b = (uint8) q.data()[12 + i];
+        if (a != b && !(a >= 'A' && a <= 'Z' && (a | 0x20) == b)) return -1;
+    }
+    if (p[2] & 0x02) return kTruncated;
+    int pos = 12 + qlen;
+
+    // records of other types (CNAME...) are skipped, servers with recursion
+    // give the final A or AAAA records in the answer section.
+    for (int i = 0; i < an; ++i) {
+        pos = skip_name(p, n, pos);
+        if (pos < 0 || pos + 10 > n) return -1;
+        const uint16 t = get16(p + pos);
+        const uint16 c = get16(p + pos + 2);
+        const uint32 x = get32(p + pos + 4);
+        const int len = get16(p + pos + 8);
+        pos += 10;
+        if (pos + len > n) return -1;
+
+        if (c == kClassIN && t == type && len == (t == kTypeA ? 4 : 16)) {
+            char s[INET6_ADDRSTRLEN] = { 0 };
+            inet_ntop(t == kTypeA ? AF_INET : AF_INET6, p + pos, s, sizeof(s));
+            ips->push_back(fastring(s));
+            if (x < *ttl) *ttl = x;
+        }
+        pos += len;
+    }
+
+    return rcode;
+}
+
+union Addr {
+    struct sockaddr_in  v4;
+    struct sockaddr_in6 v6;
+};
+
+// return length of the address, or 0 if @server is invalid
+int init_addr(const Server& server, Addr* addr) {
+    if (server.ip.find(':') == server.ip.npos) {
+        if (!co::init_ip_addr(&addr->v4, server.ip.c_str(), server.port)) return 0;
+        return (int) sizeof(addr->v4);
+    }
+    if (!co::init_ip_addr(&addr->v6, server.ip.c_str(), server.port)) return 0;
+    return (int) sizeof(addr->v6);
+}
+
+// time left before @deadline, at least 1 ms, as -1 is for no timeout
+inline int left_ms(int64 deadline) {
+    const int64 x = deadline - now::ms();
+    return x > 0 ? (int) x : 1;
+}
+
+// send the query @q over tcp, for answers truncated over udp.
+// return rcode of the response, or -1 on error.
+int query_tcp(
+    const Server& server, const fastream& q, uint16 id, uint16 type, int ms,
+    std::vector<fastring>* ips, uint32* ttl
+) {
+    Addr addr;
+    const int addrlen = init_addr(server, &addr);
+    if (addrlen == 0 || ms <= 0) return -1;
+
+    sock_t fd = co::tcp_socket(addrlen == sizeof(addr.v4) ? AF_INET : AF_INET6);
+    if (fd == (sock_t)-1) return -1;
+
+    int r = -1;
+    int n = 0;
+    uint8 len[2] = { (uint8)(q.size() >> 8), (uint8)(q.size() & 0xff) };
+    co::iovec iov[2] = {
+        { len, 2 },
+        { (void*) q.data(), q.size() },
+    };
+    std::unique_ptr<char[]> buf;
+    int64 deadline = now::ms() + ms;
+
+    // the response has a length of 2 bytes before it
+    if (co::connect(fd, &addr, addrlen, ms) != 0) goto end;
+    if (co::writev(fd, iov, 2, left_ms(deadline)) == -1) goto end;
+    if (co::recvn(fd, len, 2, left_ms(deadline)) <= 0) goto end;
+    n = get16(len);
+    buf.reset(new char[n > 0 ? n : 1]);
+    if (n == 0 || co::recvn(fd, buf.get(), n, left_ms(deadline)) <= 0) goto end;
+
+    r = parse_response((const uint8*)buf.get(), n, q, id, type, ips, ttl);
+    if (r == kTruncated) r = -1;
+
+  end:
+    co::close(fd);
+    return r;
+}
+
+// send A and AAAA queries together to @server, and wait for the responses.
+// The ids are random, and the kernel picks a random source port for each
+// socket, answers must match the id and the question of a query. Answers with
+// the TC bit set are queried again over tcp.
+// return 1 if any address was found, 0 if the name does not exist, -1 on error.
+int query(
+    const Server& server, const fastring& name, int ms,
+    std::vector<fastring>* ips, uint32* ttl
+) {
+    const uint32 x = random32();
+    const uint16 ids[2] = { (uint16)(x >> 16), (uint16)(x & 0xffff) };
+    const uint16 types[2] = { kTypeA, kTypeAAAA };
+
+    fastream q[2];
+    for (int i = 0; i < 2; ++i) {
+        if (!build_query(q[i], ids[i], name, types[i])) return 0;
+    }
+
+    Addr addr;
+    const int addrlen = init_addr(server, &addr);
+    if (addrlen == 0) return -1;
+
+    sock_t fd = co::udp_socket(addrlen == sizeof(addr.v4) ? AF_INET : AF_INET6);
+    if (fd == (sock_t)-1) return -1;
+
+    int r = -1;
+    std::vector<fastring> res[2];
+    bool answered[2] = { false, false };
+    bool truncated[2] = { false, false };
+    int rcode[2] = { 0, 0 };
+    int64 deadline = now::ms() + ms;
+    std::unique_ptr<char[]> buf(new char[2048]);
+
+    if (co::connect(fd, &addr, addrlen) != 0) goto end;
+    for (int i = 0; i < 2; ++i) {
+        if (co::send(fd, q[i].data(), (int) q[i].size()) == -1) goto end;
+    }
+
+    while (!answered[0] || !answered[1]) {
+        int64 left = deadline - now::ms();
+        if (left <= 0) break;
+
+        int n = co::recv(fd, buf.get(), 2048, (int) left);
+        if (n < 0) {
+            if (co::error() == ETIMEDOUT) break;
+            if (co::error() == EINTR) continue;
+            DLOG << "dns recv from " << server.ip << " error: " << co::strerror();
+            goto end;
+        }
+
+        for (int i = 0; i < 2; ++i) {
+            if (answered[i]) continue;
+            std::vector<fastring> v;
+            int x = parse_response((const uint8*)buf.get(), n, q[i], ids[i], types[i], &v, ttl);
+            if (x == -1) continue;
+            answered[i] = true;
+            truncated[i] = x == kTruncated;
+            rcode[i] = truncated[i] ? 0 : x;
+            res[i].swap(v);
+        }
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        if (!truncated[i]) continue;
+        int x = query_tcp(server, q[i], ids[i], types[i], (int)(deadline - now::ms()), &res[i], ttl);
+        if (x < 0) {
+            answered[i] = false;
+        } else {
+            rcode[i] = x;
+        }
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        for (size_t k = 0; k < res[i].size(); ++k) ips->push_back(std::move(res[i][k]));
+    }
+
+    if (!ips->empty()) {
+        r = 1;
+    } else if ((answered[0] && rcode[0] == kRcodeNxDomain) || (answered[1] && rcode[1] == kRcodeNxDomain)) {
+        r = 0;
+    } else if (answered[0] && answered[1] && rcode[0] == 0 && rcode[1] == 0) {
+        r = 0; // no address for the name
+    }
+
+  end:
+    co::close(fd);
+    return r;
+}
+
+// addresses of @name found by getaddrinfo(), it may block for seconds
+bool get_addrinfo(const fastring& name, std::vector<fastring>* ips) {
+    struct addrinfo* info = 0;
+    if (::getaddrinfo(name.c_str(), NULL, NULL, &info) != 0) return false;
+    for (auto p = info; p; p = p->ai_next) {
+        if (p->ai_socktype != 0 && p->ai_socktype != SOCK_STREAM) continue;
+        if (p->ai_family == AF_INET) {
+            ips->push_back(co::ip_str((struct sockaddr_in*)p->ai_addr));
+        } else if (p->ai_family == AF_INET6) {
+            ips->push_back(co::ip_str((struct sockaddr_in6*)p->ai_addr));
+        }
+    }
+    freeaddrinfo(info);
+    return !ips->empty();
+}
+
+// getaddrinfo() is called in helper threads, as it blocks the scheduler.
+class SystemResolver {
+  public:
+    enum { kThreads = 2 };
+
+    SystemResolver() : _started(false) {}
+    ~SystemResolver() = default;
+
+    // getaddrinfo() in a helper thread, return false if no address was found
+    // or timeout. MUST be called in coroutine.
+    bool resolve(const fastring& name, int ms, std::vector<fastring>* ips);
+
+  private:
+    // on heap, the helper thread writes it after the coroutine is suspended,
+    // or after the coroutine has given up on timeout.
+    struct Task {
+        fastring name;
+        std::vector<fastring> ips;
+        int sched_id;
+        co::Event ev;
+    };
+
+    void loop();
+
+  private:
+    ::Mutex _mtx;
+    SyncEvent _ev;
+    std::deque<std::shared_ptr<Task>> _tasks;
+    bool _started;
+};
+
+bool SystemResolver::resolve(const fastring& name, int ms, std::vector<fastring>* ips) {
+    std::shared_ptr<Task> t(new Task());
+    t->name = name;
+    t->sched_id = co::sched_id();
+
+    do {
+        ::MutexGuard g(_mtx);
+        if (!_started) {
+            _started = true;
+            // the threads are detached and run until the process exits
+            for (int i = 0; i < kThreads; ++i) Thread(&SystemResolver::loop, this).detach();
+        }
+        _tasks.push_back(t);
+    } while (0);
+    _ev.signal();
+
+    // the helper thread signals the event in a new coroutine, which runs after
+    // this one is suspended.
+    if (!t->ev.wait((unsigned int) ms)) return false;
+    for (size_t i = 0; i < t->ips.size(); ++i) ips->push_back(std::move(t->ips[i]));
+    return !ips->empty();
+}
+
+void SystemResolver::loop() {
+    while (true) {
+        std::shared_ptr<Task> t;
+        do {
+            ::MutexGuard g(_mtx);
+            if (!_tasks.empty()) {
+                t = _tasks.front();
+                _tasks.pop_front();
+            }
+        } while (0);
+
+        if (!t) {
+            _ev.wait();
+            continue;
+        }
+
+        get_addrinfo(t->name, &t->ips);
+        co::go_on(t->sched_id, new_callback([t]() { t->ev.signal(); }));
+    }
+}
+
+inline SystemResolver& system_resolver() {
+    static SystemResolver* r = new SystemResolver();
+    return *r;
+}
+
+// resolve with getaddrinfo() if no dns server is configured (Windows), or the
+// name is not found by the dns servers
+inline bool resolve_by_system(const fastring& name, int ms, std::vector<fastring>* ips) {
+    return system_resolver().resolve(name, ms, ips);
+}
+
+bool do_resolve(const fastring& name, int ms, std::vector<fastring>* ips, uint32* ttl) {
+    const auto& servers = config().servers();
+    const int64 deadline = now::ms() + ms;
+    if (servers.empty()) {
+        *ttl = 60;
+        return resolve_by_system(name, ms, ips);
+    }
+
+    // try the names with search domains in order, until one is found
+    const std::vector<fastring> names = config().names(name);
+    for (size_t x = 0; x < names.size(); ++x) {
+        int r = -1;
+        for (int k = 0; r < 0 && (k < FLG_dns_attempts || k == 0); ++k) {
+            for (size_t i = 0; i < servers.size(); ++i) {
+                int64 left = deadline - now::ms();
+                if (left <= 0) return false;
+                int t = (int) (left < FLG_dns_timeout ? left : FLG_dns_timeout);
+
+                r = query(servers[i], names[x], t, ips, ttl);
+                if (r >= 0) break;
+            }
+        }
+        if (r == 1) return true;
+    }
+
+    // the name may be found in other sources configured in nsswitch.conf
+    if (!FLG_dns_system_fallback) return false;
+    *ttl = 60;
+    return resolve_by_system(name, left_ms(deadline), ips);
+}
+
+} // xx
+
+bool resolve(const fastring& host, std::vector<fastring>* ips, int ms) {
+    ips->clear();
+    if (host.empty()) return false;
+
+    do {
+        struct in6_addr a;
+        if (inet_pton(AF_INET, host.c_str(), &a) == 1 || inet_pton(AF_INET6, host.c_str(), &a) == 1) {
+            ips->push_back(host);
+            return true;
+        }
+    } while (0);
+
+    xx::config().load();
+    fastring name = host.lower();
+    auto h = xx::config().host(name);
+    if (h) {
+        *ips = *h;
+        return true;
+    }
+
+    if (ms < 0) {
+        const int n = (int) xx::config().servers().size();
+        ms = FLG_dns_timeout * (FLG_dns_attempts > 0 ? FLG_dns_attempts : 1) * (n > 0 ? n : 1);
+    }
+
+    bool owner = false;
+    auto a = xx::cache().get(name, &owner);
+    if (!owner) {
+        // wait for the query in progress
+        if (!xx::cache().result(a, ips)) {
+            a->ev.wait((unsigned int) ms);
+            xx::cache().result(a, ips);
+        }
+        return !ips->empty();
+    }
+
+    uint32 ttl = -1;
+    xx::do_resolve(name, ms, &a->ips, &ttl);
+    if (a->ips.empty() && name == "localhost") {
+        a->ips.push_back("127.0.0.1");
+        a->ips.push_back("::1");
+    }
+
+    if (ttl > (uint32) FLG_dns_max_ttl) ttl = FLG_dns_max_ttl;
+    a->expire = now::ms() + (int64) ttl * 1000;
+    *ips = a->ips;
+    xx::cache().done(name, a);
+
+    if (ips->empty()) {
+        ELOG << "dns resolve failed: " << host;
+        return false;
+    }
+    return true;
+}
+
+void clear_cache() {
+    xx::cache().clear();
+}
+
+} // dns
+} // so
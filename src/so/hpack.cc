@@ -0,0 +1,455 @@
+#include "co/so/hpack.h"
+#include <string.h>
+#include <unordered_map>
+
+namespace so {
+namespace http {
+namespace hpack {
+
+// huffman code of the 256 octets and EOS, RFC 7541 Appendix B
+static const struct {
+    uint32 code;
+    uint32 len;
+} kHuffman[257] = {
+    { 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 },
+    { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+    { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+    { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+    { 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 },
+    { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+    { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+    { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+    { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+    { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+    { 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 },
+    { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+    { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 },
+    { 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+    { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+    { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+    { 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 },
+    { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+    { 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 },
+    { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+    { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+    { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+    { 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 },
+    { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+    { 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 },
+    { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+    { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+    { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+    { 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 },
+    { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+    { 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 },
+    { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+    { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+    { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+    { 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 },
+    { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+    { 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 },
+    { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+    { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+    { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+    { 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 },
+    { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+    { 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 },
+    { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+    { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+    { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+    { 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 },
+    { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+    { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 },
+    { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+    { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+    { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+    { 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 },
+    { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+    { 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 },
+    { 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+    { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+    { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+    { 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 },
+    { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+    { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 },
+    { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+    { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+    { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+    { 0x3fffffff, 30 },
+};
+
+// the static table, RFC 7541 Appendix A, index from 1
+static const char* kStaticTable[61][2] = {
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" },
+};
+
+// binary tree of the huffman code, for decoding
+struct HuffmanTree {
+    struct Node {
+        Node() : sym(-1) { next[0] = next[1] = 0; }
+        int16 next[2]; // 0 for none, as the root is never a child
+        int16 sym;     // the symbol of a leaf, -1 for inner nodes
+    };
+
+    HuffmanTree() {
+        nodes.reserve(520);
+        nodes.push_back(Node());
+        for (int s = 0; s < 257; ++s) {
+            int x = 0;
+            for (int i = (int) kHuffman[s].len - 1; i >= 0; --i) {
+                const int b = (kHuffman[s].code >> i) & 1;
+                if (nodes[x].next[b] == 0) {
+                    nodes[x].next[b] = (int16) nodes.size();
+                    nodes.push_back(Node());
+                }
+                x = nodes[x].next[b];
+            }
+            nodes[x].sym = (int16) s;
+        }
+    }
+
+    std::vector<Node> nodes;
+};
+
+size_t huffman_len(const char* s, size_t n) {
+    uint64 bits = 0;
+    for (size_t i = 0; i < n; ++i) bits += kHuffman[(uint8)s[i]].len;
+    return (size_t)((bits + 7) >> 3);
+}
+
+size_t huffman_encode(const char* s, size_t n, fastring& out) {
+    const size_t beg = out.size();
+    uint64 bits = 0; // bits not appended are at the low end
+    int nbits = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const uint32 len = kHuffman[(uint8)s[i]].len;
+        bits = (bits << len) | kHuffman[(uint8)s[i]].code;
+        nbits += len;
+        while (nbits >= 8) {
+            nbits -= 8;
+            out.append((char)(bits >> nbits));
+        }
+    }
+
+    // padded with the most significant bits of EOS
+    if (nbits > 0) out.append((char)((bits << (8 - nbits)) | (0xff >> nbits)));
+    return out.size() - beg;
+}
+
+bool huffman_decode(const char* s, size_t n, fastring& out) {
+    static const HuffmanTree* t = new HuffmanTree();
+    const HuffmanTree::Node* nodes = t->nodes.data();
+    int x = 0, depth = 0;
+    bool ones = true; // the bits after the last symbol are all 1
+
+    for (size_t i = 0; i < n; ++i) {
+        const uint8 c = (uint8) s[i];
+        for (int k = 7; k >= 0; --k) {
+            const int b = (c >> k) & 1;
+            x = nodes[x].next[b];
+            ++depth;
+            ones = ones && b;
+            const int sym = nodes[x].sym;
+            if (sym >= 0) {
+                if (sym == 256) return false; // EOS must not be in the string
+                out.append((char) sym);
+                x = depth = 0;
+                ones = true;
+            }
+        }
+    }
+
+    // padding longer than 7 bits, or not a prefix of EOS is an error
+    return depth <= 7 && ones;
+}
+
+void encode_int(uint64 v, int bits, uint8 flags, fastring& out) {
+    const uint32 max = (1u << bits) - 1;
+    if (v < max) {
+        out.append((char)(flags | v));
+        return;
+    }
+
+    out.append((char)(flags | max));
+    v -= max;
+    while (v >= 128) {
+        out.append((char)(0x80 | (v & 0x7f)));
+        v >>= 7;
+    }
+    out.append((char) v);
+}
+
+static bool decode_int(const uint8*& p, const uint8* e, int bits, uint64* v) {
+    const uint32 max = (1u << bits) - 1;
+    uint64 x = *p++ & max;
+    if (x < max) {
+        *v = x;
+        return true;
+    }
+
+    for (int m = 0; p < e && m <= 28; m += 7) {
+        const uint8 b = *p++;
+        x += (uint64)(b & 0x7f) << m;
+        if (!(b & 0x80)) {
+            *v = x;
+            return true;
+        }
+    }
+    return false; // truncated, or too large
+}
+
+static bool decode_str(const uint8*& p, const uint8* e, fastring& out) {
+    if (p >= e) return false;
+    const bool huffman = (*p & 0x80) != 0;
+    uint64 n;
+    if (!decode_int(p, e, 7, &n) || n > (uint64)(e - p)) return false;
+
+    out.clear();
+    if (huffman) {
+        if (!huffman_decode((const char*) p, (size_t) n, out)) return false;
+    } else {
+        out.append((const char*) p, (size_t) n);
+    }
+    p += n;
+    return true;
+}
+
+static void encode_str(const char* s, size_t n, fastring& out) {
+    const size_t h = huffman_len(s, n);
+    if (h < n) {
+        encode_int(h, 7, 0x80, out);
+        huffman_encode(s, n, out);
+    } else {
+        encode_int(n, 7, 0, out);
+        out.append(s, n);
+    }
+}
+
+struct StaticTable {
+    StaticTable() {
+        for (int i = 0; i < 61; ++i) {
+            names[i] = kStaticTable[i][0];
+            values[i] = kStaticTable[i][1];
+            if (index.find(names[i]) == index.end()) index[names[i]] = i + 1;
+        }
+    }
+
+    fastring names[61];
+    fastring values[61];
+    std::unordered_map<fastring, int> index; // the first index of a name
+};
+
+static const StaticTable& static_table() {
+    static const StaticTable* t = new StaticTable();
+    return *t;
+}
+
+bool Decoder::get(uint32 index, const fastring** name, const fastring** value) const {
+    if (index == 0) return false;
+    if (index <= 61) {
+        const StaticTable& t = static_table();
+        *name = &t.names[index - 1];
+        *value = &t.values[index - 1];
+        return true;
+    }
+    if (index - 62 >= _table.size()) return false;
+    const Entry& e = _table[index - 62];
+    *name = &e.name;
+    *value = &e.value;
+    return true;
+}
+
+void Decoder::evict(size_t max_size) {
+    while (_size > max_size && !_table.empty()) {
+        const Entry& e = _table.back();
+        _size -= e.name.size() + e.value.size() + 32;
+        _table.pop_back();
+    }
+}
+
+void Decoder::add(const fastring& name, const fastring& value) {
+    const size_t n = name.size() + value.size() + 32;
+    if (n > _max_size) {
+        // an entry larger than the table empties it
+        this->evict(0);
+        return;
+    }
+
+    this->evict(_max_size - n);
+    _table.push_front(Entry());
+    _table.front().name = name;
+    _table.front().value = value;
+    _size += n;
+}
+
+bool Decoder::decode(const char* s, size_t n, std::vector<fastring>& h, size_t* m) {
+    const uint8* p = (const uint8*) s;
+    const uint8* e = p + n;
+    bool update_allowed = true; // size updates at the beginning of the block
+    size_t k = 0, list_size = 0;
+    uint64 x;
+
+    while (p < e) {
+        const uint8 b = *p;
+        if ((b & 0xe0) == 0x20) {
+            // dynamic table size update
+            if (!update_allowed || !decode_int(p, e, 5, &x) || x > _limit) return false;
+            _max_size = (size_t) x;
+            this->evict(_max_size);
+            continue;
+        }
+
+        update_allowed = false;
+        if (k + 2 > h.size()) h.resize(k + 2);
+        fastring& name = h[k];
+        fastring& value = h[k + 1];
+        const fastring* a;
+        const fastring* v;
+
+        if (b & 0x80) {
+            // indexed field
+            if (!decode_int(p, e, 7, &x) || !this->get((uint32) x, &a, &v)) return false;
+            name = *a;
+            value = *v;
+        } else {
+            // literal with incremental indexing (01), without indexing (0000),
+            // or never indexed (0001), the name is indexed or a literal
+            const bool indexing = (b & 0x40) != 0;
+            if (!decode_int(p, e, indexing ? 6 : 4, &x)) return false;
+            if (x > 0) {
+                if (!this->get((uint32) x, &a, &v)) return false;
+                name = *a;
+            } else if (!decode_str(p, e, name)) {
+                return false;
+            }
+            if (!decode_str(p, e, value)) return false;
+            if (indexing) this->add(name, value);
+        }
+        list_size += name.size() + value.size();
+        if (list_size > _max_list_size) return false;
+        k += 2;
+    }
+
+    *m = k;
+    return true;
+}
+
+// index of @name in the static table, 0 if not found. @exact is set if the
+// value matches too.
+static int find_static(const char* name, size_t nlen, const char* value, size_t vlen, bool* exact) {
+    const StaticTable& t = static_table();
+    *exact = false;
+    auto it = t.index.find(fastring(name, nlen));
+    if (it == t.index.end()) return 0;
+
+    const int i = it->second;
+    for (int k = i; k <= 61 && t.names[k - 1].size() == nlen && memcmp(t.names[k - 1].data(), name, nlen) == 0; ++k) {
+        const fastring& x = t.values[k - 1];
+        if (!x.empty() && x.size() == vlen && memcmp(x.data(), value, vlen) == 0) {
+            *exact = true;
+            return k;
+        }
+    }
+    return i;
+}
+
+void Encoder::encode(const char* name, size_t nlen, const char* value, size_t vlen, fastring& out) {
+    bool exact;
+    const int i = find_static(name, nlen, value, vlen, &exact);
+    if (exact) {
+        encode_int(i, 7, 0x80, out);
+        return;
+    }
+
+    // literal without indexing
+    if (i > 0) {
+        encode_int(i, 4, 0, out);
+    } else {
+        out.append('\0');
+        encode_str(name, nlen, out);
+    }
+    encode_str(value, vlen, out);
+}
+
+void Encoder::encode_status(int status, fastring& out) {
+    switch (status) {
+      case 200: out.append((char) 0x88); return;
+      case 204: out.append((char) 0x89); return;
+      case 206: out.append((char) 0x8a); return;
+      case 304: out.append((char) 0x8b); return;
+      case 400: out.append((char) 0x8c); return;
+      case 404: out.append((char) 0x8d); return;
+      case 500: out.append((char) 0x8e); return;
+    }
+
+    char buf[4] = {
+        (char)('0' + status / 100 % 10), (char)('0' + status / 10 % 10), (char)('0' + status % 10), 0
+    };
+    encode_int(8, 4, 0, out); // the name ":status" at index 8
+    encode_int(3, 7, 0, out);
+    out.append(buf, 3);
+}
+
+} // hpack
+} // http
+} // so
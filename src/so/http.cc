@@ -1,5 +1,6 @@
 #include "co/so/http.h"
 #include "co/co.h"
+#include "co/buffered_conn.h"
 #include "co/flag.h"
 #include "co/log.h"
 #include "co/fastring.h"
@@ -8,7 +9,6 @@
 #include "co/time.h"
 #include "co/fs.h"
 #include "co/path.h"
-#include "co/lru_map.h"
 #include <memory>
 
 DEF_int32(http_max_header_size, 4096, "#2 max size of http header");
@@ -19,6 +19,10 @@ DEF_int32(http_conn_timeout, 3000, "#2 connect timeout in ms");
 DEF_int32(http_conn_idle_sec, 180, "#2 connection may be closed if no data was recieved for n seconds");
 DEF_int32(http_max_idle_conn, 128, "#2 max idle connections");
 DEF_bool(http_log, true, "#2 enable http log if true");
+DEF_int32(http_sendfile_size, 64 << 10, "#2 http::StaticFiles sends files larger than this with sendfile, default: 64k");
+
+DEC_int32(co_zerocopy_size);
+DEC_bool(http_compress);
 
 #define HTTPLOG LOG_IF(FLG_http_log)
 
@@ -26,21 +30,566 @@ namespace so {
 namespace http {
 
 Server::Server(const char* ip, int port)
-    : tcp::Server(ip, port), _conn_num(0), _buffer(
-          []() { return (void*) new fastring(4096); },
-          [](void* p) { delete (fastring*)p; }
-      ) {
+    : tcp::Server(ip, port), _conn_num(0), _stream_body(false), _h2c(false) {
 }
 
 Server::~Server() = default;
 
 void Server::start() {
+    if (_metrics) _metrics->init(_router);
     tcp::Server::start();
     LOG << "http server start, ip: " << _ip << ", port: " << _port;
 }
 
-int parse_req(fastring& s, size_t end, Req* req, int* body_len);
-int parse_res(fastring& s, size_t end, Res* res, int* body_len);
+#ifndef _WIN32
+// send the file body of @res with the zero-copy sendfile()
+static int send_file(sock_t fd, int file_fd, const Res& res) {
+    int64 r = co::sendfile(fd, file_fd, res.file_off(), res.file_len(), FLG_http_send_timeout);
+    return r == res.file_len() ? 0 : -1;
+}
+
+static int open_file(const fastring& path) {
+    return ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+static void close_file(int fd) {
+    ::close(fd);
+}
+
+#else
+static int send_file(sock_t fd, fs::file* f, const Res& res) {
+    fastring buf(64 * 1024);
+    int64 remain = res.file_len();
+    f->seek(res.file_off());
+
+    while (remain > 0) {
+        size_t n = f->read((void*)buf.data(), remain < 64 * 1024 ? (size_t)remain : 64 * 1024);
+        if (n == 0) return -1;
+        if (co::send(fd, buf.data(), (int) n, FLG_http_send_timeout) == -1) return -1;
+        remain -= n;
+    }
+    return 0;
+}
+
+static fs::file* open_file(const fastring& path) {
+    fs::file* f = new fs::file(path.c_str(), 'r');
+    if (*f) return f;
+    delete f;
+    return 0;
+}
+
+static void close_file(fs::file* f) {
+    delete f;
+}
+#endif
+
+// fill @req with the request parsed by @p from @s
+static void set_req(const Parser& p, const char* s, Req* req) {
+    req->set_parsing();
+    req->set_method((Method) p.method());
+    p.version() == kHTTP10 ? req->set_version_http10() : req->set_version_http11();
+    req->set_url(s + p.url().off, p.url().len);
+    for (int i = 0; i < p.header_num(); ++i) {
+        const Parser::Slice& k = p.key(i);
+        const Parser::Slice& v = p.value(i);
+        req->add_header(s + k.off, k.len, s + v.off, v.len);
+    }
+}
+
+// fill @res with the response parsed by @p from @s
+static void set_res(const Parser& p, const char* s, Res* res) {
+    res->set_parsing();
+    p.version() == kHTTP10 ? res->set_version_http10() : res->set_version_http11();
+    res->set_status(p.status());
+    for (int i = 0; i < p.header_num(); ++i) {
+        const Parser::Slice& k = p.key(i);
+        const Parser::Slice& v = p.value(i);
+        res->add_header(s + k.off, k.len, s + v.off, v.len);
+    }
+}
+
+void Base::add_header(const char* key, size_t klen, const char* val, size_t vlen) {
+    int k = known_header(key, klen);
+    if (k >= 0 && _known[k] < 0) _known[k] = (int16)_nh;
+
+    if (_nh + 2 > _headers.size()) _headers.resize(_nh + 2);
+    fastring& x = _headers[_nh];
+    fastring& y = _headers[_nh + 1];
+    x.clear();
+    x.append(key, klen);
+    y.clear();
+    y.append(val, vlen);
+    _nh += 2;
+}
+
+void Base::remove_header(const char* key, size_t n) {
+    size_t k = 0;
+    for (size_t i = 0; i < _nh; i += 2) {
+        const fastring& x = _headers[i];
+        if (x.size() == n && equal_nocase(x.data(), key, n)) continue;
+        if (k != i) {
+            _headers[k].swap(_headers[i]);
+            _headers[k + 1].swap(_headers[i + 1]);
+        }
+        k += 2;
+    }
+    if (k == _nh) return;
+
+    _nh = k;
+    memset(_known, -1, sizeof(_known));
+    for (size_t i = 0; i < _nh; i += 2) {
+        int h = known_header(_headers[i].data(), _headers[i].size());
+        if (h >= 0 && _known[h] < 0) _known[h] = (int16)i;
+    }
+}
+
+fastring* Base::mutable_header(const char* key, size_t n) {
+    for (size_t i = 0; i < _nh; i += 2) {
+        const fastring& x = _headers[i];
+        if (x.size() == n && equal_nocase(x.data(), key, n)) return &_headers[i + 1];
+    }
+    return NULL;
+}
+
+const fastring& Base::header(const char* key, size_t n) const {
+    int k = known_header(key, n);
+    if (k >= 0) return this->header((KnownHeader)k);
+
+    for (size_t i = 0; i < _nh; i += 2) {
+        const fastring& x = _headers[i];
+        if (x.size() == n && equal_nocase(x.data(), key, n)) return _headers[i + 1];
+    }
+    return empty_string();
+}
+
+// Responses to pipelined requests, they are sent together with one writev.
+// Headers are serialized into one buffer reused by the connection, and bodies
+// are sent from where they are, without being copied.
+class ResBatch {
+  public:
+    ResBatch() : _metrics(0), _n(0), _bytes(0) {}
+    ~ResBatch() = default;
+
+    size_t size() const { return _n; }
+    size_t bytes() const { return _bytes; }
+
+    // serialize the header of @res and take its body, @res gets the buffer of
+    // a body sent before, so the memory is reused by the next response.
+    // @head: response to HEAD, the body is not sent.
+    void add(Res& res, bool head) {
+        if (_b.size() <= _n) {
+            _b.resize(_n + 1);
+            _hlen.resize(_n + 1);
+        }
+        const size_t off = _h.size();
+        res.header_str(_h);
+        if (head) res.mutable_body().clear();
+        _hlen[_n] = _h.size() - off;
+        _b[_n].swap(res.mutable_body());
+        _bytes += _hlen[_n] + _b[_n].size();
+        ++_n;
+    }
+
+    // responses in the batch are recorded to @m when they are sent
+    void set_metrics(Metrics* m) { _metrics = m; }
+
+    // record the last response added after it is sent, @beg_us: time the
+    // handler was called.
+    void record(int route, int method, int status, int64 in, int64 out, int64 beg_us) {
+        const Stat x = { route, method, status, in, out, beg_us };
+        _stat.push_back(x);
+    }
+
+    // header of the last response added
+    fastring last_header() const {
+        const size_t n = _hlen[_n - 1];
+        return fastring(_h.data() + _h.size() - n, n);
+    }
+
+    // send all responses in the batch, return -1 on error
+    int send(sock_t fd, int ms) {
+        _iov.resize(_n * 2);
+        int k = 0;
+        size_t off = 0;
+        for (size_t i = 0; i < _n; ++i) {
+            _iov[k].iov_base = (void*)(_h.data() + off);
+            _iov[k].iov_len = _hlen[i];
+            off += _hlen[i];
+            ++k;
+            if (_b[i].empty()) continue;
+            _iov[k].iov_base = (void*) _b[i].data();
+            _iov[k].iov_len = _b[i].size();
+            ++k;
+        }
+
+        int r = co::writev(fd, _iov.data(), k, ms);
+        if (r != -1 && !_stat.empty()) {
+            const int64 now_us = now::us();
+            for (size_t i = 0; i < _stat.size(); ++i) {
+                const Stat& x = _stat[i];
+                _metrics->record(x.route, x.method, x.status, x.in, x.out, now_us - x.beg_us);
+            }
+        }
+        _stat.clear();
+        _h.clear();
+        for (size_t i = 0; i < _n; ++i) {
+            // do not hold large buffers for idle connections
+            if (_b[i].capacity() > kMaxKeepBytes) {
+                _b[i].swap(fastring());
+            } else {
+                _b[i].clear();
+            }
+        }
+        _n = _bytes = 0;
+        return r == -1 ? -1 : 0;
+    }
+
+  private:
+    enum { kMaxKeepBytes = 64 * 1024 };
+    struct Stat {
+        int route;
+        int method;
+        int status;
+        int64 in;
+        int64 out;
+        int64 beg_us;
+    };
+    Metrics* _metrics;
+    std::vector<Stat> _stat;    // responses to be recorded
+    fastring _h;                // headers of all responses
+    std::vector<size_t> _hlen;  // length of each header in _h
+    std::vector<fastring> _b;   // bodies
+    std::vector<co::iovec> _iov;
+    size_t _n;
+    size_t _bytes;
+};
+
+// responses are sent when the batch is large enough, or no complete request 
+// is left in the buffer.
+const size_t kMaxBatchSize = 32;
+const size_t kMaxBatchBytes = 256 * 1024;
+
+int format_date(int64 sec, char* buf) {
+    static const char* wday[] = {
+        "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+    };
+    static const char* mon[] = {
+        "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+        "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+    };
+
+    const time_t t = (time_t) sec;
+    struct tm x;
+  #ifdef _WIN32
+    gmtime_s(&x, &t);
+  #else
+    gmtime_r(&t, &x);
+  #endif
+    return snprintf(buf, 32, "%s, %02d %s %d %02d:%02d:%02d GMT",
+        wday[x.tm_wday], x.tm_mday, mon[x.tm_mon], x.tm_year + 1900,
+        x.tm_hour, x.tm_min, x.tm_sec);
+}
+
+// value of the Date header, it is formatted once a second in each thread.
+static const fastring& http_date() {
+    static __thread fastring* s = 0;
+    static __thread time_t last = 0;
+    if (unlikely(s == 0)) s = new fastring(32);
+
+    const time_t t = ::time(0);
+    if (t != last) {
+        char buf[32];
+        int n = format_date(t, buf);
+        s->clear();
+        s->append(buf, n);
+        last = t;
+    }
+    return *s;
+}
+
+// add the Date header to @res, if the handler has not done it
+static inline void add_date(Res& res) {
+    if (res.header(kHeaderDate).empty()) {
+        const fastring& d = http_date();
+        res.add_header("Date", 4, d.data(), d.size());
+    }
+}
+
+static inline void set_error(int e) {
+  #ifdef _WIN32
+    WSASetLastError(e);
+  #else
+    errno = e;
+  #endif
+}
+
+// Reads the body of a message from a BufferedConn, in pieces. The body ends
+// after Content-Length bytes, or the last chunk with chunked encoding, or when
+// the peer closes the connection.
+class BodyReader {
+  public:
+    BodyReader() : _bc(0), _left(0), _state(kDone), _chunked(false), _crlf(false) {}
+    ~BodyReader() = default;
+
+    // @len: Content-Length, -1 for a body ends with the connection
+    void init(co::BufferedConn* bc, int64 len, bool chunked) {
+        _bc = bc;
+        _chunked = chunked;
+        _crlf = false;
+        if (chunked) {
+            _left = 0;
+            _state = kChunk;
+        } else {
+            _left = len >= 0 ? len : -1;
+            _state = len != 0 ? kData : kDone;
+        }
+    }
+
+    bool done() const { return _state == kDone; }
+
+    // return bytes read, 0 at the end of the body, -1 on error or timeout
+    int read(void* buf, int n, int ms);
+
+  private:
+    // read the next chunk-size line, and the trailers after the last chunk
+    int next_chunk(int ms);
+
+  private:
+    enum { kData, kChunk, kDone };
+    co::BufferedConn* _bc;
+    int64 _left; // bytes left in the body or the current chunk, -1: unknown
+    int _state;
+    bool _chunked;
+    bool _crlf;  // CRLF after the data of the previous chunk is not read yet
+};
+
+int BodyReader::read(void* buf, int n, int ms) {
+    if (_state == kChunk) {
+        int r = this->next_chunk(ms);
+        if (r != 1) return r;
+    }
+    if (_state == kDone || n <= 0) return 0;
+
+    if (_bc->size() == 0) {
+        int r = _bc->peek(1, ms);
+        if (r == 0) {
+            if (_left < 0) { _state = kDone; return 0; }
+            set_error(ECONNRESET); // closed before the end of the body
+            return -1;
+        }
+        if (r == -1) return -1;
+    }
+
+    size_t m = _bc->size() < (size_t)n ? _bc->size() : (size_t)n;
+    if (_left >= 0 && (int64)m > _left) m = (size_t)_left;
+    memcpy(buf, _bc->data(), m);
+    _bc->consume(m);
+
+    if (_left > 0 && (_left -= m) == 0) _state = _chunked ? kChunk : kDone;
+    return (int) m;
+}
+
+int BodyReader::next_chunk(int ms) {
+    int r;
+    while (true) {
+        r = _bc->read_until("\r\n", 1024, ms);
+        if (r <= 0) goto recv_err;
+
+        if (_crlf) {
+            if (r != 2) goto bad_chunk;
+            _bc->consume(2);
+            _crlf = false;
+            continue;
+        }
+
+        // chunk-size in hex, may be followed by chunk extensions
+        int64 len = 0;
+        const char* p = _bc->data();
+        const char* e = p + r - 2;
+        int k = 0;
+        for (; p < e && k < 15; ++p, ++k) {
+            const char c = *p;
+            if ('0' <= c && c <= '9') len = (len << 4) | (c - '0');
+            else if ('a' <= (c | 0x20) && (c | 0x20) <= 'f') len = (len << 4) | ((c | 0x20) - 'a' + 10);
+            else break;
+        }
+        if (k == 0 || (p < e && *p != ';' && *p != ' ' && *p != '\t')) goto bad_chunk;
+        _bc->consume(r);
+
+        if (len > 0) {
+            _left = len;
+            _state = kData;
+            _crlf = true;
+            return 1;
+        }
+
+        // the last chunk, skip the trailers until an empty line
+        do {
+            r = _bc->read_until("\r\n", 4096, ms);
+            if (r <= 0) goto recv_err;
+            _bc->consume(r);
+        } while (r != 2);
+        _state = kDone;
+        return 0;
+    }
+
+  recv_err:
+    if (r == 0) set_error(ECONNRESET);
+    return -1;
+  bad_chunk:
+    set_error(EBADMSG);
+    return -1;
+}
+
+// Sends the body of a response in pieces, the header is sent on the first
+// write, after responses in the batch.
+class BodyWriter {
+  public:
+    BodyWriter(sock_t fd, ResBatch* batch)
+        : _fd(fd), _batch(batch), _chunked(false), _head(false), _err(false) {
+    }
+    ~BodyWriter() = default;
+
+    // response to HEAD, only the header is sent
+    void set_head(bool head) { _head = head; }
+
+    int write(Res* res, const void* data, int n);
+
+    // send the last chunk, return -1 on error
+    int finish() {
+        if (_err) return -1;
+        if (!_chunked || _head) return 0;
+        return co::send(_fd, "0\r\n\r\n", 5, FLG_http_send_timeout) == -1 ? -1 : 0;
+    }
+
+  private:
+    sock_t _fd;
+    ResBatch* _batch;
+    bool _chunked;
+    bool _head;
+    bool _err;
+};
+
+int BodyWriter::write(Res* res, const void* data, int n) {
+    if (_err) return -1;
+
+    if (!res->streaming()) {
+        res->set_streaming();
+        _chunked = res->is_version_http11();
+        add_date(*res);
+        if (_batch->size() > 0 && _batch->send(_fd, FLG_http_send_timeout) == -1) goto err;
+
+        fastring s = res->header_str();
+        if (co::send(_fd, s.data(), (int) s.size(), FLG_http_send_timeout) == -1) goto err;
+        HTTPLOG << "http send res: " << s;
+    }
+
+    // an empty chunk would end the body
+    if (n <= 0) return 0;
+    if (_head) return n;
+
+    if (_chunked) {
+        char hex[20];
+        int k = snprintf(hex, sizeof(hex), "%x\r\n", n);
+        co::iovec iov[3] = {
+            { hex, (size_t)k },
+            { (void*)data, (size_t)n },
+            { (void*)"\r\n", 2 },
+        };
+        if (co::writev(_fd, iov, 3, FLG_http_send_timeout) == -1) goto err;
+    } else {
+        if (co::send(_fd, data, n, FLG_http_send_timeout) == -1) goto err;
+    }
+    return n;
+
+  err:
+    _err = true;
+    return -1;
+}
+
+int Req::read_body(void* buf, int n, int ms) const {
+    if (!_reader) return 0;
+    return _reader->read(buf, n, ms);
+}
+
+int Res::write(const void* data, int n) {
+    if (!_writer) return -1;
+    return _writer->write(this, data, n);
+}
+
+// read the whole body with @r into @s, return -1 on error, or if the body is
+// larger than FLG_http_max_body_size (errno set to EMSGSIZE).
+static int read_all(BodyReader& r, fastring& s, int ms) {
+    while (true) {
+        if (s.size() > (size_t) FLG_http_max_body_size) {
+            set_error(EMSGSIZE);
+            return -1;
+        }
+        if (s.capacity() - s.size() < 4096) s.reserve(s.size() + 8192);
+        int n = r.read((void*)(s.data() + s.size()), (int)(s.capacity() - s.size()), ms);
+        if (n <= 0) return n;
+        s.resize(s.size() + n);
+    }
+}
+
+// send a response with no body for @status, and the connection will be closed
+static void send_error(sock_t fd, int status) {
+    fastring s;
+    s << "HTTP/1.1" << ' ' << status << ' ' << Res::status_str(status) << "\r\n";
+    s << "Content-Length: 0" << "\r\n";
+    s << "Connection: close" << "\r\n";
+    s << "\r\n";
+    co::send(fd, s.data(), (int)s.size(), FLG_http_send_timeout);
+    HTTPLOG << "http send error res: " << s;
+}
+
+// reply "100 Continue" to a request with "Expect: 100-continue", if the body 
+// is not received yet.
+static inline int send_continue(sock_t fd, const Req& req) {
+    const fastring& x = req.header(kHeaderExpect);
+    if (x.size() != 12 || !equal_nocase(x.data(), "100-continue", 12)) return 0;
+    return co::send(fd, "HTTP/1.1 100 Continue\r\n\r\n", 25, FLG_http_send_timeout) == -1 ? -1 : 0;
+}
+
+// whether the connection starts with the HTTP/2 preface, it returns as soon as
+// the data received differs from it. Errors are left to the HTTP/1.x code.
+static bool recv_h2_preface(co::BufferedConn& bc) {
+    static const char p[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+    while (true) {
+        const size_t n = bc.size() < 24 ? bc.size() : 24;
+        if (n > 0 && memcmp(bc.data(), p, n) != 0) return false;
+        if (n == 24) {
+            bc.consume(24);
+            return true;
+        }
+        const int r = bc.peek(n + 1, n == 0 ? FLG_http_conn_idle_sec * 1000 : FLG_http_recv_timeout);
+        if (r <= 0) return false;
+    }
+}
+
+void Server::on(Method method, const char* path, Fun&& fun) {
+    CHECK(_router.add(method, path, std::move(fun))) << "bad route: " << path;
+}
+
+int Server::handle(Req& req, Res& res) {
+    const Fun* f = _router.empty() ? 0 : _router.find(&req);
+    if (f) {
+        (*f)(req, res);
+    } else {
+        this->process(req, res);
+        if (!_on_req && !_router.empty()) {
+            // the path is routed for other methods
+            fastring a = _router.allow(&req);
+            if (!a.empty()) {
+                res.set_status(405);
+                res.add_header("Allow", a.c_str());
+            }
+        }
+    }
+    add_date(res);
+    if (FLG_http_compress && !res.streaming() && res.file().empty()) compress_res(req, res);
+    return f ? _router.index(f) : -1;
+}
 
 void Server::on_connection(Connection* conn) {
     std::unique_ptr<Connection> x(conn);
@@ -51,106 +600,172 @@ void Server::on_connection(Connection* conn) {
     LOG << "http server accept new connection: " << *conn << ", conn fd: " << fd
         << ", conn num: " << atomic_inc(&_conn_num);
 
-    char c;
-    int r = 0, body_len = 0;
-    size_t pos = 0;
-    fastring* buf = 0;
+    int r = 0, route;
+    int64 body_len = 0, beg_us = 0, in = 0, out = 0;
+    co::BufferedConn bc(fd);
+    Parser parser;
+    ResBatch batch;
+    BodyReader reader;
+    BodyWriter writer(fd, &batch);
     Req req;
     Res res;
+    batch.set_metrics(_metrics.get());
+
+    if (_h2c && recv_h2_preface(bc)) {
+        LOG << "http2 connection: " << *conn << ", fd: " << fd;
+        this->on_h2(bc);
+        goto cleanup;
+    }
 
     while (true) {
         do {
           recv_beg:
-            if (!buf) {
-                r = co::recv(fd, &c, 1, FLG_http_conn_idle_sec * 1000);
+            if (bc.size() == 0) {
+                // all pipelined requests are handled, send the responses
+                if (batch.size() > 0 && batch.send(fd, FLG_http_send_timeout) == -1) goto send_err;
+                r = bc.peek(1, FLG_http_conn_idle_sec * 1000);
                 if (unlikely(r == 0)) goto recv_zero_err;
                 if (unlikely(r == -1)) {
                     if (co::error() != ETIMEDOUT) goto recv_err;
                     if (_conn_num > FLG_http_max_idle_conn) goto idle_err;
                     goto recv_beg;
                 }
-
-                buf = (fastring*) _buffer.pop();
-                buf->clear();
-                buf->append(c);
             }
 
-            while ((pos = buf->find("\r\n\r\n")) == buf->npos) {
-                if (buf->size() > FLG_http_max_header_size) goto header_too_long_err;
-
-                buf->reserve(buf->size() + 1024);
-                r = co::recv(
-                    fd, (void*)(buf->data() + buf->size()), 
-                    (int)(buf->capacity() - buf->size()), FLG_http_recv_timeout
-                );
-
+            // parse the header in the buffer, more than one request may be
+            // received by one recv. The parser goes on from where it stopped
+            // when more data is received.
+            parser.reset();
+            while ((r = parser.parse_req(bc.data(), bc.size())) == Parser::kMore) {
+                if (bc.size() > (size_t) FLG_http_max_header_size) goto header_too_long_err;
+                if (batch.size() > 0 && batch.send(fd, FLG_http_send_timeout) == -1) goto send_err;
+                r = bc.peek(bc.size() + 1, FLG_http_recv_timeout);
                 if (unlikely(r == 0)) goto recv_zero_err;
                 if (unlikely(r == -1)) goto recv_err;
-                buf->resize(buf->size() + r);
             }
 
-            // parse http req
-            r = parse_req(*buf, pos, &req, &body_len);
+            if (r == 0 && !_stream_body && parser.content_length() > FLG_http_max_body_size) r = 413;
             if (r != 0) {
-                fastring s;
-                s << "HTTP/1.1" << ' ' << r << ' ' << Res::status_str(r) << "\r\n";
-                s << "Content-Length: 0" << "\r\n";
-                s << "Connection: close" << "\r\n";
-                s << "\r\n";
-                co::send(fd, s.data(), (int)s.size(), FLG_http_send_timeout);
-                HTTPLOG << "http parse req error, send res: " << s;
+                if (batch.size() > 0 && batch.send(fd, FLG_http_send_timeout) == -1) goto send_err;
+                send_error(fd, r);
+                if (_metrics) _metrics->record(-1, parser.method(), r, 0, 0, 0);
                 goto err_end;
             }
 
-            do {
-                size_t total_len = pos + 4 + body_len;
-
-                if (body_len > 0) {
-                    if (buf->size() < total_len) {
-                        buf->reserve(total_len);
-                        r = co::recvn(
-                            fd, (void*)(buf->data() + buf->size()), 
-                            (int)(total_len - buf->size()), FLG_http_recv_timeout
-                        );
+            set_req(parser, bc.data(), &req);
+            bc.consume(parser.header_len());
+            body_len = parser.content_length() > 0 ? parser.content_length() : 0;
+            reader.init(&bc, parser.chunked() ? -1 : body_len, parser.chunked());
 
-                        if (unlikely(r == 0)) goto recv_zero_err;
-                        if (unlikely(r == -1)) goto recv_err;
-                        buf->resize(total_len);
-                    }
-
-                    req.set_body(buf->substr(pos + 4, body_len));
-                }
+            if (!reader.done() && (parser.chunked() || (int64) bc.size() < body_len)) {
+                // the body is not fully received, send the responses first
+                if (batch.size() > 0 && batch.send(fd, FLG_http_send_timeout) == -1) goto send_err;
+                if (bc.size() == 0 && send_continue(fd, req) == -1) goto send_err;
+            }
 
-                if (buf->size() == total_len) {
-                    buf->clear();
-                    _buffer.push(buf);
-                    buf = 0;
-                } else {
-                    buf->lshift(total_len);
+            if (_stream_body) {
+                req.set_reader(&reader);
+            } else if (parser.chunked()) {
+                r = read_all(reader, req.mutable_body(), FLG_http_recv_timeout);
+                if (unlikely(r == -1)) {
+                    if (co::error() == EMSGSIZE) goto body_too_long_err;
+                    if (co::error() == EBADMSG) goto bad_chunk_err;
+                    goto recv_err;
                 }
-            } while (0);
+            } else if (body_len > 0) {
+                // not larger than FLG_http_max_body_size here
+                fastring body((size_t) body_len);
+                r = bc.read_exact((void*)body.data(), (int) body_len, FLG_http_recv_timeout);
+                if (unlikely(r == 0)) goto recv_zero_err;
+                if (unlikely(r == -1)) goto recv_err;
+                body.resize((size_t) body_len);
+                req.set_body(std::move(body));
+            }
         } while (0);
 
         do {
             HTTPLOG << "http recv req: " << req.dbg();
-            bool need_close = false;
-            const fastring& conn = req.header("CONNECTION");
+            bool need_close = false, batched = false;
+            const fastring& conn = req.header(kHeaderConnection);
             if (!conn.empty()) res.add_header("Connection", conn);
 
             if (req.is_version_http10()) {
                 res.set_version_http10();
-                if (conn.empty() || conn.lower() != "keep-alive") need_close = true;
+                if (conn.size() != 10 || !equal_nocase(conn.data(), "keep-alive", 10)) need_close = true;
             } else {
-                if (!conn.empty() && conn == "close") need_close = true;
+                if (conn.size() == 5 && equal_nocase(conn.data(), "close", 5)) need_close = true;
             }
 
-            this->process(req, res);
-            fastring s = res.str();
-            r = co::send(fd, s.data(), (int) s.size(), FLG_http_send_timeout);
-            if (unlikely(r == -1)) goto send_err;
+            res.set_writer(&writer);
+            writer.set_head(req.is_method_head());
+            if (_metrics) beg_us = now::us();
+            route = this->handle(req, res);
+
+            // bytes of the bodies, before the response body is moved to the batch
+            in = parser.chunked() ? (int64) req.body().size() : body_len;
+            out = req.is_method_head() ? 0 : (res.file().empty() ? res.body_len() : res.file_len());
+
+            if (_stream_body && !reader.done()) {
+                // discard the body not read by the handler, the response is
+                // still sent if the body is bad, and the connection is closed.
+                char buf[4096];
+                while ((r = reader.read(buf, sizeof(buf), FLG_http_recv_timeout)) > 0);
+                if (unlikely(r == -1)) {
+                    if (co::error() != EBADMSG) goto recv_err;
+                    need_close = true;
+                }
+            }
 
-            s.resize(s.size() - res.body_len());
-            HTTPLOG << "http send res: " << s;
+            if (res.streaming()) {
+                // the body has been sent by the handler
+                if (writer.finish() == -1) goto send_err;
+                if (res.is_version_http10()) need_close = true;
+
+            } else if (res.file().empty() && (req.is_method_head() || !(FLG_co_zerocopy_size > 0 && res.body_len() >= FLG_co_zerocopy_size))) {
+                // responses are sent in order, with the header and body not
+                // concatenated. If the next request is already in the buffer, 
+                // wait to send the responses together.
+                batch.add(res, req.is_method_head());
+                batched = true;
+                if (_metrics) batch.record(route, req.method(), res.status(), in, out, beg_us);
+                HTTPLOG << "http send res: " << batch.last_header();
+                if (need_close || bc.size() == 0 || batch.size() >= kMaxBatchSize || batch.bytes() >= kMaxBatchBytes) {
+                    if (batch.send(fd, FLG_http_send_timeout) == -1) goto send_err;
+                }
+
+            } else if (res.file().empty()) {
+                if (batch.size() > 0 && batch.send(fd, FLG_http_send_timeout) == -1) goto send_err;
+
+                // the body is moved to the scheduler and released after
+                // the kernel has sent it with MSG_ZEROCOPY
+                fastring s = res.header_str();
+                auto body = std::make_shared<fastring>(std::move(res.mutable_body()));
+                r = co::send(fd, s.data(), (int) s.size(), FLG_http_send_timeout);
+                if (r != -1) r = co::send_zerocopy(fd, body, FLG_http_send_timeout);
+                if (unlikely(r == -1)) goto send_err;
+                HTTPLOG << "http send res: " << s;
+
+            } else {
+                if (batch.size() > 0 && batch.send(fd, FLG_http_send_timeout) == -1) goto send_err;
+
+                auto f = open_file(res.file());
+                if (!f) {
+                    ELOG << "http open file failed: " << res.file();
+                    res.set_file("", 0, 0);
+                    res.set_status(404);
+                }
+
+                fastring s = res.header_str();
+                r = co::send(fd, s.data(), (int) s.size(), FLG_http_send_timeout);
+                if (r != -1 && f && !req.is_method_head()) r = send_file(fd, f, res);
+                if (f) close_file(f);
+                if (unlikely(r == -1)) goto send_err;
+                HTTPLOG << "http send res: " << s;
+            }
+
+            if (_metrics && !batched) {
+                _metrics->record(route, req.method(), res.status(), in, out, now::us() - beg_us);
+            }
 
             if (need_close) {
                 co::close(fd);
@@ -174,6 +789,16 @@ void Server::on_connection(Connection* conn) {
   header_too_long_err:
     ELOG << "http recv error: header too long";
     goto err_end;
+  body_too_long_err:
+    ELOG << "http recv error: body too long";
+    send_error(fd, 413);
+    if (_metrics) _metrics->record(-1, req.method(), 413, 0, 0, 0);
+    goto err_end;
+  bad_chunk_err:
+    ELOG << "http recv error: bad chunk";
+    send_error(fd, 400);
+    if (_metrics) _metrics->record(-1, req.method(), 400, 0, 0, 0);
+    goto err_end;
   recv_err:
     ELOG << "http recv error: " << co::strerror();
     goto err_end;
@@ -184,98 +809,289 @@ void Server::on_connection(Connection* conn) {
     co::reset_tcp_socket(fd, 1000);
   cleanup:
     atomic_dec(&_conn_num);
-    if (buf) { 
-        buf->clear();
-        buf->capacity() <= 1024 * 1024 ? _buffer.push(buf) : delete buf;
-    }
 }
 
 Client::Client(const char* serv_ip, int serv_port)
-    : tcp::Client(serv_ip, serv_port) {
+    : tcp::Client(serv_ip, serv_port), _head(false), _close(false), _decode(false) {
 }
 
 Client::~Client() = default;
 
+co::BufferedConn* Client::conn() {
+    if (!_bc || _bc->fd() != _fd) _bc.reset(new co::BufferedConn(_fd));
+    if (!_reader) _reader.reset(new BodyReader());
+    return _bc.get();
+}
+
+void Client::close_conn() {
+    _bc.reset();
+    this->disconnect();
+}
+
+// the client asks for compressed bodies and decompresses them, unless the
+// user has set Accept-Encoding
+static inline bool auto_decode(const Req& req) {
+  #ifdef HAS_ZLIB
+    return req.header(kHeaderAcceptEncoding).empty();
+  #else
+    (void) req;
+    return false;
+  #endif
+}
+
+// return 0 on success, or the error code as the status of the response
+int Client::send_req(const Req& req, bool chunked) {
+    if (!this->connected() && !this->connect(FLG_http_conn_timeout)) {
+        return 577; // Connection Timeout
+    }
+    _head = req.is_method_head();
+    _decode = !chunked && auto_decode(req);
+
+    fastring s;
+    req.header_str(s, chunked);
+    if (_decode) {
+        s.resize(s.size() - 2);
+        s << "Accept-Encoding: gzip, deflate\r\n\r\n";
+    }
+
+    co::iovec iov[2] = {
+        { (void*) s.data(), s.size() },
+        { (void*) req.body().data(), chunked ? 0 : req.body().size() },
+    };
+    if (co::writev(_fd, iov, 2, FLG_http_send_timeout) == -1) {
+        ELOG << "http send error: " << co::strerror();
+        int status = co::error() == ETIMEDOUT ? 579 : 581;
+        this->close_conn();
+        return status;
+    }
+
+    HTTPLOG << "http send req: " << s;
+    return 0;
+}
+
 // user-defined error code:
 //   577: "Connection Timeout";
 //   578: "Connection Closed";
 //   579: "Send Timeout";   580: "Recv Timeout";
 //   581: "Send Failed";    582: "Recv Failed";
 void Client::call(const Req& req, Res& res) {
-    if (!this->connected() && !this->connect(FLG_http_conn_timeout)) {
-        res.set_status(577); // Connection Timeout
+    int r = this->send_req(req, false);
+    if (r != 0) {
+        res.set_status(r);
         return;
     }
 
-    int r = 0, body_len = 0;
-    size_t pos = 0;
+    if (!this->recv_res(res)) return;
 
-    // send request
-    do {
-        fastring s = req.str();
-        r = this->send(s.data(), (int) s.size(), FLG_http_send_timeout);
-        if (unlikely(r == -1)) goto send_err;
+    if (_bc->size() != 0) {
+        ELOG << "http content length error";
+        res.set_status(500);
+        _close = true;
+    }
 
-        s.resize(s.size() - req.body_len());
-        HTTPLOG << "http send req: " << s;
-    } while (0);
+    // the connection can't be reused, it should never go back to the pool
+    if (_close) this->close_conn();
+}
 
-    // recv response
-    do {
-        fastring buf(4096);
+// recv the response with the whole body, the connection is closed on error
+bool Client::recv_res(Res& res) {
+    if (!this->recv_header(res)) return false;
+
+    int r = read_all(*_reader, res.mutable_body(), FLG_http_recv_timeout);
+    if (unlikely(r == -1)) {
+        if (co::error() == EMSGSIZE) {
+            ELOG << "http recv error: body too long";
+            res.set_status(500);
+        } else {
+            ELOG << "http recv error: " << co::strerror();
+            res.set_status(co::error() == ETIMEDOUT ? 580 : 582);
+        }
+        this->close_conn();
+        return false;
+    }
 
-        // recv http header
-        do {
-            if (buf.size() > FLG_http_max_header_size) goto header_too_long_err;
+    if (_decode && !res.body().empty()) {
+        const int enc = content_encoding(res.header(kHeaderContentEncoding));
+        if (enc != kIdentity) {
+            fastring s;
+            if (decompress(enc, res.body().data(), res.body().size(), s)) {
+                res.set_body(std::move(s));
+                res.remove_header("Content-Encoding", 16);
+                res.remove_header("Content-Length", 14);
+            } else {
+                ELOG << "http decompress body failed, size: " << res.body().size();
+                res.set_status(500);
+            }
+        }
+    }
 
-            buf.reserve(buf.size() + 1024);
-            r = this->recv(
-                (void*)(buf.data() + buf.size()), 
-                (int)(buf.capacity() - buf.size()), FLG_http_recv_timeout
-            );
+    HTTPLOG << "http recv res: " << res.dbg();
+    return true;
+}
 
-            if (unlikely(r == 0)) goto recv_zero_err;
-            if (unlikely(r == -1)) goto recv_err;
-            buf.resize(buf.size() + r);
-        } while ((pos = buf.find("\r\n\r\n")) == buf.npos);
+void Client::pipeline(const std::vector<Req>& reqs, std::vector<Res>& res) {
+    res.resize(reqs.size());
+    if (reqs.empty()) return;
 
-        r = parse_res(buf, pos, &res, &body_len);
-        if (r != 0) goto parse_err;
+    size_t i = 0;
+    int status = 0;
+    if (!this->connected() && !this->connect(FLG_http_conn_timeout)) {
+        status = 577; // Connection Timeout
+        goto err_end;
+    }
 
-        do {
-            size_t total_len = pos + 4 + body_len;
-
-            if (body_len > 0) {
-                if (buf.size() < total_len) {
-                    buf.reserve(total_len);
-                    r = this->recvn(
-                        (void*)(buf.data() + buf.size()), 
-                        (int)(total_len - buf.size()), FLG_http_recv_timeout
-                    );
-
-                    if (unlikely(r == 0)) goto recv_zero_err;
-                    if (unlikely(r == -1)) goto recv_err;
-                    buf.resize(total_len);
+    // send requests in groups, headers of a group are put in one buffer, and
+    // sent together with the bodies by one writev
+    do {
+        const size_t kGroup = 64;
+        fastring h;
+        std::vector<size_t> hlen(kGroup);
+        std::vector<co::iovec> iov(kGroup * 2);
+
+        for (size_t beg = 0; beg < reqs.size(); beg += kGroup) {
+            const size_t end = beg + kGroup < reqs.size() ? beg + kGroup : reqs.size();
+            h.clear();
+            for (size_t k = beg; k < end; ++k) {
+                const size_t x = h.size();
+                h << reqs[k].header_str();
+                if (auto_decode(reqs[k])) {
+                    h.resize(h.size() - 2);
+                    h << "Accept-Encoding: gzip, deflate\r\n\r\n";
                 }
+                hlen[k - beg] = h.size() - x;
+            }
 
-                res.set_body(buf.substr(pos + 4, body_len));
+            int n = 0;
+            size_t off = 0;
+            for (size_t k = beg; k < end; ++k) {
+                iov[n].iov_base = (void*)(h.data() + off);
+                iov[n].iov_len = hlen[k - beg];
+                off += hlen[k - beg];
+                ++n;
+                if (reqs[k].body().empty()) continue;
+                iov[n].iov_base = (void*) reqs[k].body().data();
+                iov[n].iov_len = reqs[k].body().size();
+                ++n;
             }
 
-            if (buf.size() != total_len) goto content_length_err;
-        } while (0);
+            if (co::writev(_fd, iov.data(), n, FLG_http_send_timeout) == -1) {
+                ELOG << "http send error: " << co::strerror();
+                status = co::error() == ETIMEDOUT ? 579 : 581;
+                this->close_conn();
+                goto err_end;
+            }
+        }
+    } while (0);
 
-        HTTPLOG << "http recv res: " << res.dbg();
-        goto success;
+    for (; i < reqs.size(); ++i) {
+        _head = reqs[i].is_method_head();
+        _decode = auto_decode(reqs[i]);
+        if (!this->recv_res(res[i])) {
+            status = res[i].status();
+            ++i;
+            goto err_end;
+        }
+
+        // the server will close the connection, responses left are lost
+        if (_close && i + 1 < reqs.size()) {
+            this->close_conn();
+            status = 578; // Connection Closed
+            ++i;
+            goto err_end;
+        }
+    }
+
+    if (_close) this->close_conn();
+    return;
+
+  err_end:
+    for (; i < reqs.size(); ++i) res[i].set_status(status);
+}
+
+bool Client::begin_req(const Req& req) {
+    return this->send_req(req, true) == 0;
+}
+
+int Client::write_body(const void* data, int n) {
+    if (n <= 0) return 0; // an empty chunk would end the body
+    char hex[20];
+    int k = snprintf(hex, sizeof(hex), "%x\r\n", n);
+    co::iovec iov[3] = {
+        { hex, (size_t)k },
+        { (void*)data, (size_t)n },
+        { (void*)"\r\n", 2 },
+    };
+    if (co::writev(_fd, iov, 3, FLG_http_send_timeout) == -1) {
+        ELOG << "http send error: " << co::strerror();
+        this->close_conn();
+        return -1;
+    }
+    return n;
+}
+
+bool Client::end_req() {
+    if (co::send(_fd, "0\r\n\r\n", 5, FLG_http_send_timeout) == -1) {
+        ELOG << "http send error: " << co::strerror();
+        this->close_conn();
+        return false;
+    }
+    return true;
+}
+
+bool Client::recv_header(Res& res) {
+    if (!this->connected()) {
+        res.set_status(578); // Connection Closed
+        return false;
+    }
+
+    int r = 0;
+    int64 len = 0;
+    co::BufferedConn* bc = this->conn();
+    Parser parser;
+
+    do {
+        res.clear();
+        parser.reset();
+        while ((r = parser.parse_res(bc->data(), bc->size())) == Parser::kMore) {
+            if (bc->size() > (size_t) FLG_http_max_header_size) goto header_too_long_err;
+            r = bc->peek(bc->size() + 1, FLG_http_recv_timeout);
+            if (unlikely(r == 0)) goto recv_zero_err;
+            if (unlikely(r == -1)) goto recv_err;
+        }
+
+        if (r != 0) goto parse_err;
+        set_res(parser, bc->data(), &res);
+        bc->consume(parser.header_len());
+    } while (res.status() == 100); // skip "100 Continue"
+
+    do {
+        const fastring& conn = res.header(kHeaderConnection);
+        if (res.is_version_http10()) {
+            _close = conn.size() != 10 || !equal_nocase(conn.data(), "keep-alive", 10);
+        } else {
+            _close = conn.size() == 5 && equal_nocase(conn.data(), "close", 5);
+        }
     } while (0);
 
+    // no body in responses to HEAD, or with status 1xx, 204, 304
+    len = parser.content_length();
+    if (_head || res.status() < 200 || res.status() == 204 || res.status() == 304) {
+        _reader->init(bc, 0, false);
+    } else if (parser.chunked()) {
+        _reader->init(bc, -1, true);
+    } else {
+        // without Content-Length, the body ends with the connection if it will
+        // be closed or Transfer-Encoding is present, otherwise there is no body.
+        if (len < 0 && !_close && !parser.has_transfer_encoding()) len = 0;
+        _reader->init(bc, len, false);
+        if (len < 0) _close = true;
+    }
+    return true;
+
   header_too_long_err:
     ELOG << "http recv error: header too long";
     res.set_status(500);
     goto err_end;
-  content_length_err:
-    ELOG << "http content length error";
-    res.set_status(500);
-    goto err_end;
   parse_err:
     ELOG << "http parse response error..";
     res.set_status(500);
@@ -288,209 +1104,95 @@ void Client::call(const Req& req, Res& res) {
     ELOG << "http recv error: " << co::strerror();
     res.set_status(co::error() == ETIMEDOUT ? 580 : 582);
     goto err_end;
-  send_err:
-    ELOG << "http send error: " << co::strerror();
-    res.set_status(co::error() == ETIMEDOUT ? 579 : 581);
-    goto err_end;
   err_end:
-    this->disconnect();
-  success:
-    return;
+    this->close_conn();
+    return false;
 }
 
-fastring Req::str() const {
-    fastring s;
-    s << method_str() << ' ' << _url << ' ' << version_str() << "\r\n";
-
-    if (!_body.empty() && !this->parsing()) {
-        s << "Content-Length: " << _body.size() << "\r\n";
-    }
-
-    for (size_t i = 0; i < _headers.size(); i += 2) {
-        s << _headers[i] << ": " << _headers[i + 1] << "\r\n";
+int Client::read_body(void* buf, int n, int ms) {
+    if (!_bc || !this->connected()) return 0;
+    int r = _reader->read(buf, n, ms);
+    if (r == -1) {
+        ELOG << "http recv error: " << co::strerror();
+        this->close_conn();
+    } else if (r == 0 && _close) {
+        this->close_conn();
     }
-
-    s << "\r\n";
-    if (!_body.empty()) s << _body;
-    return std::move(s);
+    return r;
 }
 
-fastring Req::dbg() const {
+fastring Req::header_str() const {
     fastring s;
-    s << method_str() << ' ' << _url << ' ' << version_str() << "\r\n";
-
-    if (!_body.empty() && !this->parsing()) {
-        s << "Content-Length: " << _body.size() << "\r\n";
-    }
-
-    for (size_t i = 0; i < _headers.size(); i += 2) {
-        s << _headers[i] << ": " << _headers[i + 1] << "\r\n";
-    }
-
-    return std::move(s);
+    this->header_str(s, false);
+    return s;
 }
 
-fastring Res::str() const {
-    fastring s;
-    s << version_str() << ' ' << status() << ' ' << status_str() << "\r\n";
+void Req::header_str(fastring& s, bool chunked) const {
+    s << method_str() << ' ' << _url << ' ' << version_str() << "\r\n";
 
-    if (!this->parsing()) {
+    if (chunked) {
+        s << "Transfer-Encoding: chunked\r\n";
+    } else if (!_body.empty() && !this->parsing()) {
         s << "Content-Length: " << _body.size() << "\r\n";
     }
 
-    for (size_t i = 0; i < _headers.size(); i += 2) {
-        s << _headers[i] << ": " << _headers[i + 1] << "\r\n";
+    for (size_t i = 0; i < _nh; i += 2) {
+        const fastring& k = _headers[i];
+        if (chunked && ((k.size() == 14 && equal_nocase(k.data(), "content-length", 14)) ||
+            (k.size() == 17 && equal_nocase(k.data(), "transfer-encoding", 17)))) {
+            continue;
+        }
+        s << k << ": " << _headers[i + 1] << "\r\n";
     }
 
     s << "\r\n";
-    if (!_body.empty()) s << _body;
-    return std::move(s);
 }
 
-fastring Res::dbg() const {
-    fastring s;
-    s << version_str() << ' ' << status() << ' ' << status_str() << "\r\n";
-
-    if (!this->parsing()) {
-        s << "Content-Length: " << _body.size() << "\r\n";
-    }
-
-    for (size_t i = 0; i < _headers.size(); i += 2) {
-        s << _headers[i] << ": " << _headers[i + 1] << "\r\n";
-    }
-
-    return std::move(s);
+fastring Req::str() const {
+    fastring s = this->header_str();
+    if (!_body.empty()) s << _body;
+    return s;
 }
 
-int parse_req_start_line(const char* beg, const char* end, Req* req) {
-    const char* p = strchr(beg, ' ');
-    if (!p || p >= end) return 400; // Bad Request
-
-    fastring method(std::move(fastring(beg, p - beg).toupper()));
-    if (method == "GET") {
-        req->set_method_get();
-    } else if (method == "POST") {
-        req->set_method_post();
-    } else if (method == "HEAD") {
-        req->set_method_head();
-    } else if (method == "PUT") {
-        req->set_method_put();
-    } else if (method == "DELETE") {
-        req->set_method_delete();
-    } else {
-        return 405; // Method Not Allowed
-    }
-    
-    do { ++p; } while (*p == ' ' && p < end);
-    const char* q = strchr(p, ' ');
-    if (!q || q >= end) return 400;
-    req->set_url(fastring(p, q - p));
-
-    do { ++q; } while (*q == ' ' && q < end);
-    if (q >= end) return 400;
-
-    fastring version(std::move(fastring(q, end - q).toupper()));
-    if (version == "HTTP/1.1") {
-        req->set_version_http11();
-    } else if (version == "HTTP/1.0") {
-        req->set_version_http10();
-    } else {
-        return 505; // HTTP Version Not Supported
-    }
-
-    return 0;
+fastring Req::dbg() const {
+    fastring s = this->header_str();
+    s.resize(s.size() - 2);
+    return s;
 }
 
-int parse_header(fastring& s, size_t beg, size_t end, Base* base, int* body_len) {
-    size_t x;
-    while (beg < end) {
-        x = s.find('\r', beg);
-        if (s[x + 1] != '\n') return -1;
+fastring Res::header_str() const {
+    fastring s(256);
+    this->header_str(s);
+    return s;
+}
 
-        size_t t = s.find(':', beg);
-        if (t >= x) return -1;
+void Res::header_str(fastring& s) const {
+    static const fastring* lines = create_status_lines();
+    s.append(lines[_version * 600 + _status]);
 
-        fastring key = s.substr(beg, t - beg);
-        do { ++t; } while (s[t] == ' ' && t < x);
-        base->add_header(std::move(key), s.substr(t, x - t));
-        beg = x + 2;
+    if (_streaming) {
+        if (this->is_version_http11()) s << "Transfer-Encoding: chunked\r\n";
+    } else if (!this->parsing() && _status >= 200 && _status != 204 && _status != 304) {
+        s << "Content-Length: " << (_file.empty() ? (int64)_body.size() : _file_len) << "\r\n";
     }
 
-    fastring v = base->header("CONTENT-LENGTH");
-    if (v.empty() || v == "0") {
-        *body_len = 0;
-        return 0;
-    } else {
-        int len = atoi(v.c_str());
-        if (len <= 0) {
-            ELOG << "http parse error, invalid content-length: " << v;
-            return -1;
-        }
-
-        if (len > FLG_http_max_body_size) {
-            ELOG << "http parse error, content-length is too long: " << v;
-            return -1;
-        }
-
-        *body_len = len;
-        return 0;
+    for (size_t i = 0; i < _nh; i += 2) {
+        s << _headers[i] << ": " << _headers[i + 1] << "\r\n";
     }
-}
-
-int parse_req(fastring& s, size_t end, Req* req, int* body_len) {
-    req->set_parsing();
 
-    // start line
-    size_t p = s.find('\r');
-    if (s[p + 1] != '\n') return 400;
-
-    const char* beg = s.c_str();
-    int r = parse_req_start_line(beg, beg + p, req);
-    if (r != 0) return r;
-    p += 2;
-
-    // headers 
-    r = parse_header(s, p, end, req, body_len);
-    return r == 0 ? 0 : 400;
+    s << "\r\n";
 }
 
-int parse_res_start_line(const char* beg, const char* end, Res* res) {
-    const char* p = strchr(beg, ' ');
-    if (!p || p >= end) return -1;
-
-    fastring version(std::move(fastring(beg, p - beg).toupper()));
-    if (version == "HTTP/1.1") {
-        res->set_version_http11();
-    } else if (version == "HTTP/1.0") {
-        res->set_version_http10();
-    }
-    
-    do { ++p; } while (*p == ' ' && p < end);
-    const char* q = strchr(p, ' ');
-    if (!q || q >= end) return -1;
-
-    int status = atoi(fastring(p, q - p).c_str());
-    res->set_status(status);
-
-    do { ++q; } while (*q == ' ' && q < end);
-    if (q >= end) return -1;
-    return 0;
+fastring Res::str() const {
+    fastring s = this->header_str();
+    if (!_body.empty()) s << _body;
+    return s;
 }
 
-int parse_res(fastring& s, size_t end, Res* res, int* body_len) {
-    res->set_parsing();
-
-    // start line
-    size_t p = s.find('\r');
-    if (s[p + 1] != '\n') return -1;
-
-    const char* beg = s.c_str();
-    int r = parse_res_start_line(beg, beg + p, res);
-    if (r != 0) return r;
-    p += 2;
-
-    // headers 
-    return parse_header(s, p, end, res, body_len);
+fastring Res::dbg() const {
+    fastring s = this->header_str();
+    s.resize(s.size() - 2);
+    return s;
 }
 
 const char** Res::create_status_table() {
@@ -534,6 +1236,7 @@ const char** Res::create_status_table() {
     s[415] = "Unsupported Media Type";
     s[416] = "Requested Range Not Satisfiable";
     s[417] = "Expectation Failed";
+    s[431] = "Request Header Fields Too Large";
 
     s[500] = "Internal Server Error";
     s[501] = "Not Implemented";
@@ -554,55 +1257,107 @@ const char** Res::create_status_table() {
     return s;
 }
 
-} // http
+// "HTTP/1.x 200 OK\r\n"... for all versions and status codes
+const fastring* Res::create_status_lines() {
+    static fastring s[2 * 600];
+    static const char* v[] = { "HTTP/1.0", "HTTP/1.1" };
+    for (int i = 0; i < 2; ++i) {
+        for (int k = 100; k < 600; ++k) {
+            s[i * 600 + k] << v[i] << ' ' << k << ' ' << Res::status_str(k) << "\r\n";
+        }
+    }
+    return s;
+}
 
-void easy(const char* root_dir, const char* ip, int port) {
-    http::Server serv(ip, port);
-    std::vector<LruMap<fastring, std::pair<fastring, int64>>> contents(co::max_sched_num());
-    fastring root(root_dir);
-    if (root.empty()) root.append('.');
+// calls of fan_out() on heap, they may live longer than fan_out() if they
+// are not done before the deadline.
+struct FanOut {
+    explicit FanOut(size_t n)
+        : calls(n, Call("", 0)), fds(n, (sock_t)-1), done(n, 0), left((int)n), expired(false) {
+    }
 
-    serv.on_req(
-        [&](const http::Req& req, http::Res& res) {
-            if (!req.is_method_get()) {
-                res.set_status(405);
-                return;
+    co::Event ev;
+    std::vector<Call> calls;
+    std::vector<sock_t> fds; // sockets of calls in progress
+    std::vector<char> done;
+    int left;                // number of calls not done
+    bool expired;            // fan_out() has returned
+};
+
+// coroutines of a fan-out run in the same scheduler, no lock is needed.
+static void fan_out_call(const std::shared_ptr<FanOut>& s, size_t i) {
+    Call& c = s->calls[i];
+    if (!s->expired) {
+        Client cli(c.ip.c_str(), c.port);
+        cli.use_pool();
+        if (cli.connect(FLG_http_conn_timeout)) {
+            if (!s->expired) {
+                s->fds[i] = cli.fd();
+                cli.call(c.req, c.res);
+                s->fds[i] = (sock_t)-1;
             }
+        } else {
+            c.res.set_status(577); // Connection Timeout
+        }
+    }
 
-            fastring url = path::clean(req.url());
-            if (!url.starts_with('/')) {
-                res.set_status(403);
-                return;
-            }
+    s->done[i] = 1;
+    if (--s->left == 0 && !s->expired) s->ev.signal();
+}
 
-            fastring path = path::join(root, url);
-            if (fs::isdir(path)) path = path::join(path, "index.html");
-
-            auto& map = contents[co::sched_id()];
-            auto it = map.find(path);
-            if (it != map.end()) {
-                if (now::ms() < it->second.second + 300 * 1000) {
-                    res.set_status(200);
-                    res.set_body(it->second.first);
-                    return;
-                } else {
-                    map.erase(it); // timeout
-                }
-            }
+// move @from to @to, the body is swapped, not copied
+static void move_res(Res& from, Res& to) {
+    to.clear();
+    to.set_status(from.status());
+    from.is_version_http10() ? to.set_version_http10() : to.set_version_http11();
+    for (int i = 0; i < from.header_num(); ++i) {
+        to.add_header(from.header_key(i), from.header_value(i));
+    }
+    to.mutable_body().swap(from.mutable_body());
+}
 
-            fs::file f(path.c_str(), 'r');
-            if (!f) {
-                res.set_status(404);
-                return;
-            }
+int fan_out(std::vector<Call>& calls, int ms) {
+    if (calls.empty()) return 0;
+    const int id = co::sched_id();
+    CHECK(id >= 0) << "fan_out() must be called in coroutine..";
+
+    std::shared_ptr<FanOut> s(new FanOut(calls.size()));
+    for (size_t i = 0; i < calls.size(); ++i) {
+        s->calls[i].ip = calls[i].ip;
+        s->calls[i].port = calls[i].port;
+        s->calls[i].req = calls[i].req;
+        co::go_on(id, new_callback([s, i]() { fan_out_call(s, i); }));
+    }
 
-            fastring s = f.read(f.size());
-            map.insert(path, std::make_pair(s, now::ms()));
-            res.set_status(200);
-            res.set_body(std::move(s));
+    // the coroutines run after this one is suspended, and the last one done
+    // signals the event
+    if (ms < 0) {
+        s->ev.wait();
+    } else {
+        s->ev.wait((unsigned int) ms);
+    }
+    s->expired = true;
+
+    int n = 0;
+    for (size_t i = 0; i < calls.size(); ++i) {
+        if (s->done[i]) {
+            move_res(s->calls[i].res, calls[i].res);
+            ++n;
+        } else {
+            // wake up the call blocked on the socket, it will close the socket
+            if (s->fds[i] != (sock_t)-1) co::shutdown(s->fds[i]);
+            calls[i].res.clear();
+            calls[i].res.set_status(580); // Recv Timeout
         }
-    );
+    }
+    return n;
+}
+
+} // http
 
+void easy(const char* root_dir, const char* ip, int port) {
+    http::Server serv(ip, port);
+    serv.on_req(http::StaticFiles(root_dir));
     serv.start();
     while (true) sleep::sec(1024);
 }
@@ -0,0 +1,834 @@
+#include "co/so/http.h"
+#include "co/so/hpack.h"
+#include "co/co.h"
+#include "co/buffered_conn.h"
+#include "co/flag.h"
+#include "co/log.h"
+#include "co/fs.h"
+#include "co/time.h"
+#include <memory>
+#include <unordered_map>
+
+DEF_int32(http2_max_streams, 128, "#2 max concurrent streams of an http/2 connection");
+DEF_int32(http2_window_size, 1 << 20, "#2 flow control window of http/2 streams and connections for receiving, default: 1M");
+DEF_int32(http2_max_buffered_size, 16 << 20, "#2 max bytes of request bodies held by an http/2 connection, streams going beyond it get 503, default: 16M");
+
+DEC_int32(http_max_header_size);
+DEC_int32(http_max_body_size);
+DEC_int32(http_recv_timeout);
+DEC_int32(http_send_timeout);
+DEC_int32(http_conn_idle_sec);
+DEC_int32(http_max_idle_conn);
+DEC_bool(http_log);
+
+#define HTTPLOG LOG_IF(FLG_http_log)
+
+namespace so {
+namespace http {
+
+enum FrameType {
+    kFrameData = 0,
+    kFrameHeaders = 1,
+    kFramePriority = 2,
+    kFrameRstStream = 3,
+    kFrameSettings = 4,
+    kFramePushPromise = 5,
+    kFramePing = 6,
+    kFrameGoAway = 7,
+    kFrameWindowUpdate = 8,
+    kFrameContinuation = 9,
+};
+
+enum FrameFlag {
+    kFlagEndStream = 0x1,
+    kFlagAck = 0x1,
+    kFlagEndHeaders = 0x4,
+    kFlagPadded = 0x8,
+    kFlagPriority = 0x20,
+};
+
+enum ErrorCode {
+    kErrNone = 0x0,
+    kErrProtocol = 0x1,
+    kErrInternal = 0x2,
+    kErrFlowControl = 0x3,
+    kErrStreamClosed = 0x5,
+    kErrFrameSize = 0x6,
+    kErrRefusedStream = 0x7,
+    kErrCancel = 0x8,
+    kErrCompression = 0x9,
+    kErrEnhanceYourCalm = 0xb,
+};
+
+enum Setting {
+    kSettingHeaderTableSize = 1,
+    kSettingEnablePush = 2,
+    kSettingMaxConcurrentStreams = 3,
+    kSettingInitialWindowSize = 4,
+    kSettingMaxFrameSize = 5,
+    kSettingMaxHeaderListSize = 6,
+};
+
+static const uint32 kDefaultFrameSize = 16384; // the max frame size we accept
+static const int64 kMaxWindow = 0x7fffffff;
+static const size_t kMaxOutBytes = 256 * 1024; // frames waiting for the writer
+
+static inline uint32 get_u32(const char* s) {
+    const uint8* p = (const uint8*) s;
+    return ((uint32)p[0] << 24) | ((uint32)p[1] << 16) | ((uint32)p[2] << 8) | p[3];
+}
+
+static inline void put_u32(fastring& s, uint32 v) {
+    const char b[4] = { (char)(v >> 24), (char)(v >> 16), (char)(v >> 8), (char) v };
+    s.append(b, 4);
+}
+
+static inline void put_frame_header(fastring& s, uint32 len, int type, int flags, uint32 id) {
+    const char b[9] = {
+        (char)(len >> 16), (char)(len >> 8), (char) len, (char) type, (char) flags,
+        (char)(id >> 24), (char)(id >> 16), (char)(id >> 8), (char) id
+    };
+    s.append(b, 9);
+}
+
+struct H2Stream {
+    H2Stream(uint32 id, int64 send_window, int64 recv_window)
+        : id(id), send_window(send_window), recv_window(recv_window),
+          unacked(0), buffered(0), status(0), end_stream(false), reset(false) {
+    }
+
+    uint32 id;
+    int64 send_window; // bytes we may send
+    int64 recv_window; // bytes the peer may send
+    int64 unacked;     // bytes received, not acked by WINDOW_UPDATE yet
+    int64 buffered;    // bytes of the body counted in H2Conn::_buffered
+    int status;        // the response without calling the handler, if not 0
+    bool end_stream;   // the request is received
+    bool reset;        // RST_STREAM sent or received
+    Req req;
+    Res res;
+};
+
+typedef std::shared_ptr<H2Stream> StreamPtr;
+
+// An HTTP/2 connection. The coroutine of the connection reads frames, each
+// stream is handled in a coroutine of the same scheduler, and frames of all
+// streams are sent by a writer coroutine. These coroutines share the state on
+// heap, no lock is needed as they run in one thread.
+class H2Conn : public std::enable_shared_from_this<H2Conn> {
+  public:
+    H2Conn(Server* serv, sock_t fd)
+        : _serv(serv), _fd(fd), _sched(co::sched_id()), _last_id(0), _cont_id(0),
+          _cont_end(false), _send_window(65535), _recv_window(65535), _unacked(0), _buffered(0),
+          _init_window(65535), _max_frame_size(kDefaultFrameSize), _nframes(0), _active(0),
+          _dead(false), _closing(false), _abort(false), _goaway(false), _writer_done(false) {
+        _dec.set_max_list_size((size_t) FLG_http_max_header_size);
+    }
+
+    ~H2Conn() = default;
+
+    // serve the connection until it is closed, the preface has been consumed
+    void serve(co::BufferedConn& bc);
+
+    // the writer coroutine
+    void write_loop();
+
+    // handle the request of @s, in a coroutine of its own
+    void run(const StreamPtr& s);
+
+  private:
+    int on_frame(int type, int flags, uint32 id, const char* p, uint32 len);
+    int on_data(int flags, uint32 id, const char* p, uint32 len);
+    int on_stream_data(int flags, uint32 id, const char* p, uint32 len);
+    int on_headers(int flags, uint32 id, const char* p, uint32 len);
+    int on_header_block();
+    int on_settings(int flags, uint32 id, const char* p, uint32 len);
+    int on_window_update(uint32 id, const char* p, uint32 len);
+    int set_req(H2Stream* s, size_t m);
+    void start(const StreamPtr& s);
+
+    void send_settings();
+    void send_rst(uint32 id, uint32 err);
+    void send_window_update(uint32 id, uint32 n);
+    void release(H2Stream* s);
+    void send_goaway(uint32 err);
+    void send_headers(H2Stream* s, bool end_stream);
+    int send_data(H2Stream* s, const char* p, size_t n, bool end_stream);
+    void send_res(H2Stream* s);
+    void wake() { _out_ev.signal(); }
+    void set_dead();
+
+  private:
+    Server* _serv;
+    sock_t _fd;
+    int _sched;
+    hpack::Decoder _dec;
+    std::vector<fastring> _h;  // fields decoded from a header block
+    std::unordered_map<uint32, StreamPtr> _streams;
+    uint32 _last_id;           // the last stream opened by the peer
+    uint32 _cont_id;           // the stream expecting CONTINUATION, 0 for none
+    bool _cont_end;            // END_STREAM on the HEADERS
+    fastring _block;           // the header block being received
+    fastring _out;             // frames to be sent by the writer
+    co::Event _out_ev;         // frames added, or the connection is closing
+    co::Event _drain_ev;       // frames sent by the writer
+    co::Event _window_ev;      // send windows increased, or streams reset
+    co::Event _done_ev;        // the writer exits
+    int64 _send_window;        // of the connection
+    int64 _recv_window;
+    int64 _unacked;
+    int64 _buffered;           // bytes of request bodies held by streams
+    int64 _init_window;        // SETTINGS_INITIAL_WINDOW_SIZE of the peer
+    uint32 _max_frame_size;    // SETTINGS_MAX_FRAME_SIZE of the peer
+    uint64 _nframes;           // frames received
+    int _active;               // streams being handled
+    bool _dead;                // the connection is broken
+    bool _closing;             // the reader is done
+    bool _abort;               // close without waiting for streams
+    bool _goaway;              // GOAWAY received, no new streams
+    bool _writer_done;
+};
+
+void H2Conn::set_dead() {
+    _dead = true;
+    _out_ev.signal();
+    _drain_ev.signal();
+    _window_ev.signal();
+}
+
+void H2Conn::write_loop() {
+    fastring buf;
+    while (true) {
+        if (_out.empty()) {
+            if (_dead || (_closing && (_abort || _active == 0))) break;
+            _out_ev.wait();
+            continue;
+        }
+
+        buf.swap(_out);
+        const int r = co::send(_fd, buf.data(), (int) buf.size(), FLG_http_send_timeout);
+        buf.clear();
+        if (buf.capacity() > kMaxOutBytes * 4) fastring().swap(buf);
+        _drain_ev.signal();
+        if (unlikely(r == -1)) {
+            ELOG << "http2 send error: " << co::strerror();
+            this->set_dead();
+            co::shutdown(_fd); // wake up the reader
+            break;
+        }
+    }
+
+    _writer_done = true;
+    _done_ev.signal();
+}
+
+void H2Conn::send_settings() {
+    put_frame_header(_out, 4 * 6, kFrameSettings, 0, 0);
+    const uint32 s[4][2] = {
+        { kSettingEnablePush, 0 },
+        { kSettingMaxConcurrentStreams, (uint32) FLG_http2_max_streams },
+        { kSettingInitialWindowSize, (uint32) FLG_http2_window_size },
+        { kSettingMaxHeaderListSize, (uint32) FLG_http_max_header_size },
+    };
+    for (int i = 0; i < 4; ++i) {
+        const char b[2] = { (char)(s[i][0] >> 8), (char) s[i][0] };
+        _out.append(b, 2);
+        put_u32(_out, s[i][1]);
+    }
+
+    // the window of the connection starts from 65535, not changed by settings
+    if (FLG_http2_window_size > 65535) {
+        this->send_window_update(0, (uint32)(FLG_http2_window_size - 65535));
+        _recv_window = FLG_http2_window_size;
+    }
+    this->wake();
+}
+
+void H2Conn::send_rst(uint32 id, uint32 err) {
+    put_frame_header(_out, 4, kFrameRstStream, 0, id);
+    put_u32(_out, err);
+    this->wake();
+}
+
+void H2Conn::send_window_update(uint32 id, uint32 n) {
+    put_frame_header(_out, 4, kFrameWindowUpdate, 0, id);
+    put_u32(_out, n);
+    this->wake();
+}
+
+void H2Conn::send_goaway(uint32 err) {
+    put_frame_header(_out, 8, kFrameGoAway, 0, 0);
+    put_u32(_out, _last_id);
+    put_u32(_out, err);
+    this->wake();
+}
+
+void H2Conn::serve(co::BufferedConn& bc) {
+    int r;
+    uint32 err = kErrNone;
+    this->send_settings();
+
+    while (!_dead) {
+        r = bc.peek(9, FLG_http_conn_idle_sec * 1000);
+        if (unlikely(r == 0)) goto recv_zero_err;
+        if (unlikely(r == -1)) {
+            if (co::error() != ETIMEDOUT || _dead) goto recv_err;
+            if (_active == 0 && _serv->_conn_num > FLG_http_max_idle_conn) goto idle_err;
+            continue;
+        }
+
+        do {
+            const char* p = bc.data();
+            const uint32 len = get_u32(p) >> 8;
+            const int type = (uint8) p[3];
+            const int flags = (uint8) p[4];
+            const uint32 id = get_u32(p + 5) & 0x7fffffff;
+            if (len > kDefaultFrameSize) {
+                err = kErrFrameSize;
+                goto proto_err;
+            }
+
+            if (bc.size() < 9 + len) {
+                r = bc.peek(9 + len, FLG_http_recv_timeout);
+                if (unlikely(r == 0)) goto recv_zero_err;
+                if (unlikely(r == -1)) goto recv_err;
+            }
+
+            // nothing here yields, data in the buffer stays where it is
+            ++_nframes;
+            err = this->on_frame(type, flags, id, bc.data() + 9, len);
+            bc.consume(9 + len);
+            if (err != kErrNone) goto proto_err;
+        } while (0);
+    }
+    goto end;
+
+  recv_zero_err:
+    LOG << "http2 client close the connection, fd: " << _fd;
+    this->set_dead();
+    goto end;
+  idle_err:
+    ELOG << "http2 close idle connection, fd: " << _fd;
+    this->send_goaway(kErrNone);
+    goto end;
+  recv_err:
+    if (!_dead) ELOG << "http2 recv error: " << co::strerror();
+    this->set_dead();
+    goto end;
+  proto_err:
+    ELOG << "http2 protocol error: " << err << ", fd: " << _fd;
+    this->send_goaway(err);
+    _abort = true;
+  end:
+    // wait for the writer to send what is left
+    _closing = true;
+    this->wake();
+    while (!_writer_done) _done_ev.wait();
+    if (_dead) {
+        co::reset_tcp_socket(_fd, 1000);
+    } else {
+        co::close(_fd);
+    }
+    this->set_dead();
+}
+
+int H2Conn::on_frame(int type, int flags, uint32 id, const char* p, uint32 len) {
+    // a header block must not be interrupted by other frames
+    if (_cont_id != 0 && (type != kFrameContinuation || id != _cont_id)) return kErrProtocol;
+
+    switch (type) {
+      case kFrameData:
+        return this->on_data(flags, id, p, len);
+
+      case kFrameHeaders:
+        return this->on_headers(flags, id, p, len);
+
+      case kFrameContinuation:
+        if (_cont_id == 0) return kErrProtocol;
+        if (_block.size() + len > (size_t) FLG_http_max_header_size) return kErrEnhanceYourCalm;
+        _block.append(p, len);
+        return (flags & kFlagEndHeaders) ? this->on_header_block() : kErrNone;
+
+      case kFramePriority:
+        if (id == 0) return kErrProtocol;
+        if (len != 5) this->send_rst(id, kErrFrameSize);
+        return kErrNone;
+
+      case kFrameRstStream:
+        if (id == 0 || id > _last_id) return kErrProtocol;
+        if (len != 4) return kErrFrameSize;
+        do {
+            auto it = _streams.find(id);
+            if (it != _streams.end()) {
+                StreamPtr s = it->second;
+                s->reset = true;
+                _streams.erase(it);
+                if (!s->end_stream) this->release(s.get());
+                _window_ev.signal();
+            }
+        } while (0);
+        return kErrNone;
+
+      case kFrameSettings:
+        return this->on_settings(flags, id, p, len);
+
+      case kFramePushPromise:
+        return kErrProtocol; // clients never push
+
+      case kFramePing:
+        if (id != 0) return kErrProtocol;
+        if (len != 8) return kErrFrameSize;
+        if (!(flags & kFlagAck)) {
+            put_frame_header(_out, 8, kFramePing, kFlagAck, 0);
+            _out.append(p, 8);
+            this->wake();
+        }
+        return kErrNone;
+
+      case kFrameGoAway:
+        if (id != 0) return kErrProtocol;
+        _goaway = true;
+        return kErrNone;
+
+      case kFrameWindowUpdate:
+        return this->on_window_update(id, p, len);
+
+      default:
+        return kErrNone; // unknown frames are ignored
+    }
+}
+
+int H2Conn::on_settings(int flags, uint32 id, const char* p, uint32 len) {
+    if (id != 0) return kErrProtocol;
+    if (flags & kFlagAck) return len == 0 ? kErrNone : kErrFrameSize;
+    if (len % 6 != 0) return kErrFrameSize;
+
+    for (uint32 i = 0; i < len; i += 6) {
+        const int k = ((uint8)p[i] << 8) | (uint8)p[i + 1];
+        const uint32 v = get_u32(p + i + 2);
+        switch (k) {
+          case kSettingEnablePush:
+            if (v > 1) return kErrProtocol;
+            break;
+          case kSettingInitialWindowSize:
+            if (v > kMaxWindow) return kErrFlowControl;
+            // the change applies to all streams, windows may be negative
+            for (auto it = _streams.begin(); it != _streams.end(); ++it) {
+                H2Stream* s = it->second.get();
+                s->send_window += (int64) v - _init_window;
+                if (s->send_window > kMaxWindow) return kErrFlowControl;
+            }
+            _init_window = v;
+            _window_ev.signal();
+            break;
+          case kSettingMaxFrameSize:
+            if (v < kDefaultFrameSize || v > 0xffffff) return kErrProtocol;
+            _max_frame_size = v;
+            break;
+          default:
+            // the encoder does not use the dynamic table, the header table
+            // size is not a concern, and unknown settings are ignored
+            break;
+        }
+    }
+
+    put_frame_header(_out, 0, kFrameSettings, kFlagAck, 0);
+    this->wake();
+    return kErrNone;
+}
+
+int H2Conn::on_window_update(uint32 id, const char* p, uint32 len) {
+    if (len != 4) return kErrFrameSize;
+    const uint32 n = get_u32(p) & 0x7fffffff;
+
+    if (id == 0) {
+        if (n == 0) return kErrProtocol;
+        _send_window += n;
+        if (_send_window > kMaxWindow) return kErrFlowControl;
+    } else {
+        if (id > _last_id) return kErrProtocol;
+        auto it = _streams.find(id);
+        if (it == _streams.end()) return kErrNone;
+        StreamPtr s = it->second;
+        if (n == 0 || s->send_window + n > kMaxWindow) {
+            this->send_rst(id, n == 0 ? kErrProtocol : kErrFlowControl);
+            s->reset = true;
+            _streams.erase(it);
+            if (!s->end_stream) this->release(s.get());
+        } else {
+            s->send_window += n;
+        }
+    }
+
+    _window_ev.signal();
+    return kErrNone;
+}
+
+int H2Conn::on_data(int flags, uint32 id, const char* p, uint32 len) {
+    if (id == 0) return kErrProtocol;
+
+    // flow control counts the whole payload, padding included
+    _recv_window -= len;
+    if (_recv_window < 0) return kErrFlowControl;
+    _unacked += len;
+
+    // The window of the connection is reopened as data arrives, the data is
+    // either discarded, or held in a body within FLG_http2_max_buffered_size.
+    // Holding the window back instead may stall all streams, when the bodies
+    // held are of requests not finished.
+    if (_unacked >= FLG_http2_window_size / 2) {
+        this->send_window_update(0, (uint32) _unacked);
+        _recv_window += _unacked;
+        _unacked = 0;
+    }
+    return this->on_stream_data(flags, id, p, len);
+}
+
+// the body of @s is done or discarded
+void H2Conn::release(H2Stream* s) {
+    _buffered -= s->buffered;
+    s->buffered = 0;
+}
+
+int H2Conn::on_stream_data(int flags, uint32 id, const char* p, uint32 len) {
+    const uint32 size = len;
+    if (flags & kFlagPadded) {
+        if (len < 1 || (uint8)p[0] >= len) return kErrProtocol;
+        len -= 1 + (uint8)p[0];
+        ++p;
+    }
+
+    auto it = _streams.find(id);
+    if (it == _streams.end()) {
+        // data of streams closed or reset are discarded
+        return id > _last_id ? kErrProtocol : kErrNone;
+    }
+
+    StreamPtr s = it->second;
+    if (s->end_stream) {
+        this->send_rst(id, kErrStreamClosed);
+        s->reset = true;
+        _streams.erase(it);
+        return kErrNone;
+    }
+
+    s->recv_window -= size;
+    if (s->recv_window < 0) {
+        this->send_rst(id, kErrFlowControl);
+        s->reset = true;
+        _streams.erase(it);
+        this->release(s.get());
+        return kErrNone;
+    }
+
+    const bool too_large = s->req.body().size() + len > (size_t) FLG_http_max_body_size;
+    if (too_large || _buffered + len > FLG_http2_max_buffered_size) {
+        // respond before the request ends, and tell the peer to stop sending.
+        // 503 if the connection holds too many bodies.
+        s->res.set_status(too_large ? 413 : 503);
+        this->send_headers(s.get(), true);
+        this->send_rst(id, kErrNone);
+        s->reset = true;
+        _streams.erase(it);
+        this->release(s.get());
+        return kErrNone;
+    }
+    s->req.mutable_body().append(p, len);
+    s->buffered += len;
+    _buffered += len;
+
+    if (flags & kFlagEndStream) {
+        s->end_stream = true;
+        this->start(s);
+        return kErrNone;
+    }
+
+    // The window of the stream is not reopened beyond what the body may take,
+    // plus one byte, so a body too large gets 413, instead of stalling.
+    s->unacked += size;
+    if (s->unacked >= FLG_http2_window_size / 2) {
+        int64 n = FLG_http_max_body_size + 1 - (int64) s->req.body().size() - s->recv_window;
+        if (n > s->unacked) n = s->unacked;
+        if (n > 0) {
+            this->send_window_update(id, (uint32) n);
+            s->recv_window += n;
+            s->unacked -= n;
+        }
+    }
+    return kErrNone;
+}
+
+int H2Conn::on_headers(int flags, uint32 id, const char* p, uint32 len) {
+    if (id == 0 || (id & 1) == 0) return kErrProtocol;
+
+    if (flags & kFlagPadded) {
+        if (len < 1 || (uint8)p[0] >= len) return kErrProtocol;
+        len -= 1 + (uint8)p[0];
+        ++p;
+    }
+    if (flags & kFlagPriority) {
+        if (len < 5) return kErrProtocol;
+        p += 5;
+        len -= 5;
+    }
+    if (len > (uint32) FLG_http_max_header_size) return kErrEnhanceYourCalm;
+
+    _block.clear();
+    _block.append(p, len);
+    _cont_id = id;
+    _cont_end = (flags & kFlagEndStream) != 0;
+    return (flags & kFlagEndHeaders) ? this->on_header_block() : kErrNone;
+}
+
+int H2Conn::on_header_block() {
+    const uint32 id = _cont_id;
+    _cont_id = 0;
+
+    // the block must be decoded anyway, to keep the table of the decoder
+    size_t m = 0;
+    if (!_dec.decode(_block.data(), _block.size(), _h, &m)) return kErrCompression;
+
+    auto it = _streams.find(id);
+    if (it != _streams.end()) {
+        // trailers, they must end the stream, and are not used
+        StreamPtr s = it->second;
+        if (!_cont_end || s->end_stream) return kErrProtocol;
+        s->end_stream = true;
+        this->start(s);
+        return kErrNone;
+    }
+
+    if (id <= _last_id) return kErrStreamClosed;
+    _last_id = id;
+    if (_goaway || _closing) return kErrNone;
+
+    if ((int) _streams.size() >= FLG_http2_max_streams) {
+        this->send_rst(id, kErrRefusedStream);
+        return kErrNone;
+    }
+
+    StreamPtr s(new H2Stream(id, _init_window, FLG_http2_window_size));
+    if (this->set_req(s.get(), m) != 0) {
+        this->send_rst(id, kErrProtocol);
+        return kErrNone;
+    }
+
+    _streams[id] = s;
+    if (_cont_end) {
+        s->end_stream = true;
+        this->start(s);
+    }
+    return kErrNone;
+}
+
+// fill the request of @s with @m strings of fields decoded in _h, pseudo
+// headers are at the beginning. return -1 if the request is malformed.
+int H2Conn::set_req(H2Stream* s, size_t m) {
+    const fastring* method = 0;
+    const fastring* path = 0;
+    const fastring* authority = 0;
+    size_t i = 0;
+
+    for (; i < m && !_h[i].empty() && _h[i][0] == ':'; i += 2) {
+        const fastring& k = _h[i];
+        if (k == ":method") method = &_h[i + 1];
+        else if (k == ":path") path = &_h[i + 1];
+        else if (k == ":authority") authority = &_h[i + 1];
+        else if (k != ":scheme") return -1;
+    }
+    if (!method || !path || path->empty()) return -1;
+
+    static const char* methods[] = { "GET", "HEAD", "POST", "PUT", "DELETE", "OPTIONS" };
+    Req& req = s->req;
+    s->status = 405; // Method Not Allowed
+    for (int k = 0; k < (int)(sizeof(methods) / sizeof(methods[0])); ++k) {
+        if (*method == methods[k]) {
+            req.set_method((Method) k);
+            s->status = 0;
+            break;
+        }
+    }
+
+    // handlers see the request as HTTP/1.1, with Host from :authority
+    req.set_parsing();
+    req.set_version_http11();
+    req.set_url(*path);
+    if (authority) req.add_header("host", 4, authority->data(), authority->size());
+    for (; i < m; i += 2) {
+        const fastring& k = _h[i];
+        if (k.empty() || k[0] == ':') return -1; // pseudo headers must be first
+        if (authority && k == "host") continue;
+        req.add_header(k, _h[i + 1]);
+    }
+    return 0;
+}
+
+void H2Conn::start(const StreamPtr& s) {
+    ++_active;
+    std::shared_ptr<H2Conn> c = this->shared_from_this();
+    co::go_on(_sched, new_callback([c, s]() { c->run(s); }));
+}
+
+void H2Conn::run(const StreamPtr& s) {
+    Req& req = s->req;
+    Res& res = s->res;
+    HTTPLOG << "http2 recv req, stream " << s->id << ": " << req.dbg();
+
+    Metrics* m = _serv->_metrics.get();
+    const int64 beg_us = m ? now::us() : 0;
+    int route = -1;
+    if (s->status != 0) {
+        res.set_status(s->status);
+    } else {
+        route = _serv->handle(req, res);
+    }
+
+    const int64 out = req.is_method_head() ? 0 : (res.file().empty() ? res.body_len() : res.file_len());
+    if (!s->reset && !_dead) this->send_res(s.get());
+    if (m) m->record(route, req.method(), res.status(), req.body().size(), out, now::us() - beg_us);
+
+    auto it = _streams.find(s->id);
+    if (it != _streams.end() && it->second == s) _streams.erase(it);
+    this->release(s.get());
+    --_active;
+    this->wake();
+}
+
+// headers that are specific to the connection are not allowed in http/2
+static bool conn_header(const fastring& k) {
+    return k == "connection" || k == "keep-alive" || k == "proxy-connection"
+        || k == "transfer-encoding" || k == "upgrade" || k == "content-length";
+}
+
+void H2Conn::send_headers(H2Stream* s, bool end_stream) {
+    const Res& res = s->res;
+    const int status = res.status();
+    fastring b(256);
+    fastring k;
+    hpack::Encoder::encode_status(status, b);
+
+    for (int i = 0; i < res.header_num(); ++i) {
+        const fastring& x = res.header_key(i);
+        k.clear();
+        for (size_t n = 0; n < x.size(); ++n) {
+            const char c = x[n];
+            k.append(('A' <= c && c <= 'Z') ? (char)(c | 0x20) : c);
+        }
+        if (conn_header(k)) continue;
+        hpack::Encoder::encode(k, res.header_value(i), b);
+    }
+
+    if (status >= 200 && status != 204 && status != 304) {
+        char buf[24];
+        const int n = snprintf(buf, sizeof(buf), "%lld",
+            (long long)(res.file().empty() ? (int64) res.body().size() : res.file_len()));
+        hpack::Encoder::encode("content-length", 14, buf, n, b);
+    }
+
+    // the block is sent in HEADERS and CONTINUATION frames, they are put in the
+    // buffer together, no other frames will be in between.
+    size_t off = 0;
+    do {
+        const size_t n = b.size() - off < _max_frame_size ? b.size() - off : _max_frame_size;
+        const bool last = off + n == b.size();
+        int flags = last ? kFlagEndHeaders : 0;
+        if (off == 0 && end_stream) flags |= kFlagEndStream;
+        put_frame_header(_out, (uint32) n, off == 0 ? kFrameHeaders : kFrameContinuation, flags, s->id);
+        _out.append(b.data() + off, n);
+        off += n;
+    } while (off < b.size());
+
+    this->wake();
+    HTTPLOG << "http2 send res, stream " << s->id << ": " << status << ' ' << Res::status_str(status);
+}
+
+// send @n bytes of @p in DATA frames, within the windows of the stream and the
+// connection. return -1 if the stream is reset, or the peer sends nothing for
+// FLG_http_send_timeout while the stream is waiting for windows.
+int H2Conn::send_data(H2Stream* s, const char* p, size_t n, bool end_stream) {
+    do {
+        if (s->reset || _dead) return -1;
+
+        // a writer blocked too long makes the connection dead
+        if (_out.size() >= kMaxOutBytes) {
+            _drain_ev.wait();
+            continue;
+        }
+
+        int64 w = s->send_window < _send_window ? s->send_window : _send_window;
+        if (w > (int64) _max_frame_size) w = _max_frame_size;
+        if (w > (int64) n) w = (int64) n;
+        if (w <= 0 && n > 0) {
+            // the peer may open windows of other streams first, the stream
+            // fails only if nothing is received from the peer in time
+            const uint64 x = _nframes;
+            if (!_window_ev.wait(FLG_http_send_timeout) && x == _nframes) goto timeout_err;
+            continue;
+        }
+
+        const bool last = (size_t) w == n;
+        put_frame_header(_out, (uint32) w, kFrameData, (last && end_stream) ? kFlagEndStream : 0, s->id);
+        _out.append(p, (size_t) w);
+        s->send_window -= w;
+        _send_window -= w;
+        p += w;
+        n -= (size_t) w;
+        this->wake();
+    } while (n > 0);
+    return 0;
+
+  timeout_err:
+    ELOG << "http2 send timeout, stream " << s->id;
+    this->send_rst(s->id, kErrCancel);
+    s->reset = true;
+    return -1;
+}
+
+void H2Conn::send_res(H2Stream* s) {
+    const Res& res = s->res;
+    const int status = res.status();
+    const bool head = s->req.is_method_head();
+
+    if (res.file().empty()) {
+        const fastring& body = res.body();
+        const bool no_body = head || body.empty() || status == 204 || status == 304;
+        this->send_headers(s, no_body);
+        if (!no_body) this->send_data(s, body.data(), body.size(), true);
+        return;
+    }
+
+    fs::file f(res.file().c_str(), 'r');
+    if (!f) {
+        ELOG << "http open file failed: " << res.file();
+        s->res.set_file("", 0, 0);
+        s->res.set_status(404);
+        this->send_headers(s, true);
+        return;
+    }
+
+    int64 left = res.file_len();
+    this->send_headers(s, head || left == 0);
+    if (head || left == 0) return;
+
+    fastring buf(64 * 1024);
+    f.seek(res.file_off());
+    while (left > 0) {
+        const size_t m = f.read((void*) buf.data(), left < 64 * 1024 ? (size_t) left : 64 * 1024);
+        if (m == 0) {
+            ELOG << "http read file failed: " << res.file();
+            this->send_rst(s->id, kErrInternal);
+            return;
+        }
+        left -= m;
+        if (this->send_data(s, buf.data(), m, left == 0) == -1) return;
+    }
+}
+
+void Server::on_h2(co::BufferedConn& bc) {
+    std::shared_ptr<H2Conn> c(new H2Conn(this, bc.fd()));
+    co::go_on(co::sched_id(), new_callback([c]() { c->write_loop(); }));
+    c->serve(bc);
+}
+
+} // http
+} // so
@@ -0,0 +1,390 @@
+#include "co/so/http.h"
+#include "co/flag.h"
+#include "co/log.h"
+#include "co/hash.h"
+#include "co/thread.h"
+#include "co/time.h"
+#include <list>
+#include <unordered_map>
+
+#ifdef HAS_ZLIB
+#include <zlib.h>
+#endif
+
+// With FLG_http_compress, bodies of responses to clients that accept gzip or
+// deflate are compressed if they are not smaller than FLG_http_compress_min_size,
+// and the Content-Type is text, json, xml or not set. Files and bodies sent by
+// Res::write() are not compressed.
+//
+// Each scheduler spends at most FLG_http_compress_budget_us per second on
+// compression at FLG_http_compress_level, and the same time again at level 1,
+// bodies are sent as they are after that. Compressed bodies are cached by hash
+// of the body, so repeated responses are compressed only once.
+DEF_bool(http_compress, false, "#2 compress response bodies with gzip or deflate if the client accepts, zlib required");
+DEF_int32(http_compress_min_size, 1024, "#2 bodies smaller than this are not compressed");
+DEF_int32(http_compress_level, 6, "#2 compression level, 1-9");
+DEF_int32(http_compress_budget_us, 200000, "#2 cpu time in us each scheduler may spend compressing per second at http_compress_level, then level 1 is used with the same budget, and bodies are not compressed for the rest of the second, <=0: no limit");
+DEF_int32(http_compress_cache_size, 16 << 20, "#2 max size of compressed bodies cached for repeated responses, 0 to disable the cache, default: 16M");
+
+DEC_int32(http_max_body_size);
+
+namespace so {
+namespace http {
+
+int content_encoding(const fastring& s) {
+    if (s.size() == 4 && equal_nocase(s.data(), "gzip", 4)) return kGzip;
+    if (s.size() == 6 && equal_nocase(s.data(), "x-gzip", 6)) return kGzip;
+    if (s.size() == 7 && equal_nocase(s.data(), "deflate", 7)) return kDeflate;
+    return kIdentity;
+}
+
+void add_vary(Res& res) {
+    fastring* v = res.mutable_header("Vary", 4);
+    if (!v) {
+        res.add_header("Vary", 4, "Accept-Encoding", 15);
+        return;
+    }
+
+    const char* p = v->data();
+    const char* e = p + v->size();
+    while (p < e) {
+        const char* q = (const char*) memchr(p, ',', e - p);
+        if (!q) q = e;
+        const char* x = q;
+        while (p < x && (*p == ' ' || *p == '\t')) ++p;
+        while (x > p && (x[-1] == ' ' || x[-1] == '\t')) --x;
+        if (x - p == 1 && *p == '*') return;
+        if (x - p == 15 && equal_nocase(p, "accept-encoding", 15)) return;
+        p = q + 1;
+    }
+    v->append(v->empty() ? "Accept-Encoding" : ", Accept-Encoding");
+}
+
+#ifdef HAS_ZLIB
+// deflate streams are made once for each thread and reset for each body,
+// initializing one allocates about 256k.
+struct Deflater {
+    Deflater() : ok(false), level(0) {}
+    ~Deflater() { if (ok) deflateEnd(&zs); }
+
+    z_stream zs;
+    bool ok;
+    int level;
+};
+
+struct Inflater {
+    Inflater() : ok(false), raw(false) {}
+    ~Inflater() { if (ok) inflateEnd(&zs); }
+
+    z_stream zs;
+    bool ok;
+    bool raw;
+};
+
+static z_stream* get_deflater(int enc, int level) {
+    static __thread Deflater* d = 0;
+    if (!d) d = new Deflater[2];
+
+    Deflater& x = d[enc == kGzip ? 0 : 1];
+    if (x.ok && x.level == level) {
+        deflateReset(&x.zs);
+        return &x.zs;
+    }
+
+    if (x.ok) deflateEnd(&x.zs);
+    memset(&x.zs, 0, sizeof(x.zs));
+    // window bits + 16 for the gzip wrapper, or the zlib wrapper for deflate
+    x.ok = deflateInit2(&x.zs, level, Z_DEFLATED, enc == kGzip ? 31 : 15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    x.level = level;
+    return x.ok ? &x.zs : 0;
+}
+
+// @raw: deflate without the zlib wrapper, sent by some servers as "deflate"
+static z_stream* get_inflater(bool raw) {
+    static __thread Inflater* d = 0;
+    if (!d) d = new Inflater();
+
+    if (d->ok && d->raw == raw) {
+        inflateReset(&d->zs);
+        return &d->zs;
+    }
+
+    if (d->ok) inflateEnd(&d->zs);
+    memset(&d->zs, 0, sizeof(d->zs));
+    // window bits + 32 to detect the gzip or zlib wrapper automatically
+    d->ok = inflateInit2(&d->zs, raw ? -15 : 47) == Z_OK;
+    d->raw = raw;
+    return d->ok ? &d->zs : 0;
+}
+
+bool compress(int enc, const char* s, size_t n, fastring& out, int level) {
+    if (enc != kGzip && enc != kDeflate) return false;
+    if (level < 1) level = 1;
+    if (level > 9) level = 9;
+
+    z_stream* zs = get_deflater(enc, level);
+    if (!zs) return false;
+
+    const size_t bound = deflateBound(zs, (uLong) n);
+    out.clear();
+    out.reserve(bound);
+    zs->next_in = (Bytef*) s;
+    zs->avail_in = (uInt) n;
+    zs->next_out = (Bytef*) out.data();
+    zs->avail_out = (uInt) bound;
+    if (deflate(zs, Z_FINISH) != Z_STREAM_END) return false;
+    out.resize(bound - zs->avail_out);
+    return true;
+}
+
+static int inflate_to(z_stream* zs, const char* s, size_t n, fastring& out) {
+    zs->next_in = (Bytef*) s;
+    zs->avail_in = (uInt) n;
+    out.clear();
+    out.reserve(n * 4 + 64);
+
+    while (true) {
+        if (out.capacity() == out.size()) {
+            if (out.size() >= (size_t) FLG_http_max_body_size) return Z_BUF_ERROR;
+            out.reserve(out.capacity() * 2);
+        }
+        const size_t avail = out.capacity() - out.size();
+        zs->next_out = (Bytef*)(out.data() + out.size());
+        zs->avail_out = (uInt) avail;
+        const int r = inflate(zs, Z_NO_FLUSH);
+        out.resize(out.size() + avail - zs->avail_out);
+        if (r == Z_STREAM_END) return Z_OK;
+        if (r != Z_OK) return r == Z_BUF_ERROR && zs->avail_in == 0 ? Z_DATA_ERROR : r;
+    }
+}
+
+bool decompress(int enc, const char* s, size_t n, fastring& out) {
+    if (enc != kGzip && enc != kDeflate) return false;
+    z_stream* zs = get_inflater(false);
+    if (!zs) return false;
+
+    int r = inflate_to(zs, s, n, out);
+    if (r == Z_DATA_ERROR && enc == kDeflate) {
+        zs = get_inflater(true);
+        if (!zs) return false;
+        r = inflate_to(zs, s, n, out);
+    }
+    if (r != Z_OK) return false;
+    if (out.size() > (size_t) FLG_http_max_body_size) return false;
+    return true;
+}
+
+// choose a coding from Accept-Encoding, e.g. "gzip, deflate;q=0.5, br".
+// gzip is preferred, codings with q=0 are not acceptable.
+static int accept_encoding(const fastring& s) {
+    bool gz = false, df = false;
+    const char* p = s.data();
+    const char* e = p + s.size();
+
+    while (p < e) {
+        const char* x = (const char*) memchr(p, ',', e - p);
+        if (!x) x = e;
+
+        while (p < x && (*p == ' ' || *p == '\t')) ++p;
+        const char* q = p;
+        while (q < x && *q != ';' && *q != ' ' && *q != '\t') ++q;
+        const size_t n = q - p;
+
+        // q=0, q=0.0, q=0.00...
+        bool zero = false;
+        const char* v = (const char*) memchr(q, '=', x - q);
+        if (v) {
+            for (++v; v < x && *v == ' '; ++v);
+            zero = v < x && *v == '0';
+            for (++v; zero && v < x && *v != ' '; ++v) {
+                if (*v != '.' && *v != '0') zero = false;
+            }
+        }
+
+        if (!zero) {
+            if ((n == 4 && equal_nocase(p, "gzip", 4)) || (n == 1 && *p == '*')) gz = true;
+            else if (n == 7 && equal_nocase(p, "deflate", 7)) df = true;
+        }
+        p = x + 1;
+    }
+
+    return gz ? kGzip : (df ? kDeflate : kIdentity);
+}
+
+static bool compressible(const fastring& type) {
+    if (type.empty()) return true;
+    if (type.size() >= 5 && equal_nocase(type.data(), "text/", 5)) return true;
+    return type.find("json") != type.npos || type.find("javascript") != type.npos
+        || type.find("xml") != type.npos || type.find("urlencoded") != type.npos;
+}
+
+// Bodies compressed recently, shared by all schedulers. The key is hash of the
+// body, and the body is compared on a hit, as different bodies may have the
+// same hash.
+struct CompressCache {
+    CompressCache() : bytes(0) {}
+    ~CompressCache() = default;
+
+    struct Value {
+        int enc;
+        fastring body;
+        fastring data;
+    };
+
+    typedef std::shared_ptr<Value> ValuePtr;
+
+    struct Entry {
+        ValuePtr value;
+        std::list<uint64>::iterator pos;
+    };
+
+    static size_t cost(const Value& v) {
+        return v.body.size() + v.data.size() + 128;
+    }
+
+    static uint64 key(uint64 hash, int enc) {
+        return hash * 31 + enc;
+    }
+
+    ValuePtr get(uint64 k) {
+        ::MutexGuard g(mtx);
+        auto it = map.find(k);
+        if (it == map.end()) return ValuePtr();
+        lru.splice(lru.begin(), lru, it->second.pos);
+        return it->second.value;
+    }
+
+    void put(uint64 k, const ValuePtr& v) {
+        const size_t n = cost(*v);
+        ::MutexGuard g(mtx);
+        auto it = map.find(k);
+        if (it != map.end()) {
+            bytes -= cost(*it->second.value);
+            it->second.value = v;
+            lru.splice(lru.begin(), lru, it->second.pos);
+        } else {
+            lru.push_front(k);
+            Entry& e = map[k];
+            e.value = v;
+            e.pos = lru.begin();
+        }
+        bytes += n;
+
+        while (bytes > (size_t) FLG_http_compress_cache_size && !lru.empty()) {
+            auto x = map.find(lru.back());
+            bytes -= cost(*x->second.value);
+            map.erase(x);
+            lru.pop_back();
+        }
+    }
+
+    ::Mutex mtx;
+    std::list<uint64> lru; // the most recently used at the front
+    std::unordered_map<uint64, Entry> map;
+    size_t bytes;
+};
+
+static CompressCache* compress_cache() {
+    static CompressCache* c = new CompressCache();
+    return c;
+}
+
+// cpu time spent on compression by the current scheduler in this second
+struct Budget {
+    int64 sec;
+    int64 us;
+};
+
+static inline Budget* budget() {
+    static __thread Budget* b = 0;
+    if (!b) b = new Budget();
+    return b;
+}
+
+// level to be used, or 0 if the budget runs out
+static int compress_level(Budget* b, int64 now_us) {
+    const int64 sec = now_us / 1000000;
+    if (sec != b->sec) {
+        b->sec = sec;
+        b->us = 0;
+    }
+
+    const int64 x = FLG_http_compress_budget_us;
+    if (x <= 0 || b->us < x) return FLG_http_compress_level;
+    if (FLG_http_compress_level > 1 && b->us < x * 2) return 1;
+    return 0;
+}
+
+void compress_res(const Req& req, Res& res) {
+    const int status = res.status();
+    if (status < 200 || status >= 300 || status == 204 || status == 206) return;
+    if (res.body().size() < (size_t) FLG_http_compress_min_size) return;
+    if (!res.header(kHeaderContentEncoding).empty()) return;
+    if (!compressible(res.header(kHeaderContentType))) return;
+
+    // caches must not send the compressed body to clients not accepting it
+    add_vary(res);
+
+    const int enc = accept_encoding(req.header(kHeaderAcceptEncoding));
+    if (enc == kIdentity) return;
+
+    static __thread fastring* buf = 0;
+    if (!buf) buf = new fastring();
+
+    const fastring& body = res.body();
+    const bool use_cache = body.size() <= (size_t) FLG_http_compress_cache_size / 16;
+    uint64 k = 0;
+    if (use_cache) {
+        k = CompressCache::key(hash64(body.data(), body.size()), enc);
+        CompressCache::ValuePtr v = compress_cache()->get(k);
+        if (v && v->enc == enc && v->body == body) {
+            res.mutable_body().clear();
+            res.mutable_body().append(v->data);
+            goto end;
+        }
+    }
+
+    do {
+        Budget* b = budget();
+        const int64 beg = now::us();
+        const int level = compress_level(b, beg);
+        if (level == 0) return;
+
+        const bool ok = compress(enc, body.data(), body.size(), *buf, level);
+        b->us += now::us() - beg;
+        if (!ok) {
+            ELOG << "http compress body failed, size: " << body.size();
+            return;
+        }
+        if (buf->size() >= body.size()) return; // not worth it
+
+        if (use_cache) {
+            CompressCache::ValuePtr v(new CompressCache::Value());
+            v->enc = enc;
+            v->body = body;
+            v->data = *buf;
+            compress_cache()->put(k, v);
+        }
+
+        // the buffer keeps the memory of the original body for the next time
+        res.mutable_body().swap(*buf);
+    } while (0);
+
+  end:
+    res.add_header("Content-Encoding", 16, enc == kGzip ? "gzip" : "deflate", enc == kGzip ? 4 : 7);
+}
+
+#else
+bool compress(int, const char*, size_t, fastring&, int) {
+    return false;
+}
+
+bool decompress(int, const char*, size_t, fastring&) {
+    return false;
+}
+
+void compress_res(const Req&, Res&) {}
+#endif
+
+} // http
+} // so
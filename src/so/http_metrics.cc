@@ -0,0 +1,194 @@
+#include "co/so/http.h"
+#include "co/co.h"
+#include "co/atomic.h"
+
+namespace so {
+namespace http {
+
+// upper bounds of the latency buckets in us, and the label "le" of them
+static const int64 kBounds[] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+    100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000,
+};
+
+static const char* kLe[] = {
+    "0.0001", "0.00025", "0.0005", "0.001", "0.0025", "0.005", "0.01", "0.025", "0.05",
+    "0.1", "0.25", "0.5", "1", "2.5", "5", "10",
+};
+
+enum {
+    kBuckets = sizeof(kBounds) / sizeof(kBounds[0]),
+    kNumMethods = kOptions + 1,
+};
+
+struct Metrics::Counters {
+    uint64 req[5];                // requests by status class, 1xx to 5xx
+    uint64 in;                    // bytes of request bodies
+    uint64 out;                   // bytes of response bodies
+    uint64 us;                    // sum of latency
+    uint64 bucket[kBuckets + 1];  // requests in each bucket, the last for +Inf
+};
+
+// method="GET",route="/users/:id"
+static fastring make_label(Method method, const fastring& route) {
+    static const char* methods[] = { "GET", "HEAD", "POST", "PUT", "DELETE", "OPTIONS" };
+    fastring s(route.size() + 32);
+    s << "method=\"" << methods[method] << "\",route=\"";
+    for (size_t i = 0; i < route.size(); ++i) {
+        const char c = route[i];
+        if (c == '"' || c == '\\') {
+            s << '\\' << c;
+        } else if (c == '\n') {
+            s << "\\n";
+        } else {
+            s << c;
+        }
+    }
+    s << '"';
+    return s;
+}
+
+Metrics::Metrics() : _nslot(0) {}
+
+Metrics::~Metrics() {
+    for (size_t i = 0; i < _c.size(); ++i) delete[] _c[i];
+}
+
+void Metrics::init(const Router& router) {
+    if (!_c.empty()) return;
+    for (size_t i = 0; i < router.size(); ++i) {
+        _labels.push_back(make_label(router.method(i), router.path(i)));
+    }
+    for (int m = 0; m < kNumMethods; ++m) {
+        _labels.push_back(make_label((Method) m, fastring("other")));
+    }
+    _nslot = (int) _labels.size();
+    _c.resize(co::max_sched_num() + 1, 0);
+    _c.back() = new Counters[_nslot]();
+}
+
+// counters of the scheduler @id, created by the scheduler on the first request,
+// so schedulers never used have none.
+inline Metrics::Counters* Metrics::counters(int id) {
+    Counters* c = _c[id];
+    if (unlikely(c == 0)) {
+        c = new Counters[_nslot]();
+        atomic_set(&_c[id], c);
+    }
+    return c;
+}
+
+void Metrics::record(int route, int method, int status, int64 in, int64 out, int64 us) {
+    if (unlikely(_c.empty())) return;
+    if (unlikely(method < 0 || method >= kNumMethods)) return;
+
+    // routes added after init() have no counters, they are recorded as "other"
+    const int nroute = _nslot - kNumMethods;
+    const int i = (route >= 0 && route < nroute) ? route : nroute + method;
+    int k = status / 100 - 1;
+    if (k < 0 || k > 4) k = 4;
+    int b = 0;
+    while (b < kBuckets && us > kBounds[b]) ++b;
+
+    const int id = co::sched_id();
+    if (id >= 0) {
+        // only the scheduler itself writes its counters
+        Counters& c = this->counters(id)[i];
+        ++c.req[k];
+        c.in += in;
+        c.out += out;
+        c.us += us;
+        ++c.bucket[b];
+    } else {
+        Counters& c = _c.back()[i];
+        atomic_inc(&c.req[k]);
+        atomic_add(&c.in, in);
+        atomic_add(&c.out, out);
+        atomic_add(&c.us, us);
+        atomic_inc(&c.bucket[b]);
+    }
+}
+
+fastring Metrics::str() const {
+    // counters of schedulers are read while they are written, a request may
+    // be partly counted, which is fixed by the next read.
+    std::vector<Counters> v(_nslot);
+    std::vector<uint64> n(_nslot);
+    for (size_t x = 0; x < _c.size(); ++x) {
+        const Counters* c = atomic_get(const_cast<Counters**>(&_c[x]));
+        if (!c) continue;
+        for (int i = 0; i < _nslot; ++i) {
+            Counters& a = v[i];
+            const Counters& b = c[i];
+            for (int k = 0; k < 5; ++k) a.req[k] += b.req[k];
+            a.in += b.in;
+            a.out += b.out;
+            a.us += b.us;
+            for (int k = 0; k <= kBuckets; ++k) a.bucket[k] += b.bucket[k];
+        }
+    }
+
+    // slots with no requests are not shown
+    for (int i = 0; i < _nslot; ++i) {
+        for (int k = 0; k <= kBuckets; ++k) n[i] += v[i].bucket[k];
+    }
+
+    fastring s(4096);
+    s << "# HELP http_requests_total Requests handled, by route and status class.\n"
+      << "# TYPE http_requests_total counter\n";
+    for (int i = 0; i < _nslot; ++i) {
+        if (n[i] == 0) continue;
+        for (int k = 0; k < 5; ++k) {
+            if (v[i].req[k] == 0) continue;
+            s << "http_requests_total{" << _labels[i] << ",status=\"" << (k + 1) << "xx\"} "
+              << v[i].req[k] << '\n';
+        }
+    }
+
+    s << "# HELP http_request_body_bytes_total Bytes of request bodies received.\n"
+      << "# TYPE http_request_body_bytes_total counter\n";
+    for (int i = 0; i < _nslot; ++i) {
+        if (n[i] == 0) continue;
+        s << "http_request_body_bytes_total{" << _labels[i] << "} " << v[i].in << '\n';
+    }
+
+    s << "# HELP http_response_body_bytes_total Bytes of response bodies sent.\n"
+      << "# TYPE http_response_body_bytes_total counter\n";
+    for (int i = 0; i < _nslot; ++i) {
+        if (n[i] == 0) continue;
+        s << "http_response_body_bytes_total{" << _labels[i] << "} " << v[i].out << '\n';
+    }
+
+    s << "# HELP http_request_duration_seconds Time from calling the handler to sending the response.\n"
+      << "# TYPE http_request_duration_seconds histogram\n";
+    for (int i = 0; i < _nslot; ++i) {
+        if (n[i] == 0) continue;
+        const fastring& l = _labels[i];
+        uint64 x = 0;
+        for (int k = 0; k < kBuckets; ++k) {
+            x += v[i].bucket[k];
+            s << "http_request_duration_seconds_bucket{" << l << ",le=\"" << kLe[k] << "\"} " << x << '\n';
+        }
+        s << "http_request_duration_seconds_bucket{" << l << ",le=\"+Inf\"} " << n[i] << '\n';
+        s << "http_request_duration_seconds_sum{" << l << "} " << (v[i].us / 1000000.0) << '\n';
+        s << "http_request_duration_seconds_count{" << l << "} " << n[i] << '\n';
+    }
+    return s;
+}
+
+void Server::enable_metrics(const char* path) {
+    if (_metrics) return;
+    _metrics.reset(new Metrics());
+    this->on(kGet, path, [this](const Req&, Res& res) {
+        fastring s = _metrics->str();
+        s << "# HELP http_connections Connections open.\n"
+          << "# TYPE http_connections gauge\n"
+          << "http_connections " << atomic_get(&_conn_num) << '\n';
+        res.set_status(200);
+        res.add_header("Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+        res.set_body(std::move(s));
+    });
+}
+
+} // http
+} // so
@@ -0,0 +1,297 @@
+#include "co/so/http_parser.h"
+#include "co/so/http.h"
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HTTP_PARSER_SSE2
+#endif
+
+namespace so {
+namespace http {
+
+static inline char lower(char c) {
+    return ('A' <= c && c <= 'Z') ? (c | 0x20) : c;
+}
+
+bool equal_nocase(const char* a, const char* b, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (a[i] != b[i] && lower(a[i]) != lower(b[i])) return false;
+    }
+    return true;
+}
+
+int known_header(const char* s, size_t n) {
+    #define _match(x) (n == sizeof(x) - 1 && equal_nocase(s, x, n))
+    switch (lower(*s)) {
+      case 'a':
+        if (_match("accept-encoding")) return kHeaderAcceptEncoding;
+        break;
+      case 'c':
+        if (_match("connection")) return kHeaderConnection;
+        if (_match("content-length")) return kHeaderContentLength;
+        if (_match("content-type")) return kHeaderContentType;
+        if (_match("content-encoding")) return kHeaderContentEncoding;
+        break;
+      case 'd':
+        if (_match("date")) return kHeaderDate;
+        break;
+      case 'e':
+        if (_match("expect")) return kHeaderExpect;
+        break;
+      case 'h':
+        if (_match("host")) return kHeaderHost;
+        break;
+      case 'i':
+        if (_match("if-none-match")) return kHeaderIfNoneMatch;
+        if (_match("if-modified-since")) return kHeaderIfModifiedSince;
+        break;
+      case 'r':
+        if (_match("range")) return kHeaderRange;
+        break;
+      case 't':
+        if (_match("transfer-encoding")) return kHeaderTransferEncoding;
+        break;
+      case 'u':
+        if (_match("upgrade")) return kHeaderUpgrade;
+        break;
+    }
+    #undef _match
+    return -1;
+}
+
+// find the first '\r' or ':' in [p, e), return e if not found
+static inline const char* find_delim(const char* p, const char* e) {
+  #ifdef HTTP_PARSER_SSE2
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i colon = _mm_set1_epi8(':');
+    for (; e - p >= 16; p += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)p);
+        int m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, cr), _mm_cmpeq_epi8(x, colon)));
+        if (m != 0) {
+          #ifdef _MSC_VER
+            unsigned long i;
+            _BitScanForward(&i, m);
+            return p + i;
+          #else
+            return p + __builtin_ctz(m);
+          #endif
+        }
+    }
+  #endif
+    for (; p < e; ++p) {
+        if (*p == '\r' || *p == ':') return p;
+    }
+    return e;
+}
+
+void Parser::reset() {
+    _state = 0;
+    _pos = 0;
+    _scan = 0;
+    _method = kGet;
+    _version = kHTTP11;
+    _status = 0;
+    _nh = 0;
+    _content_length = -1;
+    _chunked = false;
+    _req = true;
+    _url.off = _url.len = 0;
+    memset(_known, -1, sizeof(_known));
+}
+
+int Parser::parse(const char* s, size_t n, bool req) {
+    _req = req;
+    while (_state < 2) {
+        // find the end of the current line, searching from where it stopped
+        const char* e = (const char*) memchr(s + _scan, '\r', n - _scan);
+        if (e == NULL || e + 1 == s + n) {
+            _scan = e ? (uint32)(e - s) : (uint32)n;
+            return kMore;
+        }
+        if (e[1] != '\n') return req ? 400 : -1;
+
+        // a bare LF is not a line ending, and not allowed in a line
+        const size_t end = e - s;
+        if (memchr(s + _pos, '\n', end - _pos)) return req ? 400 : -1;
+
+        int r;
+        if (_state == 0) {
+            r = req ? this->parse_req_line(s + _pos, end - _pos)
+                    : this->parse_res_line(s + _pos, end - _pos);
+            if (r != 0) return r;
+            _state = 1;
+        } else if (end == _pos) {
+            r = this->check_framing();
+            if (r != 0) return r;
+            _state = 2; // empty line, end of headers
+        } else {
+            r = this->parse_header(s, _pos, end);
+            if (r != 0) return r;
+        }
+
+        _pos = _scan = (uint32)(end + 2);
+    }
+    return kDone;
+}
+
+static int parse_version(const char* s, size_t n) {
+    if (n != 8 || !equal_nocase(s, "HTTP/1.", 7)) return -1;
+    if (s[7] == '1') return kHTTP11;
+    if (s[7] == '0') return kHTTP10;
+    return -1;
+}
+
+int Parser::parse_req_line(const char* s, size_t n) {
+    const char* e = s + n;
+    const char* p = (const char*) memchr(s, ' ', n);
+    if (!p) return 400;
+
+    const size_t m = p - s;
+    switch (m) {
+      case 3:
+        if (equal_nocase(s, "GET", 3)) { _method = kGet; break; }
+        if (equal_nocase(s, "PUT", 3)) { _method = kPut; break; }
+        return 405;
+      case 4:
+        if (equal_nocase(s, "POST", 4)) { _method = kPost; break; }
+        if (equal_nocase(s, "HEAD", 4)) { _method = kHead; break; }
+        return 405;
+      case 6:
+        if (equal_nocase(s, "DELETE", 6)) { _method = kDelete; break; }
+        return 405;
+      case 7:
+        if (equal_nocase(s, "OPTIONS", 7)) { _method = kOptions; break; }
+        return 405;
+      default:
+        return 405; // Method Not Allowed
+    }
+
+    while (p < e && *p == ' ') ++p;
+    const char* q = (const char*) memchr(p, ' ', e - p);
+    if (!q || q == p) return 400;
+    _url.off = (uint32)(p - s + _pos);
+    _url.len = (uint32)(q - p);
+
+    while (q < e && *q == ' ') ++q;
+    if (q >= e) return 400;
+
+    int v = parse_version(q, e - q);
+    if (v < 0) return 505; // HTTP Version Not Supported
+    _version = v;
+    return 0;
+}
+
+int Parser::parse_res_line(const char* s, size_t n) {
+    const char* e = s + n;
+    const char* p = (const char*) memchr(s, ' ', n);
+    if (!p) return -1;
+
+    int v = parse_version(s, p - s);
+    if (v >= 0) _version = v;
+
+    while (p < e && *p == ' ') ++p;
+    int status = 0, i = 0;
+    for (; p < e && '0' <= *p && *p <= '9'; ++p, ++i) status = status * 10 + (*p - '0');
+    if (i != 3) return -1;
+    _status = status;
+    return 0;
+}
+
+static int64 parse_length(const char* p, const char* e) {
+    if (p == e) return -1;
+    int64 v = 0;
+    for (; p < e; ++p) {
+        if (*p < '0' || *p > '9') return -1;
+        v = v * 10 + (*p - '0');
+        if (v > ((int64)1 << 48)) return -1;
+    }
+    return v;
+}
+
+// token characters of field names: letters, digits and "!#$%&'*+-.^_`|~"
+static inline bool is_tchar(char c) {
+    if (('a' <= (c | 0x20) && (c | 0x20) <= 'z') || ('0' <= c && c <= '9') || c == '-') return true;
+    return c != '\0' && strchr("!#$%&'*+.^_`|~", c) != NULL;
+}
+
+// parse codings in the value of Transfer-Encoding, as "gzip, chunked".
+// return false if a coding follows chunked, which is applied only once and
+// must be the last.
+static bool parse_codings(const char* p, const char* e, bool* chunked) {
+    while (p < e) {
+        const char* q = (const char*) memchr(p, ',', e - p);
+        if (!q) q = e;
+        const char* x = q;
+        while (p < x && (*p == ' ' || *p == '\t')) ++p;
+        while (x > p && (x[-1] == ' ' || x[-1] == '\t')) --x;
+        if (x > p) {
+            if (*chunked) return false;
+            *chunked = x - p == 7 && equal_nocase(p, "chunked", 7);
+        }
+        p = q + 1;
+    }
+    return true;
+}
+
+int Parser::parse_header(const char* s, size_t beg, size_t end) {
+    const int err = _req ? 400 : -1;
+    const char* p = s + beg;
+    const char* e = s + end;
+
+    const char* colon = find_delim(p, e);
+    if (colon == e || *colon != ':' || colon == p) return err;
+    if (_nh == kMaxHeaders) return _req ? 431 : -1;
+
+    // no whitespace or control characters in the name, nor before the colon
+    for (const char* x = p; x < colon; ++x) {
+        if (!is_tchar(*x)) return err;
+    }
+
+    const char* v = colon + 1;
+    while (v < e && (*v == ' ' || *v == '\t')) ++v;
+    const char* ve = e;
+    while (ve > v && (ve[-1] == ' ' || ve[-1] == '\t')) --ve;
+    if (memchr(v, '\0', ve - v)) return err;
+
+    Slice* h = _h + _nh * 2;
+    h[0].off = (uint32) beg;
+    h[0].len = (uint32)(colon - p);
+    h[1].off = (uint32)(v - s);
+    h[1].len = (uint32)(ve - v);
+
+    int k = known_header(p, colon - p);
+    if (k >= 0) {
+        if (_known[k] < 0) _known[k] = (int8)_nh;
+        if (k == kHeaderContentLength) {
+            int64 len = parse_length(v, ve);
+            if (len < 0) return err;
+            if (_content_length >= 0 && _content_length != len) return err;
+            _content_length = len;
+        } else if (k == kHeaderTransferEncoding) {
+            // repeated headers are combined into one list of codings
+            if (!parse_codings(v, ve, &_chunked)) return err;
+        }
+    }
+
+    ++_nh;
+    return 0;
+}
+
+int Parser::check_framing() {
+    if (_known[kHeaderTransferEncoding] < 0) return 0;
+    if (_req) {
+        // The length of a request body is unknown if chunked is not the last
+        // coding. Content-Length with Transfer-Encoding may be a request
+        // smuggling attempt, both are rejected.
+        if (!_chunked || _content_length >= 0) return 400;
+    } else {
+        // Transfer-Encoding overrides Content-Length in responses, the body
+        // ends with the connection if chunked is not the last coding.
+        _content_length = -1;
+    }
+    return 0;
+}
+
+} // http
+} // so
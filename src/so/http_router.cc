@@ -0,0 +1,245 @@
+#include "co/so/http.h"
+#include "co/log.h"
+#include <string.h>
+
+namespace so {
+namespace http {
+
+// A node of the radix trie. Static children are found by the first char of
+// their path, a node has at most one parameter child and one wildcard child.
+struct RouteNode {
+    RouteNode() : param(0), wildcard(0), fun(-1) {}
+
+    ~RouteNode() {
+        for (size_t i = 0; i < children.size(); ++i) delete children[i];
+        delete param;
+        delete wildcard;
+    }
+
+    fastring path;                    // static text on the edge to this node
+    fastring indices;                 // first chars of path of the children
+    std::vector<RouteNode*> children; // static children
+    RouteNode* param;                 // ":name"
+    RouteNode* wildcard;              // "*name"
+    fastring name;                    // name of a parameter or wildcard
+    int fun;                          // index of the handler, -1 for none
+};
+
+// add static text @s of @n bytes under @x, return the node where it ends
+static RouteNode* add_static(RouteNode* x, const char* s, size_t n) {
+    while (n > 0) {
+        const char* p = (const char*) memchr(x->indices.data(), *s, x->indices.size());
+        if (p == NULL) {
+            RouteNode* c = new RouteNode();
+            c->path.append(s, n);
+            x->indices.append(*s);
+            x->children.push_back(c);
+            return c;
+        }
+
+        const size_t k = p - x->indices.data();
+        RouteNode* c = x->children[k];
+        size_t l = 0;
+        while (l < n && l < c->path.size() && c->path[l] == s[l]) ++l;
+
+        if (l < c->path.size()) {
+            // split the edge at the end of the common prefix
+            RouteNode* m = new RouteNode();
+            m->path.append(c->path.data(), l);
+            m->indices.append(c->path[l]);
+            m->children.push_back(c);
+            c->path = c->path.substr(l);
+            x->children[k] = m;
+            c = m;
+        }
+
+        s += l;
+        n -= l;
+        x = c;
+    }
+    return x;
+}
+
+Router::Router() {
+    memset(_root, 0, sizeof(_root));
+}
+
+Router::~Router() {
+    for (size_t i = 0; i < sizeof(_root) / sizeof(_root[0]); ++i) delete _root[i];
+}
+
+// a parameter or wildcard starts at the beginning of a segment
+static inline bool is_param(const char* s) {
+    return (*s == ':' || *s == '*') && s[-1] == '/';
+}
+
+// check names of parameters and the wildcard in @path
+static bool check_params(const char* path) {
+    int np = 0;
+    for (const char* s = path + 1; *s; ++s) {
+        if (!is_param(s)) continue;
+        const char* e = s + 1;
+        while (*e && *e != '/') ++e;
+        if (e == s + 1) {
+            ELOG << "http route error: empty parameter name in " << path;
+            return false;
+        }
+        if (*s == '*' && *e) {
+            ELOG << "http route error: wildcard not at the end of " << path;
+            return false;
+        }
+        if (++np > Req::kMaxParams) {
+            ELOG << "http route error: too many parameters in " << path;
+            return false;
+        }
+        s = e - 1;
+    }
+    return true;
+}
+
+bool Router::add(Method method, const char* path, Fun&& fun) {
+    if (!path || *path != '/') {
+        ELOG << "http route error: not start with '/': " << (path ? path : "");
+        return false;
+    }
+    if (!check_params(path)) return false;
+    if (!_root[method]) _root[method] = new RouteNode();
+
+    // nodes added before a conflict is found are static nodes without a
+    // handler, they match nothing.
+    RouteNode* x = _root[method];
+    const char* s = path;
+    while (*s) {
+        if (is_param(s)) {
+            const bool wild = *s == '*';
+            const char* e = s + 1;
+            while (*e && *e != '/') ++e;
+            fastring name(s + 1, e - s - 1);
+
+            RouteNode*& c = wild ? x->wildcard : x->param;
+            if (!c) {
+                c = new RouteNode();
+                c->name = name;
+            } else if (c->name != name) {
+                ELOG << "http route error: " << path << " conflicts with "
+                     << (wild ? '*' : ':') << c->name << " at the same position";
+                return false;
+            }
+            x = c;
+            s = e;
+        } else {
+            const char* e = s + 1;
+            while (*e && !is_param(e)) ++e;
+            x = add_static(x, s, e - s);
+            s = e;
+        }
+    }
+
+    if (x->fun >= 0) {
+        ELOG << "http route error: " << path << " already added";
+        return false;
+    }
+    x->fun = (int) _funs.size();
+    _funs.push_back(std::move(fun));
+    _methods.push_back(method);
+    _paths.push_back(fastring(path));
+    return true;
+}
+
+// match @s of @n bytes under @x, whose own path has been matched already.
+// @b is the beginning of the url, parameters are saved as offsets from it.
+static int match(const RouteNode* x, const char* b, const char* s, size_t n, Req* req) {
+    if (n == 0) {
+        if (x->fun >= 0) return x->fun;
+        if (x->wildcard && x->wildcard->fun >= 0) {
+            req->add_param(&x->wildcard->name, (uint32)(s - b), 0);
+            return x->wildcard->fun;
+        }
+        return -1;
+    }
+
+    if (!x->indices.empty()) {
+        const char* p = (const char*) memchr(x->indices.data(), *s, x->indices.size());
+        if (p) {
+            const RouteNode* c = x->children[p - x->indices.data()];
+            const size_t l = c->path.size();
+            if (l <= n && memcmp(c->path.data(), s, l) == 0) {
+                int r = match(c, b, s + l, n - l, req);
+                if (r >= 0) return r;
+            }
+        }
+    }
+
+    if (x->param) {
+        const char* e = (const char*) memchr(s, '/', n);
+        if (e == NULL) e = s + n;
+        if (e > s) {
+            const int np = req->param_num();
+            req->add_param(&x->param->name, (uint32)(s - b), (uint32)(e - s));
+            int r = match(x->param, b, e, n - (e - s), req);
+            if (r >= 0) return r;
+            req->set_param_num(np);
+        }
+    }
+
+    if (x->wildcard && x->wildcard->fun >= 0) {
+        req->add_param(&x->wildcard->name, (uint32)(s - b), (uint32)n);
+        return x->wildcard->fun;
+    }
+    return -1;
+}
+
+const char* Req::param(const char* key, size_t* n) const {
+    const size_t k = strlen(key);
+    for (int i = 0; i < _np; ++i) {
+        const fastring& x = *_params[i].key;
+        if (x.size() == k && memcmp(x.data(), key, k) == 0) {
+            *n = _params[i].len;
+            return _url.data() + _params[i].off;
+        }
+    }
+    return 0;
+}
+
+// find the route of @req in the trie @x, return index of the handler, or -1
+static int find_route(const RouteNode* x, Req* req) {
+    if (!x) return -1;
+
+    // the query string is not a part of the path
+    const fastring& url = req->url();
+    const char* p = (const char*) memchr(url.data(), '?', url.size());
+    const size_t n = p ? p - url.data() : url.size();
+
+    req->set_param_num(0);
+    int r = match(x, url.data(), url.data(), n, req);
+    if (r < 0) req->set_param_num(0);
+    return r;
+}
+
+const Router::Fun* Router::find(Req* req) const {
+    int r = find_route(_root[req->method()], req);
+
+    // HEAD goes to GET routes, if no route for HEAD matches
+    if (r < 0 && req->method() == kHead) r = find_route(_root[kGet], req);
+    return r < 0 ? 0 : &_funs[r];
+}
+
+fastring Router::allow(Req* req) const {
+    static const char* s[] = {
+        "GET", "HEAD", "POST", "PUT", "DELETE", "OPTIONS"
+    };
+
+    fastring a;
+    for (int m = kGet; m <= kOptions; ++m) {
+        int r = find_route(_root[m], req);
+        if (r < 0 && m == kHead) r = find_route(_root[kGet], req);
+        if (r < 0) continue;
+        if (!a.empty()) a.append(", ");
+        a.append(s[m]);
+    }
+    req->set_param_num(0);
+    return a;
+}
+
+} // http
+} // so
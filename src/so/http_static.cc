@@ -0,0 +1,479 @@
+#include "co/so/http.h"
+#include "co/co.h"
+#include "co/flag.h"
+#include "co/log.h"
+#include "co/fs.h"
+#include "co/path.h"
+#include "co/thread.h"
+#include "co/time.h"
+#include <deque>
+#include <list>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+DEF_int32(http_file_cache_size, 64 << 20, "#2 max size of files cached in memory by http::StaticFiles, default: 64M");
+
+DEC_int32(http_sendfile_size);
+
+namespace so {
+namespace http {
+
+// a file, or its ".gz" variant, never changed once created
+struct FileInfo {
+    fastring path;
+    bool exists;
+    bool dir;
+    bool cached;   // content of the file is in data
+    int64 size;
+    int64 mtime;
+    fastring etag;
+    fastring last_modified;
+    fastring data;
+};
+
+typedef std::shared_ptr<FileInfo> FilePtr;
+
+// LRU cache of files, shared by all schedulers. Files not found are kept in
+// a separate small LRU, so requests for missing files can't evict others.
+struct FileCache {
+    FileCache() = default;
+    ~FileCache() = default;
+
+    enum { kMaxMissingBytes = 256 << 10 };
+
+    struct Entry {
+        FilePtr file;
+        int64 check_ms; // when the file was checked last time
+        std::list<fastring>::iterator pos;
+    };
+
+    struct Lru {
+        Lru() : bytes(0) {}
+        std::list<fastring> list; // the most recently used at the front
+        std::unordered_map<fastring, Entry> map;
+        size_t bytes;
+    };
+
+    static size_t cost(const FileInfo& f) {
+        return f.data.size() + f.path.size() + 128;
+    }
+
+    // return NULL if not found
+    FilePtr get(const fastring& path, int64* check_ms) {
+        ::MutexGuard g(mtx);
+        Entry* e = this->find(files, path);
+        if (!e) e = this->find(missing, path);
+        if (!e) return FilePtr();
+        *check_ms = e->check_ms;
+        return e->file;
+    }
+
+    // the file was checked and not changed
+    void touch(const fastring& path, int64 now_ms) {
+        ::MutexGuard g(mtx);
+        auto it = files.map.find(path);
+        if (it != files.map.end()) { it->second.check_ms = now_ms; return; }
+        it = missing.map.find(path);
+        if (it != missing.map.end()) it->second.check_ms = now_ms;
+    }
+
+    void put(const FilePtr& f, int64 now_ms) {
+        const size_t n = cost(*f);
+        Lru& c = f->exists ? files : missing;
+        const size_t cap = f->exists ? (size_t) FLG_http_file_cache_size : (size_t) kMaxMissingBytes;
+        if (n > cap) return;
+
+        ::MutexGuard g(mtx);
+        this->erase(f->exists ? missing : files, f->path);
+        auto it = c.map.find(f->path);
+        if (it != c.map.end()) {
+            c.bytes -= cost(*it->second.file);
+            it->second.file = f;
+            it->second.check_ms = now_ms;
+            c.list.splice(c.list.begin(), c.list, it->second.pos);
+        } else {
+            c.list.push_front(f->path);
+            Entry& e = c.map[f->path];
+            e.file = f;
+            e.check_ms = now_ms;
+            e.pos = c.list.begin();
+        }
+        c.bytes += n;
+
+        while (c.bytes > cap && !c.list.empty()) this->erase(c, c.list.back());
+    }
+
+    Entry* find(Lru& c, const fastring& path) {
+        auto it = c.map.find(path);
+        if (it == c.map.end()) return NULL;
+        c.list.splice(c.list.begin(), c.list, it->second.pos);
+        return &it->second;
+    }
+
+    void erase(Lru& c, const fastring& path) {
+        auto it = c.map.find(path);
+        if (it == c.map.end()) return;
+        c.bytes -= cost(*it->second.file);
+        c.list.erase(it->second.pos);
+        c.map.erase(it);
+    }
+
+    ::Mutex mtx;
+    Lru files;
+    Lru missing;
+};
+
+static bool stat_file(const fastring& path, FileInfo* f) {
+  #ifdef _WIN32
+    if (!fs::exists(path)) return false;
+    f->dir = fs::isdir(path);
+    f->size = fs::fsize(path);
+    f->mtime = fs::mtime(path);
+  #else
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) return false;
+    f->dir = S_ISDIR(st.st_mode);
+    f->size = st.st_size;
+    f->mtime = st.st_mtime;
+  #endif
+    return true;
+}
+
+// check the file @path, and read it if it has been changed since @f, which
+// may be NULL. return @f if it is not changed.
+static FilePtr load_file(const FilePtr& f, const fastring& path) {
+    FilePtr x(new FileInfo());
+    x->path = path;
+    x->cached = false;
+    x->exists = stat_file(path, x.get());
+    if (!x->exists) {
+        x->dir = false;
+        x->size = x->mtime = -1;
+    }
+
+    if (f && f->exists == x->exists && f->size == x->size && f->mtime == x->mtime) {
+        return f;
+    }
+
+    if (x->exists && !x->dir) {
+        char buf[48];
+        int n = snprintf(buf, sizeof(buf), "\"%llx-%llx\"", (long long)x->mtime, (long long)x->size);
+        x->etag.append(buf, n);
+        n = format_date(x->mtime, buf);
+        x->last_modified.append(buf, n);
+
+        if (x->size <= FLG_http_sendfile_size) {
+            fs::file file(path.c_str(), 'r');
+            if (file) {
+                x->data = file.read((size_t) x->size);
+                x->cached = x->data.size() == (size_t) x->size;
+                if (!x->cached) x->data.clear();
+            }
+        }
+    }
+    return x;
+}
+
+// Files are checked and read in helper threads, as stat() and read() would
+// block the scheduler (stat() is not hooked even with FLG_co_hook_file_io).
+// The threads are started on the first load, detached and never joined, they
+// wait for tasks until the process exits. The loader is never deleted, so
+// they can't outlive it.
+class FileLoader {
+  public:
+    enum { kThreads = 2 };
+
+    FileLoader() : _started(false) {}
+    ~FileLoader() = default;
+
+    // load_file() in a helper thread. MUST be called in coroutine.
+    FilePtr load(const FilePtr& f, const fastring& path);
+
+  private:
+    // on heap, the helper thread writes it after the coroutine is suspended
+    struct Task {
+        FilePtr f;
+        fastring path;
+        int sched_id;
+        co::Event ev;
+    };
+
+    void loop();
+
+  private:
+    ::Mutex _mtx;
+    SyncEvent _ev;
+    std::deque<std::shared_ptr<Task>> _tasks;
+    bool _started;
+};
+
+FilePtr FileLoader::load(const FilePtr& f, const fastring& path) {
+    std::shared_ptr<Task> t(new Task());
+    t->f = f;
+    t->path = path;
+    t->sched_id = co::sched_id();
+
+    do {
+        ::MutexGuard g(_mtx);
+        if (!_started) {
+            _started = true;
+            for (int i = 0; i < kThreads; ++i) Thread(&FileLoader::loop, this).detach();
+        }
+        _tasks.push_back(t);
+    } while (0);
+    _ev.signal();
+
+    // co::Event wakes up only coroutines already waiting, the helper thread
+    // signals it in a new coroutine, which runs after this one is suspended.
+    t->ev.wait();
+    return t->f;
+}
+
+void FileLoader::loop() {
+    while (true) {
+        std::shared_ptr<Task> t;
+        do {
+            ::MutexGuard g(_mtx);
+            if (!_tasks.empty()) {
+                t = _tasks.front();
+                _tasks.pop_front();
+            }
+        } while (0);
+
+        if (!t) {
+            _ev.wait();
+            continue;
+        }
+
+        t->f = load_file(t->f, t->path);
+        co::go_on(t->sched_id, new_callback([t]() { t->ev.signal(); }));
+    }
+}
+
+inline FileLoader& file_loader() {
+    static FileLoader* l = new FileLoader();
+    return *l;
+}
+
+// find the file @path in the cache, it is checked again if it was checked
+// more than one second ago, and read again if it has been changed.
+static FilePtr lookup(FileCache* c, const fastring& path) {
+    const int64 now_ms = now::ms();
+    int64 check_ms = 0;
+    FilePtr f = c->get(path, &check_ms);
+    if (f && now_ms < check_ms + 1000) return f;
+
+    FilePtr x = co::sched_id() >= 0 ? file_loader().load(f, path) : load_file(f, path);
+    if (x == f) {
+        c->touch(path, now_ms);
+    } else {
+        c->put(x, now_ms);
+    }
+    return x;
+}
+
+static const char* content_type(const fastring& path) {
+    static const char* types[][2] = {
+        { ".html", "text/html; charset=utf-8" },
+        { ".htm", "text/html; charset=utf-8" },
+        { ".css", "text/css; charset=utf-8" },
+        { ".js", "application/javascript; charset=utf-8" },
+        { ".mjs", "application/javascript; charset=utf-8" },
+        { ".json", "application/json" },
+        { ".map", "application/json" },
+        { ".txt", "text/plain; charset=utf-8" },
+        { ".md", "text/markdown; charset=utf-8" },
+        { ".xml", "text/xml; charset=utf-8" },
+        { ".svg", "image/svg+xml" },
+        { ".png", "image/png" },
+        { ".jpg", "image/jpeg" },
+        { ".jpeg", "image/jpeg" },
+        { ".gif", "image/gif" },
+        { ".webp", "image/webp" },
+        { ".ico", "image/x-icon" },
+        { ".woff", "font/woff" },
+        { ".woff2", "font/woff2" },
+        { ".wasm", "application/wasm" },
+        { ".pdf", "application/pdf" },
+        { ".mp4", "video/mp4" },
+        { ".zip", "application/zip" },
+    };
+
+    const char* e = strrchr(path.c_str(), '.');
+    if (e && !strchr(e, '/')) {
+        const size_t n = strlen(e);
+        for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+            if (strlen(types[i][0]) == n && equal_nocase(e, types[i][0], n)) return types[i][1];
+        }
+    }
+    return "application/octet-stream";
+}
+
+static inline int hex_value(char c) {
+    if ('0' <= c && c <= '9') return c - '0';
+    c |= 0x20;
+    if ('a' <= c && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// decode %xx in the url path, return false if it is invalid
+static bool decode_path(const char* s, size_t n, fastring& out) {
+    out.reserve(n + 1);
+    for (size_t i = 0; i < n; ++i) {
+        if (s[i] != '%') {
+            out.append(s[i]);
+            continue;
+        }
+        if (i + 2 >= n) return false;
+        const int a = hex_value(s[i + 1]);
+        const int b = hex_value(s[i + 2]);
+        if (a < 0 || b < 0 || (a | b) == 0) return false;
+        out.append((char)((a << 4) | b));
+        i += 2;
+    }
+    return true;
+}
+
+// parse the Range header, only a single range is supported:
+//   bytes=a-b   bytes=a-   bytes=-n
+// return 0 on success, 1 if the header is ignored, -1 if not satisfiable.
+static int parse_range(const fastring& s, int64 size, int64* off, int64* len) {
+    if (s.size() < 7 || !equal_nocase(s.data(), "bytes=", 6)) return 1;
+    const char* p = s.data() + 6;
+    const char* e = s.data() + s.size();
+    if (memchr(p, ',', e - p)) return 1; // multiple ranges
+
+    int64 a = -1, b = -1;
+    for (; p < e && '0' <= *p && *p <= '9'; ++p) a = (a < 0 ? 0 : a * 10) + (*p - '0');
+    if (p == e || *p != '-') return 1;
+    for (++p; p < e && '0' <= *p && *p <= '9'; ++p) b = (b < 0 ? 0 : b * 10) + (*p - '0');
+    if (p != e || (a < 0 && b < 0)) return 1;
+
+    if (a < 0) {
+        // the last b bytes
+        if (b == 0 || size == 0) return -1;
+        if (b > size) b = size;
+        *off = size - b;
+        *len = b;
+        return 0;
+    }
+
+    if (a >= size) return -1;
+    if (b < 0 || b >= size) b = size - 1;
+    if (b < a) return 1;
+    *off = a;
+    *len = b - a + 1;
+    return 0;
+}
+
+StaticFiles::StaticFiles(const char* root)
+    : _root((root && *root) ? root : "."), _cache(new FileCache()) {
+}
+
+StaticFiles::~StaticFiles() = default;
+
+void StaticFiles::operator()(const Req& req, Res& res) const {
+    const fastring& url = req.url();
+    const char* p = (const char*) memchr(url.data(), '?', url.size());
+    this->serve(req, res, url.data(), p ? p - url.data() : url.size());
+}
+
+void StaticFiles::serve(const Req& req, Res& res, const char* s, size_t n) const {
+    if (!req.is_method_get() && !req.is_method_head()) {
+        res.set_status(405);
+        res.add_header("Allow", "GET, HEAD");
+        return;
+    }
+
+    fastring url("/");
+    if (!decode_path(s, n, url)) {
+        res.set_status(400);
+        return;
+    }
+
+    url = path::clean(url);
+    if (!url.starts_with('/')) {
+        res.set_status(403);
+        return;
+    }
+
+    fastring path = path::join(_root, url);
+    FilePtr f = lookup(_cache.get(), path);
+    if (f->exists && f->dir) {
+        path = path::join(path, "index.html");
+        f = lookup(_cache.get(), path);
+    }
+    if (!f->exists || f->dir) {
+        res.set_status(404);
+        return;
+    }
+
+    // the precompressed variant
+    FilePtr gz = lookup(_cache.get(), path + ".gz");
+    if (!gz->exists || gz->dir) {
+        gz.reset();
+    } else {
+        add_vary(res);
+        const fastring& ae = req.header(kHeaderAcceptEncoding);
+        if (ae.find("gzip") == ae.npos) gz.reset();
+    }
+
+    const FileInfo& x = gz ? *gz : *f;
+    res.add_header("Content-Type", content_type(path));
+    if (gz) res.add_header("Content-Encoding", "gzip");
+    res.add_header("ETag", x.etag);
+    res.add_header("Last-Modified", x.last_modified);
+    res.add_header("Accept-Ranges", "bytes");
+
+    do {
+        const fastring& inm = req.header(kHeaderIfNoneMatch);
+        const bool not_modified = !inm.empty()
+            ? (inm == "*" || inm.find(x.etag.c_str()) != inm.npos)
+            : req.header(kHeaderIfModifiedSince) == x.last_modified;
+        if (not_modified) {
+            res.set_status(304);
+            return;
+        }
+    } while (0);
+
+    int64 off = 0, len = x.size;
+    do {
+        const fastring& range = req.header(kHeaderRange);
+        if (range.empty()) break;
+
+        // If-Range: the range is used only if the file is not modified
+        const fastring& ir = req.header("If-Range");
+        if (!ir.empty() && ir != x.etag && ir != x.last_modified) break;
+
+        const int r = parse_range(range, x.size, &off, &len);
+        if (r > 0) break;
+
+        char buf[64];
+        if (r < 0) {
+            snprintf(buf, sizeof(buf), "bytes */%lld", (long long) x.size);
+            res.add_header("Content-Range", buf);
+            res.set_status(416);
+            return;
+        }
+
+        snprintf(buf, sizeof(buf), "bytes %lld-%lld/%lld",
+            (long long) off, (long long)(off + len - 1), (long long) x.size);
+        res.add_header("Content-Range", buf);
+        res.set_status(206);
+    } while (0);
+
+    if (res.status() != 206) res.set_status(200);
+    if (x.cached) {
+        // the body buffer of res is reused, no memory allocated
+        res.mutable_body().clear();
+        res.mutable_body().append(x.data.data() + off, (size_t) len);
+    } else {
+        res.set_file(x.path, off, len);
+    }
+}
+
+} // http
+} // so
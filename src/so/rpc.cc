@@ -1,6 +1,7 @@
 #include "co/so/rpc.h"
 #include "co/so/tcp.h"
 #include "co/co.h"
+#include "co/buffered_conn.h"
 #include "co/flag.h"
 #include "co/log.h"
 #include "co/fastring.h"
@@ -17,6 +18,9 @@ DEF_int32(rpc_conn_timeout, 3000, "#2 connect timeout in ms");
 DEF_int32(rpc_conn_idle_sec, 180, "#2 connection may be closed if no data was recieved for n seconds");
 DEF_int32(rpc_max_idle_conn, 128, "#2 max idle connections");
 DEF_bool(rpc_log, true, "#2 enable rpc log if true");
+DEF_bool(rpc_coalesce_writes, false, "#2 rpc server buffers responses, and the scheduler sends them at the end of each loop, with fewer syscalls under load");
+
+DEC_int32(co_zerocopy_size);
 
 #define RPCLOG LOG_IF(FLG_rpc_log)
 
@@ -32,6 +36,7 @@ struct Header {
 static const uint16 kMagic = 0x7777;
 
 inline void set_header(void* header, int msg_len) {
+    ((Header*) header)->info = 0;
     ((Header*) header)->magic = kMagic;
     ((Header*) header)->len = hton32(msg_len);
 }
@@ -87,13 +92,15 @@ void ServerImpl::on_connection(Connection* conn) {
     int r = 0, len = 0;
     Header header;
     fastring* buf = 0;
+    co::BufferedConn bc(fd);
+    bc.set_deferred_flush(FLG_rpc_coalesce_writes, FLG_rpc_send_timeout);
     Json req, res;
 
     while (true) {
         // recv req from the client
         do {
           recv_beg:
-            r = co::recvn(fd, &header, sizeof(header), FLG_rpc_conn_idle_sec * 1000);
+            r = bc.peek(sizeof(header), FLG_rpc_conn_idle_sec * 1000);
 
             if (unlikely(r == 0)) goto recv_zero_err;
             if (unlikely(r == -1)) {
@@ -108,18 +115,26 @@ void ServerImpl::on_connection(Connection* conn) {
                 goto recv_beg;
             }
 
+            memcpy(&header, bc.data(), sizeof(header));
+            bc.consume(sizeof(header));
             if (unlikely(header.magic != kMagic)) goto magic_err;
 
             len = ntoh32(header.len);
             if (unlikely(len > FLG_rpc_max_msg_size)) goto msg_too_long_err;
 
             if (buf == NULL) buf = (fastring*) _buffer.pop();
-            buf->resize(len);
-            r = co::recvn(fd, (char*)buf->data(), len, FLG_rpc_recv_timeout);
-            if (unlikely(r == 0)) goto recv_zero_err;
-            if (unlikely(r == -1)) goto recv_err;
-
-            req = json::parse(buf->data(), buf->size());
+            if (bc.size() >= (size_t) len) {
+                // the whole message is in the read buffer, parse it there
+                req = json::parse(bc.data(), len);
+                if (req.is_null()) { buf->clear(); buf->append(bc.data(), len); }
+                bc.consume(len);
+            } else {
+                buf->resize(len);
+                r = bc.read_exact((char*)buf->data(), len, FLG_rpc_recv_timeout);
+                if (unlikely(r == 0)) goto recv_zero_err;
+                if (unlikely(r == -1)) goto recv_err;
+                req = json::parse(buf->data(), buf->size());
+            }
             if (req.is_null()) goto json_parse_err;
 
             RPCLOG << "rpc recv req: " << req;
@@ -130,11 +145,29 @@ void ServerImpl::on_connection(Connection* conn) {
             res.reset();
             _service->process(req, res);
 
-            buf->resize(sizeof(Header));
+            buf->clear();
             res.str(*(fastream*)buf);
-            set_header((void*)buf->data(), (int) buf->size() - sizeof(Header));
-            
-            r = co::send(fd, buf->data(), (int) buf->size(), FLG_rpc_send_timeout);
+            set_header(&header, (int) buf->size());
+
+            if (FLG_co_zerocopy_size > 0 && buf->size() >= (size_t) FLG_co_zerocopy_size) {
+                // the buffer is moved to the scheduler and released after
+                // the kernel has sent it with MSG_ZEROCOPY
+                auto body = std::make_shared<fastring>(std::move(*buf));
+                r = bc.flush(FLG_rpc_send_timeout);
+                if (r != -1) r = co::send(fd, &header, sizeof(header), FLG_rpc_send_timeout);
+                if (r != -1) r = co::send_zerocopy(fd, body, FLG_rpc_send_timeout);
+            } else if (bc.deferred_flush()) {
+                // sent by the scheduler with responses of other requests
+                // received in this loop, large ones are sent at once.
+                r = bc.write(&header, sizeof(header), FLG_rpc_send_timeout);
+                if (r != -1) r = bc.write(buf->data(), (int) buf->size(), FLG_rpc_send_timeout);
+            } else {
+                co::iovec iov[2] = {
+                    { &header, sizeof(header) },
+                    { (void*) buf->data(), buf->size() },
+                };
+                r = co::writev(fd, iov, 2, FLG_rpc_send_timeout);
+            }
             if (unlikely(r == -1)) goto send_err;
 
             RPCLOG << "rpc send res: " << res;;
@@ -143,10 +176,12 @@ void ServerImpl::on_connection(Connection* conn) {
 
   recv_zero_err:
     LOG << "rpc client close the connection: " << *conn;
+    bc.flush(FLG_rpc_send_timeout);
     co::close(fd);
     goto cleanup;
   idle_err:
     ELOG << "rpc close idle connection: " << *conn;
+    bc.flush(FLG_rpc_send_timeout);
     co::close(fd);
     goto cleanup;
   magic_err:
@@ -165,6 +200,7 @@ void ServerImpl::on_connection(Connection* conn) {
     ELOG << "rpc json parse error: " << *buf;
     goto err_end;
   err_end:
+    bc.discard();
     co::reset_tcp_socket(fd, 1000);
   cleanup:
     atomic_dec(&_conn_num);
@@ -310,13 +346,23 @@ bool ServerImpl::auth(Connection* conn) {
 
 class ClientImpl : public rpc::Client, public tcp::Client {
   public:
-    ClientImpl(const char* serv_ip, int serv_port, const char* passwd);
+    ClientImpl(const char* serv_ip, int serv_port, const char* passwd, bool pooled);
     virtual ~ClientImpl() = default;
 
     virtual bool connect();
     virtual void ping();
     virtual void call(const Json& req, Json& res);
 
+    virtual int warm_up(int n) {
+        return tcp::Client::warm_up(n, FLG_rpc_conn_timeout);
+    }
+
+  protected:
+    // auth for new connections, pooled connections are authenticated already
+    virtual bool on_connected() {
+        return _passwd.empty() || this->auth();
+    }
+
   private:
     fastring _passwd;
     fastream _fs;
@@ -324,20 +370,15 @@ class ClientImpl : public rpc::Client, public tcp::Client {
     bool auth();
 };
 
-ClientImpl::ClientImpl(const char* serv_ip, int serv_port, const char* passwd)
+ClientImpl::ClientImpl(const char* serv_ip, int serv_port, const char* passwd, bool pooled)
     : tcp::Client(serv_ip, serv_port) {
     if (passwd && *passwd) _passwd = md5sum(passwd);
+    if (pooled) this->use_pool(("rpc" + _passwd).c_str());
 }
 
 bool ClientImpl::connect() {
     if (!tcp::Client::connect(FLG_rpc_conn_timeout)) return false;
-
-    if (!_passwd.empty() && !this->auth()) {
-        this->disconnect();
-        return false;
-    }
-
-    LOG << "connect to rpc server " << _ip << ':' << _port << " success";
+    if (!this->reused()) LOG << "connect to rpc server " << _ip << ':' << _port << " success";
     return true;
 }
 
@@ -355,11 +396,15 @@ void ClientImpl::call(const Json& req, Json& res) {
 
     // send request
     do {
-        _fs.resize(sizeof(Header));
+        _fs.clear();
         req.str(_fs);
-        set_header((void*)_fs.data(), (int) _fs.size() - sizeof(Header));
+        set_header(&header, (int) _fs.size());
 
-        r = co::send(_fd, _fs.data(), (int) _fs.size(), FLG_rpc_send_timeout);
+        co::iovec iov[2] = {
+            { &header, sizeof(header) },
+            { (void*) _fs.data(), _fs.size() },
+        };
+        r = co::writev(_fd, iov, 2, FLG_rpc_send_timeout);
         if (unlikely(r == -1)) goto send_err;
 
         RPCLOG << "rpc send req: " << req;
@@ -383,6 +428,9 @@ void ClientImpl::call(const Json& req, Json& res) {
         res = json::parse(_fs.c_str(), _fs.size());
         if (res.is_null()) goto json_parse_err;
         RPCLOG << "rpc recv res: " << res;
+
+        // the connection is shared by pooled clients between calls
+        if (!_pool_key.empty()) this->release();
         return;
     } while (0);
 
@@ -519,8 +567,8 @@ Server* new_server(const char* ip, int port, const char* passwd) {
     return new ServerImpl(ip, port, passwd);
 }
 
-Client* new_client(const char* ip, int port, const char* passwd) {
-    return new ClientImpl(ip, port, passwd);
+Client* new_client(const char* ip, int port, const char* passwd, bool pooled) {
+    return new ClientImpl(ip, port, passwd, pooled);
 }
 
 } // rpc
@@ -1,66 +1,232 @@
 #include "co/so/tcp.h"
+#include "co/so/dns.h"
+#include "co/flag.h"
 #include "co/log.h"
 #include "co/str.h"
+#include "co/time.h"
+#include <deque>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <sys/un.h>
+#include <stddef.h>
+#endif
+
+#ifdef __linux__
+#include <netinet/tcp.h>
+#ifndef TCP_FASTOPEN
+#define TCP_FASTOPEN 23
+#endif
+#ifndef TCP_FASTOPEN_CONNECT
+#define TCP_FASTOPEN_CONNECT 30
+#endif
+#endif
+
+DEF_bool(tcp_reuseport, false, "#2 tcp::Server listens with SO_REUSEPORT in each scheduler, and handles connections in the scheduler where they were accepted, linux only");
+DEF_uint32(tcp_max_conn, 0, "#2 max connections handled by a tcp::Server, 0 for no limit");
+DEF_uint32(tcp_max_pending, 4096, "#2 max connections accepted by a tcp::Server and not yet handled, 0 for no limit");
+DEF_bool(tcp_reject_overload, false, "#2 tcp::Server resets new connections if it is overloaded, instead of stopping accepting");
+DEF_bool(tcp_fastopen, false, "#2 enable TCP Fast Open for tcp::Server and tcp::Client, data of the first request is sent in the SYN, not used by clients for hosts with more than one address");
+DEF_int32(tcp_conn_stagger_ms, 250, "#2 tcp::Client tries the next address if connecting to the current one takes longer than n ms");
+DEF_int32(tcp_pool_max_idle, 32, "#2 max idle connections for each host:port in each scheduler, for tcp::Client with use_pool()");
+DEF_int32(tcp_pool_idle_sec, 60, "#2 idle connections in the pool are closed after n seconds");
+DEF_int32(tcp_pool_max_life_sec, 0, "#2 connections are not reused n seconds after they were created, 0 for no limit");
 
 namespace so {
 namespace tcp {
 
-static void on_new_connection(void* p) {
+// unix domain socket address: unix:/path, or unix:@name in the abstract 
+// namespace (linux only).
+static inline bool is_unix_addr(const fastring& s) {
+    return s.starts_with("unix:");
+}
+
+#ifndef _WIN32
+// return length of the address, or -1 if the path is empty or too long
+static int init_unix_addr(struct sockaddr_un* addr, const fastring& s) {
+    const char* path = s.data() + 5;
+    size_t n = s.size() - 5;
+    if (n == 0 || n >= sizeof(addr->sun_path)) return -1;
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path, path, n);
+    if (*path == '@') {
+        addr->sun_path[0] = '\0'; // abstract name is not null-terminated
+        return (int)(offsetof(struct sockaddr_un, sun_path) + n);
+    }
+    return (int)(offsetof(struct sockaddr_un, sun_path) + n + 1);
+}
+#endif
+
+void on_new_connection(void* p) {
     Connection* c = (Connection*) p;
     Server* s = (Server*) c->p;
+    atomic_dec(&s->_pending_num);
+    s->wake_acceptor();
     s->on_connection(c);
 }
 
-void Server::loop() {
-    sock_t fd, connfd;
-
-    union {
-        struct sockaddr_in  v4;
-        struct sockaddr_in6 v6;
-    } addr; // use union here to support both ipv4 and ipv6
+// The connection may be still in use after on_connection() returns, e.g. it
+// is handled by other coroutines, it is done when the Connection is deleted.
+Connection::~Connection() {
+    Server* s = (Server*) p;
+    if (s) {
+        atomic_dec(&s->_conn_num);
+        s->wake_acceptor();
+    }
+}
 
-    int addrlen = sizeof(addr);
+void Server::wake_acceptor() {
+    if (unlikely(atomic_get(&_nwait) > 0) && !this->overloaded()) _ev.signal();
+}
 
-    do {
-        fastring port = str::from(_port);
-        struct addrinfo* info = 0;
+bool Server::overloaded() {
+    return (FLG_tcp_max_conn > 0 && atomic_get(&_conn_num) >= FLG_tcp_max_conn) ||
+           (FLG_tcp_max_pending > 0 && atomic_get(&_pending_num) >= FLG_tcp_max_pending);
+}
 
-        // getaddrinfo works with either a ipv4 or a ipv6 address.
-        int r = getaddrinfo(_ip.c_str(), port.c_str(), NULL, &info);
-        CHECK_EQ(r, 0) << "invalid ip address: " << _ip << ':' << _port;
-        CHECK(info != NULL);
+sock_t Server::listen(bool reuseport) {
+    if (is_unix_addr(_ip)) {
+      #ifndef _WIN32
+        struct sockaddr_un addr;
+        int len = init_unix_addr(&addr, _ip);
+        CHECK_GT(len, 0) << "invalid unix socket address: " << _ip;
 
-        fd = co::tcp_socket(info->ai_family);
+        sock_t fd = co::socket(AF_UNIX, SOCK_STREAM, 0);
         CHECK_NE(fd, (sock_t)-1) << "create socket error: " << co::strerror();
-        co::set_reuseaddr(fd);
 
-        // turn off IPV6_V6ONLY
-        if (info->ai_family == AF_INET6) {
-            int on = 0; 
-            co::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
-        }
+        // remove the socket file left by the last run
+        if (addr.sun_path[0] != '\0') ::unlink(addr.sun_path);
 
-        r = co::bind(fd, info->ai_addr, (int) info->ai_addrlen);
-        CHECK_EQ(r, 0) << "bind (" << _ip << ':' << _port << ") failed: " << co::strerror();
+        int r = co::bind(fd, &addr, len);
+        CHECK_EQ(r, 0) << "bind (" << _ip << ") failed: " << co::strerror();
 
         r = co::listen(fd, 1024);
         CHECK_EQ(r, 0) << "listen error: " << co::strerror();
+        return fd;
+      #else
+        CHECK(false) << "unix socket is not supported on windows: " << _ip;
+      #endif
+    }
+
+    fastring port = str::from(_port);
+    struct addrinfo* info = 0;
+
+    // getaddrinfo works with either a ipv4 or a ipv6 address.
+    int r = getaddrinfo(_ip.c_str(), port.c_str(), NULL, &info);
+    CHECK_EQ(r, 0) << "invalid ip address: " << _ip << ':' << _port;
+    CHECK(info != NULL);
+
+    sock_t fd = co::tcp_socket(info->ai_family);
+    CHECK_NE(fd, (sock_t)-1) << "create socket error: " << co::strerror();
+    co::set_reuseaddr(fd);
+  #ifdef SO_REUSEPORT
+    if (reuseport) co::set_reuseport(fd);
+  #else
+    (void) reuseport;
+  #endif
+
+    // turn off IPV6_V6ONLY
+    if (info->ai_family == AF_INET6) {
+        int on = 0; 
+        co::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+    }
+
+    r = co::bind(fd, info->ai_addr, (int) info->ai_addrlen);
+    CHECK_EQ(r, 0) << "bind (" << _ip << ':' << _port << ") failed: " << co::strerror();
+
+  #ifdef TCP_FASTOPEN
+    // accept data in the SYN from clients, at most 256 pending fast open 
+    // requests are allowed.
+    if (FLG_tcp_fastopen) {
+        int qlen = 256;
+        if (co::setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen)) != 0) {
+            WLOG << "enable TCP_FASTOPEN failed: " << co::strerror();
+        }
+    }
+  #endif
+
+    r = co::listen(fd, 1024);
+    CHECK_EQ(r, 0) << "listen error: " << co::strerror();
+
+    freeaddrinfo(info);
+    return fd;
+}
+
+void Server::loop() {
+  #if defined(__linux__) && defined(SO_REUSEPORT)
+    if (FLG_tcp_reuseport && co::sched_num() > 1 && !is_unix_addr(_ip)) {
+        // bind all listeners before accepting, so a failure is reported early
+        std::vector<sock_t> fds(co::sched_num());
+        for (size_t i = 0; i < fds.size(); ++i) fds[i] = this->listen(true);
+
+        for (int i = 0; i < co::sched_num(); ++i) {
+            if (i == co::sched_id()) continue;
+            sock_t fd = fds[i];
+            co::go_on(i, new_callback([this, fd]() { this->accept_loop(fd, true); }));
+        }
+        this->accept_loop(fds[co::sched_id()], true);
+        return;
+    }
+  #endif
+
+    this->accept_loop(this->listen(false), false);
+}
 
-        freeaddrinfo(info);
-    } while (0);
+// Connection coroutines run after the accept coroutine yields. Under a flood
+// of new connections, co::accept() may not wait for a long time, so the accept
+// coroutine yields after every batch of connections.
+const int kAcceptBatch = 64;
+
+void Server::accept_loop(sock_t fd, bool local) {
+    union {
+        struct sockaddr_in  v4;
+        struct sockaddr_in6 v6;
+      #ifndef _WIN32
+        struct sockaddr_un  un;
+      #endif
+    } addr; // use union here to support both ipv4 and ipv6
+
+    int addrlen, n = 0;
+    const int id = co::sched_id();
+    const bool unix_sock = is_unix_addr(_ip);
 
     while (true) {
+        // stop accepting, new connections wait in the backlog of the listener
+        if (unlikely(!FLG_tcp_reject_overload && this->overloaded())) {
+            WLOG << "tcp server overloaded, conn num: " << _conn_num << ", pending: " << _pending_num;
+            // the timeout is for a signal sent right before the wait
+            atomic_inc(&_nwait);
+            while (this->overloaded()) _ev.wait(1000);
+            atomic_dec(&_nwait);
+        }
+
         addrlen = sizeof(addr);
-        connfd = co::accept(fd, &addr, &addrlen);
+        sock_t connfd = co::accept(fd, &addr, &addrlen);
         if (unlikely(connfd == (sock_t)-1)) {
             WLOG << "accept error: " << co::strerror();
             continue;
         }
 
+        if (unlikely(FLG_tcp_reject_overload && this->overloaded())) {
+            co::reset_tcp_socket(connfd);
+            if (atomic_inc(&_rejected_num) % 1024 == 1) {
+                WLOG << "tcp server overloaded, connections rejected: " << _rejected_num;
+            }
+            continue;
+        }
+
+        atomic_inc(&_conn_num);
+        atomic_inc(&_pending_num);
+
         Connection* conn = new Connection;
         conn->fd = connfd;
         conn->p = this;
-        if (addrlen == sizeof(sockaddr_in)) {
+        if (unix_sock) {
+            conn->ip = _ip; // peers of unix sockets are usually unnamed
+            conn->port = 0;
+        } else if (addrlen == sizeof(sockaddr_in)) {
             conn->ip = co::ip_str(&addr.v4);
             conn->port = ntoh16(addr.v4.sin_port);
         } else {
@@ -68,40 +234,330 @@ void Server::loop() {
             conn->port = ntoh16(addr.v6.sin6_port);
         }
 
-        go(on_new_connection, conn);
+        if (local) {
+            co::go_on(id, new_callback(on_new_connection, conn));
+        } else {
+            go(on_new_connection, conn);
+        }
+
+        if (++n == kAcceptBatch) {
+            n = 0;
+            co::sleep(0);
+        }
     }
 }
 
-bool Client::connect(int ms) {
-    if (this->connected()) return true;
+static inline void set_error(int e) {
+  #ifdef _WIN32
+    WSASetLastError(e);
+  #else
+    errno = e;
+  #endif
+}
 
-    fastring port = str::from(_port);
-    struct addrinfo* info = 0;
-    int r = getaddrinfo(_ip.c_str(), port.c_str(), NULL, &info);
-    CHECK_EQ(r, 0) << "invalid ip address: " << _ip << ':' << _port;
-    CHECK(info != NULL);
+// create a socket and connect to @ip:@port, return the socket, or -1 on error.
+// @fastopen: use TCP_FASTOPEN_CONNECT with FLG_tcp_fastopen.
+static sock_t connect_to(const fastring& ip, int port, int ms, bool fastopen) {
+    union {
+        struct sockaddr_in  v4;
+        struct sockaddr_in6 v6;
+    } addr;
+    int addrlen;
+    int family = ip.find(':') == ip.npos ? AF_INET : AF_INET6;
+    if (family == AF_INET) {
+        co::init_ip_addr(&addr.v4, ip.c_str(), port);
+        addrlen = sizeof(addr.v4);
+    } else {
+        co::init_ip_addr(&addr.v6, ip.c_str(), port);
+        addrlen = sizeof(addr.v6);
+    }
 
-    _fd = co::tcp_socket(info->ai_family);
-    if (_fd == (sock_t)-1) {
-        ELOG << "create socket error: " << co::strerror();
-        freeaddrinfo(info);
-        return false;
+    sock_t fd = co::tcp_socket(family);
+    if (fd == (sock_t)-1) return fd;
+
+  #ifdef TCP_FASTOPEN_CONNECT
+    // connect() returns at once if there is a cookie for the server, and data
+    // of the first send() goes out with the SYN.
+    if (fastopen && FLG_tcp_fastopen) {
+        int v = 1;
+        co::setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &v, sizeof(v));
     }
+  #else
+    (void) fastopen;
+  #endif
 
-    r = co::connect(_fd, info->ai_addr, (int) info->ai_addrlen, ms);
-    if (r == -1) {
-        co::close(_fd);
-        _fd = (sock_t)-1;
+    if (co::connect(fd, &addr, addrlen, ms) == -1) {
+        int e = co::error();
+        co::close(fd);
+        set_error(e);
+        return (sock_t)-1;
+    }
+    return fd;
+}
+
+static sock_t connect_unix(const fastring& path, int ms) {
+  #ifndef _WIN32
+    struct sockaddr_un addr;
+    int len = init_unix_addr(&addr, path);
+    if (len < 0) {
+        set_error(EINVAL);
+        return (sock_t)-1;
+    }
+
+    sock_t fd = co::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == (sock_t)-1) return fd;
+
+    if (co::connect(fd, &addr, len, ms) == -1) {
+        int e = co::error();
+        co::close(fd);
+        set_error(e);
+        return (sock_t)-1;
+    }
+    return fd;
+  #else
+    set_error(WSAEAFNOSUPPORT);
+    return (sock_t)-1;
+  #endif
+}
+
+// State shared by parallel connection attempts, they all run in the same 
+// scheduler, so no lock is needed.
+struct Attempts {
+    Attempts() : fd((sock_t)-1), running(0), err(0), done(false) {}
+    co::Event ev;
+    sock_t fd;    // the first connected socket
+    int running;  // attempts in progress
+    int err;      // error of the last failed attempt
+    bool done;    // the caller has returned
+};
+
+// TCP_FASTOPEN_CONNECT is not used, as connect() would return before the
+// handshake, and the first address would always win the race.
+static void attempt(const std::shared_ptr<Attempts>& x, const fastring& ip, int port, int ms) {
+    sock_t fd = connect_to(ip, port, ms, false);
+    --x->running;
+    if (fd == (sock_t)-1) {
+        x->err = co::error();
+    } else if (x->done || x->fd != (sock_t)-1) {
+        co::close(fd); // lost the race
+        return;
+    } else {
+        x->fd = fd;
+    }
+    if (!x->done) x->ev.signal();
+}
+
+// Happy Eyeballs (RFC 8305): connect to @ips one by one, but do not wait for
+// an attempt longer than FLG_tcp_conn_stagger_ms before starting the next one.
+// The first connected socket wins, and the others are closed.
+static sock_t connect_any(std::vector<fastring>& ips, int port, int ms) {
+    // alternate address families, in case all addresses of one family are
+    // unreachable
+    std::vector<fastring> v, w;
+    for (size_t i = 0; i < ips.size(); ++i) {
+        bool same = (ips[i].find(':') == ips[i].npos) == (ips[0].find(':') == ips[0].npos);
+        (same ? v : w).push_back(ips[i]);
+    }
+    ips.clear();
+    for (size_t i = 0; i < v.size() || i < w.size(); ++i) {
+        if (i < v.size()) ips.push_back(v[i]);
+        if (i < w.size()) ips.push_back(w[i]);
+    }
+
+    auto x = std::make_shared<Attempts>();
+    const int64 deadline = ms >= 0 ? now::ms() + ms : -1;
+    const int id = co::sched_id();
+    size_t next = 0;
+
+    while (true) {
+        int left = -1;
+        if (deadline >= 0) {
+            left = (int)(deadline - now::ms());
+            if (left <= 0) break;
+        }
+
+        int wait = left;
+        if (next < ips.size()) {
+            fastring ip = ips[next++];
+            ++x->running;
+            co::go_on(id, new_callback([x, ip, port, left]() { attempt(x, ip, port, left); }));
+            if (next < ips.size()) {
+                int stagger = FLG_tcp_conn_stagger_ms > 0 ? FLG_tcp_conn_stagger_ms : 1;
+                if (wait < 0 || wait > stagger) wait = stagger;
+            }
+        } else if (x->running == 0) {
+            break; // all failed
+        }
+
+        wait < 0 ? x->ev.wait() : (void) x->ev.wait(wait);
+        if (x->fd != (sock_t)-1) break;
+    }
+
+    x->done = true;
+    if (x->fd == (sock_t)-1) set_error(x->err ? x->err : ETIMEDOUT);
+    return x->fd;
+}
+
+bool Client::new_connection(int ms) {
+    const bool unix_sock = is_unix_addr(_ip);
+    if (unix_sock) {
+        _fd = connect_unix(_ip, ms);
+    } else {
+        // resolve with the coroutine-native resolver, answers are cached
+        std::vector<fastring> ips;
+        if (!dns::resolve(_ip, &ips, ms)) {
+            ELOG << "resolve " << _ip << " failed";
+            return false;
+        }
+        _fd = ips.size() == 1 ? connect_to(ips[0], _port, ms, true) : connect_any(ips, _port, ms);
+    }
+
+    if (_fd == (sock_t)-1) {
         ELOG << "connect to " << _ip << ':' << _port << " failed: " << co::strerror();
-        freeaddrinfo(info);
         return false;
     }
 
     _sched_id = co::sched_id();
-    co::set_tcp_nodelay(_fd);
-    freeaddrinfo(info);
+    _born_ms = now::ms();
+    if (!unix_sock) co::set_tcp_nodelay(_fd);
+
+    if (!this->on_connected()) {
+        this->disconnect();
+        return false;
+    }
     return true;
 }
 
+// Idle connections for tcp::Client. Each scheduler has its own idle lists, so
+// a connection is always used in the scheduler where it was created, and no
+// lock is needed.
+class ConnPool {
+  public:
+    ConnPool() : _pools(co::max_sched_num()) {}
+    ~ConnPool() = default;
+
+    // get an alive connection, the most recently used one first.
+    bool get(const fastring& key, sock_t* fd, int64* born_ms) {
+        auto& q = _pools[co::sched_id()][key];
+        const int64 now_ms = now::ms();
+        while (!q.empty()) {
+            Conn c = q.back();
+            q.pop_back();
+            if (this->expired(c, now_ms) || !this->alive(c.fd)) {
+                co::close(c.fd);
+                continue;
+            }
+            *fd = c.fd;
+            *born_ms = c.born_ms;
+            return true;
+        }
+        return false;
+    }
+
+    void put(const fastring& key, sock_t fd, int64 born_ms) {
+        auto& q = _pools[co::sched_id()][key];
+        const int64 now_ms = now::ms();
+
+        // the least recently used connections are at the front
+        while (!q.empty() && this->expired(q.front(), now_ms)) {
+            co::close(q.front().fd);
+            q.pop_front();
+        }
+
+        Conn c = { fd, born_ms, now_ms };
+        if (this->expired(c, now_ms) || FLG_tcp_pool_max_idle <= 0) {
+            co::close(fd);
+            return;
+        }
+
+        if (q.size() >= (size_t) FLG_tcp_pool_max_idle) {
+            co::close(q.front().fd);
+            q.pop_front();
+        }
+        q.push_back(c);
+    }
+
+  private:
+    struct Conn {
+        sock_t fd;
+        int64 born_ms;
+        int64 idle_ms; // time when the connection was put into the pool
+    };
+
+    bool expired(const Conn& c, int64 now_ms) const {
+        if (FLG_tcp_pool_idle_sec > 0 && now_ms - c.idle_ms > FLG_tcp_pool_idle_sec * 1000LL) return true;
+        if (FLG_tcp_pool_max_life_sec > 0 && now_ms - c.born_ms > FLG_tcp_pool_max_life_sec * 1000LL) return true;
+        return false;
+    }
+
+    // the connection is alive if nothing can be read from it, data or EOF.
+    bool alive(sock_t fd) const {
+      #ifdef _WIN32
+        u_long n = 0;
+        return ioctlsocket(fd, FIONREAD, &n) == 0 && n == 0;
+      #else
+        char c;
+        int r = (int) ::recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        return r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+      #endif
+    }
+
+  private:
+    std::vector<std::unordered_map<fastring, std::deque<Conn>>> _pools;
+};
+
+inline ConnPool& conn_pool() {
+    static ConnPool kConnPool;
+    return kConnPool;
+}
+
+bool Client::connect(int ms) {
+    if (this->connected()) return true;
+
+    if (!_pool_key.empty() && conn_pool().get(_pool_key, &_fd, &_born_ms)) {
+        _sched_id = co::sched_id();
+        _reused = true;
+        return true;
+    }
+
+    _reused = false;
+    return this->new_connection(ms);
+}
+
+void Client::release() {
+    if (!this->connected()) return;
+    if (_pool_key.empty()) {
+        this->disconnect();
+        return;
+    }
+
+    assert(_sched_id == co::sched_id());
+    conn_pool().put(_pool_key, _fd, _born_ms);
+    _fd = (sock_t)-1;
+    _sched_id = -1;
+}
+
+int Client::warm_up(int n, int ms) {
+    if (_pool_key.empty()) return 0;
+
+    // keep the current connection of this client
+    sock_t fd = _fd;
+    int sched_id = _sched_id;
+    int64 born_ms = _born_ms;
+    _fd = (sock_t)-1;
+
+    int k = 0;
+    for (; k < n; ++k) {
+        if (!this->new_connection(ms)) break;
+        conn_pool().put(_pool_key, _fd, _born_ms);
+        _fd = (sock_t)-1;
+    }
+
+    _fd = fd;
+    _sched_id = sched_id;
+    _born_ms = born_ms;
+    return k;
+}
+
 } // tcp
 } // so
@@ -0,0 +1,147 @@
+// test for so::dns::resolve() with a stand-in dns server
+//
+// build:
+//   xmake -b dns
+//
+// run:
+//   xmake r dns                  # resolve *.test with the local stand-in server
+//   xmake r dns name=github.com  # resolve with the servers in /etc/resolv.conf
+
+#include "co/all.h"
+
+DEF_string(ip, "127.0.0.1", "ip of the stand-in dns server");
+DEF_int32(port, 5353, "port of the stand-in dns server");
+DEF_int32(ttl, 2, "ttl of answers from the stand-in dns server");
+DEF_int32(n, 64, "number of coroutines resolving a name at the same time");
+DEF_string(name, "", "resolve this name with the system dns servers if not empty");
+
+DEC_string(dns_servers);
+
+uint32 g_queries = 0;
+
+// answer A and AAAA queries for names ending with ".test", NXDOMAIN for others
+void server_fun() {
+    sock_t fd = co::udp_socket();
+    struct sockaddr_in addr;
+    co::init_ip_addr(&addr, FLG_ip.c_str(), FLG_port);
+    if (co::bind(fd, &addr, sizeof(addr)) != 0) {
+        COUT << "bind failed: " << co::strerror();
+        return;
+    }
+
+    char buf[512];
+    struct sockaddr_in peer;
+    while (true) {
+        int len = sizeof(peer);
+        int n = co::recvfrom(fd, buf, sizeof(buf), &peer, &len);
+        if (n < 12) continue;
+        atomic_inc(&g_queries);
+
+        // question: labels, type, class
+        fastring name;
+        int pos = 12;
+        while (pos < n && buf[pos] != 0) {
+            if (!name.empty()) name.append('.');
+            name.append(buf + pos + 1, (uint8)buf[pos]);
+            pos += (uint8)buf[pos] + 1;
+        }
+        pos += 1;
+        if (pos + 4 > n) continue;
+        uint16 type = (uint16)(((uint8)buf[pos] << 8) | (uint8)buf[pos + 1]);
+        pos += 4;
+
+        fastream res(512);
+        res.append(buf, 2);                      // id
+        res.append((char)0x81);                  // QR, RD
+        res.append((char)(name.ends_with(".test") ? 0x80 : 0x83)); // RA, rcode
+        res.append("\x00\x01", 2);               // QDCOUNT
+        bool found = name.ends_with(".test") && (type == 1 || type == 28);
+        res.append(found ? "\x00\x01" : "\x00\x00", 2); // ANCOUNT
+        res.append("\x00\x00\x00\x00", 4);
+        res.append(buf + 12, pos - 12);          // question
+
+        if (found) {
+            res.append("\xc0\x0c", 2);           // pointer to the name
+            res.append((char)0).append((char)type);
+            res.append("\x00\x01", 2);
+            res.append(hton32((uint32)FLG_ttl));
+            if (type == 1) {
+                res.append("\x00\x04" "\x0a\x00\x00\x01", 6); // 10.0.0.1
+            } else {
+                res.append("\x00\x10", 2);                    // fd00::1
+                res.append("\xfd\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x01", 16);
+            }
+        }
+
+        co::sendto(fd, res.data(), (int) res.size(), &peer, len);
+    }
+}
+
+void resolve(const char* name) {
+    std::vector<fastring> ips;
+    int64 beg = now::us();
+    bool ok = so::dns::resolve(name, &ips);
+    int64 t = now::us() - beg;
+
+    fastream fs;
+    for (size_t i = 0; i < ips.size(); ++i) fs << ips[i] << ' ';
+    COUT << "resolve " << name << (ok ? " ok: " : " failed: ") << fs.str() << "(" << t << " us)";
+}
+
+uint32 g_done = 0;
+
+void resolve_many() {
+    std::vector<fastring> ips;
+    so::dns::resolve("same.test", &ips);
+    atomic_inc(&g_done);
+}
+
+void test_fun() {
+    if (!FLG_name.empty()) {
+        resolve(FLG_name.c_str());
+        resolve(FLG_name.c_str());
+        return;
+    }
+
+    resolve("localhost");
+    resolve("127.0.0.1");
+    resolve("::1");
+
+    uint32 x = atomic_get(&g_queries);
+    resolve("a.test");
+    COUT << "queries sent: " << (atomic_get(&g_queries) - x);
+
+    x = atomic_get(&g_queries);
+    resolve("a.test");
+    COUT << "queries sent (cached): " << (atomic_get(&g_queries) - x);
+
+    x = atomic_get(&g_queries);
+    resolve("nx.example");
+    COUT << "queries sent: " << (atomic_get(&g_queries) - x);
+
+    // resolve the same name in many coroutines, only one query is sent
+    x = atomic_get(&g_queries);
+    for (int i = 0; i < FLG_n; ++i) go(resolve_many);
+    while (atomic_get(&g_done) != (uint32) FLG_n) co::sleep(1);
+    COUT << FLG_n << " coroutines resolve same.test, queries sent: " << (atomic_get(&g_queries) - x);
+
+    co::sleep(FLG_ttl * 1000 + 100);
+    x = atomic_get(&g_queries);
+    resolve("a.test");
+    COUT << "queries sent (expired): " << (atomic_get(&g_queries) - x);
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+    log::init();
+
+    if (FLG_name.empty()) {
+        FLG_dns_servers = FLG_ip + ':' + str::from(FLG_port);
+        go(server_fun);
+        sleep::ms(32);
+    }
+
+    go(test_fun);
+    sleep::ms(FLG_ttl * 1000 + 1000);
+    return 0;
+}
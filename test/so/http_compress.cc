@@ -0,0 +1,103 @@
+// benchmark for compression of http responses, throughput vs bytes on the wire
+//
+// build (zlib required):
+//   xmake f --with_zlib=y && xmake -b http_compress
+//
+// run:
+//   xmake r http_compress               # a json body of about 64k
+//   xmake r http_compress size=4096 n=10000
+
+#include "co/so/http.h"
+#include "co/flag.h"
+#include "co/log.h"
+#include "co/time.h"
+
+DEF_int32(n, 2000, "times to compress the body");
+DEF_int32(size, 64 << 10, "size of the body");
+
+DEC_bool(http_compress);
+DEC_int32(http_compress_budget_us);
+
+// json like responses of an api
+fastring make_body(size_t size) {
+    fastring s(size + 256);
+    s << '[';
+    for (int i = 0; s.size() < size; ++i) {
+        if (i > 0) s << ',';
+        s << "{\"id\":" << (i * 7919 % 100003) << ",\"name\":\"user" << i
+          << "\",\"email\":\"user" << i << "@example.com\",\"active\":"
+          << (i % 3 ? "true" : "false") << ",\"score\":" << (i * 31 % 1000) << '}';
+    }
+    s << ']';
+    return s;
+}
+
+void report(const char* name, size_t raw, size_t wire, int64 us) {
+    const double mb = (double) raw * FLG_n / (1 << 20);
+    COUT << name << ": " << (int64)(mb * 1000000 / (us > 0 ? us : 1)) << " MB/s, "
+         << wire << " bytes on the wire (" << (wire * 100 / raw) << "%), "
+         << (us * 1000 / FLG_n) << " ns per body";
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+
+    fastring body = make_body(FLG_size);
+    fastring out, x;
+    Timer t;
+    int64 us;
+
+    COUT << "body size: " << body.size() << " bytes, compressed " << FLG_n << " times";
+    if (!http::compress(http::kGzip, body.data(), body.size(), out, 1)) {
+        COUT << "zlib not available, build with WITH_ZLIB (cmake) or --with_zlib=y (xmake)";
+        return 0;
+    }
+
+    COUT << "identity: " << body.size() << " bytes on the wire";
+
+    const int levels[] = { 1, 3, 6, 9 };
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); ++i) {
+        t.restart();
+        for (int k = 0; k < FLG_n; ++k) {
+            http::compress(http::kGzip, body.data(), body.size(), out, levels[i]);
+        }
+        us = t.us();
+        fastring name("gzip level ");
+        name << levels[i];
+        report(name.c_str(), body.size(), out.size(), us);
+    }
+
+    do {
+        http::compress(http::kGzip, body.data(), body.size(), out, 6);
+        t.restart();
+        for (int k = 0; k < FLG_n; ++k) {
+            http::decompress(http::kGzip, out.data(), out.size(), x);
+        }
+        us = t.us();
+        report("gunzip", body.size(), out.size(), us);
+        if (x != body) COUT << "decompress error";
+    } while (0);
+
+    do {
+        // responses of the server, the body is compressed once and found in
+        // the cache later
+        FLG_http_compress = true;
+        FLG_http_compress_budget_us = 0;
+        http::Req req;
+        http::Res res;
+        req.add_header("Accept-Encoding", "gzip, deflate");
+        size_t wire = 0;
+
+        t.restart();
+        for (int k = 0; k < FLG_n; ++k) {
+            res.clear();
+            res.set_body(body);
+            http::compress_res(req, res);
+            wire = res.body().size();
+        }
+        us = t.us();
+        report("server, cached", body.size(), wire, us);
+    } while (0);
+
+    return 0;
+}
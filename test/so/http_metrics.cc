@@ -0,0 +1,59 @@
+// benchmark for recording metrics of http requests
+//
+// build:
+//   xmake -b http_metrics
+//
+// run:
+//   xmake r http_metrics            # record requests in each scheduler
+//   xmake r http_metrics n=10000000 # record n requests in each scheduler
+//   xmake r http_metrics show=true  # print the metrics
+
+#include "co/so/http.h"
+#include "co/co.h"
+#include "co/flag.h"
+#include "co/log.h"
+#include "co/thread.h"
+#include "co/time.h"
+
+DEF_int32(n, 1000000, "number of requests to record in each scheduler");
+DEF_bool(show, false, "print the metrics in prometheus text format");
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+
+    http::Router router;
+    router.add(http::kGet, "/users", [](const http::Req&, http::Res&) {});
+    router.add(http::kGet, "/users/:id", [](const http::Req&, http::Res&) {});
+    router.add(http::kPost, "/users", [](const http::Req&, http::Res&) {});
+    router.add(http::kGet, "/static/*file", [](const http::Req&, http::Res&) {});
+
+    http::Metrics m;
+    m.init(router);
+
+    // requests recorded by all schedulers at the same time
+    const int num = co::sched_num();
+    SyncEvent ev;
+    int left = num;
+    int64 ns = 0;
+
+    for (int i = 0; i < num; ++i) {
+        co::go_on(i, new_callback([&]() {
+            Timer t;
+            for (int k = 0; k < FLG_n; ++k) {
+                const int route = (k & 7) - 3; // -1 for not matched
+                m.record(route < 0 ? -1 : route, http::kGet, (k & 15) ? 200 : 404, 0, 1024, (k & 1023) * 7);
+            }
+            atomic_add(&ns, t.us() * 1000 / FLG_n);
+            if (atomic_dec(&left) == 0) ev.signal();
+        }));
+    }
+
+    ev.wait();
+    COUT << num << " schedulers, " << FLG_n << " requests each: " << (ns / num) << " ns per request";
+
+    Timer t;
+    fastring s = m.str();
+    COUT << "read metrics in " << t.us() << " us, " << s.size() << " bytes";
+    if (FLG_show) COUT << s;
+    return 0;
+}
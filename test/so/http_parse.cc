@@ -0,0 +1,133 @@
+// benchmark for parsing http requests
+//
+// build:
+//   xmake -b http_parse
+//
+// run:
+//   xmake r http_parse            # parse a typical browser request
+//   xmake r http_parse n=1000000  # parse it n times
+
+#include "co/so/http.h"
+#include "co/flag.h"
+#include "co/log.h"
+#include "co/time.h"
+
+DEF_int32(n, 200000, "times to parse the request");
+
+const char* kReq =
+    "GET /index.html?q=coroutine&page=2 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/96.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/webp,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: keep-alive\r\n"
+    "Cookie: session=8a7f6c1e2d3b4a59; theme=dark; lang=en\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "\r\n";
+
+// the way requests were parsed before: substr for every header, and upper()
+// on every key when a header is looked up.
+int legacy_parse(const fastring& s, fastring* url, std::vector<fastring>* headers) {
+    size_t end = s.find("\r\n\r\n");
+    size_t p = s.find('\r');
+    size_t x = s.find(' ');
+    fastring method = s.substr(0, x).toupper();
+    size_t y = s.find(' ', x + 1);
+    *url = s.substr(x + 1, y - x - 1);
+    fastring version = s.substr(y + 1, p - y - 1).toupper();
+    if (method != "GET" || version != "HTTP/1.1") return -1;
+
+    size_t beg = p + 2;
+    headers->clear();
+    while (beg < end) {
+        x = s.find('\r', beg);
+        size_t t = s.find(':', beg);
+        headers->push_back(s.substr(beg, t - beg));
+        do { ++t; } while (s[t] == ' ' && t < x);
+        headers->push_back(s.substr(t, x - t));
+        beg = x + 2;
+    }
+
+    fastring k("CONNECTION");
+    for (size_t i = 0; i < headers->size(); i += 2) {
+        if ((*headers)[i].upper() == k) return 0;
+    }
+    return -1;
+}
+
+void report(const char* name, int64 us) {
+    double ns = us * 1000.0 / FLG_n;
+    COUT << name << ": " << (int64)(FLG_n * 1000000.0 / (us > 0 ? us : 1)) << " req/s, "
+         << ns << " ns per request";
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+
+    fastring req(kReq);
+    Timer t;
+    int64 us;
+    int r = 0;
+
+    COUT << "request size: " << req.size() << " bytes, parse " << FLG_n << " times";
+
+    do {
+        fastring url;
+        std::vector<fastring> headers;
+        t.restart();
+        for (int i = 0; i < FLG_n; ++i) r += legacy_parse(req, &url, &headers);
+        us = t.us();
+        report("legacy parse", us);
+    } while (0);
+
+    do {
+        http::Parser p;
+        t.restart();
+        for (int i = 0; i < FLG_n; ++i) {
+            p.reset();
+            r += p.parse_req(req.data(), req.size());
+            r += p.find(http::kHeaderConnection) < 0;
+        }
+        us = t.us();
+        report("http::Parser", us);
+    } while (0);
+
+    do {
+        // parse in pieces, as the request arrives in several packets
+        http::Parser p;
+        t.restart();
+        for (int i = 0; i < FLG_n; ++i) {
+            p.reset();
+            for (size_t n = 64; n < req.size(); n += 64) {
+                if (p.parse_req(req.data(), n) != http::Parser::kMore) ++r;
+            }
+            r += p.parse_req(req.data(), req.size());
+        }
+        us = t.us();
+        report("http::Parser, 64 bytes a time", us);
+    } while (0);
+
+    do {
+        // parse and fill http::Req, as the server does
+        http::Parser p;
+        http::Req x;
+        t.restart();
+        for (int i = 0; i < FLG_n; ++i) {
+            p.reset();
+            x.clear();
+            r += p.parse_req(req.data(), req.size());
+            x.set_url(req.data() + p.url().off, p.url().len);
+            for (int k = 0; k < p.header_num(); ++k) {
+                x.add_header(req.data() + p.key(k).off, p.key(k).len, req.data() + p.value(k).off, p.value(k).len);
+            }
+            r += x.header(http::kHeaderConnection).empty();
+        }
+        us = t.us();
+        report("http::Parser + http::Req", us);
+    } while (0);
+
+    if (r != 0) COUT << "parse error: " << r;
+    return 0;
+}
@@ -0,0 +1,151 @@
+// benchmark for routing http requests
+//
+// build:
+//   xmake -b http_route
+//
+// run:
+//   xmake r http_route            # route requests with a few hundred routes
+//   xmake r http_route n=1000000  # route n requests
+
+#include "co/so/http.h"
+#include "co/flag.h"
+#include "co/log.h"
+#include "co/str.h"
+#include "co/time.h"
+
+DEF_int32(n, 1000000, "number of requests to route");
+
+static const char* kResources[] = {
+    "users", "orgs", "repos", "issues", "pulls", "commits", "branches", "tags",
+    "releases", "assets", "hooks", "keys", "teams", "members", "projects",
+    "columns", "cards", "milestones", "labels", "comments", "reviews", "gists",
+    "notifications", "events", "feeds", "stars", "watchers", "forks", "deployments",
+    "statuses", "checks", "runs", "jobs", "artifacts", "secrets", "packages",
+    "pages", "builds", "invitations", "collaborators", "topics", "licenses",
+    "emojis", "markdown", "search",
+};
+
+static const int kNumResources = sizeof(kResources) / sizeof(kResources[0]);
+
+// the way requests are routed without a router: compare the path with every
+// route, segment by segment
+struct Route {
+    http::Method method;
+    std::vector<fastring> segs;
+    int id;
+};
+
+static int linear_find(const std::vector<Route>& routes, int method, const fastring& url) {
+    std::vector<fastring> segs = str::split(url, '/');
+    for (size_t i = 0; i < routes.size(); ++i) {
+        const Route& r = routes[i];
+        if (r.method != method) continue;
+        bool wild = !r.segs.empty() && r.segs.back().starts_with('*');
+        if (wild ? segs.size() < r.segs.size() - 1 : segs.size() != r.segs.size()) continue;
+        size_t k = 0;
+        for (; k < r.segs.size(); ++k) {
+            const fastring& s = r.segs[k];
+            if (s.starts_with('*')) { k = r.segs.size(); break; }
+            if (s.starts_with(':')) continue;
+            if (s != segs[k]) break;
+        }
+        if (k == r.segs.size()) return r.id;
+    }
+    return -1;
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+
+    http::Router router;
+    std::vector<Route> routes;
+    int hits = 0;
+
+    auto add = [&](http::Method m, const fastring& path) {
+        int id = (int) routes.size();
+        router.add(m, path.c_str(), [&hits, id](const http::Req&, http::Res&) { hits += id; });
+        Route r;
+        r.method = m;
+        r.segs = str::split(path.substr(1), '/');
+        r.id = id;
+        routes.push_back(r);
+    };
+
+    for (int i = 0; i < kNumResources; ++i) {
+        fastring r = fastring("/") + kResources[i];
+        add(http::kGet, r);
+        add(http::kPost, r);
+        add(http::kGet, r + "/:id");
+        add(http::kPut, r + "/:id");
+        add(http::kDelete, r + "/:id");
+        add(http::kGet, r + "/:id/items");
+        add(http::kGet, r + "/:id/items/:item");
+    }
+    add(http::kGet, "/static/*file");
+
+    // requests to route, on different depths of the trie
+    std::vector<std::pair<int, fastring>> reqs;
+    for (int i = 0; i < kNumResources; ++i) {
+        fastring r = fastring("/") + kResources[i];
+        reqs.push_back(std::make_pair((int)http::kGet, r));
+        reqs.push_back(std::make_pair((int)http::kGet, r + "/12345"));
+        reqs.push_back(std::make_pair((int)http::kDelete, r + "/12345"));
+        reqs.push_back(std::make_pair((int)http::kGet, r + "/12345/items/678?page=2"));
+    }
+    reqs.push_back(std::make_pair((int)http::kGet, fastring("/static/js/app.min.js")));
+
+    COUT << "routes: " << routes.size() << ", route " << FLG_n << " requests";
+
+    std::vector<http::Req> xs(reqs.size());
+    for (size_t i = 0; i < reqs.size(); ++i) {
+        xs[i].set_method((http::Method) reqs[i].first);
+        xs[i].set_url(reqs[i].second.substr(0, reqs[i].second.find('?')));
+    }
+
+    Timer t;
+    int64 us;
+    int64 r = 0;
+
+    do {
+        t.restart();
+        for (int i = 0; i < FLG_n; ++i) {
+            const http::Req& x = xs[i % xs.size()];
+            r += linear_find(routes, x.method(), x.url());
+        }
+        us = t.us();
+        COUT << "linear compare: " << (us * 1000.0 / FLG_n) << " ns per request";
+    } while (0);
+
+    do {
+        int64 x = 0;
+        for (size_t i = 0; i < xs.size(); ++i) {
+            xs[i].set_url(reqs[i].second);
+        }
+
+        t.restart();
+        for (int i = 0; i < FLG_n; ++i) {
+            http::Req& req = xs[i % xs.size()];
+            const http::Router::Fun* f = router.find(&req);
+            if (f) x += req.param_num(); else ++x;
+        }
+        us = t.us();
+        COUT << "http::Router: " << (us * 1000.0 / FLG_n) << " ns per request";
+        r += x;
+    } while (0);
+
+    // check the parameters
+    do {
+        http::Req req;
+        req.set_url("/repos/co/items/42?x=1");
+        const http::Router::Fun* f = router.find(&req);
+        http::Res res;
+        if (f) (*f)(req, res);
+        COUT << "/repos/co/items/42 => id: " << req.param("id") << ", item: " << req.param("item");
+        req.set_url("/static/css/a.css");
+        router.find(&req);
+        COUT << "/static/css/a.css => file: " << req.param("file");
+    } while (0);
+
+    if (r == 0) COUT << "";
+    return 0;
+}
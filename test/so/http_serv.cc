@@ -7,6 +7,10 @@
 //   xmake r http_serv                          # 0.0.0.0:80
 //   xmake r http_serv ip=127.0.0.1 port=7777   # 127.0.0.1:7777
 //   xmake r http_serv ip=::                    # :::80  (ipv6)
+//   xmake r http_serv stream=true              # stream request bodies
+//   xmake r http_serv h2c=true                 # HTTP/2 with prior knowledge
+//                                              # curl --http2-prior-knowledge
+//   xmake r http_serv metrics=/metrics         # prometheus metrics at /metrics
 //   
 // special notes:
 //   For ipv6 link-local address, we have to specify the network interface:
@@ -15,16 +19,23 @@
 #include "co/so.h"
 #include "co/flag.h"
 #include "co/log.h"
+#include "co/str.h"
 #include "co/time.h"
 
 DEF_string(ip, "0.0.0.0", "http server ip");
 DEF_int32(port, 80, "http server port");
+DEF_bool(stream, false, "stream request bodies, they are not held in memory");
+DEF_bool(h2c, false, "serve HTTP/2 over tcp with prior knowledge");
+DEF_string(metrics, "", "serve metrics of requests at this path if not empty");
 
 int main(int argc, char** argv) {
     flag::init(argc, argv);
     log::init();
 
     http::Server serv(FLG_ip.c_str(), FLG_port);
+    serv.stream_req_body(FLG_stream);
+    serv.h2c(FLG_h2c);
+    if (!FLG_metrics.empty()) serv.enable_metrics(FLG_metrics.c_str());
 
     serv.on_req(
         [](const http::Req& req, http::Res& res) {
@@ -32,9 +43,25 @@ int main(int argc, char** argv) {
                 if (req.url() == "/hello") {
                     res.set_status(200);
                     res.set_body("hello world");
+                } else if (req.url() == "/stream") {
+                    // the body is sent in pieces with chunked encoding
+                    res.set_status(200);
+                    for (int i = 0; i < 8; ++i) {
+                        if (res.write("hello world\n") == -1) break;
+                    }
                 } else {
                     res.set_status(404);
                 }
+            } else if (req.is_method_post() && req.url() == "/upload") {
+                // curl --data-binary @file http://127.0.0.1/upload
+                int64 n = req.body_len();
+                if (FLG_stream) {
+                    char buf[4096];
+                    int r;
+                    for (n = 0; (r = req.read_body(buf, sizeof(buf))) > 0;) n += r;
+                }
+                res.set_status(200);
+                res.set_body(str::from(n));
             } else {
                 res.set_status(501);
             }
@@ -0,0 +1,66 @@
+// tcp proxy based on co::relay(), data is moved between sockets with splice()
+//
+// build:
+//   xmake -b proxy
+//
+// run:
+//   xmake r proxy port=8888 dst_ip=127.0.0.1 dst_port=80
+//   curl http://127.0.0.1:8888/
+
+#include "co/all.h"
+
+DEF_string(ip, "0.0.0.0", "proxy ip");
+DEF_int32(port, 8888, "proxy port");
+DEF_string(dst_ip, "127.0.0.1", "destination ip");
+DEF_int32(dst_port, 80, "destination port");
+DEF_int32(idle_ms, 60000, "close the connections if no data was moved for n ms");
+
+class Proxy : public tcp::Server {
+  public:
+    Proxy(const char* ip, int port)
+        : tcp::Server(ip, port) {
+    }
+
+    virtual ~Proxy() = default;
+
+    virtual void on_connection(so::Connection* conn);
+};
+
+void Proxy::on_connection(so::Connection* conn) {
+    std::unique_ptr<so::Connection> c(conn);
+    co::set_tcp_nodelay(c->fd);
+
+    struct sockaddr_in addr;
+    co::init_ip_addr(&addr, FLG_dst_ip.c_str(), FLG_dst_port);
+
+    sock_t fd = co::tcp_socket();
+    if (co::connect(fd, &addr, sizeof(addr), 3000) == -1) {
+        ELOG << "connect to " << FLG_dst_ip << ':' << FLG_dst_port << " failed: " << co::strerror();
+        co::close(fd);
+        co::reset_tcp_socket(c->fd);
+        return;
+    }
+    co::set_tcp_nodelay(fd);
+
+    int64 n = co::relay(c->fd, fd, FLG_idle_ms);
+    if (n == -1) {
+        ELOG << "relay " << *c << " error: " << co::strerror();
+        co::reset_tcp_socket(fd);
+        co::reset_tcp_socket(c->fd);
+    } else {
+        LOG << "relay " << *c << " done, bytes: " << n;
+        co::close(fd);
+        co::close(c->fd);
+    }
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+    log::init();
+
+    Proxy proxy(FLG_ip.c_str(), FLG_port);
+    proxy.start();
+
+    while (true) sleep::sec(1024);
+    return 0;
+}
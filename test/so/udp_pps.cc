@@ -0,0 +1,130 @@
+// udp packets-per-second benchmark
+//
+// build:
+//   xmake -b udp_pps
+//
+// run:
+//   xmake r udp_pps                     # recvmmsg/sendmmsg, 64 datagrams per batch
+//   xmake r udp_pps batch=1             # recvfrom/sendto, one datagram per syscall
+//   xmake r udp_pps size=512 sec=5      # 512-byte datagrams, run for 5 seconds
+
+#include "co/all.h"
+
+DEF_string(ip, "127.0.0.1", "ip");
+DEF_int32(port, 6699, "port");
+DEF_int32(batch, 64, "datagrams per syscall, recvfrom/sendto are used if batch <= 1");
+DEF_int32(size, 64, "size of a datagram");
+DEF_int32(sec, 3, "seconds to run");
+
+uint64 g_recv = 0;
+uint64 g_sent = 0;
+bool g_stop = false;
+
+void server_fun() {
+    sock_t fd = co::udp_socket();
+    co::set_recv_buffer_size(fd, 8 << 20);
+
+    struct sockaddr_in addr;
+    co::init_ip_addr(&addr, FLG_ip.c_str(), FLG_port);
+    co::bind(fd, &addr, sizeof(addr));
+
+    const int n = FLG_batch > 1 ? FLG_batch : 1;
+    char* buf = (char*) malloc(n * 2048);
+    std::vector<struct iovec> iov(n);
+    std::vector<struct mmsghdr> msgs(n);
+    for (int i = 0; i < n; ++i) {
+        iov[i].iov_base = buf + i * 2048;
+        iov[i].iov_len = 2048;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (!g_stop) {
+        int r;
+        if (n > 1) {
+            r = co::recvmmsg(fd, &msgs[0], n, 100);
+        } else {
+            r = co::recvfrom(fd, buf, 2048, NULL, NULL, 100);
+            if (r >= 0) r = 1;
+        }
+
+        if (r > 0) {
+            atomic_add(&g_recv, r);
+        } else if (co::error() != ETIMEDOUT) {
+            COUT << "server recv error: " << co::strerror();
+            break;
+        }
+    }
+
+    free(buf);
+    co::close(fd);
+}
+
+void client_fun() {
+    sock_t fd = co::udp_socket();
+    co::set_send_buffer_size(fd, 8 << 20);
+
+    struct sockaddr_in addr;
+    co::init_ip_addr(&addr, FLG_ip.c_str(), FLG_port);
+    co::connect(fd, &addr, sizeof(addr));
+
+    const int n = FLG_batch > 1 ? FLG_batch : 1;
+    fastring data(FLG_size, 'x');
+    std::vector<struct iovec> iov(n);
+    std::vector<struct mmsghdr> msgs(n);
+    for (int i = 0; i < n; ++i) {
+        iov[i].iov_base = (void*) data.data();
+        iov[i].iov_len = data.size();
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    uint32 k = 0;
+    while (!g_stop) {
+        int r;
+        if (n > 1) {
+            r = co::sendmmsg(fd, &msgs[0], n);
+        } else {
+            r = co::send(fd, data.data(), (int) data.size());
+            if (r >= 0) r = 1;
+        }
+
+        if (r < 0) {
+            // ECONNREFUSED may be reported if the server is not ready
+            if (co::error() == ECONNREFUSED) { co::sleep(1); continue; }
+            COUT << "client send error: " << co::strerror();
+            break;
+        }
+
+        atomic_add(&g_sent, r);
+        if (++k % 64 == 0) co::sleep(0); // let the server run if on the same scheduler
+    }
+
+    co::close(fd);
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+    log::init();
+
+    go(server_fun);
+    sleep::ms(32);
+    go(client_fun);
+
+    uint64 last = 0;
+    for (int i = 0; i < FLG_sec; ++i) {
+        sleep::sec(1);
+        uint64 x = atomic_get(&g_recv);
+        COUT << "recv: " << (x - last) << " pps, sent: " << atomic_get(&g_sent);
+        last = x;
+    }
+
+    COUT << "batch: " << FLG_batch << ", size: " << FLG_size
+         << ", avg: " << (atomic_get(&g_recv) / FLG_sec) << " pps";
+
+    atomic_swap(&g_stop, true);
+    sleep::ms(200);
+    return 0;
+}
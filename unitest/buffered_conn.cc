@@ -0,0 +1,245 @@
+#ifndef _WIN32
+
+#include "co/unitest.h"
+#include "co/buffered_conn.h"
+#include "co/co.h"
+#include "co/thread.h"
+#include <functional>
+#include <memory>
+#include <sys/socket.h>
+
+namespace test {
+
+// run @f in a coroutine, and wait for it
+static void go_wait(const std::function<void()>& f) {
+    SyncEvent ev;
+    co::go([&]() {
+        f();
+        ev.signal();
+    });
+    ev.wait();
+}
+
+// a pair of connected non-blocking unix sockets, closed by close()
+struct Pair {
+    Pair() {
+        int fds[2] = { -1, -1 };
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        a = fds[0];
+        b = fds[1];
+        co::set_nonblock(a);
+        co::set_nonblock(b);
+    }
+
+    // MUST be called in coroutine
+    void close() {
+        co::close(a);
+        co::close(b);
+    }
+
+    sock_t a;
+    sock_t b;
+};
+
+static fastring make_data(size_t n) {
+    fastring s(n);
+    for (size_t i = 0; i < n; ++i) s.append((char)('a' + i % 26));
+    return s;
+}
+
+DEF_test(buffered_conn) {
+    DEF_case(read) {
+        int r1 = 0, r2 = 0, r3 = 0, r4 = 0;
+        fastring s1, s2, s3;
+        go_wait([&]() {
+            Pair p;
+            co::BufferedConn bc(p.a, 64);
+            const char* s = "GET / HTTP/1.1\r\nHost: x\r\n\r\nbodyxyz";
+            co::send(p.b, s, (int) strlen(s));
+
+            r1 = bc.read_until("\r\n\r\n", 1024, 100);
+            s1 = fastring(bc.data(), r1);
+            bc.consume(r1);
+
+            r2 = bc.peek(4, 100);
+            s2 = fastring(bc.data(), 4);
+
+            // the rest in the buffer is copied first
+            co::send(p.b, "12345", 5);
+            char buf[10];
+            r3 = bc.read_exact(buf, 10, 100);
+            s3 = fastring(buf, 10);
+
+            r4 = (int) bc.size();
+            p.close();
+        });
+        EXPECT_EQ(r1, 27);
+        EXPECT_EQ(s1, "GET / HTTP/1.1\r\nHost: x\r\n\r\n");
+        EXPECT_GE(r2, 4);
+        EXPECT_EQ(s2, "body");
+        EXPECT_EQ(r3, 10);
+        EXPECT_EQ(s3, "bodyxyz123");
+        EXPECT_EQ(r4, 0);
+    }
+
+    DEF_case(read.split) {
+        // the delimiter arrives in pieces, and the buffer grows
+        int r = 0;
+        fastring s;
+        go_wait([&]() {
+            Pair p;
+            co::BufferedConn bc(p.a, 64);
+            fastring x = make_data(300);
+            co::send(p.b, x.data(), (int) x.size());
+            co::send(p.b, "\r", 1);
+            co::go([p]() {
+                co::sleep(5);
+                co::send(p.b, "\nnext", 5);
+            });
+            r = bc.read_until("\r\n", 1024, 1000);
+            if (r > 0) s = fastring(bc.data(), r);
+            co::sleep(10);
+            p.close();
+        });
+        EXPECT_EQ(r, 302);
+        EXPECT_EQ(s, make_data(300) + "\r\n");
+    }
+
+    DEF_case(read.errors) {
+        int r1 = 0, e1 = 0, r2 = 0, r3 = 0, r4 = 0;
+        go_wait([&]() {
+            Pair p;
+            co::BufferedConn bc(p.a, 64);
+            co::send(p.b, "0123456789", 10);
+
+            // not found within max bytes
+            r1 = bc.read_until("\r\n", 8, 100);
+            e1 = co::error();
+
+            // timeout
+            r2 = bc.peek(20, 10);
+
+            // closed by the peer
+            co::close(p.b);
+            r3 = bc.peek(20, 100);
+            r4 = bc.read_until("\r\n", 1024, 100);
+            co::close(p.a);
+        });
+        EXPECT_EQ(r1, -1);
+        EXPECT_EQ(e1, EMSGSIZE);
+        EXPECT_EQ(r2, -1);
+        EXPECT_EQ(r3, 0);
+        EXPECT_EQ(r4, 0);
+    }
+
+    DEF_case(write) {
+        size_t n1 = 0, n2 = 0;
+        int r = 0;
+        fastring s;
+        go_wait([&]() {
+            Pair p;
+            co::BufferedConn bc(p.a, 64);
+            bc.write("hello ", 6);
+            bc.write("world", 5);
+            n1 = bc.pending();
+
+            // larger than the buffer, sent with the buffered data at once
+            fastring x = make_data(100);
+            bc.write(x.data(), (int) x.size());
+            n2 = bc.pending();
+            bc.write("!", 1);
+            bc.flush();
+
+            co::BufferedConn rb(p.b);
+            char buf[112];
+            r = rb.read_exact(buf, 112, 100);
+            s = fastring(buf, 112);
+            p.close();
+        });
+        EXPECT_EQ(n1, 11);
+        EXPECT_EQ(n2, 0);
+        EXPECT_EQ(r, 112);
+        EXPECT_EQ(s, fastring("hello world") + make_data(100) + "!");
+    }
+
+    DEF_case(deferred_flush) {
+        // sent by the scheduler, without flush()
+        int r = 0;
+        size_t n = 0;
+        fastring s;
+        go_wait([&]() {
+            Pair p;
+            co::BufferedConn bc(p.a);
+            bc.set_deferred_flush(true);
+            bc.write("abc", 3);
+            bc.write("def", 3);
+            n = bc.pending();
+
+            char buf[6];
+            r = co::recvn(p.b, buf, 6, 100);
+            s = fastring(buf, 6);
+            bc.flush();
+            p.close();
+        });
+        EXPECT_EQ(n, 6);
+        EXPECT_EQ(r, 6);
+        EXPECT_EQ(s, "abcdef");
+    }
+
+    DEF_case(deferred_flush.eagain) {
+        // more than the socket buffer, the rest is sent by a coroutine when the
+        // socket becomes writable, and later writes wait for it.
+        struct State {
+            fastring got;
+            bool done;
+        };
+        std::shared_ptr<State> st(new State());
+        st->done = false;
+        const fastring data = make_data(1 << 20);
+        size_t left = 0;
+        int r = 0;
+
+        go_wait([&]() {
+            Pair p;
+            int x = 4096;
+            setsockopt(p.a, SOL_SOCKET, SO_SNDBUF, &x, sizeof(x));
+
+            co::BufferedConn bc(p.a, 2 << 20);
+            bc.set_deferred_flush(true, 3000);
+            for (size_t i = 0; i < data.size(); i += 1000) {
+                const size_t n = data.size() - i < 1000 ? data.size() - i : 1000;
+                bc.write(data.data() + i, (int) n);
+            }
+
+            // the scheduler sends what the socket takes
+            co::sleep(1);
+            left = bc.pending();
+
+            sock_t b = p.b;
+            co::go([st, b]() {
+                co::sleep(10);
+                char buf[8192];
+                int n;
+                while ((n = co::recv(b, buf, sizeof(buf), 1000)) > 0) {
+                    st->got.append(buf, n);
+                    if (st->got.ends_with("tail")) break;
+                }
+                st->done = true;
+            });
+
+            bc.write("tail", 4);
+            r = bc.flush(3000);
+            for (int i = 0; i < 3000 && !st->done; ++i) co::sleep(1);
+            p.close();
+        });
+        EXPECT_GT(left, 0);
+        EXPECT_EQ(r, 0);
+        EXPECT(st->done);
+        EXPECT_EQ(st->got.size(), data.size() + 4);
+        EXPECT(st->got == data + "tail");
+    }
+}
+
+} // namespace test
+
+#endif
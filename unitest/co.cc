@@ -1,9 +1,38 @@
 #include "co/unitest.h"
 #include "co/co.h"
+#include "co/fs.h"
+#include "co/os.h"
+#include "co/thread.h"
 #include "../src/co/impl/scheduler.h"
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+
+DEC_bool(co_hook_file_io);
+#endif
+
 namespace test {
 
+#ifndef _WIN32
+// whether the hooked file I/O in @f suspends the coroutine. @f runs in a
+// coroutine, and a coroutine added to the same scheduler before it can run
+// only if the current one is suspended.
+static bool suspended(const std::function<void()>& f) {
+    std::shared_ptr<bool> x(new bool(false));
+    bool r = false;
+    SyncEvent ev;
+    co::go([&]() {
+        co::go_on(co::sched_id(), new_callback([x]() { *x = true; }));
+        f();
+        r = *x;
+        ev.signal();
+    });
+    ev.wait();
+    return r;
+}
+#endif
+
 DEF_test(co) {
     EXPECT(co::null_timer_id == co::timer_id_t());
 
@@ -121,6 +150,85 @@ DEF_test(co) {
         }
     }
 
+    DEF_case(sched.busy_poll) {
+        SyncEvent ev;
+        int id = co::sched_num() - 1;
+        co::BusyPollStats a = co::busy_poll_stats(id);
+        co::go_on(id, new_callback([&ev]() {
+            co::set_busy_poll(2000);
+            for (int i = 0; i < 8; ++i) co::sleep(1);
+            co::set_busy_poll(0);
+            ev.signal();
+        }));
+        ev.wait();
+
+        // the scheduler polls without blocking while it waits for the timers
+        co::BusyPollStats b = co::busy_poll_stats(id);
+        EXPECT_GT(b.spins, a.spins);
+        EXPECT_GT(b.hits + b.sleeps, a.hits + a.sleeps);
+        EXPECT_GE(b.spins - a.spins, (b.hits + b.sleeps) - (a.hits + a.sleeps));
+    }
+
+  #ifndef _WIN32
+    DEF_case(hook.file_io) {
+        const bool hook_file_io = FLG_co_hook_file_io;
+        FLG_co_hook_file_io = true;
+        fastring path;
+        path << "/tmp/co_unitest_file_io_" << os::pid();
+        const fastring data(8192, 'x');
+        ssize_t r[5] = { 0 };
+        int err = 0;
+        fastring s;
+
+        // offloaded to the helper threads
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        EXPECT(suspended([&]() { r[0] = ::write(fd, data.data(), data.size()); }));
+        EXPECT(suspended([&]() { r[1] = (ssize_t) ::fsync(fd); }));
+
+        // the buffer on the shared stack is copied
+        EXPECT(suspended([&]() {
+            char buf[4096];
+            r[2] = ::pread(fd, buf, sizeof(buf), 4000);
+            if (r[2] > 0) s.append(buf, r[2]);
+        }));
+
+        // kept in the scheduler thread
+        co::set_file_io_offload(fd, false);
+        EXPECT(!suspended([&]() { r[3] = ::pwrite(fd, "hello", 5, 0); }));
+
+        // the setting is cleared by close()
+        suspended([&]() { ::close(fd); });
+        fd = ::open(path.c_str(), O_RDONLY);
+        EXPECT(suspended([&]() {
+            char buf[8];
+            r[4] = ::read(fd, buf, 5);
+            if (r[4] > 0) s.append(buf, r[4]);
+        }));
+
+        // errno of the helper thread is returned
+        EXPECT(suspended([&]() {
+            if (::write(fd, "x", 1) == -1) err = errno;
+        }));
+        suspended([&]() { ::close(fd); });
+
+        // not offloaded if co_hook_file_io is false
+        FLG_co_hook_file_io = false;
+        fd = ::open(path.c_str(), O_RDONLY);
+        EXPECT(!suspended([&]() { char c; ::read(fd, &c, 1); }));
+        ::close(fd);
+        fs::remove(path);
+        FLG_co_hook_file_io = hook_file_io;
+
+        EXPECT_EQ(r[0], (ssize_t) data.size());
+        EXPECT_EQ(r[1], 0);
+        EXPECT_EQ(r[2], 4096);
+        EXPECT_EQ(r[3], 5);
+        EXPECT_EQ(r[4], 5);
+        EXPECT_EQ(s, fastring(4096, 'x') + "hello");
+        EXPECT_EQ(err, EBADF);
+    }
+  #endif
+
     //DEF_case(epoll) {}
 }
 
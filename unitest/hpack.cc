@@ -0,0 +1,162 @@
+#include "co/unitest.h"
+#include "co/so/hpack.h"
+#include <string.h>
+
+namespace test {
+
+namespace hpack = so::http::hpack;
+
+// bytes of the hex string @s, spaces are ignored
+static fastring unhex(const char* s) {
+    fastring r;
+    int n = 0, v = 0;
+    for (; *s; ++s) {
+        const char c = *s;
+        if (c == ' ') continue;
+        v = v * 16 + (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+        if (++n == 2) {
+            r.append((char) v);
+            n = v = 0;
+        }
+    }
+    return r;
+}
+
+// decode @hex with @d, and join the fields as "name: value\n"
+static fastring decode(hpack::Decoder& d, const char* hex) {
+    fastring s = unhex(hex);
+    std::vector<fastring> h;
+    size_t m = 0;
+    if (!d.decode(s.data(), s.size(), h, &m)) return "error";
+
+    fastring r;
+    for (size_t i = 0; i < m; i += 2) r << h[i] << ": " << h[i + 1] << '\n';
+    return r;
+}
+
+static fastring encode_int(uint64 v, int bits) {
+    fastring s;
+    hpack::encode_int(v, bits, 0, s);
+    return s;
+}
+
+static fastring huffman(const char* s) {
+    fastring r;
+    hpack::huffman_encode(s, strlen(s), r);
+    return r;
+}
+
+// test vectors in RFC 7541, Appendix C
+DEF_test(hpack) {
+    DEF_case(int) {
+        EXPECT_EQ(encode_int(10, 5), unhex("0a"));
+        EXPECT_EQ(encode_int(1337, 5), unhex("1f9a0a"));
+        EXPECT_EQ(encode_int(42, 8), unhex("2a"));
+    }
+
+    DEF_case(huffman) {
+        EXPECT_EQ(huffman("www.example.com"), unhex("f1e3 c2e5 f23a 6ba0 ab90 f4ff"));
+        EXPECT_EQ(huffman("no-cache"), unhex("a8eb 1064 9cbf"));
+        EXPECT_EQ(huffman("custom-key"), unhex("25a8 49e9 5ba9 7d7f"));
+        EXPECT_EQ(huffman("custom-value"), unhex("25a8 49e9 5bb8 e8b4 bf"));
+        EXPECT_EQ(hpack::huffman_len("www.example.com", 15), 12);
+
+        fastring s;
+        fastring x = unhex("f1e3 c2e5 f23a 6ba0 ab90 f4ff");
+        EXPECT(hpack::huffman_decode(x.data(), x.size(), s));
+        EXPECT_EQ(s, "www.example.com");
+    }
+
+    DEF_case(fields) {
+        hpack::Decoder d;
+        EXPECT_EQ(decode(d, "400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572"),
+            "custom-key: custom-header\n");
+
+        hpack::Decoder d2;
+        EXPECT_EQ(decode(d2, "040c 2f73 616d 706c 652f 7061 7468"), ":path: /sample/path\n");
+        EXPECT_EQ(decode(d2, "1008 7061 7373 776f 7264 0673 6563 7265 74"), "password: secret\n");
+        EXPECT_EQ(decode(d2, "82"), ":method: GET\n");
+    }
+
+    DEF_case(requests) {
+        hpack::Decoder d;
+        EXPECT_EQ(decode(d, "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d"),
+            ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n");
+        EXPECT_EQ(decode(d, "8286 84be 5808 6e6f 2d63 6163 6865"),
+            ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\ncache-control: no-cache\n");
+        EXPECT_EQ(decode(d, "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65"),
+            ":method: GET\n:scheme: https\n:path: /index.html\n:authority: www.example.com\ncustom-key: custom-value\n");
+    }
+
+    DEF_case(requests.huffman) {
+        hpack::Decoder d;
+        EXPECT_EQ(decode(d, "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff"),
+            ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n");
+        EXPECT_EQ(decode(d, "8286 84be 5886 a8eb 1064 9cbf"),
+            ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\ncache-control: no-cache\n");
+        EXPECT_EQ(decode(d, "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf"),
+            ":method: GET\n:scheme: https\n:path: /index.html\n:authority: www.example.com\ncustom-key: custom-value\n");
+    }
+
+    // the table size is 256, entries are evicted
+    DEF_case(responses) {
+        hpack::Decoder d;
+        d.set_limit(256);
+        EXPECT_EQ(decode(d,
+            "4803 3330 3258 0770 7269 7661 7465 611d"
+            "4d6f 6e2c 2032 3120 4f63 7420 3230 3133"
+            "2032 303a 3133 3a32 3120 474d 546e 1768"
+            "7474 7073 3a2f 2f77 7777 2e65 7861 6d70"
+            "6c65 2e63 6f6d"),
+            ":status: 302\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:21 GMT\n"
+            "location: https://www.example.com\n");
+        EXPECT_EQ(decode(d, "4803 3330 37c1 c0bf"),
+            ":status: 307\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:21 GMT\n"
+            "location: https://www.example.com\n");
+        EXPECT_EQ(decode(d,
+            "88c1 611d 4d6f 6e2c 2032 3120 4f63 7420"
+            "3230 3133 2032 303a 3133 3a32 3220 474d"
+            "54c0 5a04 677a 6970 7738 666f 6f3d 4153"
+            "444a 4b48 514b 425a 584f 5157 454f 5049"
+            "5541 5851 5745 4f49 553b 206d 6178 2d61"
+            "6765 3d33 3630 303b 2076 6572 7369 6f6e"
+            "3d31"),
+            ":status: 200\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:22 GMT\n"
+            "location: https://www.example.com\ncontent-encoding: gzip\n"
+            "set-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1\n");
+    }
+
+    DEF_case(responses.huffman) {
+        hpack::Decoder d;
+        d.set_limit(256);
+        EXPECT_EQ(decode(d,
+            "4882 6402 5885 aec3 771a 4b61 96d0 7abe"
+            "9410 54d4 44a8 2005 9504 0b81 66e0 82a6"
+            "2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8"
+            "e9ae 82ae 43d3"),
+            ":status: 302\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:21 GMT\n"
+            "location: https://www.example.com\n");
+        EXPECT_EQ(decode(d, "4883 640e ffc1 c0bf"),
+            ":status: 307\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:21 GMT\n"
+            "location: https://www.example.com\n");
+        EXPECT_EQ(decode(d,
+            "88c1 6196 d07a be94 1054 d444 a820 0595"
+            "040b 8166 e084 a62d 1bff c05a 839b d9ab"
+            "77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b"
+            "3960 d5af 2708 7f36 72c1 ab27 0fb5 291f"
+            "9587 3160 65c0 03ed 4ee5 b106 3d50 07"),
+            ":status: 200\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:22 GMT\n"
+            "location: https://www.example.com\ncontent-encoding: gzip\n"
+            "set-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1\n");
+    }
+
+    DEF_case(errors) {
+        hpack::Decoder d;
+        EXPECT_EQ(decode(d, "80"), "error");       // index 0
+        EXPECT_EQ(decode(d, "be"), "error");       // not in the table
+        EXPECT_EQ(decode(d, "3fe2 1f"), "error");  // table size update to 4097, above the limit
+        EXPECT_EQ(decode(d, "8220"), "error");     // table size update after a field
+    }
+}
+
+} // namespace test
@@ -0,0 +1,431 @@
+#include "co/unitest.h"
+#include "co/so/http.h"
+#include "co/co.h"
+#include "co/flag.h"
+#include "co/fs.h"
+#include "co/os.h"
+#include "co/str.h"
+#include "co/thread.h"
+#include "co/time.h"
+#include <functional>
+#include <vector>
+
+DEC_int32(co_zerocopy_size);
+
+namespace test {
+
+// run @f in a coroutine, and wait for it
+static void go_wait(const std::function<void()>& f) {
+    SyncEvent ev;
+    co::go([&]() {
+        f();
+        ev.signal();
+    });
+    ev.wait();
+}
+
+// the servers run on abstract unix sockets until the process exits
+static const char* kServ = "unix:@co_unitest_http";
+static const char* kStreamServ = "unix:@co_unitest_http_stream";
+static const char* kPipeServ = "unix:@co_unitest_http_pipe";
+static fastring g_file; // sent by kPipeServ for /file
+
+// echo the body, with the value of Transfer-Encoding of the request
+static void echo(const http::Req& req, http::Res& res) {
+    res.set_status(200);
+    res.add_header("X-TE", req.header("Transfer-Encoding").c_str());
+    res.add_header("X-CL", req.header("Content-Length").c_str());
+    res.set_body(req.body());
+}
+
+static void start_servers() {
+    static bool started = false;
+    if (started) return;
+    started = true;
+
+    http::Server* s = new http::Server(kServ, 0);
+    s->on_req(echo);
+    s->start();
+
+    // read the body in pieces, and send it back in pieces, or 400 if the body
+    // is bad
+    http::Server* t = new http::Server(kStreamServ, 0);
+    t->stream_req_body(true);
+    t->on_req([](const http::Req& req, http::Res& res) {
+        fastring s;
+        char buf[1000];
+        int r;
+        while ((r = req.read_body(buf, sizeof(buf))) > 0) s.append(buf, r);
+        if (r < 0) {
+            res.set_status(400);
+            res.set_body("bad body");
+            return;
+        }
+
+        res.set_status(200);
+        res.add_header("X-TE", req.header("Transfer-Encoding").c_str());
+        for (size_t i = 0; i < s.size(); i += 1000) {
+            res.write(s.data() + i, (int) (s.size() - i < 1000 ? s.size() - i : 1000));
+        }
+    });
+    t->start();
+
+    // the body is the path without '/', or large bodies, or the file g_file.
+    // For /sleep/n, the body is sent after n ms.
+    http::Server* u = new http::Server(kPipeServ, 0);
+    u->on_req([](const http::Req& req, http::Res& res) {
+        const fastring& url = req.url();
+        if (url.starts_with("/sleep/")) {
+            co::sleep(atoi(url.data() + 7));
+            res.set_body(url.substr(7));
+        } else if (url == "/file") {
+            res.set_file(g_file, 0, 4);
+        } else if (url == "/half") {
+            res.set_body(fastring(150000, 'h'));
+        } else if (url == "/big") {
+            res.set_body(fastring(300000, 'b'));
+        } else {
+            res.set_body(url.substr(1));
+        }
+        res.set_status(200);
+    });
+    u->start();
+    sleep::ms(50);
+}
+
+// send @s to the server @serv, and receive until the connection is closed,
+// or only the first recv if @first is true, for errors the server resets the
+// connection a while after the response.
+static fastring raw(const char* serv, const fastring& s, bool first=false) {
+    fastring r;
+    go_wait([&]() {
+        tcp::Client c(serv, 0);
+        if (!c.connect(1000)) return;
+        if (c.send(s.data(), (int) s.size(), 1000) != (int) s.size()) return;
+        char buf[4096];
+        int n;
+        while ((n = c.recv(buf, sizeof(buf), 1000)) > 0) {
+            r.append(buf, n);
+            if (first) break;
+        }
+    });
+    return r;
+}
+
+// send @s to the server @serv in pieces of @n bytes, with a short pause after
+// each piece, then shutdown the write side, and receive until the connection
+// is closed
+static fastring raw_split(const char* serv, const fastring& s, size_t n) {
+    fastring r;
+    go_wait([&]() {
+        tcp::Client c(serv, 0);
+        if (!c.connect(1000)) return;
+        for (size_t i = 0; i < s.size(); i += n) {
+            const int k = (int) (s.size() - i < n ? s.size() - i : n);
+            if (c.send(s.data() + i, k, 1000) != k) return;
+            co::sleep(1);
+        }
+        co::shutdown(c.fd(), 'w');
+        char buf[4096];
+        int x;
+        while ((x = c.recv(buf, sizeof(buf), 1000)) > 0) r.append(buf, x);
+    });
+    return r;
+}
+
+// the status line of the response to @s, which is an error
+static fastring raw_err(const char* serv, const fastring& s) {
+    fastring r = raw(serv, s, true);
+    return r.substr(0, r.find("\r\n"));
+}
+
+// status and body of the responses in @s, which have Content-Length
+static std::vector<std::pair<int, fastring>> responses(const fastring& s) {
+    std::vector<std::pair<int, fastring>> v;
+    size_t p = 0;
+    while (p < s.size()) {
+        const size_t e = s.find("\r\n\r\n", p);
+        if (e == s.npos) break;
+        const fastring h = s.substr(p, e - p);
+        const size_t k = h.find("Content-Length: ");
+        const size_t n = k == h.npos ? 0 : (size_t) atoi(h.data() + k + 16);
+        if (e + 4 + n > s.size()) break;
+        v.push_back(std::make_pair(atoi(h.data() + 9), s.substr(e + 4, n)));
+        p = e + 4 + n;
+    }
+    return v;
+}
+
+// the body of the last response in @s
+static fastring last_body(const fastring& s) {
+    size_t p = s.rfind("\r\n\r\n");
+    return p == s.npos ? fastring() : s.substr(p + 4);
+}
+
+DEF_test(http) {
+    start_servers();
+
+    DEF_case(req.header_str) {
+        http::Req req(http::kPost);
+        req.set_url("/x");
+        req.add_header("Content-Length", "3");
+        req.add_header("X-A", "1");
+        req.set_body("abc");
+
+        fastring s = req.header_str();
+        EXPECT(s.find("Content-Length: 3\r\n") != s.npos);
+        EXPECT(s.find("Transfer-Encoding") == s.npos);
+
+        // the body is sent in pieces, Content-Length is not sent
+        s.clear();
+        req.header_str(s, true);
+        EXPECT(s.starts_with("POST /x HTTP/1.1\r\nTransfer-Encoding: chunked\r\n"));
+        EXPECT(s.find("Content-Length") == s.npos);
+        EXPECT(s.find("X-A: 1\r\n") != s.npos);
+        EXPECT(s.ends_with("\r\n\r\n"));
+    }
+
+    DEF_case(chunked) {
+        // chunk extensions and trailers, the next request on the connection
+        // is still handled.
+        fastring s = raw(kServ,
+            "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+            "5\r\nhello\r\n6;x=1\r\n world\r\n0\r\nX-Trailer: 1\r\n\r\n"
+            "POST / HTTP/1.1\r\nConnection: close\r\nContent-Length: 2\r\n\r\nok"
+        );
+        EXPECT(s.starts_with("HTTP/1.1 200 OK\r\n"));
+        EXPECT(s.find("\r\n\r\nhello world") != s.npos);
+        EXPECT(s.find("X-TE: chunked\r\n") != s.npos);
+        EXPECT_EQ(last_body(s), "ok");
+
+        // chunk sizes in upper case hex
+        s = raw(kServ,
+            "POST / HTTP/1.1\r\nConnection: close\r\nTransfer-Encoding: chunked\r\n\r\n"
+            "A\r\n0123456789\r\n0\r\n\r\n"
+        );
+        EXPECT_EQ(last_body(s), "0123456789");
+    }
+
+    DEF_case(chunked.bad) {
+        const char* h = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+        EXPECT_EQ(raw_err(kServ, fastring(h) << "zz\r\nhello\r\n0\r\n\r\n"), "HTTP/1.1 400 Bad Request");
+        EXPECT_EQ(raw_err(kServ, fastring(h) << ";x\r\nhello\r\n0\r\n\r\n"), "HTTP/1.1 400 Bad Request");
+        EXPECT_EQ(raw_err(kServ, fastring(h) << "5x\r\nhello\r\n0\r\n\r\n"), "HTTP/1.1 400 Bad Request");
+        EXPECT_EQ(raw_err(kServ, fastring(h) << "10000000000000000\r\nhello\r\n0\r\n\r\n"), "HTTP/1.1 400 Bad Request");
+
+        // no CRLF after the data of a chunk
+        EXPECT_EQ(raw_err(kServ, fastring(h) << "5\r\nhelloX\r\n0\r\n\r\n"), "HTTP/1.1 400 Bad Request");
+    }
+
+    DEF_case(split) {
+        // requests are read through a buffer, and may be split anywhere
+        const fastring req =
+            "POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello"
+            "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+            "3\r\nabc\r\n2\r\nde\r\n0\r\n\r\n"
+            "POST / HTTP/1.1\r\nConnection: close\r\nContent-Length: 2\r\n\r\nok";
+        const size_t pieces[] = { 1, 7, 40, 64 };
+        for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); ++i) {
+            fastring s = raw_split(kServ, req, pieces[i]);
+            const size_t a = s.find("\r\n\r\nhello");
+            const size_t b = s.find("\r\n\r\nabcde");
+            EXPECT(s.starts_with("HTTP/1.1 200 OK\r\n"));
+            EXPECT(a != s.npos);
+            EXPECT(b != s.npos && b > a);
+            EXPECT_EQ(last_body(s), "ok");
+        }
+
+        // a body larger than the read buffer
+        fastring body;
+        for (int i = 0; i < 100000; ++i) body << (char)('a' + i % 26);
+        fastring s = raw(kServ, fastring("POST / HTTP/1.1\r\nConnection: close\r\nContent-Length: ")
+            << body.size() << "\r\n\r\n" << body);
+        EXPECT(s.starts_with("HTTP/1.1 200 OK\r\n"));
+        EXPECT_EQ(last_body(s), body);
+
+        // the client stops sending in the header, or in the body
+        s = raw_split(kServ, "POST / HTTP/1.1\r\nContent-Le", 8);
+        EXPECT(s.empty());
+        s = raw_split(kServ, "POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\nhel", 8);
+        EXPECT(s.empty());
+    }
+
+    DEF_case(pipeline) {
+        // responses are batched, and sent in order of the requests, with
+        // responses of files and large bodies between them
+        g_file = "/tmp/co_unitest_http_pipe_";
+        g_file << os::pid();
+        do {
+            fs::file f(g_file.c_str(), 'w');
+            f.write("file", 4);
+        } while (0);
+        const int32 zerocopy_size = FLG_co_zerocopy_size;
+        FLG_co_zerocopy_size = 200000;
+
+        fastring req;
+        std::vector<fastring> expected;
+        for (int i = 0; i < 40; ++i) {
+            req << "GET /" << i << " HTTP/1.1\r\n\r\n";
+            expected.push_back(str::from(i));
+        }
+        const char* urls[] = { "half", "half", "file", "40", "big", "41" };
+        for (size_t i = 0; i < sizeof(urls) / sizeof(urls[0]); ++i) {
+            req << "GET /" << urls[i] << " HTTP/1.1\r\n\r\n";
+            const fastring u(urls[i]);
+            expected.push_back(
+                u == "half" ? fastring(150000, 'h') : u == "big" ? fastring(300000, 'b') : u
+            );
+        }
+
+        // nothing is sent after Connection: close
+        req << "GET /42 HTTP/1.1\r\nConnection: close\r\n\r\n";
+        expected.push_back("42");
+        req << "GET /43 HTTP/1.1\r\n\r\n";
+
+        std::vector<std::pair<int, fastring>> v = responses(raw(kPipeServ, req));
+        FLG_co_zerocopy_size = zerocopy_size;
+        fs::remove(g_file);
+
+        EXPECT_EQ(v.size(), expected.size());
+        size_t n = 0;
+        for (size_t i = 0; i < v.size() && i < expected.size(); ++i) {
+            if (v[i].first == 200 && v[i].second == expected[i]) ++n;
+        }
+        EXPECT_EQ(n, expected.size());
+
+        // responses before a bad request are sent before the 400
+        v = responses(raw(kPipeServ,
+            "GET /0 HTTP/1.1\r\n\r\nGET /1 HTTP/1.1\r\n\r\nGET\r\n\r\nGET /2 HTTP/1.1\r\n\r\n"
+        ));
+        EXPECT_EQ(v.size(), 3u);
+        if (v.size() == 3) {
+            EXPECT_EQ(v[0].second, "0");
+            EXPECT_EQ(v[1].second, "1");
+            EXPECT_EQ(v[2].first, 400);
+        }
+    }
+
+    DEF_case(client.pipeline) {
+        std::vector<http::Req> reqs;
+        std::vector<http::Res> res;
+        for (int i = 0; i < 100; ++i) {
+            http::Req req(i == 50 ? http::kHead : http::kGet);
+            req.set_url(fastring("/") << i);
+            reqs.push_back(req);
+        }
+        go_wait([&]() {
+            http::Client c(kPipeServ, 0);
+            c.pipeline(reqs, res);
+        });
+
+        // more than one group of requests, and no body for HEAD
+        size_t n = 0;
+        for (int i = 0; i < 100 && i < (int) res.size(); ++i) {
+            const fastring body = i == 50 ? fastring() : str::from(i);
+            if (res[i].status() == 200 && res[i].body() == body) ++n;
+        }
+        EXPECT_EQ(res.size(), 100u);
+        EXPECT_EQ(n, 100u);
+
+        // the connection is closed after the second response, the following
+        // responses get the error status
+        reqs.resize(4);
+        reqs[1].add_header("Connection", "close");
+        go_wait([&]() {
+            http::Client c(kPipeServ, 0);
+            c.pipeline(reqs, res);
+        });
+        EXPECT_EQ(res.size(), 4u);
+        if (res.size() == 4) {
+            EXPECT_EQ(res[0].body(), "0");
+            EXPECT_EQ(res[1].body(), "1");
+            EXPECT_EQ(res[2].status(), 578); // Connection Closed
+            EXPECT_EQ(res[3].status(), res[2].status());
+        }
+    }
+
+    DEF_case(fan_out) {
+        std::vector<http::Call> calls;
+        const char* urls[] = { "/sleep/10", "/a", "/sleep/300", "/b" };
+        for (int i = 0; i < 4; ++i) {
+            calls.push_back(http::Call(kPipeServ, 0));
+            calls.back().req.set_url(urls[i]);
+        }
+        calls.push_back(http::Call("unix:@co_unitest_http_none", 0));
+        calls.back().req.set_url("/c");
+
+        int n[2] = { 0 };
+        int64 t = 0;
+        go_wait([&]() {
+            Timer timer;
+            n[0] = http::fan_out(calls, 100);
+            t = timer.ms();
+        });
+
+        // partial results at the deadline
+        EXPECT_EQ(n[0], 4);
+        EXPECT_GE(t, 95);
+        EXPECT_LT(t, 250);
+        EXPECT_EQ(calls[0].res.status(), 200);
+        EXPECT_EQ(calls[0].res.body(), "10");
+        EXPECT_EQ(calls[1].res.body(), "a");
+        EXPECT_EQ(calls[2].res.status(), 580);
+        EXPECT(calls[2].res.body().empty());
+        EXPECT_EQ(calls[3].res.body(), "b");
+        EXPECT_EQ(calls[4].res.status(), 577);
+
+        // without a timeout, connections in the pool are still good
+        for (int i = 0; i < 4; ++i) calls[i].res = http::Res();
+        go_wait([&]() {
+            n[1] = http::fan_out(calls, -1);
+        });
+        EXPECT_EQ(n[1], 5);
+        EXPECT_EQ(calls[2].res.status(), 200);
+        EXPECT_EQ(calls[2].res.body(), "300");
+        EXPECT_EQ(calls[3].res.body(), "b");
+    }
+
+    DEF_case(stream) {
+        fastring data;
+        for (int i = 0; i < 10000; ++i) data << (i % 10);
+
+        fastring body, te;
+        int status = 0;
+        go_wait([&]() {
+            http::Client c(kStreamServ, 0);
+            http::Req req(http::kPost);
+            req.set_url("/");
+            req.set_body("ignored"); // the body is not sent by begin_req()
+            req.add_header("Content-Length", "7");
+            if (!c.begin_req(req)) return;
+            for (size_t i = 0; i < data.size(); i += 3000) {
+                const size_t n = data.size() - i < 3000 ? data.size() - i : 3000;
+                if (c.write_body(data.data() + i, (int) n) != (int) n) return;
+            }
+            if (!c.end_req()) return;
+
+            http::Res res;
+            if (!c.recv_header(res)) return;
+            status = res.status();
+            te = res.header("Transfer-Encoding");
+            char buf[777];
+            int r;
+            while ((r = c.read_body(buf, sizeof(buf))) > 0) body.append(buf, r);
+            if (r < 0) body = "error";
+        });
+        EXPECT_EQ(status, 200);
+        EXPECT_EQ(te, "chunked");
+        EXPECT_EQ(body, data);
+    }
+
+    DEF_case(stream.bad) {
+        fastring s = raw(kStreamServ,
+            "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+            "5\r\nhello\r\nzz\r\n", true
+        );
+        EXPECT(s.starts_with("HTTP/1.1 400"));
+        EXPECT(s.find("bad body") != s.npos);
+    }
+}
+
+} // namespace test
@@ -0,0 +1,214 @@
+#include "co/unitest.h"
+#include "co/so/http.h"
+#include "co/co.h"
+#include "co/flag.h"
+#include "co/thread.h"
+#include "co/time.h"
+#include <functional>
+
+DEC_bool(http_compress);
+DEC_int32(http_max_body_size);
+
+namespace test {
+
+// run @f in a coroutine, and wait for it
+static void go_wait(const std::function<void()>& f) {
+    SyncEvent ev;
+    co::go([&]() {
+        f();
+        ev.signal();
+    });
+    ev.wait();
+}
+
+static fastring text(size_t n) {
+    fastring s(n);
+    for (size_t i = 0; s.size() < n; ++i) s << "hello world " << (i % 100) << '\n';
+    s.resize(n);
+    return s;
+}
+
+static const char* kServ = "unix:@co_unitest_http_encoding";
+
+static void start_server() {
+    static bool started = false;
+    if (started) return;
+    started = true;
+    http::Server* s = new http::Server(kServ, 0);
+    s->on_req([](const http::Req&, http::Res& res) {
+        res.set_status(200);
+        res.set_body(text(8000));
+    });
+    s->start();
+    sleep::ms(50);
+}
+
+// compress_res() with @body and the Accept-Encoding @ae, return the
+// Content-Encoding of the response
+static fastring negotiate(const char* ae, http::Res& res, const fastring& body) {
+    http::Req req(http::kGet);
+    req.set_url("/");
+    if (ae) req.add_header("Accept-Encoding", ae);
+    res = http::Res();
+    res.set_status(200);
+    res.set_body(body);
+    http::compress_res(req, res);
+    return res.header("Content-Encoding");
+}
+
+DEF_test(http_encoding) {
+    DEF_case(content_encoding) {
+        EXPECT_EQ(http::content_encoding("gzip"), http::kGzip);
+        EXPECT_EQ(http::content_encoding("X-GZIP"), http::kGzip);
+        EXPECT_EQ(http::content_encoding("Deflate"), http::kDeflate);
+        EXPECT_EQ(http::content_encoding("br"), http::kIdentity);
+        EXPECT_EQ(http::content_encoding(""), http::kIdentity);
+    }
+
+    DEF_case(vary) {
+        http::Res res;
+        http::add_vary(res);
+        EXPECT_EQ(res.header("Vary"), "Accept-Encoding");
+        http::add_vary(res);
+        EXPECT_EQ(res.header("Vary"), "Accept-Encoding");
+
+        res = http::Res();
+        res.add_header("Vary", "Origin");
+        http::add_vary(res);
+        EXPECT_EQ(res.header("Vary"), "Origin, Accept-Encoding");
+
+        res = http::Res();
+        res.add_header("Vary", "origin, accept-encoding");
+        http::add_vary(res);
+        EXPECT_EQ(res.header("Vary"), "origin, accept-encoding");
+
+        res = http::Res();
+        res.add_header("Vary", "*");
+        http::add_vary(res);
+        EXPECT_EQ(res.header("Vary"), "*");
+    }
+
+  #ifdef HAS_ZLIB
+    DEF_case(compress) {
+        const fastring s = text(10000);
+        fastring z, x;
+        EXPECT(http::compress(http::kGzip, s.data(), s.size(), z));
+        EXPECT_LT(z.size(), s.size());
+        EXPECT(z.starts_with("\x1f\x8b"));
+        EXPECT(http::decompress(http::kGzip, z.data(), z.size(), x));
+        EXPECT_EQ(x, s);
+
+        EXPECT(http::compress(http::kDeflate, s.data(), s.size(), z));
+        x.clear();
+        EXPECT(http::decompress(http::kDeflate, z.data(), z.size(), x));
+        EXPECT_EQ(x, s);
+
+        // the gzip or zlib wrapper is detected
+        EXPECT(http::decompress(http::kGzip, z.data(), z.size(), x));
+        EXPECT_EQ(x, s);
+
+        // bad or truncated data, or larger than FLG_http_max_body_size
+        EXPECT(!http::decompress(http::kGzip, s.data(), 100, x));
+        EXPECT(http::compress(http::kGzip, s.data(), s.size(), z));
+        EXPECT(!http::decompress(http::kGzip, z.data(), z.size() / 2, x));
+        const int32 max = FLG_http_max_body_size;
+        FLG_http_max_body_size = 5000;
+        EXPECT(!http::decompress(http::kGzip, z.data(), z.size(), x));
+        FLG_http_max_body_size = max;
+    }
+
+    DEF_case(negotiate) {
+        const fastring body = text(4096);
+        http::Res res;
+        EXPECT_EQ(negotiate("gzip", res, body), "gzip");
+        EXPECT_EQ(res.header("Vary"), "Accept-Encoding");
+        fastring x;
+        EXPECT(http::decompress(http::kGzip, res.body().data(), res.body().size(), x));
+        EXPECT_EQ(x, body);
+
+        // gzip is preferred, codings with q=0 are not acceptable
+        EXPECT_EQ(negotiate("deflate, gzip", res, body), "gzip");
+        EXPECT_EQ(negotiate("deflate", res, body), "deflate");
+        EXPECT_EQ(negotiate("gzip;q=0, deflate", res, body), "deflate");
+        EXPECT_EQ(negotiate("deflate;q=0.5, GZIP;q=0.000", res, body), "deflate");
+        EXPECT_EQ(negotiate("gzip;q=0.001", res, body), "gzip");
+        EXPECT_EQ(negotiate("*", res, body), "gzip");
+
+        // not compressed, but caches must know the body depends on it
+        EXPECT_EQ(negotiate("br", res, body), "");
+        EXPECT_EQ(res.body(), body);
+        EXPECT_EQ(res.header("Vary"), "Accept-Encoding");
+        EXPECT_EQ(negotiate(0, res, body), "");
+        EXPECT_EQ(res.header("Vary"), "Accept-Encoding");
+        EXPECT_EQ(negotiate("gzip;q=0, deflate;q=0", res, body), "");
+
+        // small bodies are sent as they are
+        EXPECT_EQ(negotiate("gzip", res, "small"), "");
+        EXPECT(res.header("Vary").empty());
+
+        // not compressible, or already encoded
+        http::Req req(http::kGet);
+        req.add_header("Accept-Encoding", "gzip");
+        res = http::Res();
+        res.set_status(200);
+        res.add_header("Content-Type", "image/png");
+        res.set_body(body);
+        http::compress_res(req, res);
+        EXPECT(res.header("Content-Encoding").empty());
+        EXPECT_EQ(res.body(), body);
+
+        res = http::Res();
+        res.set_status(200);
+        res.add_header("Content-Encoding", "br");
+        res.set_body(body);
+        http::compress_res(req, res);
+        EXPECT_EQ(res.header("Content-Encoding"), "br");
+        EXPECT_EQ(res.body(), body);
+
+        res = http::Res();
+        res.set_status(206);
+        res.set_body(body);
+        http::compress_res(req, res);
+        EXPECT(res.header("Content-Encoding").empty());
+    }
+
+    DEF_case(client) {
+        start_server();
+        const bool compress = FLG_http_compress;
+        FLG_http_compress = true;
+
+        http::Res a, b;
+        go_wait([&]() {
+            http::Client c(kServ, 0);
+
+            // the client asks for gzip or deflate, and decompresses the body
+            http::Req req(http::kGet);
+            req.set_url("/");
+            c.call(req, a);
+
+            // not decompressed if Accept-Encoding is set by the user
+            http::Req r(http::kGet);
+            r.set_url("/");
+            r.add_header("Accept-Encoding", "deflate");
+            c.call(r, b);
+        });
+        FLG_http_compress = compress;
+
+        const fastring body = text(8000);
+        EXPECT_EQ(a.status(), 200);
+        EXPECT_EQ(a.body(), body);
+        EXPECT(a.header("Content-Encoding").empty());
+        EXPECT(a.header("Content-Length").empty());
+        EXPECT_EQ(a.header("Vary"), "Accept-Encoding");
+
+        fastring x;
+        EXPECT_EQ(b.status(), 200);
+        EXPECT_EQ(b.header("Content-Encoding"), "deflate");
+        EXPECT_LT(b.body().size(), body.size());
+        EXPECT(http::decompress(http::kDeflate, b.body().data(), b.body().size(), x));
+        EXPECT_EQ(x, body);
+    }
+  #endif
+}
+
+} // namespace test
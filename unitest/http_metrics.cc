@@ -0,0 +1,157 @@
+#include "co/unitest.h"
+#include "co/so/http.h"
+#include "co/co.h"
+#include "co/thread.h"
+#include "co/time.h"
+#include <functional>
+
+namespace test {
+
+static void nop(const http::Req&, http::Res&) {}
+
+// run @f in a coroutine, and wait for it
+static void go_wait(const std::function<void()>& f) {
+    SyncEvent ev;
+    co::go([&]() {
+        f();
+        ev.signal();
+    });
+    ev.wait();
+}
+
+// whether the line @l is in the metrics @s
+static bool has_line(const fastring& s, const fastring& l) {
+    return s.starts_with(l + "\n") || s.find((fastring("\n") + l + "\n").c_str()) != s.npos;
+}
+
+static const char* kServ = "unix:@co_unitest_http_metrics";
+
+// send @s to the server, return the response received
+static fastring request(const fastring& s) {
+    static bool started = false;
+    if (!started) {
+        started = true;
+        http::Server* serv = new http::Server(kServ, 0);
+        serv->on(http::kGet, "/hello", [](const http::Req&, http::Res& res) {
+            res.set_body("hello");
+        });
+        serv->on(http::kPost, "/hello", nop);
+        serv->enable_metrics();
+        serv->start();
+        sleep::ms(50);
+    }
+
+    fastring r;
+    go_wait([&]() {
+        tcp::Client c(kServ, 0);
+        if (!c.connect(1000)) return;
+        if (c.send(s.data(), (int) s.size(), 1000) != (int) s.size()) return;
+        char buf[16384];
+        int n;
+        while ((n = c.recv(buf, sizeof(buf), 1000)) > 0) {
+            r.append(buf, n);
+            if (r.find("\r\n\r\n") != r.npos && !r.starts_with("HTTP/1.1 200")) break;
+        }
+    });
+    return r;
+}
+
+DEF_test(http_metrics) {
+    DEF_case(record) {
+        http::Router router;
+        router.add(http::kGet, "/users/:id", nop);
+        router.add(http::kPost, "/users", nop);
+
+        http::Metrics m;
+        m.record(0, http::kGet, 200, 0, 0, 0); // not initialized, ignored
+        m.init(router);
+
+        // from a thread that is not a scheduler
+        m.record(0, http::kGet, 200, 0, 100, 120);
+        m.record(0, http::kGet, 404, 0, 20, 3000);
+
+        // from schedulers, added up with the others
+        go_wait([&]() {
+            m.record(0, http::kGet, 200, 0, 100, 20000000);
+            m.record(1, http::kPost, 201, 7, 0, 50);
+            m.record(-1, http::kPut, 500, 0, 0, 10);
+        });
+
+        // routes added after init() are recorded as "other"
+        router.add(http::kGet, "/late", nop);
+        m.record(2, http::kGet, 200, 0, 0, 10);
+
+        const fastring s = m.str();
+        const fastring u = "method=\"GET\",route=\"/users/:id\"";
+        EXPECT(has_line(s, "# TYPE http_requests_total counter"));
+        EXPECT(has_line(s, "http_requests_total{" + u + ",status=\"2xx\"} 2"));
+        EXPECT(has_line(s, "http_requests_total{" + u + ",status=\"4xx\"} 1"));
+        EXPECT(s.find(("http_requests_total{" + u + ",status=\"5xx\"}").c_str()) == s.npos);
+        EXPECT(has_line(s, "http_requests_total{method=\"POST\",route=\"/users\",status=\"2xx\"} 1"));
+        EXPECT(has_line(s, "http_requests_total{method=\"PUT\",route=\"other\",status=\"5xx\"} 1"));
+        EXPECT(has_line(s, "http_requests_total{method=\"GET\",route=\"other\",status=\"2xx\"} 1"));
+        EXPECT(s.find("/late") == s.npos);
+
+        // slots without requests are not shown
+        EXPECT(s.find("method=\"DELETE\"") == s.npos);
+
+        EXPECT(has_line(s, "http_request_body_bytes_total{method=\"POST\",route=\"/users\"} 7"));
+        EXPECT(has_line(s, "http_response_body_bytes_total{" + u + "} 220"));
+
+        // buckets are cumulative, 20s is only in +Inf
+        EXPECT(has_line(s, "# TYPE http_request_duration_seconds histogram"));
+        EXPECT(has_line(s, "http_request_duration_seconds_bucket{" + u + ",le=\"0.0001\"} 0"));
+        EXPECT(has_line(s, "http_request_duration_seconds_bucket{" + u + ",le=\"0.00025\"} 1"));
+        EXPECT(has_line(s, "http_request_duration_seconds_bucket{" + u + ",le=\"0.0025\"} 1"));
+        EXPECT(has_line(s, "http_request_duration_seconds_bucket{" + u + ",le=\"0.005\"} 2"));
+        EXPECT(has_line(s, "http_request_duration_seconds_bucket{" + u + ",le=\"10\"} 2"));
+        EXPECT(has_line(s, "http_request_duration_seconds_bucket{" + u + ",le=\"+Inf\"} 3"));
+        EXPECT(has_line(s, "http_request_duration_seconds_count{" + u + "} 3"));
+        EXPECT(s.find(("http_request_duration_seconds_sum{" + u + "} 20.00312").c_str()) != s.npos);
+
+        // a bucket bound itself is in the bucket
+        http::Metrics x;
+        x.init(router);
+        x.record(1, http::kPost, 200, 0, 0, 100);
+        const fastring t = x.str();
+        EXPECT(has_line(t, "http_request_duration_seconds_bucket{method=\"POST\",route=\"/users\",le=\"0.0001\"} 1"));
+    }
+
+    DEF_case(label) {
+        http::Router router;
+        router.add(http::kGet, "/a\"b\\c", nop);
+        http::Metrics m;
+        m.init(router);
+        m.record(0, http::kGet, 200, 0, 0, 0);
+        EXPECT(m.str().find("route=\"/a\\\"b\\\\c\"") != fastring::npos);
+    }
+
+    DEF_case(server) {
+        request("GET /hello HTTP/1.1\r\nConnection: close\r\n\r\n");
+        request("POST /hello HTTP/1.1\r\nConnection: close\r\nContent-Length: 3\r\n\r\nabc");
+        request("GET /none HTTP/1.1\r\nConnection: close\r\n\r\n");
+
+        // rejected before calling the handler
+        fastring r = request(
+            "POST /hello HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\nabc\r\n0\r\n\r\n"
+        );
+        EXPECT(r.starts_with("HTTP/1.1 400"));
+
+        r = request("GET /metrics HTTP/1.1\r\nConnection: close\r\n\r\n");
+        EXPECT(r.starts_with("HTTP/1.1 200 OK\r\n"));
+        EXPECT(r.find("Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n") != r.npos);
+
+        const fastring s = r.substr(r.find("\r\n\r\n") + 4);
+        EXPECT(has_line(s, "http_requests_total{method=\"GET\",route=\"/hello\",status=\"2xx\"} 1"));
+        EXPECT(has_line(s, "http_requests_total{method=\"POST\",route=\"/hello\",status=\"2xx\"} 1"));
+        EXPECT(has_line(s, "http_requests_total{method=\"GET\",route=\"other\",status=\"4xx\"} 1"));
+        EXPECT(has_line(s, "http_requests_total{method=\"POST\",route=\"other\",status=\"4xx\"} 1"));
+        EXPECT(has_line(s, "http_request_body_bytes_total{method=\"POST\",route=\"/hello\"} 3"));
+        EXPECT(has_line(s, "http_response_body_bytes_total{method=\"GET\",route=\"/hello\"} 5"));
+        EXPECT(has_line(s, "http_request_duration_seconds_count{method=\"GET\",route=\"/hello\"} 1"));
+        EXPECT(has_line(s, "# TYPE http_connections gauge"));
+        EXPECT(s.find("\nhttp_connections ") != s.npos);
+    }
+}
+
+} // namespace test
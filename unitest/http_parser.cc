@@ -0,0 +1,125 @@
+#include "co/unitest.h"
+#include "co/so/http.h"
+#include "co/so/http_parser.h"
+#include "co/fastring.h"
+
+namespace test {
+
+using so::http::Parser;
+
+static int parse_req(Parser& p, const char* s) {
+    p.reset();
+    return p.parse_req(s, strlen(s));
+}
+
+static int parse_res(Parser& p, const char* s) {
+    p.reset();
+    return p.parse_res(s, strlen(s));
+}
+
+static fastring value(const char* s, const Parser& p, int i) {
+    return fastring(s + p.value(i).off, p.value(i).len);
+}
+
+DEF_test(http_parser) {
+    Parser p;
+
+    DEF_case(req) {
+        const char* s = "GET /x?y=1 HTTP/1.1\r\nHost: a.com\r\nX-Id:  7 \r\n\r\n";
+        EXPECT_EQ(parse_req(p, s), Parser::kDone);
+        EXPECT_EQ(p.header_len(), strlen(s));
+        EXPECT_EQ(p.method(), so::http::kGet);
+        EXPECT_EQ(fastring(s + p.url().off, p.url().len), "/x?y=1");
+        EXPECT_EQ(p.header_num(), 2);
+        EXPECT_EQ(p.find(so::http::kHeaderHost), 0);
+        EXPECT_EQ(value(s, p, 1), "7");
+        EXPECT_EQ(p.content_length(), -1);
+        EXPECT_EQ(p.chunked(), false);
+    }
+
+    DEF_case(incremental) {
+        const char* s = "POST / HTTP/1.1\r\nContent-Length: 3\r\n\r\n";
+        const size_t n = strlen(s);
+        p.reset();
+        EXPECT_EQ(p.parse_req(s, 10), Parser::kMore);
+        EXPECT_EQ(p.parse_req(s, n - 1), Parser::kMore);
+        EXPECT_EQ(p.parse_req(s, n), Parser::kDone);
+        EXPECT_EQ(p.content_length(), 3);
+    }
+
+    DEF_case(bad_line) {
+        EXPECT_EQ(parse_req(p, "GET / HTTP/1.1\rHost: a\r\n\r\n"), 400);
+        EXPECT_EQ(parse_req(p, "GET / HTTP/1.1\nHost: a\r\n\r\n"), 400);
+        EXPECT_EQ(parse_req(p, "GET / HTTP/1.1\r\nHost: a\nX: b\r\n\r\n"), 400);
+        EXPECT_EQ(parse_req(p, "GET / HTTP/1.1\r\nX: a\nb\r\n\r\n"), 400);
+        EXPECT_EQ(parse_req(p, "GETX / HTTP/1.1\r\n\r\n"), 405);
+        EXPECT_EQ(parse_req(p, "GET / HTTP/2.0\r\n\r\n"), 505);
+    }
+
+    DEF_case(bad_name) {
+        EXPECT_EQ(parse_req(p, "GET / HTTP/1.1\r\nHost : a\r\n\r\n"), 400);
+        EXPECT_EQ(parse_req(p, "GET / HTTP/1.1\r\n Host: a\r\n\r\n"), 400);
+        EXPECT_EQ(parse_req(p, "GET / HTTP/1.1\r\nX\tY: a\r\n\r\n"), 400);
+        EXPECT_EQ(parse_req(p, "GET / HTTP/1.1\r\nX\x01Y: a\r\n\r\n"), 400);
+        EXPECT_EQ(parse_req(p, "GET / HTTP/1.1\r\n: a\r\n\r\n"), 400);
+        EXPECT_EQ(parse_req(p, "GET / HTTP/1.1\r\nX-Y_z.1~: a\r\n\r\n"), Parser::kDone);
+
+        fastring s("GET / HTTP/1.1\r\nX: a");
+        s.append("\0b\r\n\r\n", 6);
+        p.reset();
+        EXPECT_EQ(p.parse_req(s.data(), s.size()), 400);
+    }
+
+    DEF_case(content_length) {
+        EXPECT_EQ(parse_req(p, "POST / HTTP/1.1\r\nContent-Length: 12\r\n\r\n"), Parser::kDone);
+        EXPECT_EQ(p.content_length(), 12);
+        EXPECT_EQ(parse_req(p, "POST / HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 3\r\n\r\n"), Parser::kDone);
+        EXPECT_EQ(parse_req(p, "POST / HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 4\r\n\r\n"), 400);
+        EXPECT_EQ(parse_req(p, "POST / HTTP/1.1\r\nContent-Length: -1\r\n\r\n"), 400);
+        EXPECT_EQ(parse_req(p, "POST / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n"), 400);
+        EXPECT_EQ(parse_req(p, "POST / HTTP/1.1\r\nContent-Length: 99999999999999999999\r\n\r\n"), 400);
+    }
+
+    DEF_case(transfer_encoding) {
+        EXPECT_EQ(parse_req(p, "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"), Parser::kDone);
+        EXPECT_EQ(p.chunked(), true);
+        EXPECT_EQ(parse_req(p, "POST / HTTP/1.1\r\nTransfer-Encoding: gzip, Chunked\r\n\r\n"), Parser::kDone);
+        EXPECT_EQ(p.chunked(), true);
+        EXPECT_EQ(parse_req(p, "POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\nTransfer-Encoding: chunked\r\n\r\n"), Parser::kDone);
+        EXPECT_EQ(p.chunked(), true);
+
+        // chunked is not the last coding
+        EXPECT_EQ(parse_req(p, "POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n"), 400);
+        EXPECT_EQ(parse_req(p, "POST / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n"), 400);
+        EXPECT_EQ(parse_req(p, "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nTransfer-Encoding: gzip\r\n\r\n"), 400);
+        EXPECT_EQ(parse_req(p, "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nTransfer-Encoding: chunked\r\n\r\n"), 400);
+        EXPECT_EQ(parse_req(p, "POST / HTTP/1.1\r\nTransfer-Encoding: xchunked\r\n\r\n"), 400);
+        EXPECT_EQ(parse_req(p, "POST / HTTP/1.1\r\nTransfer-Encoding: \r\n\r\n"), 400);
+
+        // with Content-Length
+        EXPECT_EQ(parse_req(p, "POST / HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n"), 400);
+        EXPECT_EQ(parse_req(p, "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n"), 400);
+    }
+
+    DEF_case(res) {
+        EXPECT_EQ(parse_res(p, "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n"), Parser::kDone);
+        EXPECT_EQ(p.status(), 200);
+        EXPECT_EQ(p.content_length(), 5);
+
+        // Transfer-Encoding overrides Content-Length
+        EXPECT_EQ(parse_res(p, "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n"), Parser::kDone);
+        EXPECT_EQ(p.chunked(), true);
+        EXPECT_EQ(p.content_length(), -1);
+
+        // the body ends with the connection
+        EXPECT_EQ(parse_res(p, "HTTP/1.1 200 OK\r\nTransfer-Encoding: gzip\r\n\r\n"), Parser::kDone);
+        EXPECT_EQ(p.chunked(), false);
+        EXPECT_EQ(p.has_transfer_encoding(), true);
+
+        EXPECT_EQ(parse_res(p, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked, gzip\r\n\r\n"), -1);
+        EXPECT_EQ(parse_res(p, "HTTP/1.1 200 OK\r\nX Y: a\r\n\r\n"), -1);
+        EXPECT_EQ(parse_res(p, "HTTP/1.1 20 OK\r\n\r\n"), -1);
+    }
+}
+
+} // namespace test
@@ -0,0 +1,250 @@
+#include "co/unitest.h"
+#include "co/so/http.h"
+#include "co/co.h"
+#include "co/thread.h"
+#include "co/time.h"
+#include <functional>
+
+namespace test {
+
+static void nop(const http::Req&, http::Res&) {}
+
+// number of the route matched, or -1
+static int route(const http::Router& r, http::Method m, const char* url, http::Req* req=0) {
+    http::Req x(m);
+    if (!req) req = &x;
+    req->set_method(m);
+    req->set_url(url);
+    const http::Router::Fun* f = r.find(req);
+    return f ? r.index(f) : -1;
+}
+
+// run @f in a coroutine, and wait for it
+static void go_wait(const std::function<void()>& f) {
+    SyncEvent ev;
+    co::go([&]() {
+        f();
+        ev.signal();
+    });
+    ev.wait();
+}
+
+static const char* kServ = "unix:@co_unitest_http_router";
+
+// send @s to the server, return the first response received
+static fastring request(const fastring& s) {
+    static bool started = false;
+    if (!started) {
+        started = true;
+        http::Server* serv = new http::Server(kServ, 0);
+        serv->on(http::kGet, "/users/:id", [](const http::Req& req, http::Res& res) {
+            res.set_body(req.param("id"));
+        });
+        serv->on(http::kPost, "/users", nop);
+        serv->on(http::kHead, "/head", nop);
+        serv->start();
+        sleep::ms(50);
+    }
+
+    fastring r;
+    go_wait([&]() {
+        tcp::Client c(kServ, 0);
+        if (!c.connect(1000)) return;
+        if (c.send(s.data(), (int) s.size(), 1000) != (int) s.size()) return;
+        char buf[4096];
+        int n;
+        while ((n = c.recv(buf, sizeof(buf), 1000)) > 0) {
+            r.append(buf, n);
+            if (r.find("\r\n\r\n") != r.npos) break;
+        }
+    });
+    return r;
+}
+
+DEF_test(http_router) {
+    DEF_case(static) {
+        http::Router r;
+        EXPECT(r.add(http::kGet, "/", nop));
+        EXPECT(r.add(http::kGet, "/users", nop));
+        EXPECT(r.add(http::kGet, "/user", nop));
+        EXPECT(r.add(http::kGet, "/users/new", nop));
+        EXPECT(r.add(http::kPost, "/users", nop));
+        EXPECT_EQ(r.size(), 5);
+
+        EXPECT_EQ(route(r, http::kGet, "/"), 0);
+        EXPECT_EQ(route(r, http::kGet, "/users"), 1);
+        EXPECT_EQ(route(r, http::kGet, "/user"), 2);
+        EXPECT_EQ(route(r, http::kGet, "/users/new"), 3);
+        EXPECT_EQ(route(r, http::kPost, "/users"), 4);
+        EXPECT_EQ(route(r, http::kGet, "/users?a=1"), 1);
+        EXPECT_EQ(route(r, http::kGet, "/use"), -1);
+        EXPECT_EQ(route(r, http::kGet, "/users/"), -1);
+        EXPECT_EQ(route(r, http::kPut, "/users"), -1);
+        EXPECT_EQ(r.path(3), "/users/new");
+        EXPECT_EQ(r.method(4), http::kPost);
+    }
+
+    DEF_case(params) {
+        http::Router r;
+        EXPECT(r.add(http::kGet, "/users/:id/posts/:pid", nop));
+        EXPECT(r.add(http::kGet, "/static/*file", nop));
+
+        http::Req req;
+        EXPECT_EQ(route(r, http::kGet, "/users/42/posts/7?x=1", &req), 0);
+        EXPECT_EQ(req.param_num(), 2);
+        EXPECT_EQ(req.param("id"), "42");
+        EXPECT_EQ(req.param("pid"), "7");
+        EXPECT_EQ(req.param("x"), "");
+
+        // the value points into the url
+        size_t n = 0;
+        const char* s = req.param("id", &n);
+        EXPECT_EQ(s, req.url().data() + 7);
+        EXPECT_EQ(n, 2);
+
+        EXPECT_EQ(route(r, http::kGet, "/static/js/a.js", &req), 1);
+        EXPECT_EQ(req.param("file"), "js/a.js");
+        EXPECT_EQ(route(r, http::kGet, "/static/", &req), 1);
+        EXPECT_EQ(req.param("file"), "");
+
+        // a parameter matches a non-empty segment
+        EXPECT_EQ(route(r, http::kGet, "/users//posts/7", &req), -1);
+        EXPECT_EQ(req.param_num(), 0);
+        EXPECT_EQ(route(r, http::kGet, "/users/42/posts", &req), -1);
+    }
+
+    DEF_case(precedence) {
+        http::Router r;
+        EXPECT(r.add(http::kGet, "/a/*rest", nop));
+        EXPECT(r.add(http::kGet, "/a/:id", nop));
+        EXPECT(r.add(http::kGet, "/a/new", nop));
+
+        http::Req req;
+        EXPECT_EQ(route(r, http::kGet, "/a/new", &req), 2);
+        EXPECT_EQ(req.param_num(), 0);
+        EXPECT_EQ(route(r, http::kGet, "/a/newer", &req), 1);
+        EXPECT_EQ(req.param("id"), "newer");
+        EXPECT_EQ(route(r, http::kGet, "/a/x", &req), 1);
+        EXPECT_EQ(route(r, http::kGet, "/a/x/y", &req), 0);
+        EXPECT_EQ(req.param_num(), 1);
+        EXPECT_EQ(req.param("rest"), "x/y");
+    }
+
+    DEF_case(backtrack) {
+        // the static path is tried first, then the parameter, then the wildcard
+        http::Router r;
+        EXPECT(r.add(http::kGet, "/a/b/c", nop));
+        EXPECT(r.add(http::kGet, "/a/:x/d", nop));
+        EXPECT(r.add(http::kGet, "/a/*rest", nop));
+
+        http::Req req;
+        EXPECT_EQ(route(r, http::kGet, "/a/b/c", &req), 0);
+        EXPECT_EQ(route(r, http::kGet, "/a/b/d", &req), 1);
+        EXPECT_EQ(req.param_num(), 1);
+        EXPECT_EQ(req.param("x"), "b");
+
+        // parameters of the failed branch are dropped
+        EXPECT_EQ(route(r, http::kGet, "/a/b/e", &req), 2);
+        EXPECT_EQ(req.param_num(), 1);
+        EXPECT_EQ(req.param("x"), "");
+        EXPECT_EQ(req.param("rest"), "b/e");
+    }
+
+    DEF_case(mid_segment) {
+        // ':' or '*' not at the beginning of a segment is a plain char
+        http::Router r;
+        EXPECT(r.add(http::kPost, "/v1/files:batch", nop));
+        EXPECT(r.add(http::kGet, "/v1/:name", nop));
+        EXPECT(r.add(http::kGet, "/a*b", nop));
+
+        http::Req req;
+        EXPECT_EQ(route(r, http::kPost, "/v1/files:batch", &req), 0);
+        EXPECT_EQ(req.param_num(), 0);
+        EXPECT_EQ(route(r, http::kPost, "/v1/files:x", &req), -1);
+        EXPECT_EQ(route(r, http::kGet, "/v1/files:batch", &req), 1);
+        EXPECT_EQ(req.param("name"), "files:batch");
+        EXPECT_EQ(route(r, http::kGet, "/a*b", &req), 2);
+        EXPECT_EQ(route(r, http::kGet, "/axb", &req), -1);
+    }
+
+    DEF_case(head) {
+        http::Router r;
+        EXPECT(r.add(http::kGet, "/x", nop));
+        EXPECT(r.add(http::kGet, "/y", nop));
+        EXPECT_EQ(route(r, http::kHead, "/x"), 0);
+
+        // GET routes are tried if no route for HEAD matches
+        EXPECT(r.add(http::kHead, "/y", nop));
+        EXPECT_EQ(route(r, http::kHead, "/y"), 2);
+        EXPECT_EQ(route(r, http::kHead, "/x"), 0);
+        EXPECT_EQ(route(r, http::kHead, "/z"), -1);
+    }
+
+    DEF_case(allow) {
+        http::Router r;
+        EXPECT(r.add(http::kGet, "/users/:id", nop));
+        EXPECT(r.add(http::kPut, "/users/:id", nop));
+        EXPECT(r.add(http::kPost, "/users", nop));
+
+        http::Req req(http::kDelete);
+        req.set_url("/users/1");
+        EXPECT_EQ(r.allow(&req), "GET, HEAD, PUT");
+        EXPECT_EQ(req.param_num(), 0);
+        req.set_url("/users");
+        EXPECT_EQ(r.allow(&req), "POST");
+        req.set_url("/none");
+        EXPECT_EQ(r.allow(&req), "");
+    }
+
+    DEF_case(conflict) {
+        http::Router r;
+        EXPECT(r.add(http::kGet, "/users/:id", nop));
+        EXPECT(r.add(http::kGet, "/files/*path", nop));
+        EXPECT(r.add(http::kPost, "/users/:name", nop)); // another method
+
+        EXPECT(!r.add(http::kGet, "/users/:id", nop));
+        EXPECT(!r.add(http::kGet, "/users/:name", nop));
+        EXPECT(!r.add(http::kGet, "/users/:name/posts", nop));
+        EXPECT(!r.add(http::kGet, "/files/*name", nop));
+        EXPECT_EQ(r.size(), 3);
+
+        // invalid routes
+        EXPECT(!r.add(http::kGet, "users", nop));
+        EXPECT(!r.add(http::kGet, "/users/:", nop));
+        EXPECT(!r.add(http::kGet, "/x/*", nop));
+        EXPECT(!r.add(http::kGet, "/x/*a/b", nop));
+        EXPECT(!r.add(http::kGet, "/:a/:b/:c/:d/:e/:f/:g/:h/:i", nop));
+        EXPECT_EQ(r.size(), 3);
+
+        // nothing left by failed routes is matched
+        EXPECT_EQ(route(r, http::kGet, "/users/1"), 0);
+        EXPECT_EQ(route(r, http::kGet, "/users/1/posts"), -1);
+        EXPECT_EQ(route(r, http::kGet, "/x/a/b"), -1);
+    }
+
+    DEF_case(server) {
+        fastring s = request("GET /users/7 HTTP/1.1\r\nConnection: close\r\n\r\n");
+        EXPECT(s.starts_with("HTTP/1.1 200 OK\r\n"));
+        EXPECT(s.ends_with("\r\n\r\n7"));
+
+        // routed for other methods
+        s = request("DELETE /users/7 HTTP/1.1\r\nConnection: close\r\n\r\n");
+        EXPECT(s.starts_with("HTTP/1.1 405 Method Not Allowed\r\n"));
+        EXPECT(s.find("\r\nAllow: GET, HEAD\r\n") != s.npos);
+
+        s = request("GET /users HTTP/1.1\r\nConnection: close\r\n\r\n");
+        EXPECT(s.starts_with("HTTP/1.1 405 Method Not Allowed\r\n"));
+        EXPECT(s.find("\r\nAllow: POST\r\n") != s.npos);
+
+        s = request("GET /none HTTP/1.1\r\nConnection: close\r\n\r\n");
+        EXPECT(s.starts_with("HTTP/1.1 404 Not Found\r\n"));
+        EXPECT(s.find("\r\nAllow:") == s.npos);
+
+        // HEAD goes to the GET route, without the body
+        s = request("HEAD /users/7 HTTP/1.1\r\nConnection: close\r\n\r\n");
+        EXPECT(s.starts_with("HTTP/1.1 200 OK\r\n"));
+        EXPECT(s.ends_with("\r\n\r\n"));
+    }
+}
+
+} // namespace test
@@ -0,0 +1,284 @@
+#include "co/unitest.h"
+#include "co/so/http.h"
+#include "co/co.h"
+#include "co/flag.h"
+#include "co/fs.h"
+#include "co/os.h"
+#include "co/thread.h"
+#include "co/time.h"
+#include <functional>
+
+DEC_int32(http_sendfile_size);
+
+namespace test {
+
+// run @f in a coroutine, and wait for it
+static void go_wait(const std::function<void()>& f) {
+    SyncEvent ev;
+    co::go([&]() {
+        f();
+        ev.signal();
+    });
+    ev.wait();
+}
+
+static void write_file(const fastring& path, const fastring& s) {
+    fs::file f(path.c_str(), 'w');
+    f.write(s.data(), s.size());
+}
+
+// files under a new directory, removed when the test ends:
+//   secret.txt  www/a.txt  www/b.js  www/b.js.gz  www/d/index.html
+struct Files {
+    Files() {
+        dir << "/tmp/co_unitest_static_" << os::pid();
+        root = dir + "/www";
+        fs::mkdir(root + "/d", true);
+        write_file(dir + "/secret.txt", "secret");
+        write_file(root + "/a.txt", "0123456789");
+        write_file(root + "/b.js", "var b = 1;");
+        write_file(root + "/b.js.gz", "gzipped");
+        write_file(root + "/d/index.html", "<html></html>");
+    }
+
+    ~Files() { fs::remove(dir, true); }
+
+    fastring dir;
+    fastring root;
+};
+
+// serve GET @url, with the header @key: @val if @key is not NULL
+static void get(const http::StaticFiles& files, http::Res& res, const char* url,
+                const char* key=0, const char* val=0) {
+    http::Req req(http::kGet);
+    req.set_url(url);
+    if (key) req.add_header(key, val);
+    res = http::Res();
+    files(req, res);
+}
+
+// send @s to the server @serv, and receive until the connection is closed
+static fastring raw(const char* serv, const fastring& s) {
+    fastring r;
+    go_wait([&]() {
+        tcp::Client c(serv, 0);
+        if (!c.connect(1000)) return;
+        if (c.send(s.data(), (int) s.size(), 1000) != (int) s.size()) return;
+        char buf[4096];
+        int n;
+        while ((n = c.recv(buf, sizeof(buf), 1000)) > 0) r.append(buf, n);
+    });
+    return r;
+}
+
+DEF_test(http_static) {
+    Files x;
+    http::StaticFiles files(x.root.c_str());
+    http::Res res;
+
+    DEF_case(get) {
+        get(files, res, "/a.txt?x=1");
+        EXPECT_EQ(res.status(), 200);
+        EXPECT_EQ(res.body(), "0123456789");
+        EXPECT_EQ(res.header("Content-Type"), "text/plain; charset=utf-8");
+        EXPECT_EQ(res.header("Accept-Ranges"), "bytes");
+        EXPECT(!res.header("ETag").empty());
+        EXPECT(res.header("Last-Modified").ends_with(" GMT"));
+
+        get(files, res, "/d/");
+        EXPECT_EQ(res.status(), 200);
+        EXPECT_EQ(res.body(), "<html></html>");
+
+        get(files, res, "/none.txt");
+        EXPECT_EQ(res.status(), 404);
+
+        http::Req req(http::kPost);
+        req.set_url("/a.txt");
+        res = http::Res();
+        files(req, res);
+        EXPECT_EQ(res.status(), 405);
+        EXPECT_EQ(res.header("Allow"), "GET, HEAD");
+
+        // files are loaded by helper threads in coroutines
+        int status = 0;
+        fastring body;
+        go_wait([&]() {
+            http::Res r;
+            get(files, r, "/d/index.html");
+            status = r.status();
+            body = r.body();
+        });
+        EXPECT_EQ(status, 200);
+        EXPECT_EQ(body, "<html></html>");
+    }
+
+    DEF_case(path) {
+        get(files, res, "/%61.txt");
+        EXPECT_EQ(res.status(), 200);
+        EXPECT_EQ(res.body(), "0123456789");
+
+        get(files, res, "/a.txt%00.html");
+        EXPECT_EQ(res.status(), 400);
+        get(files, res, "/a.tx%7");
+        EXPECT_EQ(res.status(), 400);
+        get(files, res, "/a.txt%zz");
+        EXPECT_EQ(res.status(), 400);
+
+        // paths are cleaned, and never go out of the root
+        get(files, res, "/d/../a.txt");
+        EXPECT_EQ(res.status(), 200);
+        get(files, res, "/../secret.txt");
+        EXPECT_EQ(res.status(), 404);
+        get(files, res, "/d/../../secret.txt");
+        EXPECT_EQ(res.status(), 404);
+        get(files, res, "/%2e%2e/secret.txt");
+        EXPECT_EQ(res.status(), 404);
+        get(files, res, "/..%2f..%2fsecret.txt");
+        EXPECT_EQ(res.status(), 404);
+    }
+
+    DEF_case(range) {
+        get(files, res, "/a.txt", "Range", "bytes=2-4");
+        EXPECT_EQ(res.status(), 206);
+        EXPECT_EQ(res.body(), "234");
+        EXPECT_EQ(res.header("Content-Range"), "bytes 2-4/10");
+
+        get(files, res, "/a.txt", "Range", "bytes=7-");
+        EXPECT_EQ(res.status(), 206);
+        EXPECT_EQ(res.body(), "789");
+
+        get(files, res, "/a.txt", "Range", "bytes=-3");
+        EXPECT_EQ(res.status(), 206);
+        EXPECT_EQ(res.body(), "789");
+        EXPECT_EQ(res.header("Content-Range"), "bytes 7-9/10");
+
+        // the end is cut to the size
+        get(files, res, "/a.txt", "Range", "bytes=8-100");
+        EXPECT_EQ(res.status(), 206);
+        EXPECT_EQ(res.body(), "89");
+        get(files, res, "/a.txt", "Range", "bytes=-100");
+        EXPECT_EQ(res.status(), 206);
+        EXPECT_EQ(res.body(), "0123456789");
+
+        // not satisfiable
+        get(files, res, "/a.txt", "Range", "bytes=-0");
+        EXPECT_EQ(res.status(), 416);
+        EXPECT_EQ(res.header("Content-Range"), "bytes */10");
+        EXPECT(res.body().empty());
+        get(files, res, "/a.txt", "Range", "bytes=10-");
+        EXPECT_EQ(res.status(), 416);
+
+        // ignored, the whole file is sent
+        const char* ignored[] = {
+            "bytes=5-2", "bytes=0-1,4-5", "bytes=-", "bytes=a-b", "items=0-1", "bytes=1-2x",
+        };
+        for (size_t i = 0; i < sizeof(ignored) / sizeof(ignored[0]); ++i) {
+            get(files, res, "/a.txt", "Range", ignored[i]);
+            EXPECT_EQ(res.status(), 200);
+            EXPECT_EQ(res.body(), "0123456789");
+            EXPECT(res.header("Content-Range").empty());
+        }
+
+        // If-Range that does not match the file
+        http::Req req(http::kGet);
+        req.set_url("/a.txt");
+        req.add_header("Range", "bytes=2-4");
+        req.add_header("If-Range", "\"other\"");
+        res = http::Res();
+        files(req, res);
+        EXPECT_EQ(res.status(), 200);
+        EXPECT_EQ(res.body(), "0123456789");
+    }
+
+    DEF_case(not_modified) {
+        get(files, res, "/a.txt");
+        const fastring etag = res.header("ETag");
+        const fastring lm = res.header("Last-Modified");
+
+        get(files, res, "/a.txt", "If-None-Match", etag.c_str());
+        EXPECT_EQ(res.status(), 304);
+        EXPECT(res.body().empty());
+        EXPECT_EQ(res.header("ETag"), etag);
+
+        get(files, res, "/a.txt", "If-None-Match", ("\"x\", " + etag).c_str());
+        EXPECT_EQ(res.status(), 304);
+        get(files, res, "/a.txt", "If-None-Match", "*");
+        EXPECT_EQ(res.status(), 304);
+        get(files, res, "/a.txt", "If-None-Match", "\"x\"");
+        EXPECT_EQ(res.status(), 200);
+
+        get(files, res, "/a.txt", "If-Modified-Since", lm.c_str());
+        EXPECT_EQ(res.status(), 304);
+        get(files, res, "/a.txt", "If-Modified-Since", "Sun, 06 Nov 1994 08:49:37 GMT");
+        EXPECT_EQ(res.status(), 200);
+    }
+
+    DEF_case(gzip) {
+        get(files, res, "/b.js", "Accept-Encoding", "gzip, deflate");
+        EXPECT_EQ(res.status(), 200);
+        EXPECT_EQ(res.body(), "gzipped");
+        EXPECT_EQ(res.header("Content-Encoding"), "gzip");
+        EXPECT_EQ(res.header("Content-Type"), "application/javascript; charset=utf-8");
+        EXPECT_EQ(res.header("Vary"), "Accept-Encoding");
+
+        get(files, res, "/b.js");
+        EXPECT_EQ(res.body(), "var b = 1;");
+        EXPECT(res.header("Content-Encoding").empty());
+        EXPECT_EQ(res.header("Vary"), "Accept-Encoding");
+
+        // no .gz variant, no Vary
+        get(files, res, "/a.txt", "Accept-Encoding", "gzip");
+        EXPECT(res.header("Vary").empty());
+
+        // appended to Vary set by the caller
+        http::Req req(http::kGet);
+        req.set_url("/b.js");
+        res = http::Res();
+        res.add_header("Vary", "Origin");
+        files(req, res);
+        EXPECT_EQ(res.header("Vary"), "Origin, Accept-Encoding");
+    }
+
+    DEF_case(sendfile) {
+        // files larger than FLG_http_sendfile_size are not held in memory,
+        // the server sends them with sendfile()
+        const int32 size = FLG_http_sendfile_size;
+        FLG_http_sendfile_size = 4;
+        http::StaticFiles big(x.root.c_str());
+
+        get(big, res, "/a.txt", "Range", "bytes=2-5");
+        EXPECT_EQ(res.status(), 206);
+        EXPECT(res.body().empty());
+        EXPECT(res.file().ends_with("/www/a.txt"));
+        EXPECT_EQ(res.file_off(), 2);
+        EXPECT_EQ(res.file_len(), 4);
+
+        static const char* serv = "unix:@co_unitest_http_static";
+        static bool started = false;
+        if (!started) {
+            started = true;
+            http::Server* s = new http::Server(serv, 0);
+            s->on_req(big);
+            s->start();
+            sleep::ms(50);
+        }
+
+        fastring r = raw(serv, "GET /a.txt HTTP/1.1\r\nConnection: close\r\n\r\n");
+        EXPECT(r.starts_with("HTTP/1.1 200 OK\r\n"));
+        EXPECT(r.find("Content-Length: 10\r\n") != r.npos);
+        EXPECT(r.ends_with("\r\n\r\n0123456789"));
+
+        r = raw(serv, "GET /a.txt HTTP/1.1\r\nConnection: close\r\nRange: bytes=3-5\r\n\r\n");
+        EXPECT(r.starts_with("HTTP/1.1 206 Partial Content\r\n"));
+        EXPECT(r.find("Content-Length: 3\r\n") != r.npos);
+        EXPECT(r.ends_with("\r\n\r\n345"));
+
+        // no body for HEAD
+        r = raw(serv, "HEAD /a.txt HTTP/1.1\r\nConnection: close\r\n\r\n");
+        EXPECT(r.find("Content-Length: 10\r\n") != r.npos);
+        EXPECT(r.ends_with("\r\n\r\n"));
+        FLG_http_sendfile_size = size;
+    }
+}
+
+} // namespace test
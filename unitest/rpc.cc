@@ -0,0 +1,126 @@
+#include "co/unitest.h"
+#include "co/so/rpc.h"
+#include "co/so/tcp.h"
+#include "co/co.h"
+#include "co/thread.h"
+#include "co/time.h"
+#include <functional>
+
+namespace test {
+
+// run @f in a coroutine, and wait for it
+static void go_wait(const std::function<void()>& f) {
+    SyncEvent ev;
+    co::go([&]() {
+        f();
+        ev.signal();
+    });
+    ev.wait();
+}
+
+static const char* kServ = "unix:@co_unitest_rpc";
+
+class EchoService : public rpc::Service {
+  public:
+    virtual void process(const Json& req, Json& res) {
+        res.add_member("x", req["x"]);
+    }
+};
+
+static void start_server() {
+    static bool started = false;
+    if (started) return;
+    started = true;
+    rpc::Server* s = rpc::new_server(kServ, 0);
+    s->add_service(new EchoService);
+    s->start();
+    sleep::ms(50);
+}
+
+// a message: 2 bytes reserved, magic 0x7777, length of the body, the body
+static fastring msg(const fastring& body) {
+    fastring s(8 + body.size());
+    const uint16 magic = 0x7777;
+    const uint32 len = hton32((uint32) body.size());
+    s.append((uint16) 0).append(&magic, 2).append(&len, 4).append(body);
+    return s;
+}
+
+// send @s to the server in pieces of @n bytes, with a short pause after each
+// piece, then shutdown the write side. Return bodies of the responses
+// received until the connection is closed, or "error" for a bad response.
+static std::vector<fastring> call(const fastring& s, size_t n) {
+    std::vector<fastring> v;
+    go_wait([&]() {
+        tcp::Client c(kServ, 0);
+        if (!c.connect(1000)) return;
+        for (size_t i = 0; i < s.size(); i += n) {
+            const int k = (int) (s.size() - i < n ? s.size() - i : n);
+            if (c.send(s.data() + i, k, 1000) != k) return;
+            co::sleep(1);
+        }
+        co::shutdown(c.fd(), 'w');
+
+        fastring r;
+        char buf[4096];
+        int x;
+        while ((x = c.recv(buf, sizeof(buf), 1000)) > 0) r.append(buf, x);
+        for (size_t p = 0; p < r.size();) {
+            uint32 len;
+            if (r.size() - p < 8) { v.push_back("error"); return; }
+            memcpy(&len, r.data() + p + 4, 4);
+            len = ntoh32(len);
+            if (r.size() - p - 8 < len) { v.push_back("error"); return; }
+            v.push_back(r.substr(p + 8, len));
+            p += 8 + len;
+        }
+    });
+    return v;
+}
+
+DEF_test(rpc) {
+    start_server();
+
+    DEF_case(split) {
+        // messages are read through a buffer, and may be split anywhere
+        const fastring s = msg("{\"x\":1}") + msg("{\"x\":22}") + msg("{\"x\":333}");
+        const size_t pieces[] = { 1, 5, 11, 4096 };
+        for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); ++i) {
+            std::vector<fastring> v = call(s, pieces[i]);
+            EXPECT_EQ(v.size(), 3u);
+            if (v.size() != 3) continue;
+            EXPECT_EQ(v[0], "{\"x\":1}");
+            EXPECT_EQ(v[1], "{\"x\":22}");
+            EXPECT_EQ(v[2], "{\"x\":333}");
+        }
+    }
+
+    DEF_case(large) {
+        // a message larger than the read buffer
+        fastring x(100000, 'a');
+        const fastring body = fastring("{\"x\":\"") + x + "\"}";
+        std::vector<fastring> v = call(msg(body) + msg("{\"x\":2}"), 1 << 20);
+        EXPECT_EQ(v.size(), 2u);
+        if (v.size() == 2) {
+            EXPECT_EQ(v[0], body);
+            EXPECT_EQ(v[1], "{\"x\":2}");
+        }
+    }
+
+    DEF_case(bad) {
+        // the connection is closed, responses of messages before are sent
+        fastring s = msg("{\"x\":1}");
+        s.append("\0\0\x12\x34\0\0\0\0", 8); // bad magic
+        std::vector<fastring> v = call(s, 4096);
+        EXPECT_EQ(v.size(), 1u);
+
+        v = call(msg("{\"x\":1}") + msg("not json"), 4096);
+        EXPECT_EQ(v.size(), 1u);
+
+        // the client stops sending in the header, or in the body
+        EXPECT(call(msg("{\"x\":1}").substr(0, 5), 4096).empty());
+        EXPECT(call(msg("{\"x\":1}").substr(0, 10), 4096).empty());
+    }
+}
+
+} // namespace test
@@ -0,0 +1,583 @@
+#ifndef _WIN32
+
+#include "co/unitest.h"
+#include "co/co.h"
+#include "co/flag.h"
+#include "co/fs.h"
+#include "co/os.h"
+#include "co/thread.h"
+#include <climits>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+DEC_int32(co_zerocopy_size);
+
+namespace test {
+
+// run @f in a coroutine, and wait for it
+static void go_wait(const std::function<void()>& f) {
+    SyncEvent ev;
+    co::go([&]() {
+        f();
+        ev.signal();
+    });
+    ev.wait();
+}
+
+// a pair of connected non-blocking unix sockets
+struct UnixPair {
+    explicit UnixPair(int type=SOCK_STREAM) {
+        int fds[2] = { -1, -1 };
+        socketpair(AF_UNIX, type, 0, fds);
+        a = fds[0];
+        b = fds[1];
+        co::set_nonblock(a);
+        co::set_nonblock(b);
+    }
+
+    // MUST be called in coroutine
+    void close() {
+        co::close(a);
+        co::close(b);
+    }
+
+    sock_t a;
+    sock_t b;
+};
+
+static fastring make_data(size_t n) {
+    fastring s(n);
+    for (size_t i = 0; i < n; ++i) s.append((char)('a' + i * 7 % 26));
+    return s;
+}
+
+// split @s into @n buffers of different sizes
+static std::vector<co::iovec> split(const fastring& s, int n) {
+    std::vector<co::iovec> v;
+    size_t p = 0;
+    for (int i = 0; i < n; ++i) {
+        size_t k = (i == n - 1) ? s.size() - p : (s.size() / n) * (i % 3 + 1) / 2;
+        if (k > s.size() - p) k = s.size() - p;
+        co::iovec x = { (void*)(s.data() + p), k };
+        v.push_back(x);
+        p += k;
+    }
+    return v;
+}
+
+// wait at most @ms for @done, MUST be called in coroutine
+static void wait_for(const bool& done, int ms) {
+    for (int i = 0; i < ms && !done; ++i) co::sleep(1);
+}
+
+#ifdef __linux__
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+
+// udp sockets on localhost, @s is connected to @r, MUST be created in coroutine
+struct UdpPair {
+    UdpPair() {
+        r = co::udp_socket();
+        s = co::udp_socket();
+        struct sockaddr_in addr;
+        co::init_ip_addr(&addr, "127.0.0.1", 0);
+        co::bind(r, &addr, sizeof(addr));
+        socklen_t n = sizeof(addr);
+        getsockname(r, (struct sockaddr*)&addr, &n);
+        co::connect(s, &addr, sizeof(addr));
+    }
+
+    void close() {
+        co::close(r);
+        co::close(s);
+    }
+
+    sock_t r;
+    sock_t s;
+};
+
+// tcp sockets on localhost, @s is connected to @r, MUST be created in coroutine
+struct TcpPair {
+    TcpPair() {
+        sock_t l = co::tcp_socket();
+        struct sockaddr_in addr;
+        co::init_ip_addr(&addr, "127.0.0.1", 0);
+        co::bind(l, &addr, sizeof(addr));
+        co::listen(l, 8);
+        socklen_t n = sizeof(addr);
+        getsockname(l, (struct sockaddr*)&addr, &n);
+        s = co::tcp_socket();
+        co::connect(s, &addr, sizeof(addr), 1000);
+        r = co::accept(l, 0, 0);
+        co::close(l);
+    }
+
+    void close() {
+        co::close(r);
+        co::close(s);
+    }
+
+    sock_t r;
+    sock_t s;
+};
+
+struct Received {
+    Received() : done(false) {}
+    fastring s;
+    bool done;
+};
+
+// receive @n bytes from @fd in a new coroutine
+static std::shared_ptr<Received> recv_all(sock_t fd, size_t n) {
+    std::shared_ptr<Received> x(new Received());
+    co::go([x, fd, n]() {
+        char buf[8192];
+        while (x->s.size() < n) {
+            int r = co::recv(fd, buf, sizeof(buf), 1000);
+            if (r <= 0) break;
+            x->s.append(buf, r);
+        }
+        x->done = true;
+    });
+    return x;
+}
+
+// @n messages, each with a buffer of @size bytes and a control buffer
+struct Msgs {
+    Msgs(int n, size_t size) : buf(n * size), iov(n), ctl(n * 64), msgs(n) {
+        for (int i = 0; i < n; ++i) {
+            iov[i].iov_base = size ? &buf[i * size] : 0;
+            iov[i].iov_len = size;
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+
+    // control buffers for GRO, msg_controllen is reset after each recv
+    void set_control() {
+        for (size_t i = 0; i < msgs.size(); ++i) {
+            msgs[i].msg_hdr.msg_control = &ctl[i * 64];
+            msgs[i].msg_hdr.msg_controllen = 64;
+        }
+    }
+
+    std::vector<char> buf;
+    std::vector<struct iovec> iov;
+    std::vector<char> ctl;
+    std::vector<struct mmsghdr> msgs;
+};
+
+struct GsoResult {
+    bool gso, gro, ok;
+    int w, n, gro_size;
+    size_t total;
+};
+
+// send 1000 bytes with GSO in segments of 100 bytes, and receive them with
+// GRO if @gro is true
+static GsoResult gso_send(bool gro) {
+    GsoResult x = { false, false, true, 0, 0, 0, 0 };
+    go_wait([&]() {
+        UdpPair p;
+        x.gso = co::set_udp_gso(p.s, 100);
+        if (!x.gso) { p.close(); return; }
+        if (gro) x.gro = co::set_udp_gro(p.r);
+
+        fastring data = make_data(1000);
+        x.w = co::send(p.s, data.data(), 1000, 1000);
+
+        Msgs in(16, 2048);
+        in.set_control();
+        while (x.total < 1000) {
+            const int r = co::recvmmsg(p.r, in.msgs.data(), 16, 1000);
+            if (r <= 0) break;
+            for (int i = 0; i < r; ++i) {
+                const size_t len = in.msgs[i].msg_len;
+                const int g = co::udp_gro_size(&in.msgs[i].msg_hdr);
+                if (g != 0) x.gro_size = g;
+                if (g == 0 && len != 100) x.ok = false;
+                if (memcmp(in.iov[i].iov_base, data.data() + x.total, len) != 0) x.ok = false;
+                x.total += len;
+                ++x.n;
+                in.msgs[i].msg_hdr.msg_controllen = 64;
+            }
+        }
+        p.close();
+    });
+    return x;
+}
+#endif
+
+DEF_test(sock) {
+    DEF_case(readv_writev) {
+        // larger than the socket buffer, written and read in many pieces, with
+        // more iovecs than those on the stack of co::writev
+        struct State {
+            fastring got;
+            int r;
+            bool done;
+        };
+        std::shared_ptr<State> st(new State());
+        st->r = 0;
+        st->done = false;
+        const fastring data = make_data(1 << 20);
+        int w = 0;
+
+        go_wait([&]() {
+            UnixPair p;
+            co::set_send_buffer_size(p.a, 4096);
+            sock_t b = p.b;
+            const size_t size = data.size();
+
+            co::go([st, b, size]() {
+                co::sleep(5);
+                st->got.resize(size);
+                std::vector<co::iovec> v = split(st->got, 7);
+                st->r = co::readv(b, v.data(), (int) v.size(), 3000);
+                st->done = true;
+            });
+
+            std::vector<co::iovec> v = split(data, 40);
+            co::iovec empty = { 0, 0 };
+            v.insert(v.begin() + 3, empty);
+            w = co::writev(p.a, v.data(), (int) v.size(), 3000);
+            wait_for(st->done, 3000);
+            p.close();
+        });
+        EXPECT_EQ(w, (int) data.size());
+        EXPECT_EQ(st->r, (int) data.size());
+        EXPECT(st->got == data);
+    }
+
+    DEF_case(readv_writev.errors) {
+        int r[5] = { 0 };
+        int e[2] = { 0 };
+        go_wait([&]() {
+            UnixPair p;
+            char buf[8];
+
+            // nothing to do
+            co::iovec z = { buf, 0 };
+            r[0] = co::writev(p.a, &z, 1, 100);
+
+            // more than INT_MAX bytes in total
+            co::iovec big[2] = { { buf, (size_t) INT_MAX }, { buf, 1 } };
+            r[1] = co::writev(p.a, big, 2, 100);
+            e[0] = co::error();
+
+            // timeout, and the peer closed the connection before the buffers
+            // are filled
+            co::iovec v[2] = { { buf, 4 }, { buf + 4, 4 } };
+            co::send(p.b, "abc", 3);
+            r[2] = co::readv(p.a, v, 2, 10);
+            e[1] = co::error();
+            co::close(p.b);
+            r[3] = co::readv(p.a, v, 2, 100);
+            r[4] = co::readv(p.a, v, 2, 100);
+            co::close(p.a);
+        });
+        EXPECT_EQ(r[0], 0);
+        EXPECT_EQ(r[1], -1);
+        EXPECT_EQ(e[0], EINVAL);
+        EXPECT_EQ(r[2], -1);
+        EXPECT_EQ(e[1], ETIMEDOUT);
+        EXPECT_EQ(r[3], 0);
+        EXPECT_EQ(r[4], 0);
+    }
+
+    DEF_case(sendfile) {
+        // a part of a file larger than the socket buffer, and a range past
+        // the end of the file
+        const fastring data = make_data(1 << 20);
+        fastring path;
+        path << "/tmp/co_unitest_sendfile_" << os::pid();
+        do {
+            fs::file f(path.c_str(), 'w');
+            f.write(data.data(), data.size());
+        } while (0);
+
+        struct State {
+            fastring got;
+            bool done;
+        };
+        std::shared_ptr<State> st(new State());
+        st->done = false;
+        int64 r[3] = { 0 };
+        int e = 0;
+
+        go_wait([&]() {
+            UnixPair p;
+            co::set_send_buffer_size(p.a, 4096);
+            sock_t b = p.b;
+            co::go([st, b]() {
+                co::sleep(5);
+                char buf[8192];
+                int n;
+                while ((n = co::recv(b, buf, sizeof(buf), 1000)) > 0) st->got.append(buf, n);
+                st->done = true;
+            });
+
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            r[0] = co::sendfile(p.a, fd, 100, 500000, 3000);
+            r[1] = co::sendfile(p.a, fd, data.size() - 10, 100, 3000);
+            co::shutdown(p.a, 'w');
+            wait_for(st->done, 3000);
+
+            // timeout, nobody reads it
+            UnixPair q;
+            co::set_send_buffer_size(q.a, 4096);
+            r[2] = co::sendfile(q.a, fd, 0, data.size(), 10);
+            e = co::error();
+            q.close();
+            p.close();
+            ::close(fd);
+        });
+        fs::remove(path);
+
+        EXPECT_EQ(r[0], 500000);
+        EXPECT_EQ(r[1], 10);
+        EXPECT(st->done);
+        EXPECT_EQ(st->got.size(), 500010u);
+        EXPECT(st->got == data.substr(100, 500000) + data.substr(data.size() - 10));
+        EXPECT_EQ(r[2], -1);
+        EXPECT_EQ(e, ETIMEDOUT);
+    }
+
+  #ifdef __linux__
+    DEF_case(mmsg) {
+        // datagrams of 1..20 bytes, sent with one call, received in order
+        int w = 0, r = 0, k = 0, timeout = 0, e = 0;
+        bool ok = true;
+        go_wait([&]() {
+            UdpPair p;
+            fastring data = make_data(20);
+            Msgs out(20, 0);
+            for (int i = 0; i < 20; ++i) {
+                out.iov[i].iov_base = (void*) data.data();
+                out.iov[i].iov_len = i + 1;
+            }
+            w = co::sendmmsg(p.s, out.msgs.data(), 20, 1000);
+
+            Msgs in(8, 64);
+            while (k < 20) {
+                const int n = co::recvmmsg(p.r, in.msgs.data(), 8, 1000);
+                if (n <= 0) break;
+                ++r;
+                for (int i = 0; i < n; ++i, ++k) {
+                    const size_t len = in.msgs[i].msg_len;
+                    if (len != (size_t)(k + 1) || memcmp(in.iov[i].iov_base, data.data(), len) != 0) {
+                        ok = false;
+                    }
+                }
+            }
+
+            // nothing to receive
+            timeout = co::recvmmsg(p.r, in.msgs.data(), 8, 10);
+            e = co::error();
+            p.close();
+        });
+        EXPECT_EQ(w, 20);
+        EXPECT_EQ(k, 20);
+        EXPECT(ok);
+        EXPECT_GE(r, 1);
+        EXPECT_LE(r, 20);
+        EXPECT_EQ(timeout, -1);
+        EXPECT_EQ(e, ETIMEDOUT);
+    }
+
+    DEF_case(splice) {
+        // a -> [p] -> b, the data is moved with splice(), and b is half-closed
+        // at the end
+        struct State {
+            int64 moved;
+            fastring got;
+            bool done;
+        };
+        std::shared_ptr<State> st(new State());
+        st->moved = 0;
+        st->done = false;
+        const fastring data = make_data(300000);
+        int64 idle = 0;
+
+        go_wait([&]() {
+            UnixPair a, b;
+            sock_t from = a.b, to = b.a;
+            co::go([st, from, to]() {
+                st->moved = co::splice(from, to, 1000);
+                st->done = true;
+            });
+
+            co::send(a.a, data.data(), (int) data.size(), 1000);
+            co::shutdown(a.a, 'w');
+            char buf[8192];
+            int n;
+            while ((n = co::recv(b.b, buf, sizeof(buf), 1000)) > 0) st->got.append(buf, n);
+            wait_for(st->done, 1000);
+
+            // nothing to move
+            UnixPair c, d;
+            idle = co::splice(c.b, d.a, 10);
+            c.close();
+            d.close();
+            a.close();
+            b.close();
+        });
+        EXPECT_EQ(st->moved, (int64) data.size());
+        EXPECT(st->got == data);
+        EXPECT_EQ(idle, -1);
+    }
+
+    DEF_case(relay) {
+        // client <-> [c] relay [s] <-> server, the server echoes the data back
+        // in upper case until EOF
+        struct State {
+            int64 moved;
+            bool done;
+        };
+        std::shared_ptr<State> st(new State());
+        st->moved = 0;
+        st->done = false;
+        const fastring data = make_data(200000);
+        fastring got;
+        int64 idle = 0;
+
+        go_wait([&]() {
+            UnixPair c, s;
+            sock_t x = c.b, y = s.a, serv = s.b;
+            co::go([st, x, y]() {
+                st->moved = co::relay(x, y, 1000);
+                st->done = true;
+            });
+            co::go([serv]() {
+                char buf[4096];
+                int n;
+                while ((n = co::recv(serv, buf, sizeof(buf), 1000)) > 0) {
+                    for (int i = 0; i < n; ++i) buf[i] = (char) toupper(buf[i]);
+                    if (co::send(serv, buf, n, 1000) != n) break;
+                }
+                co::shutdown(serv, 'w');
+            });
+
+            // send and receive at the same time, the data is larger than the
+            // socket buffers
+            sock_t cli = c.a;
+            const fastring* d = &data;
+            co::go([cli, d]() {
+                co::send(cli, d->data(), (int) d->size(), 1000);
+                co::shutdown(cli, 'w');
+            });
+            char buf[8192];
+            int n;
+            while ((n = co::recv(c.a, buf, sizeof(buf), 1000)) > 0) got.append(buf, n);
+            wait_for(st->done, 1000);
+
+            // nothing to relay
+            UnixPair e, f;
+            idle = co::relay(e.b, f.a, 10);
+            e.close();
+            f.close();
+            c.close();
+            s.close();
+        });
+        EXPECT(st->done);
+        EXPECT_EQ(st->moved, (int64) data.size() * 2);
+        EXPECT_EQ(got.size(), data.size());
+        EXPECT(got == data.upper());
+        EXPECT_EQ(idle, -1);
+    }
+
+    DEF_case(gso_gro) {
+        // a buffer sent with GSO arrives as datagrams of the segment size, or
+        // coalesced with GRO, reported by co::udp_gro_size().
+        GsoResult x = gso_send(false);
+        if (!x.gso) return; // not supported by the kernel
+        EXPECT_EQ(x.w, 1000);
+        EXPECT_EQ(x.total, 1000u);
+        EXPECT(x.ok);
+        EXPECT_EQ(x.n, 10);
+        EXPECT_EQ(x.gro_size, 0);
+
+        x = gso_send(true);
+        EXPECT_EQ(x.w, 1000);
+        EXPECT_EQ(x.total, 1000u);
+        EXPECT(x.ok);
+        if (x.gro && x.gro_size > 0) {
+            EXPECT_EQ(x.gro_size, 100);
+            EXPECT_LT(x.n, 10);
+        } else {
+            EXPECT_EQ(x.n, 10);
+        }
+    }
+
+    DEF_case(zerocopy) {
+        const int32 size = FLG_co_zerocopy_size;
+        FLG_co_zerocopy_size = 4096;
+        const size_t n = 1 << 20;
+        std::shared_ptr<fastring> buf(new fastring(make_data(n)));
+
+        // whether the kernel supports SO_ZEROCOPY
+        bool supported = false;
+        int r[4] = { 0 };
+        bool held = false, released = false, copied = true, done = false;
+        std::shared_ptr<Received> x[3];
+
+        go_wait([&]() {
+            TcpPair p;
+            int on = 1;
+            supported = setsockopt(p.s, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0;
+
+            // the scheduler holds @buf until the kernel reports the completion
+            x[0] = recv_all(p.r, n);
+            r[0] = co::send_zerocopy(p.s, buf, 1000);
+            held = buf.use_count() > 1;
+            wait_for(x[0]->done, 1000);
+            for (int i = 0; i < 1000 && buf.use_count() > 1; ++i) co::sleep(1);
+            released = buf.use_count() == 1;
+
+            // the kernel copied the data on loopback, zero-copy is no longer used
+            x[1] = recv_all(p.r, n);
+            r[1] = co::send_zerocopy(p.s, buf, 1000);
+            copied = buf.use_count() == 1;
+            wait_for(x[1]->done, 1000);
+            p.close();
+
+            // AF_UNIX does not support zero-copy, co::send() is used
+            UnixPair u;
+            x[2] = recv_all(u.b, n);
+            r[2] = co::send_zerocopy(u.a, buf, 1000);
+            wait_for(x[2]->done, 1000);
+            u.close();
+
+            // disabled, no reference is held
+            FLG_co_zerocopy_size = 0;
+            TcpPair q;
+            std::shared_ptr<fastring> small(new fastring("hello"));
+            r[3] = co::send_zerocopy(q.s, small, 1000);
+            done = small.use_count() == 1;
+            q.close();
+        });
+        FLG_co_zerocopy_size = size;
+
+        for (int i = 0; i < 3; ++i) {
+            EXPECT_EQ(r[i], (int) n);
+            EXPECT(x[i]->s == *buf);
+        }
+        EXPECT_EQ(r[3], 5);
+        EXPECT(done);
+        EXPECT(released);
+        if (!supported) return; // not supported by the kernel
+        EXPECT(held);
+        EXPECT(copied);
+    }
+  #endif
+}
+
+} // namespace test
+
+#endif
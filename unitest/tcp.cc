@@ -0,0 +1,395 @@
+#include "co/unitest.h"
+#include "co/so/tcp.h"
+#include "co/so/dns.h"
+#include "co/co.h"
+#include "co/flag.h"
+#include "co/fs.h"
+#include "co/os.h"
+#include "co/thread.h"
+#include "co/time.h"
+#include <functional>
+#include <memory>
+#include <set>
+#include <netinet/tcp.h>
+
+DEC_bool(tcp_reuseport);
+DEC_uint32(tcp_max_conn);
+DEC_bool(tcp_reject_overload);
+DEC_bool(tcp_fastopen);
+DEC_int32(tcp_conn_stagger_ms);
+DEC_string(dns_hosts);
+
+namespace test {
+
+// run @f in a coroutine, and wait for it
+static void go_wait(const std::function<void()>& f) {
+    SyncEvent ev;
+    co::go([&]() {
+        f();
+        ev.signal();
+    });
+    ev.wait();
+}
+
+// a free port on localhost, MUST be called in coroutine
+static int free_port() {
+    sock_t fd = co::tcp_socket();
+    struct sockaddr_in addr;
+    co::init_ip_addr(&addr, "127.0.0.1", 0);
+    co::bind(fd, &addr, sizeof(addr));
+    socklen_t n = sizeof(addr);
+    getsockname(fd, (struct sockaddr*)&addr, &n);
+    co::close(fd);
+    return ntoh16(addr.sin_port);
+}
+
+// listen on @ip:@port, and fill the backlog, so connect() to it hangs as new
+// SYNs are dropped. MUST be called in coroutine.
+struct Blackhole {
+    Blackhole(const char* ip, int port) {
+        struct sockaddr_in addr;
+        co::init_ip_addr(&addr, ip, port);
+        l = co::tcp_socket();
+        co::set_reuseaddr(l);
+        co::bind(l, &addr, sizeof(addr));
+        co::listen(l, 0);
+        c = co::tcp_socket();
+        co::connect(c, &addr, sizeof(addr), 1000);
+    }
+
+    void close() {
+        co::close(c);
+        co::close(l);
+    }
+
+    sock_t l;
+    sock_t c;
+};
+
+// echo a byte, and save ids of the schedulers handling the connections, and
+// the address of the last connection
+class EchoServer : public tcp::Server {
+  public:
+    EchoServer(const char* ip, int port) : tcp::Server(ip, port) {}
+
+    std::set<int> scheds() {
+        ::MutexGuard g(_mtx);
+        return _scheds;
+    }
+
+    fastring peer() {
+        ::MutexGuard g(_mtx);
+        return _peer;
+    }
+
+    virtual void on_connection(tcp::Connection* conn) {
+        std::unique_ptr<tcp::Connection> x(conn);
+        do {
+            ::MutexGuard g(_mtx);
+            _scheds.insert(co::sched_id());
+            _peer.clear();
+            _peer << conn->ip << ':' << conn->port;
+        } while (0);
+
+        char c;
+        while (co::recv(conn->fd, &c, 1, 3000) == 1) {
+            if (co::send(conn->fd, &c, 1, 1000) != 1) break;
+        }
+        co::close(conn->fd);
+    }
+
+  private:
+    ::Mutex _mtx;
+    std::set<int> _scheds;
+    fastring _peer;
+};
+
+// connect to @ip:@port, send a byte and receive it back
+static bool echo(const char* ip, int port) {
+    tcp::Client c(ip, port);
+    if (!c.connect(1000)) return false;
+    char x = 'x', y = 0;
+    return c.send(&x, 1, 1000) == 1 && c.recv(&y, 1, 1000) == 1 && y == 'x';
+}
+
+// send a byte on @c, and receive it back in @ms
+static bool ping(tcp::Client& c, int ms=1000) {
+    char x = 'x', y = 0;
+    return c.send(&x, 1, 1000) == 1 && c.recv(&y, 1, ms) == 1 && y == 'x';
+}
+
+// restore the flags of admission control when a case ends
+struct Flags {
+    Flags() : max_conn(FLG_tcp_max_conn), reject(FLG_tcp_reject_overload) {}
+    ~Flags() {
+        FLG_tcp_max_conn = max_conn;
+        FLG_tcp_reject_overload = reject;
+    }
+    uint32 max_conn;
+    bool reject;
+};
+
+DEF_test(tcp) {
+    DEF_case(reuseport) {
+        int port = 0;
+        go_wait([&]() { port = free_port(); });
+
+        // the flag is read when the server loop starts
+        FLG_tcp_reuseport = true;
+        EchoServer* s = new EchoServer("127.0.0.1", port);
+        s->start();
+        sleep::ms(50);
+        FLG_tcp_reuseport = false;
+
+        int n = 0;
+        bool bound = false;
+        go_wait([&]() {
+            for (int i = 0; i < 64; ++i) n += echo("127.0.0.1", port);
+
+            // other sockets with SO_REUSEPORT can bind to the port only if
+            // the listeners of the server have it too
+            sock_t fd = co::tcp_socket();
+            co::set_reuseport(fd);
+            struct sockaddr_in addr;
+            co::init_ip_addr(&addr, "127.0.0.1", port);
+            bound = co::bind(fd, &addr, sizeof(addr)) == 0;
+            co::close(fd);
+        });
+        EXPECT_EQ(n, 64);
+
+        // there is a listener in each scheduler, and the kernel spreads
+        // connections among them. Not used with only one scheduler.
+        if (co::sched_num() > 1) {
+            EXPECT(bound);
+            EXPECT_GT(s->scheds().size(), 1u);
+        } else {
+            EXPECT(!bound);
+        }
+    }
+
+    DEF_case(max_conn.reject) {
+        Flags f;
+        FLG_tcp_max_conn = 2;
+        FLG_tcp_reject_overload = true;
+        static const char* serv = "unix:@co_unitest_tcp_reject";
+        EchoServer* s = new EchoServer(serv, 0);
+        s->start();
+        sleep::ms(50);
+
+        bool r[4] = { false };
+        uint32 conn = 0;
+        uint64 rejected = 0;
+        go_wait([&]() {
+            tcp::Client a(serv, 0), b(serv, 0), c(serv, 0), d(serv, 0);
+            r[0] = a.connect(1000) && ping(a) && b.connect(1000) && ping(b);
+            conn = s->conn_num();
+
+            // accepted, and reset at once
+            r[1] = c.connect(1000) && !ping(c);
+            rejected = s->rejected_num();
+
+            // accepted again when a connection is closed
+            a.disconnect();
+            co::sleep(10);
+            r[2] = d.connect(1000) && ping(d);
+            r[3] = ping(b);
+            b.disconnect();
+            c.disconnect();
+            d.disconnect();
+        });
+        EXPECT(r[0]);
+        EXPECT(r[1]);
+        EXPECT(r[2]);
+        EXPECT(r[3]);
+        EXPECT_EQ(conn, 2u);
+        EXPECT_EQ(rejected, 1u);
+    }
+
+    DEF_case(max_conn.wait) {
+        Flags f;
+        FLG_tcp_max_conn = 1;
+        FLG_tcp_reject_overload = false;
+        static const char* serv = "unix:@co_unitest_tcp_wait";
+        EchoServer* s = new EchoServer(serv, 0);
+        s->start();
+        sleep::ms(50);
+
+        bool r[3] = { false };
+        uint32 conn = 0;
+        go_wait([&]() {
+            tcp::Client a(serv, 0), b(serv, 0);
+            r[0] = a.connect(1000) && ping(a);
+
+            // not accepted, it waits in the backlog
+            r[1] = b.connect(1000) && !ping(b, 100);
+            conn = s->conn_num();
+
+            // the echo comes when the first connection is closed
+            a.disconnect();
+            char y = 0;
+            r[2] = b.recv(&y, 1, 3000) == 1 && y == 'x';
+            b.disconnect();
+        });
+        EXPECT(r[0]);
+        EXPECT(r[1]);
+        EXPECT(r[2]);
+        EXPECT_EQ(conn, 1u);
+        EXPECT_EQ(s->rejected_num(), 0u);
+    }
+
+    DEF_case(fastopen) {
+        const bool fastopen = FLG_tcp_fastopen;
+        FLG_tcp_fastopen = true;
+        int port = 0;
+        go_wait([&]() { port = free_port(); });
+        EchoServer* s = new EchoServer("127.0.0.1", port);
+        s->start();
+        sleep::ms(50);
+
+        // the first connection gets a cookie, the next one may send data in
+        // the SYN, it works the same either way
+        bool r[2] = { false };
+        int v[2] = { 0 };
+        go_wait([&]() {
+            for (int i = 0; i < 2; ++i) {
+                tcp::Client c("127.0.0.1", port);
+                r[i] = c.connect(1000) && ping(c);
+              #ifdef TCP_FASTOPEN_CONNECT
+                socklen_t n = sizeof(v[i]);
+                getsockopt(c.fd(), IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &v[i], &n);
+              #else
+                v[i] = 1;
+              #endif
+                c.disconnect();
+            }
+        });
+        FLG_tcp_fastopen = fastopen;
+        EXPECT(r[0]);
+        EXPECT(r[1]);
+        EXPECT_EQ(v[0], 1);
+        EXPECT_EQ(v[1], 1);
+    }
+
+    DEF_case(happy_eyeballs) {
+        // names with more than one address, in a hosts file. The hosts file is
+        // loaded on the first resolution in the process.
+        fastring hosts;
+        hosts << "/tmp/co_unitest_hosts_" << os::pid();
+        do {
+            fs::file f(hosts.c_str(), 'w');
+            f.write("127.0.0.2 co-unitest-slow\n127.0.0.1 co-unitest-slow\n"
+                    "127.0.0.3 co-unitest-refused\n127.0.0.1 co-unitest-refused\n"
+                    "127.0.0.2 co-unitest-none\n127.0.0.3 co-unitest-none\n");
+        } while (0);
+        const fastring dns_hosts = FLG_dns_hosts;
+        const int32 stagger = FLG_tcp_conn_stagger_ms;
+        FLG_dns_hosts = hosts;
+
+        int port = 0;
+        bool loaded = false;
+        go_wait([&]() {
+            port = free_port();
+            std::vector<fastring> ips;
+            loaded = so::dns::resolve("co-unitest-slow", &ips, 1000) && ips.size() == 2;
+        });
+        FLG_dns_hosts = dns_hosts;
+        fs::remove(hosts);
+        if (!loaded) return; // names were resolved before this case
+
+        EchoServer* s = new EchoServer("127.0.0.1", port);
+        s->start();
+        sleep::ms(50);
+
+        bool r[3] = { false };
+        int64 t[3] = { 0 };
+        go_wait([&]() {
+            Blackhole b("127.0.0.2", port);
+            Timer timer;
+
+            // the next address is tried if the first one does not answer
+            FLG_tcp_conn_stagger_ms = 50;
+            tcp::Client x("co-unitest-slow", port);
+            r[0] = x.connect(3000) && ping(x);
+            t[0] = timer.ms();
+            x.disconnect();
+
+            // or at once if the first one fails
+            FLG_tcp_conn_stagger_ms = 5000;
+            timer.restart();
+            tcp::Client y("co-unitest-refused", port);
+            r[1] = y.connect(3000) && ping(y);
+            t[1] = timer.ms();
+            y.disconnect();
+
+            // all failed, in the timeout
+            FLG_tcp_conn_stagger_ms = 50;
+            timer.restart();
+            tcp::Client z("co-unitest-none", port);
+            r[2] = !z.connect(300);
+            t[2] = timer.ms();
+            b.close();
+        });
+        FLG_tcp_conn_stagger_ms = stagger;
+
+        EXPECT(r[0]);
+        EXPECT_GE(t[0], 45);
+        EXPECT_LT(t[0], 1000);
+        EXPECT(r[1]);
+        EXPECT_LT(t[1], 1000);
+        EXPECT(r[2]);
+        EXPECT_GE(t[2], 250);
+        EXPECT_LT(t[2], 1000);
+    }
+
+    DEF_case(unix) {
+        fastring path;
+        path << "/tmp/co_unitest_tcp_" << os::pid() << ".sock";
+        const fastring serv = "unix:" + path;
+
+        // a file left by the last run is removed
+        do {
+            fs::file f(path.c_str(), 'w');
+            f.write("x", 1);
+        } while (0);
+        EchoServer* s = new EchoServer(serv.c_str(), 0);
+        s->start();
+
+        // SO_REUSEPORT is not used for unix sockets
+        FLG_tcp_reuseport = true;
+        EchoServer* t = new EchoServer("unix:@co_unitest_tcp_abstract", 0);
+        t->start();
+        sleep::ms(50);
+        FLG_tcp_reuseport = false;
+
+        bool r[2] = { false };
+        int err[3] = { 0 };
+        go_wait([&]() {
+            tcp::Client a(serv.c_str(), 0);
+            r[0] = a.connect(1000) && ping(a);
+            a.disconnect();
+
+            tcp::Client b("unix:@co_unitest_tcp_abstract", 0);
+            r[1] = b.connect(1000) && ping(b);
+            b.disconnect();
+
+            // bad addresses
+            const fastring long_path = "unix:/tmp/" + fastring(200, 'x');
+            const char* bad[3] = { "unix:", long_path.c_str(), "unix:@co_unitest_tcp_none" };
+            for (int i = 0; i < 3; ++i) {
+                tcp::Client c(bad[i], 0);
+                if (!c.connect(1000)) err[i] = co::error();
+            }
+        });
+        EXPECT(r[0]);
+        EXPECT(r[1]);
+        EXPECT_EQ(s->peer(), serv + ":0");
+        EXPECT_EQ(t->peer(), "unix:@co_unitest_tcp_abstract:0");
+        EXPECT(fs::exists(path));
+        fs::remove(path); // the server keeps listening on its fd
+        EXPECT_EQ(err[0], EINVAL);
+        EXPECT_EQ(err[1], EINVAL);
+        EXPECT_EQ(err[2], ECONNREFUSED);
+    }
+}
+
+} // namespace test
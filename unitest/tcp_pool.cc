@@ -0,0 +1,214 @@
+#include "co/unitest.h"
+#include "co/so/tcp.h"
+#include "co/so/rpc.h"
+#include "co/co.h"
+#include "co/flag.h"
+#include "co/thread.h"
+#include "co/time.h"
+#include <functional>
+
+DEC_int32(tcp_pool_max_idle);
+DEC_int32(tcp_pool_idle_sec);
+DEC_int32(tcp_pool_max_life_sec);
+
+namespace test {
+
+// run @f in a coroutine, and wait for it. Pools are per scheduler, a case
+// runs in one coroutine.
+static void go_wait(const std::function<void()>& f) {
+    SyncEvent ev;
+    co::go([&]() {
+        f();
+        ev.signal();
+    });
+    ev.wait();
+}
+
+static const char* kServ = "unix:@co_unitest_tcp_pool";
+static const char* kRpcServ = "unix:@co_unitest_tcp_pool_rpc";
+
+// count connections, and close a connection when "q" is received
+class Server : public tcp::Server {
+  public:
+    Server() : tcp::Server(kServ, 0), _accepted(0) {}
+
+    uint32 accepted() const { return atomic_get(&_accepted); }
+
+    virtual void on_connection(tcp::Connection* conn) {
+        atomic_inc(&_accepted);
+        char c;
+        while (co::recv(conn->fd, &c, 1) == 1 && c != 'q');
+        co::close(conn->fd);
+        delete conn;
+    }
+
+  private:
+    uint32 _accepted;
+};
+
+class Echo : public rpc::Service {
+  public:
+    virtual void process(const Json& req, Json& res) {
+        res.add_member("x", req["x"]);
+    }
+};
+
+static Server* serv() {
+    static Server* s = 0;
+    if (!s) {
+        s = new Server();
+        s->start();
+        rpc::Server* r = rpc::new_server(kRpcServ, 0);
+        r->add_service(new Echo);
+        r->start();
+        sleep::ms(50);
+    }
+    return s;
+}
+
+// restore the flags of the pool when a case ends
+struct Flags {
+    Flags() : max_idle(FLG_tcp_pool_max_idle), idle_sec(FLG_tcp_pool_idle_sec),
+              life_sec(FLG_tcp_pool_max_life_sec) {}
+    ~Flags() {
+        FLG_tcp_pool_max_idle = max_idle;
+        FLG_tcp_pool_idle_sec = idle_sec;
+        FLG_tcp_pool_max_life_sec = life_sec;
+    }
+    int32 max_idle, idle_sec, life_sec;
+};
+
+DEF_test(tcp_pool) {
+    Server* s = serv();
+
+    DEF_case(reuse) {
+        bool r[4] = { false };
+        int fd[2] = { -1, -1 };
+        uint32 n = s->accepted();
+        go_wait([&]() {
+            tcp::Client a(kServ, 0);
+            a.use_pool("reuse");
+            r[0] = a.connect(1000) && !a.reused();
+            fd[0] = (int) a.fd();
+            a.release();
+            r[1] = !a.connected();
+
+            // another client of the same key takes the connection
+            tcp::Client b(kServ, 0);
+            b.use_pool("reuse");
+            r[2] = b.connect(1000) && b.reused();
+            fd[1] = (int) b.fd();
+
+            // not shared with other tags
+            tcp::Client c(kServ, 0);
+            c.use_pool("other");
+            r[3] = c.connect(1000) && !c.reused();
+            c.disconnect();
+            b.disconnect();
+
+            // wait for the server to handle the connections
+            co::sleep(10);
+            n = s->accepted() - n;
+        });
+        EXPECT(r[0]);
+        EXPECT(r[1]);
+        EXPECT(r[2]);
+        EXPECT(r[3]);
+        EXPECT_EQ(fd[0], fd[1]);
+        EXPECT_EQ(n, 2u);
+    }
+
+    DEF_case(max_idle) {
+        Flags f;
+        FLG_tcp_pool_max_idle = 2;
+        int reused = -1, created = -1;
+        go_wait([&]() {
+            tcp::Client* c[4];
+            for (int i = 0; i < 4; ++i) {
+                c[i] = new tcp::Client(kServ, 0);
+                c[i]->use_pool("max_idle");
+                c[i]->connect(1000);
+            }
+            for (int i = 0; i < 4; ++i) delete c[i]; // released to the pool
+
+            // only 2 connections are kept
+            reused = created = 0;
+            for (int i = 0; i < 4; ++i) {
+                c[i] = new tcp::Client(kServ, 0);
+                c[i]->use_pool("max_idle");
+                if (!c[i]->connect(1000)) continue;
+                c[i]->reused() ? ++reused : ++created;
+            }
+            for (int i = 0; i < 4; ++i) {
+                c[i]->disconnect();
+                delete c[i];
+            }
+        });
+        EXPECT_EQ(reused, 2);
+        EXPECT_EQ(created, 2);
+    }
+
+    DEF_case(expire) {
+        Flags f;
+        bool r[3] = { false };
+        go_wait([&]() {
+            // closed by the server
+            tcp::Client a(kServ, 0);
+            a.use_pool("expire");
+            a.connect(1000);
+            a.send("q", 1);
+            a.release();
+            co::sleep(10);
+            r[0] = a.connect(1000) && !a.reused();
+
+            // not reused after FLG_tcp_pool_max_life_sec
+            FLG_tcp_pool_max_life_sec = 1;
+            a.release();
+            co::sleep(1100);
+            r[1] = a.connect(1000) && !a.reused();
+
+            // closed when idle for FLG_tcp_pool_idle_sec
+            FLG_tcp_pool_max_life_sec = 0;
+            FLG_tcp_pool_idle_sec = 1;
+            a.release();
+            co::sleep(1100);
+            r[2] = a.connect(1000) && !a.reused();
+            a.disconnect();
+        });
+        EXPECT(r[0]);
+        EXPECT(r[1]);
+        EXPECT(r[2]);
+    }
+
+    DEF_case(rpc) {
+        // a pooled rpc client returns the connection to the pool after a call
+        bool r[3] = { false };
+        fastring x;
+        go_wait([&]() {
+            rpc::Client* c = rpc::new_client(kRpcServ, 0, "", true);
+            Json req, res;
+            req.add_member("x", 23);
+            c->call(req, res);
+            x = res.str();
+
+            tcp::Client t(kRpcServ, 0);
+            t.use_pool("rpc");
+            r[0] = t.connect(1000) && t.reused();
+            t.release();
+
+            // the next call takes it from the pool, and returns it again
+            res = Json();
+            c->call(req, res);
+            r[1] = res["x"].get_int() == 23;
+            r[2] = t.connect(1000) && t.reused();
+            t.disconnect();
+            delete c;
+        });
+        EXPECT_EQ(x, "{\"x\":23}");
+        EXPECT(r[0]);
+        EXPECT(r[1]);
+        EXPECT(r[2]);
+    }
+}
+
+} // namespace test
@@ -27,6 +27,23 @@ if is_plat("windows") then
 end
 
 
+-- build with zlib, for compression in http: xmake f --with_zlib=y
+option("with_zlib")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Build with zlib, for compression in http")
+option_end()
+
+if has_config("with_zlib") then
+    add_defines("HAS_ZLIB")
+    if is_plat("windows") then
+        add_links("zlib")
+    else
+        add_syslinks("z")
+    end
+end
+
+
 -- include dir
 add_includedirs("include")
 